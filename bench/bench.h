@@ -0,0 +1,158 @@
+//
+//  bench.h
+//  bench
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// What the test and benchmark programs share: a seeded random number
+// generator, so a failure can be replayed with the seed it printed, a
+// loop that times a function until it has run long enough to measure,
+// and a count of failed checks for the exit status.
+
+#ifndef _BENCH_H_
+#define	_BENCH_H_
+
+#include <sys/time.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define	BENCH_MINTIME	0.2	/* seconds each measurement runs for */
+
+static int bench_nfail;
+static uint64_t bench_state;
+
+static inline double
+bench_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/*
+ * Seed the generator from the -s argument, or from the clock if there is
+ * none, and say which so the run can be repeated.
+ */
+static inline void
+bench_seed(const char *arg)
+{
+
+	if (arg != NULL)
+		bench_state = strtoull(arg, NULL, 0);
+	else
+		bench_state = (uint64_t)(bench_now() * 1e6);
+	if (bench_state == 0)
+		bench_state = 1;
+	printf("seed %ju\n", (uintmax_t)bench_state);
+}
+
+/* xorshift64* */
+static inline uint64_t
+bench_random(void)
+{
+
+	bench_state ^= bench_state >> 12;
+	bench_state ^= bench_state << 25;
+	bench_state ^= bench_state >> 27;
+	return (bench_state * 0x2545f4914f6cdd1dULL);
+}
+
+/* A random number in [0, n). */
+static inline uint64_t
+bench_uniform(uint64_t n)
+{
+
+	return (n == 0 ? 0 : bench_random() % n);
+}
+
+static inline void
+bench_fill(void *buf, size_t len)
+{
+	unsigned char *p;
+	uint64_t r;
+	size_t i;
+
+	p = buf;
+	for (i = 0; i + 8 <= len; i += 8) {
+		r = bench_random();
+		memcpy(p + i, &r, 8);
+	}
+	for (r = bench_random(); i < len; i++, r >>= 8)
+		p[i] = (unsigned char)r;
+}
+
+/*
+ * Record a failed check. Only the first few are printed.
+ */
+static inline void
+bench_fail(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (bench_nfail++ >= 10)
+		return;
+	va_start(ap, fmt);
+	printf("FAIL: ");
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+}
+
+/*
+ * Run fn(arg) over and over for at least BENCH_MINTIME seconds and
+ * return the mean seconds per call. The call count doubles between clock
+ * reads, so the clock costs nothing against short calls.
+ */
+static inline double
+bench_time(void (*fn)(void *), void *arg)
+{
+	double start, secs;
+	uint64_t i, n, calls;
+
+	fn(arg);			/* warm up */
+	calls = 0;
+	start = bench_now();
+	for (n = 1;; n *= 2) {
+		for (i = 0; i < n; i++)
+			fn(arg);
+		calls += n;
+		if ((secs = bench_now() - start) >= BENCH_MINTIME)
+			break;
+	}
+	return (secs / calls);
+}
+
+/*
+ * Print one result line: what was run, the time per call and, if each
+ * call handles bytes, the throughput.
+ */
+static inline void
+bench_report(const char *name, double secs, size_t bytes)
+{
+
+	if (secs * 1e6 < 10)
+		printf("%-32s %10.1f ns", name, secs * 1e9);
+	else
+		printf("%-32s %10.1f us", name, secs * 1e6);
+	if (bytes > 0)
+		printf("  %9.1f MB/s", bytes / secs / 1e6);
+	printf("\n");
+}
+
+/* Exit status: 0 if every check passed. */
+static inline int
+bench_done(void)
+{
+
+	if (bench_nfail > 0)
+		printf("%d check(s) failed\n", bench_nfail);
+	return (bench_nfail > 0 ? 1 : 0);
+}
+
+#endif /* !_BENCH_H_ */
@@ -0,0 +1,66 @@
+//
+//  debugfs.h
+//  debugfs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+
+#ifndef debugfs_h
+#define debugfs_h
+
+#define	MAXIOSIZE	(1024 * 1024)	/* largest single read of file data */
+
+/*
+ * The parts of an inode we use, for either UFS.
+ */
+struct dinfo {
+	ino_t		ino;
+	int		mode;
+	int		nlink;
+	uint32_t	flags;
+	uint32_t	uid;
+	uint32_t	gid;
+	uint32_t	gen;
+	uint64_t	size;
+	uint64_t	blocks;
+	int64_t		atime;
+	int64_t		mtime;
+	int64_t		ctime;
+	int64_t		birthtime;	/* UFS2 only */
+	uint64_t	extsize;	/* UFS2 only */
+	int		ckhashbad;	/* UFS2 only */
+	ufs2_daddr_t	db[UFS_NDADDR];
+	ufs2_daddr_t	ib[UFS_NIADDR];
+	ufs2_daddr_t	extb[UFS_NXADDR];
+	int		islink;		/* target is in link[], not blocks */
+	char		link[(UFS_NDADDR + UFS_NIADDR) * sizeof(ufs2_daddr_t)];
+};
+
+/*
+ * Called with each piece of a file's data, in file order; what lies
+ * between two pieces is a hole. Returns -1 to stop.
+ */
+typedef int (*datafn_t)(void *, off_t, const char *, size_t);
+
+/* Called with each entry of an indexed directory: inode, name, DT_ type. */
+typedef int (*listfn_t)(void *, ino_t, const char *, size_t, int);
+
+extern struct uufsd disk;
+extern struct fs *fs;
+
+/* file.c */
+int	getdinfo(ino_t, struct dinfo *);
+int	filemap(const struct dinfo *, int, struct ufs_extent **, size_t *);
+int	readdata(const struct dinfo *, datafn_t, void *);
+int	readfile(const struct dinfo *, char **, size_t *);
+struct direct *nextdirent(const char *, size_t, size_t *);
+
+/* index.c */
+void	idx_open(const char *, int);
+void	idx_close(void);
+int	idx_list(ino_t, listfn_t, void *);
+ino_t	idx_lookup(ino_t, const char *, size_t, int *);
+int	idx_stats(uint64_t *, uint64_t *);
+
+#endif /* debugfs_h */
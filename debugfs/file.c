@@ -0,0 +1,339 @@
+//
+//  file.c
+//  debugfs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Getting at the contents of files. A file's block pointers are first
+// turned into extents by ufs_file_extents(), runs of blocks that follow
+// each other both in the file and on disk, and the data is then read a
+// run (or MAXIOSIZE of it) at a time rather than a block at a time.
+// Reads are queued with bread_async() one piece ahead, so the disk is
+// busy with the next piece while the caller deals with the current one.
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/dinode.h>
+#include <ufs/ufs/dir.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libufs.h>
+
+#include "debugfs.h"
+
+struct map {
+	struct ufs_extent *m_ext;
+	size_t		m_n;
+	size_t		m_max;
+};
+
+/* A piece of a file read in one go. */
+struct piece {
+	off_t		p_off;		/* in the file */
+	ufs2_daddr_t	p_blkno;	/* on disk, in frags */
+	size_t		p_len;		/* to read, a multiple of fs_fsize */
+	size_t		p_valid;	/* of that, before EOF */
+};
+
+static caddr_t iobuf[2];
+
+static int addextent(void *, const struct ufs_extent *);
+static int nextpiece(const struct dinfo *, const struct ufs_extent *, size_t,
+    size_t *, int64_t *, struct piece *);
+static int tomem(void *, off_t, const char *, size_t);
+
+/*
+ * Fill di from inode ino. An inode with a bad check-hash is still
+ * returned, with ckhashbad set.
+ */
+int
+getdinfo(ino_t ino, struct dinfo *di)
+{
+	union dinodep dp;
+	int i, ret;
+
+	dp.dp2 = NULL;
+	ret = getinode(&disk, &dp, ino);
+	if (ret == -1 && dp.dp2 == NULL) {
+		warnx("inode %ju: %s", (uintmax_t)ino, disk.d_error);
+		return (-1);
+	}
+	memset(di, 0, sizeof(*di));
+	di->ino = ino;
+	di->ckhashbad = ret == -1;
+	if (disk.d_ufs == 1) {
+		di->mode = dp.dp1->di_mode;
+		di->nlink = dp.dp1->di_nlink;
+		di->flags = dp.dp1->di_flags;
+		di->uid = dp.dp1->di_uid;
+		di->gid = dp.dp1->di_gid;
+		di->gen = dp.dp1->di_gen;
+		di->size = dp.dp1->di_size;
+		di->blocks = dp.dp1->di_blocks;
+		di->atime = dp.dp1->di_atime;
+		di->mtime = dp.dp1->di_mtime;
+		di->ctime = dp.dp1->di_ctime;
+		for (i = 0; i < UFS_NDADDR; i++)
+			di->db[i] = dp.dp1->di_db[i];
+		for (i = 0; i < UFS_NIADDR; i++)
+			di->ib[i] = dp.dp1->di_ib[i];
+	} else {
+		di->mode = dp.dp2->di_mode;
+		di->nlink = dp.dp2->di_nlink;
+		di->flags = dp.dp2->di_flags;
+		di->uid = dp.dp2->di_uid;
+		di->gid = dp.dp2->di_gid;
+		di->gen = dp.dp2->di_gen;
+		di->size = dp.dp2->di_size;
+		di->blocks = dp.dp2->di_blocks;
+		di->atime = dp.dp2->di_atime;
+		di->mtime = dp.dp2->di_mtime;
+		di->ctime = dp.dp2->di_ctime;
+		di->birthtime = dp.dp2->di_birthtime;
+		di->extsize = dp.dp2->di_extsize;
+		memcpy(di->db, dp.dp2->di_db, sizeof(di->db));
+		memcpy(di->ib, dp.dp2->di_ib, sizeof(di->ib));
+		memcpy(di->extb, dp.dp2->di_extb, sizeof(di->extb));
+	}
+	/* Short symbolic links keep the target where the pointers would be. */
+	if ((di->mode & IFMT) == IFLNK &&
+	    (di->size < (uint64_t)fs->fs_maxsymlinklen ||
+	    (fs->fs_maxsymlinklen == 0 && di->blocks == 0))) {
+		di->islink = 1;
+		memcpy(di->link, disk.d_ufs == 1 ?
+		    (void *)dp.dp1->di_db : (void *)dp.dp2->di_db,
+		    MIN(di->size, sizeof(di->link)));
+	}
+	return (0);
+}
+
+static int
+addextent(void *arg, const struct ufs_extent *ue)
+{
+	struct map *m;
+	struct ufs_extent *e;
+	size_t max;
+
+	m = arg;
+	if (m->m_n == m->m_max) {
+		max = m->m_max == 0 ? 16 : m->m_max * 2;
+		if ((e = realloc(m->m_ext, max * sizeof(*e))) == NULL) {
+			warn("malloc");
+			return (-1);
+		}
+		m->m_ext = e;
+		m->m_max = max;
+	}
+	m->m_ext[m->m_n++] = *ue;
+	return (0);
+}
+
+/*
+ * The extents of di, in the order ufs_file_extents() reports them, with
+ * its flags.
+ */
+int
+filemap(const struct dinfo *di, int flags, struct ufs_extent **extp,
+    size_t *np)
+{
+	union dinodep dp;
+	struct map m;
+	int ret;
+
+	memset(&m, 0, sizeof(m));
+	*extp = NULL;
+	*np = 0;
+	dp.dp2 = NULL;
+	if (getinode(&disk, &dp, di->ino) == -1 && dp.dp2 == NULL) {
+		warnx("inode %ju: %s", (uintmax_t)di->ino, disk.d_error);
+		return (-1);
+	}
+	if ((ret = ufs_file_extents(&disk, dp, flags, addextent, &m)) != 0) {
+		if (ret == -1 && disk.d_error != NULL)
+			warnx("inode %ju: %s", (uintmax_t)di->ino,
+			    disk.d_error);
+		free(m.m_ext);
+		return (-1);
+	}
+	*extp = m.m_ext;
+	*np = m.m_n;
+	return (0);
+}
+
+/*
+ * Carve the next piece out of extent *ip, of which *donep blocks have
+ * been handed out already. Returns 0 once past the last extent or EOF.
+ */
+static int
+nextpiece(const struct dinfo *di, const struct ufs_extent *ext, size_t n,
+    size_t *ip, int64_t *donep, struct piece *p)
+{
+	const struct ufs_extent *e;
+	int64_t nblks;
+	uint64_t left;
+
+	for (; *ip < n; (*ip)++, *donep = 0) {
+		e = &ext[*ip];
+		/* The extended attribute area follows the data. */
+		if (e->ue_flags & UFS_EXTENT_EXTATTR)
+			break;
+		if (*donep >= howmany(e->ue_nfrags, fs->fs_frag))
+			continue;
+		p->p_off = (e->ue_lbn + *donep) * fs->fs_bsize;
+		if ((uint64_t)p->p_off >= di->size)
+			break;
+		nblks = MIN(howmany(e->ue_nfrags, fs->fs_frag) - *donep,
+		    MAXIOSIZE / fs->fs_bsize);
+		p->p_blkno = e->ue_blkno + *donep * fs->fs_frag;
+		left = di->size - p->p_off;
+		p->p_valid = MIN((uint64_t)nblks * fs->fs_bsize, left);
+		p->p_len = fragroundup(fs, p->p_valid);
+		*donep += nblks;
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * Hand di's data to fn, piece by piece, reading the next piece while fn
+ * works on the current one.
+ */
+int
+readdata(const struct dinfo *di, datafn_t fn, void *arg)
+{
+	struct ufs_extent *ext;
+	struct piece cur, next;
+	int64_t done;
+	size_t i, n;
+	int have, ret, which;
+
+	if (di->islink)
+		return (di->size == 0 ? 0 : fn(arg, 0, di->link, di->size));
+	if (filemap(di, 0, &ext, &n) == -1)
+		return (-1);
+	for (which = 0; which < 2; which++) {
+		if (iobuf[which] != NULL ||
+		    posix_memalign((void **)&iobuf[which], 64, MAXIOSIZE) == 0)
+			continue;
+		warn("malloc");
+		free(ext);
+		return (-1);
+	}
+	ret = 0;
+	i = 0;
+	done = 0;
+	which = 0;
+	have = nextpiece(di, ext, n, &i, &done, &cur);
+	if (have && bread_async(&disk, fsbtodb(fs, cur.p_blkno), iobuf[0],
+	    cur.p_len) == -1) {
+		warnx("block %jd: %s", (intmax_t)cur.p_blkno, disk.d_error);
+		ret = -1;
+	}
+	while (have && ret == 0) {
+		if (ufs_disk_flush(&disk) == -1) {
+			warnx("block %jd: %s", (intmax_t)cur.p_blkno,
+			    disk.d_error);
+			ret = -1;
+			break;
+		}
+		have = nextpiece(di, ext, n, &i, &done, &next);
+		if (have && bread_async(&disk, fsbtodb(fs, next.p_blkno),
+		    iobuf[!which], next.p_len) == -1) {
+			warnx("block %jd: %s", (intmax_t)next.p_blkno,
+			    disk.d_error);
+			ret = -1;
+		}
+		if (fn(arg, cur.p_off, iobuf[which], cur.p_valid) == -1)
+			ret = -1;
+		cur = next;
+		which = !which;
+	}
+	/* Nothing may still be reading into iobuf when we return. */
+	if (ufs_disk_flush(&disk) == -1 && ret == 0) {
+		warnx("%s", disk.d_error);
+		ret = -1;
+	}
+	free(ext);
+	return (ret);
+}
+
+struct membuf {
+	char		*mb_buf;
+	size_t		mb_len;
+};
+
+static int
+tomem(void *arg, off_t off, const char *data, size_t len)
+{
+	struct membuf *mb;
+
+	mb = arg;
+	memcpy(mb->mb_buf + off, data, len);
+	mb->mb_len = off + len;
+	return (0);
+}
+
+/*
+ * All of di's data in one malloc'ed buffer, holes zeroed. For
+ * directories and symbolic links.
+ */
+int
+readfile(const struct dinfo *di, char **bufp, size_t *lenp)
+{
+	struct membuf mb;
+
+	if (di->size > SIZE_MAX - 1 ||
+	    (mb.mb_buf = calloc(1, di->size + 1)) == NULL) {
+		warn("inode %ju: malloc", (uintmax_t)di->ino);
+		return (-1);
+	}
+	mb.mb_len = 0;
+	if (readdata(di, tomem, &mb) == -1) {
+		free(mb.mb_buf);
+		return (-1);
+	}
+	*bufp = mb.mb_buf;
+	*lenp = di->size;
+	return (0);
+}
+
+/*
+ * The next live entry at or after *locp in directory data buf, or NULL at
+ * the end. A DIRBLKSIZ chunk with a bad record length is skipped.
+ */
+struct direct *
+nextdirent(const char *buf, size_t len, size_t *locp)
+{
+	struct direct *dp;
+	size_t blkend, loc;
+
+	for (loc = *locp; loc + DIRECTSIZ(0) <= len; ) {
+		dp = (struct direct *)(buf + loc);
+		blkend = MIN(roundup(loc + 1, DIRBLKSIZ), len);
+		if (dp->d_reclen < DIRSIZ(0, dp) ||
+		    loc + dp->d_reclen > blkend || (dp->d_reclen & 0x3) != 0) {
+			loc = blkend;
+			continue;
+		}
+		loc += dp->d_reclen;
+		if (dp->d_ino != 0) {
+			*locp = loc;
+			return (dp);
+		}
+	}
+	*locp = len;
+	return (NULL);
+}
@@ -0,0 +1,474 @@
+//
+//  index.c
+//  debugfs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// The name index. Looking a path up in the file system itself means
+// reading every directory on the way, and ls or stat of a deep path on a
+// big image does that again every time debugfs runs. Instead the whole
+// tree is walked once and every directory entry is written to a sidecar
+// file, which later runs map and search without reading the image:
+//
+//	struct idxhdr
+//	struct idxdir	[ih_ndirs]	sorted by directory inode
+//	struct idxent	[ih_nents]	each directory's run sorted by name
+//	char		[ih_strsize]	the names, not NUL terminated
+//
+// The header records what the file system looked like when the index
+// was built (fs_id, fs_time, the free counts and, for an image file, its
+// size and modification time). If any of that has changed the index is
+// rebuilt, so it is only trusted as long as nothing has written to the
+// image since.
+
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/dinode.h>
+#include <ufs/ufs/dir.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#include "debugfs.h"
+
+#define	IDX_MAGIC	0x58444944	/* "DIDX" */
+#define	IDX_VERSION	1
+
+struct idxhdr {
+	uint32_t	ih_magic;
+	uint32_t	ih_version;
+	int32_t		ih_id[2];	/* fs_id */
+	int64_t		ih_fstime;	/* fs_time */
+	int64_t		ih_cstotal[4];	/* dir, bfree, ifree, ffree */
+	int64_t		ih_size;	/* of the image file, or 0 */
+	int64_t		ih_mtime;	/* of the image file, or 0 */
+	uint64_t	ih_ndirs;
+	uint64_t	ih_nents;
+	uint64_t	ih_strsize;
+};
+
+struct idxdir {
+	uint64_t	id_ino;
+	uint64_t	id_first;	/* first of its entries */
+	uint64_t	id_count;
+};
+
+struct idxent {
+	uint64_t	ie_ino;
+	uint64_t	ie_name;	/* offset into the names */
+	uint32_t	ie_namlen;
+	uint32_t	ie_type;	/* DT_ */
+};
+
+static struct idxhdr key;		/* what the file system is now */
+static struct idxhdr *hdr;
+static struct idxdir *dirs;
+static struct idxent *ents;
+static char *strs;
+static void *map;			/* the sidecar, when loaded from one */
+static size_t maplen;
+
+static struct idxdir *finddir(ino_t);
+static void makekey(void);
+static int load(const char *);
+static void build(void);
+static int save(const char *);
+static int entcmp(const void *, const void *);
+static int dircmp(const void *, const void *);
+
+/*
+ * Make the index at path available, loading it if it is there and still
+ * describes the file system, building it otherwise. A built index is
+ * written to path; when that fails it is only used for this run.
+ */
+void
+idx_open(const char *path, int rebuild)
+{
+
+	makekey();
+	if (!rebuild && load(path) == 0)
+		return;
+	build();
+	if (save(path) == -1)
+		warn("%s: index not saved", path);
+}
+
+void
+idx_close(void)
+{
+
+	if (map != NULL) {
+		munmap(map, maplen);
+		map = NULL;
+	} else if (hdr != NULL) {
+		free(hdr);
+		free(dirs);
+		free(ents);
+		free(strs);
+	}
+	hdr = NULL;
+	dirs = NULL;
+	ents = NULL;
+	strs = NULL;
+}
+
+int
+idx_stats(uint64_t *ndirs, uint64_t *nents)
+{
+
+	if (hdr == NULL)
+		return (-1);
+	*ndirs = hdr->ih_ndirs;
+	*nents = hdr->ih_nents;
+	return (0);
+}
+
+static struct idxdir *
+finddir(ino_t dir)
+{
+	size_t lo, hi, mid;
+
+	if (hdr == NULL)
+		return (NULL);
+	for (lo = 0, hi = hdr->ih_ndirs; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if (dirs[mid].id_ino == dir)
+			return (&dirs[mid]);
+		if (dirs[mid].id_ino < dir)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (NULL);
+}
+
+/*
+ * Call fn with every entry of directory dir, in name order. Returns -1
+ * if dir isn't in the index, or whatever fn returned when it stopped.
+ */
+int
+idx_list(ino_t dir, listfn_t fn, void *arg)
+{
+	struct idxdir *d;
+	struct idxent *e;
+	uint64_t i;
+	int ret;
+
+	if ((d = finddir(dir)) == NULL)
+		return (-1);
+	for (i = 0; i < d->id_count; i++) {
+		e = &ents[d->id_first + i];
+		if ((ret = fn(arg, (ino_t)e->ie_ino, strs + e->ie_name,
+		    e->ie_namlen, e->ie_type)) != 0)
+			return (ret);
+	}
+	return (0);
+}
+
+/*
+ * Inode of entry name (namlen bytes) in directory dir, 0 if there is no
+ * such entry. Its DT_ type goes to *typep.
+ */
+ino_t
+idx_lookup(ino_t dir, const char *name, size_t namlen, int *typep)
+{
+	struct idxdir *d;
+	struct idxent *e;
+	size_t lo, hi, mid;
+	int cmp;
+
+	if ((d = finddir(dir)) == NULL)
+		return (0);
+	for (lo = d->id_first, hi = d->id_first + d->id_count; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		e = &ents[mid];
+		cmp = memcmp(name, strs + e->ie_name,
+		    MIN(namlen, e->ie_namlen));
+		if (cmp == 0)
+			cmp = namlen < e->ie_namlen ? -1 :
+			    namlen > e->ie_namlen;
+		if (cmp == 0) {
+			if (typep != NULL)
+				*typep = e->ie_type;
+			return ((ino_t)e->ie_ino);
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return (0);
+}
+
+static void
+makekey(void)
+{
+	struct stat sb;
+
+	memset(&key, 0, sizeof(key));
+	key.ih_magic = IDX_MAGIC;
+	key.ih_version = IDX_VERSION;
+	key.ih_id[0] = fs->fs_id[0];
+	key.ih_id[1] = fs->fs_id[1];
+	key.ih_fstime = fs->fs_time;
+	key.ih_cstotal[0] = fs->fs_cstotal.cs_ndir;
+	key.ih_cstotal[1] = fs->fs_cstotal.cs_nbfree;
+	key.ih_cstotal[2] = fs->fs_cstotal.cs_nifree;
+	key.ih_cstotal[3] = fs->fs_cstotal.cs_nffree;
+	/* A device's times say nothing about what was written to it. */
+	if (fstat(disk.d_fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+		key.ih_size = sb.st_size;
+		key.ih_mtime = sb.st_mtime;
+	}
+}
+
+/*
+ * Map the index at path if it describes the file system as it is now.
+ * The file is only as trustworthy as whoever could write it, so it has
+ * to be ours and private, and every offset in it is checked before one
+ * is used; anything else and it is rebuilt.
+ */
+static int
+load(const char *path)
+{
+	struct idxhdr *h;
+	struct idxdir *d;
+	struct idxent *e;
+	struct stat sb;
+	uint64_t i, need, size;
+	void *p;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_NOFOLLOW)) == -1) {
+		if (errno != ENOENT)
+			warn("%s", path);
+		return (-1);
+	}
+	if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+		close(fd);
+		return (-1);
+	}
+	if (sb.st_uid != geteuid() ||
+	    (sb.st_mode & ALLPERMS) != (S_IRUSR | S_IWUSR)) {
+		warnx("%s: not private to this user, rebuilding", path);
+		close(fd);
+		return (-1);
+	}
+	if (sb.st_size < (off_t)sizeof(*h) ||
+	    (p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+	    MAP_FAILED) {
+		close(fd);
+		return (-1);
+	}
+	close(fd);
+	h = p;
+	size = sb.st_size;
+	if (memcmp(h, &key, offsetof(struct idxhdr, ih_ndirs)) != 0)
+		goto bad;
+	/* Each part fits in the file on its own, so the sum can't wrap. */
+	if (h->ih_ndirs > size / sizeof(struct idxdir) ||
+	    h->ih_nents > size / sizeof(struct idxent) ||
+	    h->ih_strsize > size)
+		goto corrupt;
+	need = sizeof(*h) + h->ih_ndirs * sizeof(struct idxdir) +
+	    h->ih_nents * sizeof(struct idxent) + h->ih_strsize;
+	if (need != size)
+		goto corrupt;
+	d = (struct idxdir *)(h + 1);
+	e = (struct idxent *)(d + h->ih_ndirs);
+	for (i = 0; i < h->ih_ndirs; i++)
+		if (d[i].id_first > h->ih_nents ||
+		    d[i].id_count > h->ih_nents - d[i].id_first)
+			goto corrupt;
+	for (i = 0; i < h->ih_nents; i++)
+		if (e[i].ie_name > h->ih_strsize ||
+		    e[i].ie_namlen > h->ih_strsize - e[i].ie_name ||
+		    e[i].ie_type > DT_WHT)
+			goto corrupt;
+	map = p;
+	maplen = size;
+	hdr = h;
+	dirs = d;
+	ents = e;
+	strs = (char *)(e + h->ih_nents);
+	return (0);
+
+corrupt:
+	warnx("%s: index is corrupt, rebuilding", path);
+bad:
+	munmap(p, size);
+	return (-1);
+}
+
+/*
+ * Walk the tree from the root, a directory at a time, collecting every
+ * entry. Each directory is reached through exactly one name (".." and
+ * "." aside), but a broken file system may say otherwise, so directories
+ * already seen are remembered.
+ */
+static void
+build(void)
+{
+	struct dinfo di;
+	struct direct *dp;
+	struct idxent *e;
+	ino_t *queue, ino;
+	uint8_t *seen;
+	uint64_t ndirs, nents, maxdirs, maxents, strsize, maxstr;
+	size_t qhead, qtail, qmax, len, loc;
+	char *buf;
+	int type;
+
+	idx_close();
+	if ((hdr = calloc(1, sizeof(*hdr))) == NULL ||
+	    (seen = calloc(howmany((uint64_t)fs->fs_ipg * fs->fs_ncg, NBBY),
+	    1)) == NULL)
+		err(1, "malloc");
+	*hdr = key;
+	ndirs = nents = maxdirs = maxents = strsize = maxstr = 0;
+	qmax = 1024;
+	if ((queue = malloc(qmax * sizeof(*queue))) == NULL)
+		err(1, "malloc");
+	qhead = qtail = 0;
+	queue[qtail++] = UFS_ROOTINO;
+	setbit(seen, UFS_ROOTINO);
+	while (qhead < qtail) {
+		ino = queue[qhead++];
+		if (getdinfo(ino, &di) == -1 || (di.mode & IFMT) != IFDIR)
+			continue;
+		if (readfile(&di, &buf, &len) == -1)
+			continue;
+		if (ndirs == maxdirs) {
+			maxdirs = maxdirs == 0 ? 1024 : maxdirs * 2;
+			if ((dirs = realloc(dirs, maxdirs * sizeof(*dirs))) ==
+			    NULL)
+				err(1, "malloc");
+		}
+		dirs[ndirs].id_ino = ino;
+		dirs[ndirs].id_first = nents;
+		for (loc = 0; (dp = nextdirent(buf, len, &loc)) != NULL; ) {
+			if (nents == maxents) {
+				maxents = maxents == 0 ? 4096 : maxents * 2;
+				if ((ents = realloc(ents,
+				    maxents * sizeof(*ents))) == NULL)
+					err(1, "malloc");
+			}
+			while (strsize + dp->d_namlen > maxstr) {
+				maxstr = maxstr == 0 ? 65536 : maxstr * 2;
+				if ((strs = realloc(strs, maxstr)) == NULL)
+					err(1, "malloc");
+			}
+			type = dp->d_type;
+			if (type == DT_UNKNOWN && getdinfo(dp->d_ino, &di) == 0)
+				type = IFTODT(di.mode);
+			e = &ents[nents++];
+			e->ie_ino = dp->d_ino;
+			e->ie_name = strsize;
+			e->ie_namlen = dp->d_namlen;
+			e->ie_type = type;
+			memcpy(strs + strsize, dp->d_name, dp->d_namlen);
+			strsize += dp->d_namlen;
+			if (type != DT_DIR || dp->d_ino >=
+			    (uint64_t)fs->fs_ipg * fs->fs_ncg ||
+			    isset(seen, dp->d_ino))
+				continue;
+			setbit(seen, dp->d_ino);
+			if (qtail == qmax) {
+				qmax *= 2;
+				if ((queue = realloc(queue,
+				    qmax * sizeof(*queue))) == NULL)
+					err(1, "malloc");
+			}
+			queue[qtail++] = dp->d_ino;
+		}
+		free(buf);
+		dirs[ndirs].id_count = nents - dirs[ndirs].id_first;
+		qsort(&ents[dirs[ndirs].id_first], dirs[ndirs].id_count,
+		    sizeof(*ents), entcmp);
+		ndirs++;
+	}
+	qsort(dirs, ndirs, sizeof(*dirs), dircmp);
+	hdr->ih_ndirs = ndirs;
+	hdr->ih_nents = nents;
+	hdr->ih_strsize = strsize;
+	free(queue);
+	free(seen);
+}
+
+/*
+ * Write the index next to where it goes and rename it into place, so a
+ * reader never sees half of one.
+ */
+static int
+save(const char *path)
+{
+	char tmp[MAXPATHLEN];
+	FILE *fp;
+	int fd, ok;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	if ((fd = mkstemp(tmp)) == -1)
+		return (-1);
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		unlink(tmp);
+		return (-1);
+	}
+	ok = fwrite(hdr, sizeof(*hdr), 1, fp) == 1 &&
+	    fwrite(dirs, sizeof(*dirs), hdr->ih_ndirs, fp) == hdr->ih_ndirs &&
+	    fwrite(ents, sizeof(*ents), hdr->ih_nents, fp) == hdr->ih_nents &&
+	    fwrite(strs, 1, hdr->ih_strsize, fp) == hdr->ih_strsize;
+	if (fclose(fp) != 0)
+		ok = 0;
+	if (!ok || rename(tmp, path) == -1) {
+		unlink(tmp);
+		return (-1);
+	}
+	return (0);
+}
+
+/* Sorting a directory's entries; strs is where the names are. */
+static int
+entcmp(const void *a, const void *b)
+{
+	const struct idxent *ea, *eb;
+	int cmp;
+
+	ea = a;
+	eb = b;
+	cmp = memcmp(strs + ea->ie_name, strs + eb->ie_name,
+	    MIN(ea->ie_namlen, eb->ie_namlen));
+	if (cmp != 0)
+		return (cmp);
+	return (ea->ie_namlen < eb->ie_namlen ? -1 :
+	    ea->ie_namlen > eb->ie_namlen);
+}
+
+static int
+dircmp(const void *a, const void *b)
+{
+	const struct idxdir *da, *db;
+
+	da = a;
+	db = b;
+	return (da->id_ino < db->id_ino ? -1 : da->id_ino > db->id_ino);
+}
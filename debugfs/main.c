@@ -5,17 +5,19 @@
 //  Created by John Othwolo on 7/31/22.
 //  Copyright © 2022 John Othwolo. All rights reserved.
 //
-// This is just for debugging.
+// Look inside a UFS file system that isn't mounted, on a disk or in an
+// image file: print the superblock, a cylinder group or an inode, list
+// directories and copy files out. Nothing is written to the file system.
+// Paths are looked up in the name index (index.c), which is only loaded
+// or built the first time a command needs a path.
 
 #include <sys/param.h>
-#include <sys/stat.h>
-#include <sys/disk.h>
-#include <freebsd/disklabel.h>
-#include <sys/file.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
-#include <ufs/ufs/dir.h>
 #include <ufs/ufs/dinode.h>
+#include <ufs/ufs/dir.h>
 #include <ufs/ffs/fs.h>
 #include <ufs/ufs/extattr.h>
 #include <ufs/ufs/quota.h>
@@ -24,60 +26,637 @@
 #include <ctype.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <paths.h>
-#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <libufs.h>
 
-int main(int argc, const char * argv[]) {
-    // insert code here...
-    FILE *fp;
-    int devfd, ret;
-    char sb_buffer[SBLOCKSIZE] = {0};
-    struct fs *superfs;
-    size_t size, count, og_size;
-    uint64_t offset;
-    
-    if (argc < 2)
-        abort();
-    
-    fp = fopen(argv[1], "r");
-    devfd = fileno(fp);
-//    ret = (int)pread(devfd, &sb_buffer[0], SBLOCKSIZE, SBLOCK_UFS2);
-    
-//    if (ret != sizeof(sb_buffer)){
-//        printf("pread Error!: %s", strerror(errno));
-//        goto out;
-//    }
-//    superfs = &sb_buffer[0];
-//
-//    size = lseek(devfd, 0, SEEK_SET);
-//    size = lseek(devfd, 0, SEEK_END);
-//    printf("disk-size=%zu", size);
-    
-    if (ioctl(devfd, DKIOCGETBLOCKSIZE, &og_size) < 0){
-        perror("couldn't get sector size");
-        abort();
-    }
-    
-    if (ioctl(devfd, DKIOCGETBLOCKCOUNT, &count) < 0){
-        perror("couldn't get sector count");
-        abort();
-    }
-    
-    size = og_size * count;
-    ret = fscanf(fp, "%llu", &offset);
-    
-    
-out:
-    close(devfd);
-    return 0;
-}
-
-// todo find fs_fsbtodb and use that to convert ff_use_bread location.
+#include "debugfs.h"
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+struct cmd {
+	const char	*c_name;
+	int		(*c_func)(int, char *[]);
+	int		c_minargs;
+	int		c_maxargs;
+	const char	*c_usage;
+};
+
+/* Where file data goes. */
+struct out {
+	int		o_fd;
+	off_t		o_pos;
+	int		o_seek;		/* holes can be seeked over */
+	const char	*o_name;
+};
+
+struct uufsd disk;
+struct fs *fs;
+
+static const char *idxpath;
+static int idxopen;
+
+static int cmd_sb(int, char *[]);
+static int cmd_cg(int, char *[]);
+static int cmd_stat(int, char *[]);
+static int cmd_ls(int, char *[]);
+static int cmd_cat(int, char *[]);
+static int cmd_get(int, char *[]);
+static int cmd_index(int, char *[]);
+static int run(int, char *[]);
+static int interact(void);
+static int lookup(const char *, ino_t *);
+static int lsent(void *, ino_t, const char *, size_t, int);
+static int extract(const struct dinfo *, const char *);
+static int writeout(void *, off_t, const char *, size_t);
+static int fill(struct out *, off_t);
+static const char *ctimestr(int64_t);
+static void usage(void);
+
+static const struct cmd cmds[] = {
+	{ "sb",		cmd_sb,		0, 0,	"" },
+	{ "cg",		cmd_cg,		1, 1,	"cg" },
+	{ "stat",	cmd_stat,	1, 1,	"file" },
+	{ "ls",		cmd_ls,		0, 2,	"[-l] [dir]" },
+	{ "cat",	cmd_cat,	1, 1,	"file" },
+	{ "get",	cmd_get,	1, 2,	"file [dest]" },
+	{ "index",	cmd_index,	0, 0,	"" },
+};
+
+int
+main(int argc, char *argv[])
+{
+	static char defpath[MAXPATHLEN];
+	struct stat sb;
+	const char *base;
+	int ch, ret;
+
+	/* The '+' keeps glibc from taking the command's flags for ours. */
+	while ((ch = getopt(argc, argv, "+x:")) != -1)
+		switch (ch) {
+		case 'x':
+			idxpath = optarg;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1)
+		usage();
+
+	if (ufs_disk_fillout(&disk, argv[0]) == -1)
+		err(1, "%s: %s", argv[0], disk.d_error);
+	fs = &disk.d_fs;
+	/* Next to an image; a disk's directory is no place for it. */
+	if (idxpath == NULL) {
+		if (stat(argv[0], &sb) == 0 && S_ISREG(sb.st_mode))
+			snprintf(defpath, sizeof(defpath), "%s.dfidx", argv[0]);
+		else {
+			base = strrchr(argv[0], '/');
+			snprintf(defpath, sizeof(defpath), "%sdebugfs.%s.dfidx",
+			    _PATH_TMP, base == NULL ? argv[0] : base + 1);
+		}
+		idxpath = defpath;
+	}
+	ret = argc > 1 ? run(argc - 1, argv + 1) : interact();
+	idx_close();
+	ufs_disk_close(&disk);
+	return (ret);
+}
+
+static int
+run(int argc, char *argv[])
+{
+	const struct cmd *c;
+
+	for (c = cmds; c < &cmds[nitems(cmds)]; c++)
+		if (strcmp(argv[0], c->c_name) == 0)
+			break;
+	if (c == &cmds[nitems(cmds)]) {
+		warnx("%s: unknown command", argv[0]);
+		return (1);
+	}
+	if (argc - 1 < c->c_minargs || argc - 1 > c->c_maxargs) {
+		warnx("usage: %s %s", c->c_name, c->c_usage);
+		return (1);
+	}
+	return (c->c_func(argc, argv));
+}
+
+/*
+ * Commands from standard input, one per line, so that the file system
+ * and the index are only opened once for all of them.
+ */
+static int
+interact(void)
+{
+	char line[LINE_MAX], *args[8], *p;
+	int n, ret;
+
+	ret = 0;
+	for (;;) {
+		if (isatty(STDIN_FILENO)) {
+			printf("debugfs> ");
+			fflush(stdout);
+		}
+		if (fgets(line, sizeof(line), stdin) == NULL)
+			break;
+		n = 0;
+		for (p = strtok(line, " \t\n"); p != NULL && n < nitems(args);
+		    p = strtok(NULL, " \t\n"))
+			args[n++] = p;
+		if (n == 0)
+			continue;
+		if (strcmp(args[0], "quit") == 0 || strcmp(args[0], "q") == 0)
+			break;
+		ret = run(n, args);
+		fflush(stdout);
+	}
+	return (ret);
+}
+
+/*
+ * A file named by path from the root, or by inode number.
+ */
+static int
+lookup(const char *name, ino_t *inop)
+{
+	const char *p, *q;
+	uintmax_t n;
+	char *end;
+	ino_t ino;
+
+	if (isdigit((unsigned char)name[0])) {
+		n = strtoumax(name, &end, 10);
+		if (*end == '\0') {
+			if (n >= (uintmax_t)fs->fs_ipg * fs->fs_ncg) {
+				warnx("%s: inode number out of range", name);
+				return (-1);
+			}
+			*inop = (ino_t)n;
+			return (0);
+		}
+	}
+	if (!idxopen) {
+		idx_open(idxpath, 0);
+		idxopen = 1;
+	}
+	ino = UFS_ROOTINO;
+	for (p = name; *p != '\0'; p = q) {
+		while (*p == '/')
+			p++;
+		if (*p == '\0')
+			break;
+		for (q = p; *q != '\0' && *q != '/'; q++)
+			continue;
+		if ((ino = idx_lookup(ino, p, q - p, NULL)) == 0) {
+			warnx("%s: No such file or directory", name);
+			return (-1);
+		}
+	}
+	*inop = ino;
+	return (0);
+}
+
+static const char *
+ctimestr(int64_t t)
+{
+	static char buf[32];
+	time_t tt;
+
+	tt = (time_t)t;
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&tt));
+	return (buf);
+}
+
+static int
+cmd_sb(int argc, char *argv[])
+{
+
+	printf("magic\t\t%#x (UFS%d)\n", fs->fs_magic, disk.d_ufs);
+	printf("sblockloc\t%jd\n", (intmax_t)fs->fs_sblockloc);
+	printf("id\t\t%08x %08x\n", fs->fs_id[0], fs->fs_id[1]);
+	printf("volname\t\t%.*s\n", MAXVOLLEN, fs->fs_volname);
+	printf("time\t\t%s\n", ctimestr(fs->fs_time));
+	printf("size\t\t%jd\tdsize\t%jd\n", (intmax_t)fs->fs_size,
+	    (intmax_t)fs->fs_dsize);
+	printf("ncg\t\t%d\tfpg\t%d\tipg\t%d\n", fs->fs_ncg, fs->fs_fpg,
+	    fs->fs_ipg);
+	printf("bsize\t\t%d\tfsize\t%d\tfrag\t%d\n", fs->fs_bsize,
+	    fs->fs_fsize, fs->fs_frag);
+	printf("sblkno\t\t%d\tcblkno\t%d\tiblkno\t%d\tdblkno\t%d\n",
+	    fs->fs_sblkno, fs->fs_cblkno, fs->fs_iblkno, fs->fs_dblkno);
+	printf("cgsize\t\t%d\tcssize\t%d\tcsaddr\t%jd\n", fs->fs_cgsize,
+	    fs->fs_cssize, (intmax_t)fs->fs_csaddr);
+	printf("nindir\t\t%d\tinopb\t%d\tmaxsymlinklen %d\n", fs->fs_nindir,
+	    fs->fs_inopb, fs->fs_maxsymlinklen);
+	printf("minfree\t\t%d%%\toptim\t%s\n", fs->fs_minfree,
+	    fs->fs_optim == FS_OPTSPACE ? "space" : "time");
+	printf("maxbsize\t%d\tmaxcontig %d\tmaxbpg\t%d\n", fs->fs_maxbsize,
+	    fs->fs_maxcontig, fs->fs_maxbpg);
+	printf("avgfilesize\t%d\tavgfpdir %d\n", fs->fs_avgfilesize,
+	    fs->fs_avgfpdir);
+	printf("flags\t\t%#x\tmetackhash %#x\n", fs->fs_flags,
+	    fs->fs_metackhash);
+	printf("clean\t\t%d\tfmod\t%d\tronly\t%d\n", fs->fs_clean,
+	    fs->fs_fmod, fs->fs_ronly);
+	printf("cstotal\t\tndir %jd nbfree %jd nifree %jd nffree %jd\n",
+	    (intmax_t)fs->fs_cstotal.cs_ndir,
+	    (intmax_t)fs->fs_cstotal.cs_nbfree,
+	    (intmax_t)fs->fs_cstotal.cs_nifree,
+	    (intmax_t)fs->fs_cstotal.cs_nffree);
+	printf("cgrotor\t\t%d\tpendingblocks %jd\tpendinginodes %d\n",
+	    fs->fs_cgrotor, (intmax_t)fs->fs_pendingblocks,
+	    fs->fs_pendinginodes);
+	printf("contigsumsize\t%d\n", fs->fs_contigsumsize);
+	printf("fsmnt\t\t%.*s\n", MAXMNTLEN, fs->fs_fsmnt);
+	return (0);
+}
+
+static int
+cmd_cg(int argc, char *argv[])
+{
+	struct cg *cgp;
+	uint32_t ckhash, hash;
+	char *end;
+	long c;
+	int i;
+
+	c = strtol(argv[1], &end, 10);
+	if (*end != '\0' || c < 0 || c >= fs->fs_ncg) {
+		warnx("%s: no such cylinder group", argv[1]);
+		return (1);
+	}
+	/* Not cgread(), a group that fails its check is still shown. */
+	cgp = &disk.d_cg;
+	if (bread(&disk, fsbtodb(fs, cgtod(fs, c)), cgp, fs->fs_cgsize) ==
+	    -1) {
+		warnx("cg %ld: %s", c, disk.d_error);
+		return (1);
+	}
+	disk.d_lcg = -1;
+	printf("cg %ld at %jd\n", c, (intmax_t)cgtod(fs, c));
+	printf("magic\t\t%#x%s\n", cgp->cg_magic,
+	    cg_chkmagic(cgp) ? "" : " (bad)");
+	if ((fs->fs_metackhash & CK_CYLGRP) != 0) {
+		ckhash = cgp->cg_ckhash;
+		cgp->cg_ckhash = 0;
+		hash = calculate_crc32c(~0L, (void *)cgp, fs->fs_cgsize);
+		cgp->cg_ckhash = ckhash;
+		printf("ckhash\t\t%#x%s\n", ckhash, hash == ckhash ? "" :
+		    " (bad)");
+	}
+	printf("cgx\t\t%u\n", cgp->cg_cgx);
+	printf("time\t\t%s\n", ctimestr(disk.d_ufs == 1 ?
+	    cgp->cg_old_time : cgp->cg_time));
+	printf("ndblk\t\t%u\tniblk\t%u\tinitediblk %u\n", cgp->cg_ndblk,
+	    cgp->cg_niblk, cgp->cg_initediblk);
+	printf("ndir\t\t%d\tnbfree\t%d\tnifree\t%d\tnffree\t%d\n",
+	    cgp->cg_cs.cs_ndir, cgp->cg_cs.cs_nbfree, cgp->cg_cs.cs_nifree,
+	    cgp->cg_cs.cs_nffree);
+	printf("rotor\t\t%u\tfrotor\t%u\tirotor\t%u\n", cgp->cg_rotor,
+	    cgp->cg_frotor, cgp->cg_irotor);
+	printf("frsum\t");
+	for (i = 1; i < fs->fs_frag; i++)
+		printf(" %u", cgp->cg_frsum[i]);
+	printf("\n");
+	printf("unrefs\t\t%u\tnclusterblks %u\n", cgp->cg_unrefs,
+	    cgp->cg_nclusterblks);
+	return (0);
+}
+
+static int
+cmd_stat(int argc, char *argv[])
+{
+	struct dinfo di;
+	struct ufs_extent *ext;
+	size_t i, n;
+	ino_t ino;
+
+	if (lookup(argv[1], &ino) == -1 || getdinfo(ino, &di) == -1)
+		return (1);
+	printf("inode %ju%s\n", (uintmax_t)ino, di.ckhashbad ?
+	    " (bad check-hash)" : "");
+	printf("mode\t\t%06o\tnlink\t%d\tflags\t%#x\n", di.mode, di.nlink,
+	    di.flags);
+	printf("uid\t\t%u\tgid\t%u\tgen\t%u\n", di.uid, di.gid, di.gen);
+	printf("size\t\t%ju\tblocks\t%ju\n", (uintmax_t)di.size,
+	    (uintmax_t)di.blocks);
+	printf("atime\t\t%s\n", ctimestr(di.atime));
+	printf("mtime\t\t%s\n", ctimestr(di.mtime));
+	printf("ctime\t\t%s\n", ctimestr(di.ctime));
+	if (disk.d_ufs == 2) {
+		printf("birthtime\t%s\n", ctimestr(di.birthtime));
+		printf("extsize\t\t%ju\n", (uintmax_t)di.extsize);
+	}
+	if (di.islink) {
+		printf("link\t\t%.*s\n", (int)di.size, di.link);
+		return (0);
+	}
+	printf("ib\t\t%jd %jd %jd\n", (intmax_t)di.ib[0], (intmax_t)di.ib[1],
+	    (intmax_t)di.ib[2]);
+	if (di.extb[0] != 0 || di.extb[1] != 0)
+		printf("extb\t\t%jd %jd\n", (intmax_t)di.extb[0],
+		    (intmax_t)di.extb[1]);
+	if (filemap(&di, UFS_EXTENTS_INDIR, &ext, &n) == -1)
+		return (1);
+	printf("extents\t\t%zu\n", n);
+	for (i = 0; i < n; i++)
+		printf("\t%jd-%jd\tat %jd\t%jd frags%s\n",
+		    (intmax_t)ext[i].ue_lbn, (intmax_t)(ext[i].ue_lbn +
+		    howmany(ext[i].ue_nfrags, fs->fs_frag) - 1),
+		    (intmax_t)ext[i].ue_blkno, (intmax_t)ext[i].ue_nfrags,
+		    ext[i].ue_flags & UFS_EXTENT_INDIR ? "\tindirect" :
+		    ext[i].ue_flags & UFS_EXTENT_EXTATTR ? "\textattr" : "");
+	free(ext);
+	return (0);
+}
+
+static int
+lsent(void *arg, ino_t ino, const char *name, size_t namlen, int type)
+{
+	static const char types[] = "?pc?d?b?-?l?s?w";
+	struct dinfo di;
+	char *target;
+	size_t len;
+	int lflag;
+
+	lflag = *(int *)arg;
+	if (!lflag) {
+		printf("%10ju %c %.*s\n", (uintmax_t)ino,
+		    type < (int)sizeof(types) - 1 ? types[type] : '?',
+		    (int)namlen, name);
+		return (0);
+	}
+	if (getdinfo(ino, &di) == -1)
+		return (0);
+	printf("%10ju %06o %3d %5u %5u %12ju %s %.*s", (uintmax_t)ino,
+	    di.mode, di.nlink, di.uid, di.gid, (uintmax_t)di.size,
+	    ctimestr(di.mtime), (int)namlen, name);
+	if ((di.mode & IFMT) == IFLNK && readfile(&di, &target, &len) == 0) {
+		printf(" -> %.*s", (int)len, target);
+		free(target);
+	}
+	printf("\n");
+	return (0);
+}
+
+static int
+cmd_ls(int argc, char *argv[])
+{
+	struct dinfo di;
+	struct direct *dp;
+	const char *name;
+	size_t len, loc;
+	char *buf;
+	ino_t ino;
+	int lflag;
+
+	lflag = 0;
+	if (argc > 1 && strcmp(argv[1], "-l") == 0) {
+		lflag = 1;
+		argc--;
+		argv++;
+	}
+	if (argc > 2) {
+		warnx("usage: ls [-l] [dir]");
+		return (1);
+	}
+	name = argc > 1 ? argv[1] : "/";
+	if (lookup(name, &ino) == -1)
+		return (1);
+	if (idxopen && idx_list(ino, lsent, &lflag) == 0)
+		return (0);
+	/* Not in the index (named by number): read the directory. */
+	if (getdinfo(ino, &di) == -1)
+		return (1);
+	if ((di.mode & IFMT) != IFDIR) {
+		warnx("%s: Not a directory", name);
+		return (1);
+	}
+	if (readfile(&di, &buf, &len) == -1)
+		return (1);
+	for (loc = 0; (dp = nextdirent(buf, len, &loc)) != NULL; )
+		lsent(&lflag, dp->d_ino, dp->d_name, dp->d_namlen, dp->d_type);
+	free(buf);
+	return (0);
+}
+
+static int
+cmd_cat(int argc, char *argv[])
+{
+	struct dinfo di;
+	struct out o;
+	ino_t ino;
+
+	if (lookup(argv[1], &ino) == -1 || getdinfo(ino, &di) == -1)
+		return (1);
+	if ((di.mode & IFMT) == IFDIR) {
+		warnx("%s: Is a directory", argv[1]);
+		return (1);
+	}
+	o.o_fd = STDOUT_FILENO;
+	o.o_pos = 0;
+	o.o_seek = 0;
+	o.o_name = "stdout";
+	if (readdata(&di, writeout, &o) == -1 || fill(&o, di.size) == -1)
+		return (1);
+	return (0);
+}
+
+static int
+cmd_get(int argc, char *argv[])
+{
+	struct dinfo di;
+	const char *dest;
+	ino_t ino;
+
+	if (lookup(argv[1], &ino) == -1 || getdinfo(ino, &di) == -1)
+		return (1);
+	if (argc > 2)
+		dest = argv[2];
+	else if ((dest = strrchr(argv[1], '/')) != NULL && dest[1] != '\0')
+		dest++;
+	else if (dest == NULL)
+		dest = argv[1];
+	else {
+		warnx("%s: name a destination", argv[1]);
+		return (1);
+	}
+	return (extract(&di, dest) == -1);
+}
+
+static int
+cmd_index(int argc, char *argv[])
+{
+	struct timeval t0, t1;
+	uint64_t ndirs, nents;
+
+	gettimeofday(&t0, NULL);
+	idx_open(idxpath, 1);
+	idxopen = 1;
+	gettimeofday(&t1, NULL);
+	if (idx_stats(&ndirs, &nents) == -1)
+		return (1);
+	printf("%s: %ju directories, %ju entries, %.2fs\n", idxpath,
+	    (uintmax_t)ndirs, (uintmax_t)nents, (t1.tv_sec - t0.tv_sec) +
+	    (t1.tv_usec - t0.tv_usec) / 1e6);
+	return (0);
+}
+
+/*
+ * Copy di to dest: a regular file with its holes, a symbolic link, or a
+ * directory and everything below it.
+ */
+static int
+extract(const struct dinfo *di, const char *dest)
+{
+	struct timeval tv[2];
+	struct dinfo child;
+	struct direct *dp;
+	struct out o;
+	char path[MAXPATHLEN], *buf;
+	size_t len, loc;
+	int ret;
+
+	ret = 0;
+	switch (di->mode & IFMT) {
+	case IFREG:
+		if ((o.o_fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC,
+		    di->mode & 0777)) == -1) {
+			warn("%s", dest);
+			return (-1);
+		}
+		o.o_pos = 0;
+		o.o_seek = 1;
+		o.o_name = dest;
+		if (readdata(di, writeout, &o) == -1 ||
+		    fill(&o, di->size) == -1)
+			ret = -1;
+		close(o.o_fd);
+		break;
+	case IFLNK:
+		if (readfile(di, &buf, &len) == -1)
+			return (-1);
+		if (symlink(buf, dest) == -1) {
+			warn("%s", dest);
+			ret = -1;
+		}
+		free(buf);
+		return (ret);
+	case IFDIR:
+		if (mkdir(dest, (di->mode & 0777) | S_IRWXU) == -1 &&
+		    errno != EEXIST) {
+			warn("%s", dest);
+			return (-1);
+		}
+		if (readfile(di, &buf, &len) == -1)
+			return (-1);
+		for (loc = 0; (dp = nextdirent(buf, len, &loc)) != NULL; ) {
+			if (strcmp(dp->d_name, ".") == 0 ||
+			    strcmp(dp->d_name, "..") == 0)
+				continue;
+			if (snprintf(path, sizeof(path), "%s/%s", dest,
+			    dp->d_name) >= (int)sizeof(path)) {
+				warnx("%s/%s: name too long", dest, dp->d_name);
+				ret = -1;
+				continue;
+			}
+			if (getdinfo(dp->d_ino, &child) == -1 ||
+			    extract(&child, path) == -1)
+				ret = -1;
+		}
+		free(buf);
+		break;
+	default:
+		warnx("%s: inode %ju is not a file, skipped", dest,
+		    (uintmax_t)di->ino);
+		return (0);
+	}
+	tv[0].tv_sec = di->atime;
+	tv[0].tv_usec = 0;
+	tv[1].tv_sec = di->mtime;
+	tv[1].tv_usec = 0;
+	utimes(dest, tv);
+	return (ret);
+}
+
+/*
+ * Write a piece of a file at its offset, leaving or filling the hole
+ * before it.
+ */
+static int
+writeout(void *arg, off_t off, const char *data, size_t len)
+{
+	struct out *o;
+	ssize_t n;
+
+	o = arg;
+	if (off > o->o_pos && fill(o, off) == -1)
+		return (-1);
+	while (len > 0) {
+		if ((n = write(o->o_fd, data, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			warn("%s", o->o_name);
+			return (-1);
+		}
+		data += n;
+		len -= n;
+		o->o_pos += n;
+	}
+	return (0);
+}
+
+/*
+ * Move the output up to off: a seek, or zeros when it can't seek.
+ */
+static int
+fill(struct out *o, off_t off)
+{
+	static char zeros[MAXBSIZE];
+	size_t n;
+
+	if (off <= o->o_pos)
+		return (0);
+	if (o->o_seek) {
+		/* Growing the file leaves the hole unallocated. */
+		if (lseek(o->o_fd, off, SEEK_SET) == -1 ||
+		    ftruncate(o->o_fd, off) == -1) {
+			warn("%s", o->o_name);
+			return (-1);
+		}
+		o->o_pos = off;
+		return (0);
+	}
+	while (o->o_pos < off) {
+		n = MIN(sizeof(zeros), (size_t)(off - o->o_pos));
+		if (writeout(o, o->o_pos, zeros, n) == -1)
+			return (-1);
+	}
+	return (0);
+}
+
+static void
+usage(void)
+{
+	const struct cmd *c;
+
+	fprintf(stderr, "usage: debugfs [-x index] special | file "
+	    "[command [args]]\ncommands:\n");
+	for (c = cmds; c < &cmds[nitems(cmds)]; c++)
+		fprintf(stderr, "\t%s %s\n", c->c_name, c->c_usage);
+	exit(1);
+}
@@ -0,0 +1,692 @@
+//
+//  growfs.c
+//  growfs_ufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Grow a UFS file system that is not mounted to fill a larger disk or
+// image file, or to the size given with -s.
+//
+// The geometry of a cylinder group doesn't change, so growing is adding
+// groups at the end: the last group is filled out to fs_fpg frags, and
+// the groups after it are built by initcg() from newfs, the same way
+// newfs builds all of them, on -P threads and with -I leaving their
+// inode blocks for the kernel to initialize. What is left is one block
+// of writes per group, the cylinder group itself and its copy of the
+// superblock.
+//
+// The summary area (fs_csp) takes one struct csum per group, so it may
+// need more frags. It grows in place if the frags after it are free,
+// else it moves to the start of the data of the first new group, where
+// initcg() leaves room for it, else to the first free run of blocks long
+// enough in the old groups. Its old frags are then freed.
+//
+// The old groups are changed first, then the new ones built, and the
+// superblock, with the summary, written last, so that until then the old
+// file system is the one on the disk. Every group is then read back with
+// cgread1(), which checks its check-hash.
+
+#include <sys/param.h>
+#include <freebsd/disklabel.h>
+#include <sys/disk.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#include "newfs.h"
+
+#define	MAXTHREADS	256
+
+/*
+ * What initcg() and wtfs() look at, set from the file system and the
+ * command line as newfs sets them.
+ */
+struct uufsd disk;
+int	Iflag;			/* initialize inode blocks lazily */
+int	Nflag;			/* say what would be done, write nothing */
+int	Oflag;			/* UFS1 or UFS2 */
+int	Rflag;			/* never set, for newfs_random() */
+int	nthreads;		/* cylinder group initialization threads */
+ufs2_daddr_t part_ofs;		/* always 0 */
+
+static struct fs *fs;
+static struct fs ofs;		/* superblock before growing */
+static long ocsfrags;		/* summary area before growing */
+static long ncsfrags;		/* and after */
+
+static int64_t newsize(const char *, int);
+static int64_t fitsize(int64_t);
+static void placecs(void);
+static int runfree(int, ufs2_daddr_t, long);
+static ufs2_daddr_t findrun(long);
+static void setsummary(void);
+static void cgupdate(int);
+static void setfrags(struct cg *, ufs2_daddr_t, long, int);
+static void cgrecount(struct cg *);
+static void initcgs(time_t);
+static void sumtotal(void);
+static void setrecovery(void);
+static int verify(void);
+static void printgeom(const char *);
+static off_t disksize(int);
+static void usage(void);
+
+int
+main(int argc, char *argv[])
+{
+	char *size;
+	int64_t nsize;
+	int c, ch, error;
+
+	size = NULL;
+	nthreads = (int)MIN(sysconf(_SC_NPROCESSORS_ONLN), MAXTHREADS);
+	while ((ch = getopt(argc, argv, "INP:s:")) != -1)
+		switch (ch) {
+		case 'I':
+			Iflag = 1;
+			break;
+		case 'N':
+			Nflag = 1;
+			break;
+		case 'P':
+			nthreads = (int)strtol(optarg, NULL, 10);
+			if (nthreads < 1 || nthreads > MAXTHREADS)
+				errx(1, "%s: bad number of threads", optarg);
+			break;
+		case 's':
+			size = optarg;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if (ufs_disk_fillout(&disk, argv[0]) == -1)
+		errx(1, "%s: %s", argv[0], disk.d_error);
+	fs = &disk.d_fs;
+	Oflag = disk.d_ufs;
+	if (Iflag && Oflag != 2)
+		errx(1, "lazy inode initialization requires UFS2");
+	if (fs->fs_snapinum[0] != 0)
+		errx(1, "%s: has snapshots, which would not cover the "
+		    "new groups", argv[0]);
+	if (fs->fs_clean == 0 || (fs->fs_flags & FS_UNCLEAN))
+		errx(1, "%s: not clean, check it first", argv[0]);
+	if (!Nflag && ufs_disk_write(&disk) == -1)
+		errx(1, "%s: %s", argv[0], disk.d_error);
+
+	nsize = fitsize(newsize(size, disk.d_fd));
+	memcpy(&ofs, fs, sizeof(ofs));
+	ocsfrags = howmany(ofs.fs_cssize, fs->fs_fsize);
+	fs->fs_ncg = howmany(nsize, fs->fs_fpg);
+	fs->fs_size = nsize;
+	ncsfrags = howmany(fragroundup(fs, fs->fs_ncg * sizeof(struct csum)),
+	    fs->fs_fsize);
+	placecs();
+	setsummary();
+	printgeom(argv[0]);
+	if (Nflag)
+		exit(0);
+
+	/* Old groups first, so that a failure leaves the old file system. */
+	cgupdate(ofs.fs_ncg - 1);
+	if (ncsfrags != ocsfrags) {
+		c = dtog(fs, ofs.fs_csaddr);
+		if (c != ofs.fs_ncg - 1)
+			cgupdate(c);
+		c = dtog(fs, fs->fs_csaddr);
+		if (c < ofs.fs_ncg && c != ofs.fs_ncg - 1 &&
+		    c != dtog(fs, ofs.fs_csaddr))
+			cgupdate(c);
+	}
+	initcgs(time(NULL));
+	sumtotal();
+	/* The summary goes with the primary, the old groups get copies. */
+	if ((errno = sbput(disk.d_fd, fs, ofs.fs_ncg)) != 0)
+		err(1, "%s: can't write superblock", argv[0]);
+	if (Oflag == 2)
+		setrecovery();
+	error = verify();
+	if (ufs_disk_close(&disk) == -1)
+		errx(1, "%s: %s", argv[0], disk.d_error);
+	return (error == 0 ? 0 : 1);
+}
+
+/*
+ * The size to grow to in frags: from -s, in 512 byte sectors or with a
+ * b, k, m, g or t suffix in bytes, or else the size of the disk. An image
+ * file smaller than that is extended.
+ */
+static int64_t
+newsize(const char *arg, int fd)
+{
+	struct stat st;
+	uintmax_t n;
+	off_t media;
+	char *end;
+	int shift;
+
+	media = disksize(fd);
+	if (arg == NULL) {
+		if (media <= 0)
+			errx(1, "%s: can't tell its size, use -s",
+			    disk.d_name);
+		return (media / fs->fs_fsize);
+	}
+	errno = 0;
+	n = strtoumax(arg, &end, 0);
+	if (errno != 0 || end == arg)
+		errx(1, "%s: bad size", arg);
+	switch (tolower((unsigned char)*end)) {
+	case '\0':
+		shift = DEV_BSHIFT;
+		break;
+	case 'b':
+		shift = 0;
+		break;
+	case 'k':
+		shift = 10;
+		break;
+	case 'm':
+		shift = 20;
+		break;
+	case 'g':
+		shift = 30;
+		break;
+	case 't':
+		shift = 40;
+		break;
+	default:
+		errx(1, "%s: bad size", arg);
+	}
+	if (*end != '\0' && end[1] != '\0')
+		errx(1, "%s: bad size", arg);
+	if (n > (uintmax_t)INT64_MAX >> shift)
+		errx(1, "%s: too large", arg);
+	n <<= shift;
+	if ((off_t)n > media) {
+		if (fstat(fd, &st) == -1)
+			err(1, "%s", disk.d_name);
+		if (!S_ISREG(st.st_mode))
+			errx(1, "%s: %jd bytes, smaller than %s", disk.d_name,
+			    (intmax_t)media, arg);
+		if (!Nflag && ftruncate(fd, (off_t)n) == -1)
+			err(1, "%s", disk.d_name);
+	}
+	return ((int64_t)(n / fs->fs_fsize));
+}
+
+/*
+ * Trim the new size so that the last group is big enough to hold its
+ * inodes, as mkfs does, and the file system stays within what its
+ * format can count.
+ */
+static int64_t
+fitsize(int64_t nsize)
+{
+	int64_t ncg, last, lastminfpg;
+
+	if (Oflag == 1 && nsize > INT32_MAX) {
+		warnx("UFS1 is limited to %d frags", INT32_MAX);
+		nsize = INT32_MAX;
+	}
+	ncg = howmany(nsize, fs->fs_fpg);
+	if ((uint64_t)ncg * fs->fs_ipg > UINT32_MAX) {
+		ncg = UINT32_MAX / fs->fs_ipg;
+		warnx("limited to %jd cylinder groups by the number of inodes",
+		    (intmax_t)ncg);
+		nsize = ncg * fs->fs_fpg;
+	}
+	lastminfpg = roundup(fs->fs_iblkno + fs->fs_ipg / INOPF(fs),
+	    fs->fs_frag);
+	last = nsize % fs->fs_fpg;
+	if (ncg > fs->fs_ncg && last != 0 && last < lastminfpg) {
+		warnx("%jd frags at the end are too few for a cylinder group "
+		    "and are left out", (intmax_t)last);
+		nsize -= last;
+	}
+	if (nsize <= fs->fs_size)
+		errx(1, "%s: %jd frags, not larger than the %jd it has",
+		    disk.d_name, (intmax_t)nsize, (intmax_t)fs->fs_size);
+	return (nsize);
+}
+
+/*
+ * Find ncsfrags frags for the summary area: where it is if the frags
+ * after it are free or being added, at the start of the data of the
+ * first new group if it fits there, else in a free run of blocks in the
+ * old groups.
+ */
+static void
+placecs(void)
+{
+	ufs2_daddr_t bno, end;
+	int c;
+
+	if (ncsfrags == ocsfrags)
+		return;
+	c = dtog(fs, ofs.fs_csaddr);
+	if (runfree(c, ofs.fs_csaddr + ocsfrags, ncsfrags - ocsfrags))
+		return;
+	if (fs->fs_ncg > ofs.fs_ncg) {
+		bno = cgdmin(fs, ofs.fs_ncg);
+		end = MIN(cgbase(fs, ofs.fs_ncg) + fs->fs_fpg, fs->fs_size);
+		if (bno + ncsfrags <= end) {
+			fs->fs_csaddr = bno;
+			return;
+		}
+	}
+	if ((bno = findrun(ncsfrags)) == 0)
+		errx(1, "%s: no room for %ld frags of cylinder group summary",
+		    disk.d_name, ncsfrags);
+	fs->fs_csaddr = bno;
+}
+
+/*
+ * Whether n frags from bno on in group c are free, or past the old end
+ * of the file system and in it now.
+ */
+static int
+runfree(int c, ufs2_daddr_t bno, long n)
+{
+	struct cg *cgp;
+	ufs2_daddr_t base, d;
+
+	base = cgbase(fs, c);
+	if (bno + n > MIN(base + fs->fs_fpg, fs->fs_size))
+		return (0);
+	if (cgread1(&disk, c) != 1)
+		errx(1, "cg %d: %s", c, disk.d_error);
+	cgp = &disk.d_cg;
+	/* Past cg_ndblk of the old last group is what is being added. */
+	for (d = bno - base; d < bno - base + n; d++)
+		if (d < cgp->cg_ndblk && isclr(cg_blksfree(cgp), d))
+			return (0);
+	return (1);
+}
+
+/*
+ * The first run of free blocks that holds n frags in the old groups,
+ * or 0 if there is none.
+ */
+static ufs2_daddr_t
+findrun(long n)
+{
+	struct cg *cgp;
+	long nblks, h, run;
+	int c;
+
+	nblks = howmany(n, fs->fs_frag);
+	for (c = 0; c < ofs.fs_ncg; c++) {
+		if (fs->fs_csp[c].cs_nbfree < nblks)
+			continue;
+		if (cgread1(&disk, c) != 1)
+			errx(1, "cg %d: %s", c, disk.d_error);
+		cgp = &disk.d_cg;
+		for (run = 0, h = 0; h < cgp->cg_ndblk / fs->fs_frag; h++) {
+			if (!ffs_isblock(fs, cg_blksfree(cgp), h)) {
+				run = 0;
+				continue;
+			}
+			if (++run == nblks)
+				return (cgbase(fs, c) +
+				    blkstofrags(fs, h - nblks + 1));
+		}
+	}
+	return (0);
+}
+
+/*
+ * Put in the new summary information, the old groups' entries copied,
+ * and set what else in the superblock depends on the size.
+ */
+static void
+setsummary(void)
+{
+	struct csum *csp;
+	uint8_t *space;
+	int32_t *lp;
+	size_t size;
+	long cssize;
+	int i;
+
+	cssize = fragroundup(fs, fs->fs_ncg * sizeof(struct csum));
+	size = cssize;
+	if (fs->fs_contigsumsize > 0)
+		size += fs->fs_ncg * sizeof(int32_t);
+	size += fs->fs_ncg * sizeof(u_int8_t);
+	if ((space = calloc(1, size)) == NULL)
+		err(1, "calloc");
+	csp = (struct csum *)space;
+	memcpy(csp, fs->fs_csp, ofs.fs_ncg * sizeof(struct csum));
+	free(fs->fs_csp);
+	fs->fs_csp = csp;
+	space += cssize;
+	if (fs->fs_contigsumsize > 0) {
+		fs->fs_maxcluster = lp = (int32_t *)space;
+		for (i = 0; i < fs->fs_ncg; i++)
+			*lp++ = fs->fs_contigsumsize;
+		space = (uint8_t *)lp;
+	}
+	fs->fs_contigdirs = space;
+
+	fs->fs_cssize = cssize;
+	fs->fs_dsize += (fs->fs_size - ofs.fs_size) -
+	    (fs->fs_ncg - ofs.fs_ncg) * (fs->fs_dblkno - fs->fs_sblkno) -
+	    (ncsfrags - ocsfrags);
+	fs->fs_providersize = MAX(fs->fs_providersize,
+	    disksize(disk.d_fd) / fs->fs_fsize);
+	if (Oflag == 1) {
+		fs->fs_old_size = fs->fs_size;
+		fs->fs_old_ncyl = fs->fs_ncg * fs->fs_old_cpg;
+		fs->fs_old_dsize = fs->fs_dsize;
+		fs->fs_old_csaddr = fs->fs_csaddr;
+	}
+}
+
+/*
+ * Bring an old group up to the new size: the last one is filled out,
+ * the frags the summary area takes in it are taken, the ones it had
+ * are freed if it moved.
+ */
+static void
+cgupdate(int c)
+{
+	struct cg *cgp;
+	ufs2_daddr_t base;
+	long ndblk;
+
+	if (cgread1(&disk, c) != 1)
+		errx(1, "cg %d: %s", c, disk.d_error);
+	cgp = &disk.d_cg;
+	base = cgbase(fs, c);
+	if (c == ofs.fs_ncg - 1) {
+		ndblk = MIN(base + fs->fs_fpg, fs->fs_size) - base;
+		setfrags(cgp, base + cgp->cg_ndblk, ndblk - cgp->cg_ndblk, 1);
+		cgp->cg_ndblk = ndblk;
+		if (fs->fs_contigsumsize > 0)
+			cgp->cg_nclusterblks = ndblk / fs->fs_frag;
+	}
+	if (fs->fs_csaddr == ofs.fs_csaddr) {
+		setfrags(cgp, fs->fs_csaddr + ocsfrags, ncsfrags - ocsfrags, 0);
+	} else {
+		setfrags(cgp, ofs.fs_csaddr, ocsfrags, 1);
+		setfrags(cgp, fs->fs_csaddr, ncsfrags, 0);
+	}
+	cgrecount(cgp);
+	fs->fs_csp[c] = cgp->cg_cs;
+	if (cgwrite1(&disk, c) != 0)
+		errx(1, "cg %d: %s", c, disk.d_error);
+}
+
+/*
+ * Mark n frags from bno on free, or not, in the map of cgp, if they are
+ * in it.
+ */
+static void
+setfrags(struct cg *cgp, ufs2_daddr_t bno, long n, int isfree)
+{
+	ufs2_daddr_t base, d;
+
+	base = cgbase(fs, cgp->cg_cgx);
+	if (n <= 0 || bno < base || bno >= base + fs->fs_fpg)
+		return;
+	for (d = bno - base; d < bno - base + n; d++)
+		if (isfree)
+			setbit(cg_blksfree(cgp), d);
+		else
+			clrbit(cg_blksfree(cgp), d);
+}
+
+/*
+ * Count the free blocks and frags of a group again from its map, and
+ * build its fragment and cluster summaries over, as initcg() does.
+ */
+static void
+cgrecount(struct cg *cgp)
+{
+	u_char *freemap, *mapp;
+	int32_t *sump;
+	long d, h, i;
+	int map, bit, run;
+
+	freemap = cg_blksfree(cgp);
+	cgp->cg_cs.cs_nbfree = 0;
+	cgp->cg_cs.cs_nffree = 0;
+	memset(cgp->cg_frsum, 0, sizeof(cgp->cg_frsum));
+	if (fs->fs_contigsumsize > 0) {
+		memset(cg_clustersfree(cgp), 0,
+		    howmany(fragstoblks(fs, fs->fs_fpg), CHAR_BIT));
+		/* Its unused first entry overlaps the end of the free map. */
+		memset(&cg_clustersum(cgp)[1], 0,
+		    fs->fs_contigsumsize * sizeof(int32_t));
+	}
+	for (d = 0; d < cgp->cg_ndblk; d += fs->fs_frag) {
+		h = fragstoblks(fs, d);
+		if (d + fs->fs_frag <= cgp->cg_ndblk &&
+		    ffs_isblock(fs, freemap, h)) {
+			cgp->cg_cs.cs_nbfree++;
+			if (fs->fs_contigsumsize > 0)
+				setbit(cg_clustersfree(cgp), h);
+			continue;
+		}
+		for (i = d; i < d + fs->fs_frag && i < cgp->cg_ndblk; i++)
+			if (isset(freemap, i))
+				cgp->cg_cs.cs_nffree++;
+		ffs_fragacct(fs, blkmap(fs, freemap, d),
+		    (int *)cgp->cg_frsum, 1);
+	}
+	if (fs->fs_contigsumsize <= 0)
+		return;
+	sump = cg_clustersum(cgp);
+	mapp = cg_clustersfree(cgp);
+	map = *mapp++;
+	bit = 1;
+	run = 0;
+	for (i = 0; i < cgp->cg_nclusterblks; i++) {
+		if ((map & bit) != 0)
+			run++;
+		else if (run != 0) {
+			sump[MIN(run, fs->fs_contigsumsize)]++;
+			run = 0;
+		}
+		if ((i & (CHAR_BIT - 1)) != CHAR_BIT - 1)
+			bit <<= 1;
+		else {
+			map = *mapp++;
+			bit = 1;
+		}
+	}
+	if (run != 0)
+		sump[MIN(run, fs->fs_contigsumsize)]++;
+}
+
+/*
+ * Build the new groups, on nthreads threads if there is more than one
+ * of either.
+ */
+static void
+initcgs(time_t utime)
+{
+	struct cgctx cc;
+	int c;
+
+	if (nthreads > 1 && fs->fs_ncg - ofs.fs_ncg > 1) {
+		initcg_parallel(ofs.fs_ncg, utime, NULL);
+		return;
+	}
+	cgctx_init(&cc, &disk.d_cg, calloc(1, 2 * fs->fs_bsize));
+	if (cc.cc_iobuf == NULL)
+		err(1, "calloc");
+	for (c = ofs.fs_ncg; c < fs->fs_ncg; c++)
+		initcg(c, utime, &cc);
+	free(cc.cc_iobuf);
+	cgctx_free(&cc);
+}
+
+/*
+ * Total the groups' summaries for the superblock.
+ */
+static void
+sumtotal(void)
+{
+	struct csum_total *cs;
+	int c;
+
+	cs = &fs->fs_cstotal;
+	cs->cs_nbfree = cs->cs_nffree = cs->cs_nifree = cs->cs_ndir = 0;
+	for (c = 0; c < fs->fs_ncg; c++) {
+		cs->cs_nbfree += fs->fs_csp[c].cs_nbfree;
+		cs->cs_nffree += fs->fs_csp[c].cs_nffree;
+		cs->cs_nifree += fs->fs_csp[c].cs_nifree;
+		cs->cs_ndir += fs->fs_csp[c].cs_ndir;
+	}
+	if (Oflag == 1) {
+		fs->fs_old_cstotal.cs_ndir = cs->cs_ndir;
+		fs->fs_old_cstotal.cs_nbfree = cs->cs_nbfree;
+		fs->fs_old_cstotal.cs_nifree = cs->cs_nifree;
+		fs->fs_old_cstotal.cs_nffree = cs->cs_nffree;
+	}
+}
+
+/*
+ * Update the number of groups in the recovery information newfs leaves
+ * at the end of the boot block of a UFS2 file system, if it is there.
+ */
+static void
+setrecovery(void)
+{
+	struct fsrecovery *fsr;
+	char *buf;
+	long secsize;
+
+	secsize = disk.d_bsize;
+	if ((buf = malloc(secsize)) == NULL)
+		err(1, "malloc");
+	if (bread(&disk, (SBLOCK_UFS2 - secsize) / disk.d_bsize, buf,
+	    secsize) == -1)
+		errx(1, "can't read recovery area: %s", disk.d_error);
+	fsr = (struct fsrecovery *)&buf[secsize - sizeof *fsr];
+	if (fsr->fsr_magic == FS_UFS2_MAGIC && fsr->fsr_fpg == fs->fs_fpg &&
+	    fsr->fsr_sblkno == fs->fs_sblkno) {
+		fsr->fsr_ncg = fs->fs_ncg;
+		if (bwrite(&disk, (SBLOCK_UFS2 - secsize) / disk.d_bsize, buf,
+		    secsize) == -1)
+			errx(1, "can't write recovery area: %s", disk.d_error);
+	}
+	free(buf);
+}
+
+/*
+ * Read every group back, checking its check-hash, and that its summary
+ * is the one in the superblock.
+ */
+static int
+verify(void)
+{
+	struct csum *cs;
+	int c, nerrors;
+
+	nerrors = 0;
+	for (c = 0; c < fs->fs_ncg; c++) {
+		if (cgread1(&disk, c) != 1) {
+			warnx("cg %d: %s", c, disk.d_error);
+			nerrors++;
+			continue;
+		}
+		cs = &fs->fs_csp[c];
+		if (memcmp(cs, &disk.d_cg.cg_cs, sizeof(*cs)) != 0) {
+			warnx("cg %d: summary doesn't match the superblock's",
+			    c);
+			nerrors++;
+		}
+	}
+	return (nerrors);
+}
+
+static void
+printgeom(const char *name)
+{
+	char buf[32];
+	int c, col, n;
+
+#	define B2MBFACTOR (1 / (1024.0 * 1024.0))
+	printf("%s: %.1fMB (%jd sectors) block size %d, fragment size %d\n",
+	    name, (float)fs->fs_size * fs->fs_fsize * B2MBFACTOR,
+	    (intmax_t)fsbtodb(fs, fs->fs_size), fs->fs_bsize, fs->fs_fsize);
+	printf("\tusing %d cylinder groups of %.2fMB, %d blks, %d inodes.\n",
+	    fs->fs_ncg, (float)fs->fs_fpg * fs->fs_fsize * B2MBFACTOR,
+	    fs->fs_fpg / fs->fs_frag, fs->fs_ipg);
+#	undef B2MBFACTOR
+	if (fs->fs_csaddr != ofs.fs_csaddr)
+		printf("\tsummary information moved to cylinder group %jd\n",
+		    (intmax_t)dtog(fs, fs->fs_csaddr));
+	if (fs->fs_ncg == ofs.fs_ncg)
+		return;
+	printf("super-block backups (for fsck_ffs -b #) at:\n");
+	for (col = 0, c = ofs.fs_ncg; c < fs->fs_ncg; c++) {
+		n = snprintf(buf, sizeof(buf), " %jd%s",
+		    (intmax_t)fsbtodb(fs, cgsblock(fs, c)),
+		    c < fs->fs_ncg - 1 ? "," : "");
+		if (col + n >= 80) {
+			printf("\n");
+			col = 0;
+		}
+		col += n;
+		printf("%s", buf);
+	}
+	printf("\n");
+}
+
+/*
+ * Size of a disk in bytes, or 0 if it can't be told.
+ */
+static off_t
+disksize(int fd)
+{
+	uint64_t count;
+	uint32_t size;
+	off_t end;
+
+	if (ioctl(fd, DKIOCGETBLOCKSIZE, &size) == 0 &&
+	    ioctl(fd, DKIOCGETBLOCKCOUNT, &count) == 0)
+		return ((off_t)count * size);
+	if ((end = lseek(fd, 0, SEEK_END)) == -1)
+		return (0);
+	return (end);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: growfs [-IN] [-P threads] [-s size] special | file\n");
+	exit(1);
+}
@@ -0,0 +1,616 @@
+//
+//  aio.c
+//  libufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Asynchronous block I/O for libufs consumers.
+// bread_async() and bwrite_async() only queue a request; the data is not
+// valid (reads) and the buffer must not be touched (writes) until
+// ufs_disk_flush() returns. On Linux requests go through an io_uring
+// (talked to directly, so there's no liburing dependency), everywhere else,
+// or when the kernel refuses to give us a ring, a small pthread pool does
+// the pread/pwrite calls.
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define	AIO_URING
+#endif
+
+#include <libufs.h>
+
+#define	AIO_DEPTH	64	/* max requests in flight */
+#define	AIO_NTHREADS	4	/* workers in the fallback pool */
+
+struct aio_req {
+	void		*ar_data;	/* caller's buffer */
+	struct iovec	 ar_iov;	/* what we hand the kernel (may bounce) */
+	off_t		 ar_offset;
+	int		 ar_fd;
+	int		 ar_write;
+	int		 ar_next;	/* free list / pool queue link */
+};
+
+#ifdef AIO_URING
+struct aio_ring {
+	int		 r_fd;
+	unsigned	*r_sqhead;
+	unsigned	*r_sqtail;
+	unsigned	 r_sqmask;
+	unsigned	*r_sqarray;
+	struct io_uring_sqe *r_sqes;
+	unsigned	*r_cqhead;
+	unsigned	*r_cqtail;
+	unsigned	 r_cqmask;
+	struct io_uring_cqe *r_cqes;
+	void		*r_sqmap;
+	size_t		 r_sqmapsz;
+	void		*r_cqmap;
+	size_t		 r_cqmapsz;
+	size_t		 r_sqessz;
+	unsigned	 r_unsubmitted;	/* sqes queued but not yet entered */
+};
+#endif
+
+struct uufsd_aio {
+	struct aio_req	 a_req[AIO_DEPTH];
+	int		 a_free;	/* head of free request list */
+	int		 a_inflight;	/* requests not yet completed */
+	int		 a_errno;	/* first failure since last flush */
+	const char	*a_errmsg;
+	int		 a_uring;	/* using the ring, not the pool */
+	struct uufsd_dio *a_dio;	/* direct I/O bounce buffers */
+	int		 a_nbounce;	/* of those, how many we hold */
+#ifdef AIO_URING
+	struct aio_ring	 a_ring;
+#endif
+	pthread_mutex_t	 a_lock;
+	pthread_cond_t	 a_work;	/* pool: request queued */
+	pthread_cond_t	 a_done;	/* pool: request completed */
+	int		 a_qhead;	/* pool: queued, not yet picked up */
+	int		 a_qtail;
+	int		 a_shutdown;
+	int		 a_nthreads;
+	pthread_t	 a_threads[AIO_NTHREADS];
+};
+
+/*
+ * Give back a bounce buffer. Called with a_lock held.
+ */
+static void
+aio_unbounce(struct uufsd_aio *a, void *buf)
+{
+
+	if (a->a_dio != NULL) {
+		ufs_disk_dio_put(a->a_dio, buf);
+		a->a_nbounce--;
+	} else
+		free(buf);
+}
+
+/*
+ * Finish a request: check the transfer, undo any bounce buffer and put the
+ * slot back on the free list. Called with a_lock held in the pool case.
+ */
+static void
+aio_complete(struct uufsd_aio *a, int idx, ssize_t res, int err)
+{
+	struct aio_req *ar;
+	const char *msg;
+
+	ar = &a->a_req[idx];
+	msg = NULL;
+	if (res < 0)
+		msg = ar->ar_write ? "write error to block device" :
+		    "read error from block device";
+	else if (res == 0 && !ar->ar_write)
+		msg = "end of file from block device";
+	else if ((size_t)res != ar->ar_iov.iov_len)
+		msg = ar->ar_write ? "short write to block device" :
+		    "short read or read error from block device";
+	if (msg != NULL && a->a_errmsg == NULL) {
+		a->a_errmsg = msg;
+		a->a_errno = res < 0 ? err : 0;
+	}
+	if (!ar->ar_write) {
+		if (msg != NULL)
+			memset(ar->ar_data, 0, ar->ar_iov.iov_len);
+		else if (ar->ar_iov.iov_base != ar->ar_data)
+			memcpy(ar->ar_data, ar->ar_iov.iov_base,
+			    ar->ar_iov.iov_len);
+	}
+	if (ar->ar_iov.iov_base != ar->ar_data)
+		aio_unbounce(a, ar->ar_iov.iov_base);
+	ar->ar_next = a->a_free;
+	a->a_free = idx;
+	a->a_inflight--;
+}
+
+#ifdef AIO_URING
+
+static int
+aio_ring_setup(struct aio_ring *r)
+{
+	struct io_uring_params p;
+	void *sqes;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	fd = (int)syscall(__NR_io_uring_setup, AIO_DEPTH, &p);
+	if (fd < 0)
+		return (-1);
+	r->r_fd = fd;
+	r->r_sqmapsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->r_cqmapsz = p.cq_off.cqes + p.cq_entries *
+	    sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->r_cqmapsz > r->r_sqmapsz)
+			r->r_sqmapsz = r->r_cqmapsz;
+		r->r_cqmapsz = 0;
+	}
+	r->r_sqmap = mmap(NULL, r->r_sqmapsz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (r->r_sqmap == MAP_FAILED)
+		goto fail;
+	if (r->r_cqmapsz == 0) {
+		r->r_cqmap = r->r_sqmap;
+	} else {
+		r->r_cqmap = mmap(NULL, r->r_cqmapsz, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (r->r_cqmap == MAP_FAILED) {
+			munmap(r->r_sqmap, r->r_sqmapsz);
+			goto fail;
+		}
+	}
+	r->r_sqessz = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, r->r_sqessz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		munmap(r->r_sqmap, r->r_sqmapsz);
+		if (r->r_cqmapsz != 0)
+			munmap(r->r_cqmap, r->r_cqmapsz);
+		goto fail;
+	}
+	r->r_sqes = sqes;
+	r->r_sqhead = (unsigned *)((char *)r->r_sqmap + p.sq_off.head);
+	r->r_sqtail = (unsigned *)((char *)r->r_sqmap + p.sq_off.tail);
+	r->r_sqmask = *(unsigned *)((char *)r->r_sqmap + p.sq_off.ring_mask);
+	r->r_sqarray = (unsigned *)((char *)r->r_sqmap + p.sq_off.array);
+	r->r_cqhead = (unsigned *)((char *)r->r_cqmap + p.cq_off.head);
+	r->r_cqtail = (unsigned *)((char *)r->r_cqmap + p.cq_off.tail);
+	r->r_cqmask = *(unsigned *)((char *)r->r_cqmap + p.cq_off.ring_mask);
+	r->r_cqes = (struct io_uring_cqe *)((char *)r->r_cqmap +
+	    p.cq_off.cqes);
+	r->r_unsubmitted = 0;
+	return (0);
+fail:
+	close(fd);
+	return (-1);
+}
+
+static void
+aio_ring_teardown(struct aio_ring *r)
+{
+
+	munmap(r->r_sqes, r->r_sqessz);
+	if (r->r_cqmapsz != 0)
+		munmap(r->r_cqmap, r->r_cqmapsz);
+	munmap(r->r_sqmap, r->r_sqmapsz);
+	close(r->r_fd);
+}
+
+/*
+ * Hand everything queued to the kernel and wait for at least `wait'
+ * completions, then reap whatever has finished.
+ */
+static int
+aio_ring_enter(struct uufsd_aio *a, unsigned wait)
+{
+	struct aio_ring *r;
+	struct io_uring_cqe *cqe;
+	unsigned head;
+	int rv;
+
+	r = &a->a_ring;
+	while (r->r_unsubmitted > 0 || wait > 0) {
+		rv = (int)syscall(__NR_io_uring_enter, r->r_fd,
+		    r->r_unsubmitted, wait,
+		    wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (rv < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return (-1);
+		}
+		r->r_unsubmitted -= rv;
+		head = *r->r_cqhead;
+		while (head != __atomic_load_n(r->r_cqtail, __ATOMIC_ACQUIRE)) {
+			cqe = &r->r_cqes[head & r->r_cqmask];
+			aio_complete(a, (int)cqe->user_data, cqe->res,
+			    -cqe->res);
+			head++;
+			if (wait > 0)
+				wait--;
+		}
+		__atomic_store_n(r->r_cqhead, head, __ATOMIC_RELEASE);
+	}
+	return (0);
+}
+
+static int
+aio_ring_queue(struct uufsd_aio *a, int idx)
+{
+	struct aio_ring *r;
+	struct aio_req *ar;
+	struct io_uring_sqe *sqe;
+	unsigned tail, slot;
+
+	r = &a->a_ring;
+	ar = &a->a_req[idx];
+	tail = *r->r_sqtail;
+	slot = tail & r->r_sqmask;
+	sqe = &r->r_sqes[slot];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = ar->ar_write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = ar->ar_fd;
+	sqe->off = ar->ar_offset;
+	sqe->addr = (uintptr_t)&ar->ar_iov;
+	sqe->len = 1;
+	sqe->user_data = idx;
+	r->r_sqarray[slot] = slot;
+	__atomic_store_n(r->r_sqtail, tail + 1, __ATOMIC_RELEASE);
+	r->r_unsubmitted++;
+	/* Batch submissions; only enter once the ring is full. */
+	if (r->r_unsubmitted == AIO_DEPTH && aio_ring_enter(a, 0) == -1) {
+		/*
+		 * The kernel takes sqes in order and ours is the last one,
+		 * so it hasn't seen it; take it back out so that a later
+		 * enter doesn't submit a request its caller gave up on.
+		 */
+		__atomic_store_n(r->r_sqtail, tail, __ATOMIC_RELEASE);
+		r->r_unsubmitted--;
+		return (-1);
+	}
+	return (0);
+}
+
+#endif	/* AIO_URING */
+
+static void *
+aio_worker(void *arg)
+{
+	struct uufsd_aio *a;
+	struct aio_req *ar;
+	ssize_t res;
+	int idx, err;
+
+	a = arg;
+	pthread_mutex_lock(&a->a_lock);
+	for (;;) {
+		while (a->a_qhead == -1 && !a->a_shutdown)
+			pthread_cond_wait(&a->a_work, &a->a_lock);
+		if (a->a_qhead == -1)
+			break;
+		idx = a->a_qhead;
+		ar = &a->a_req[idx];
+		a->a_qhead = ar->ar_next;
+		if (a->a_qhead == -1)
+			a->a_qtail = -1;
+		pthread_mutex_unlock(&a->a_lock);
+		if (ar->ar_write)
+			res = pwrite(ar->ar_fd, ar->ar_iov.iov_base,
+			    ar->ar_iov.iov_len, ar->ar_offset);
+		else
+			res = pread(ar->ar_fd, ar->ar_iov.iov_base,
+			    ar->ar_iov.iov_len, ar->ar_offset);
+		err = errno;
+		pthread_mutex_lock(&a->a_lock);
+		aio_complete(a, idx, res, err);
+		pthread_cond_broadcast(&a->a_done);
+	}
+	pthread_mutex_unlock(&a->a_lock);
+	return (NULL);
+}
+
+static struct uufsd_aio *
+aio_get(struct uufsd *disk)
+{
+	struct uufsd_aio *a;
+	int i;
+
+	if (disk->d_aio != NULL)
+		return (disk->d_aio);
+	a = calloc(1, sizeof(*a));
+	if (a == NULL) {
+		ERROR(disk, "failed to allocate asynchronous I/O state");
+		return (NULL);
+	}
+	for (i = 0; i < AIO_DEPTH; i++)
+		a->a_req[i].ar_next = i + 1 < AIO_DEPTH ? i + 1 : -1;
+	a->a_free = 0;
+	a->a_qhead = a->a_qtail = -1;
+	a->a_dio = disk->d_dio;
+	pthread_mutex_init(&a->a_lock, NULL);
+	pthread_cond_init(&a->a_work, NULL);
+	pthread_cond_init(&a->a_done, NULL);
+#ifdef AIO_URING
+	if (aio_ring_setup(&a->a_ring) == 0)
+		a->a_uring = 1;
+#endif
+	if (!a->a_uring) {
+		for (i = 0; i < AIO_NTHREADS; i++) {
+			if (pthread_create(&a->a_threads[i], NULL,
+			    aio_worker, a) != 0)
+				break;
+			a->a_nthreads++;
+		}
+		if (a->a_nthreads == 0) {
+			ERROR(disk, "failed to start I/O threads");
+			pthread_cond_destroy(&a->a_done);
+			pthread_cond_destroy(&a->a_work);
+			pthread_mutex_destroy(&a->a_lock);
+			free(a);
+			return (NULL);
+		}
+	}
+	disk->d_aio = a;
+	return (a);
+}
+
+/*
+ * A direct I/O bounce buffer. The requests holding them only give them
+ * back when they are reaped, so to leave some for bread() and the like at
+ * most half are held here at a time.
+ */
+static void *
+aio_bounce(struct uufsd_aio *a)
+{
+
+	pthread_mutex_lock(&a->a_lock);
+	while (a->a_nbounce >= UFS_DIO_NBUF / 2) {
+#ifdef AIO_URING
+		if (a->a_uring) {
+			if (aio_ring_enter(a, 1) == -1) {
+				pthread_mutex_unlock(&a->a_lock);
+				return (NULL);
+			}
+			continue;
+		}
+#endif
+		pthread_cond_wait(&a->a_done, &a->a_lock);
+	}
+	a->a_nbounce++;
+	pthread_mutex_unlock(&a->a_lock);
+	return (ufs_disk_dio_get(a->a_dio, 1));
+}
+
+static int
+aio_queue(struct uufsd *disk, off_t offset, void *data, size_t size,
+    int write)
+{
+	struct uufsd_aio *a;
+	struct aio_req *ar;
+	void *p2;
+	int idx;
+
+	if ((a = aio_get(disk)) == NULL)
+		return (-1);
+	p2 = data;
+	if (a->a_dio != NULL) {
+		if (!ufs_disk_dio_aligned(disk, data, 0, 0) &&
+		    (p2 = aio_bounce(a)) == NULL) {
+			ERROR(disk, "failed to submit I/O");
+			return (-1);
+		}
+	}
+#ifndef __APPLE__
+	/*
+	 * XXX: same alignment bounce as bread()/bwrite().
+	 */
+	else if (((intptr_t)data) & 0x3f) {
+		p2 = malloc(size);
+		if (p2 == NULL) {
+			ERROR(disk, "allocate bounce buffer");
+			return (-1);
+		}
+	}
+#endif
+	if (p2 != data && write)
+		memcpy(p2, data, size);
+	pthread_mutex_lock(&a->a_lock);
+	while (a->a_free == -1) {
+#ifdef AIO_URING
+		if (a->a_uring) {
+			if (aio_ring_enter(a, 1) == -1) {
+				if (p2 != data)
+					aio_unbounce(a, p2);
+				pthread_mutex_unlock(&a->a_lock);
+				ERROR(disk, "failed to submit I/O");
+				return (-1);
+			}
+			continue;
+		}
+#endif
+		pthread_cond_wait(&a->a_done, &a->a_lock);
+	}
+	idx = a->a_free;
+	ar = &a->a_req[idx];
+	a->a_free = ar->ar_next;
+	ar->ar_data = data;
+	ar->ar_iov.iov_base = p2;
+	ar->ar_iov.iov_len = size;
+	ar->ar_offset = offset;
+	ar->ar_fd = ufs_disk_dio_fd(disk);
+	ar->ar_write = write;
+	ar->ar_next = -1;
+	a->a_inflight++;
+#ifdef AIO_URING
+	if (a->a_uring) {
+		if (aio_ring_queue(a, idx) == -1) {
+			/* Never submitted: give back the slot and buffer. */
+			if (p2 != data)
+				aio_unbounce(a, p2);
+			ar->ar_next = a->a_free;
+			a->a_free = idx;
+			a->a_inflight--;
+			pthread_mutex_unlock(&a->a_lock);
+			ERROR(disk, "failed to submit I/O");
+			return (-1);
+		}
+		pthread_mutex_unlock(&a->a_lock);
+		return (0);
+	}
+#endif
+	if (a->a_qtail == -1)
+		a->a_qhead = idx;
+	else
+		a->a_req[a->a_qtail].ar_next = idx;
+	a->a_qtail = idx;
+	pthread_cond_signal(&a->a_work);
+	pthread_mutex_unlock(&a->a_lock);
+	return (0);
+}
+
+static int
+aio_submit(struct uufsd *disk, ufs2_daddr_t blockno, void *data, size_t size,
+    int write)
+{
+	off_t offset;
+	size_t len;
+	ssize_t cnt;
+
+	offset = blockno * disk->d_bsize;
+	if (disk->d_dio == NULL)
+		return (aio_queue(disk, offset, data, size, write));
+	/*
+	 * Direct I/O. A transfer that only covers part of the blocks at its
+	 * ends needs those read around it, which is done here and now; the
+	 * rest is queued, a bounce buffer's worth at a time if the buffer
+	 * isn't aligned.
+	 */
+	if (!ufs_disk_dio_aligned(disk, NULL, size, offset)) {
+		cnt = ufs_disk_dio(disk, data, size, offset, write);
+		if (cnt != -1 && (size_t)cnt == size)
+			return (0);
+		if (!write)
+			memset(data, 0, size);
+		ERROR(disk, write ? "write error to block device" :
+		    "read error from block device");
+		return (-1);
+	}
+	for (; size > 0; size -= len) {
+		len = size;
+		if (!ufs_disk_dio_aligned(disk, data, 0, 0))
+			len = MIN(size, UFS_DIO_BUFSIZE);
+		if (aio_queue(disk, offset, data, len, write) == -1)
+			return (-1);
+		data = (char *)data + len;
+		offset += len;
+	}
+	return (0);
+}
+
+int
+bread_async(struct uufsd *disk, ufs2_daddr_t blockno, void *data, size_t size)
+{
+
+	ERROR(disk, NULL);
+	return (aio_submit(disk, blockno, data, size, 0));
+}
+
+int
+bwrite_async(struct uufsd *disk, ufs2_daddr_t blockno, const void *data,
+    size_t size)
+{
+
+	ERROR(disk, NULL);
+	if (ufs_disk_write(disk) == -1) {
+		ERROR(disk, "failed to open disk for writing");
+		return (-1);
+	}
+	return (aio_submit(disk, blockno, (void *)(uintptr_t)data, size, 1));
+}
+
+int
+ufs_disk_flush(struct uufsd *disk)
+{
+	struct uufsd_aio *a;
+	const char *msg;
+	int err;
+
+	ERROR(disk, NULL);
+	if ((a = disk->d_aio) == NULL)
+		return (0);
+	pthread_mutex_lock(&a->a_lock);
+#ifdef AIO_URING
+	if (a->a_uring && a->a_inflight > 0 &&
+	    aio_ring_enter(a, a->a_inflight) == -1) {
+		pthread_mutex_unlock(&a->a_lock);
+		ERROR(disk, "failed to complete I/O");
+		return (-1);
+	}
+#endif
+	while (a->a_inflight > 0)
+		pthread_cond_wait(&a->a_done, &a->a_lock);
+	msg = a->a_errmsg;
+	err = a->a_errno;
+	a->a_errmsg = NULL;
+	a->a_errno = 0;
+	pthread_mutex_unlock(&a->a_lock);
+	if (msg != NULL) {
+		errno = err;
+		ERROR(disk, msg);
+		return (-1);
+	}
+	return (0);
+}
+
+void
+ufs_disk_aio_release(struct uufsd *disk)
+{
+	struct uufsd_aio *a;
+	int i;
+
+	if ((a = disk->d_aio) == NULL)
+		return;
+	(void)ufs_disk_flush(disk);
+	pthread_mutex_lock(&a->a_lock);
+	a->a_shutdown = 1;
+	pthread_cond_broadcast(&a->a_work);
+	pthread_mutex_unlock(&a->a_lock);
+	for (i = 0; i < a->a_nthreads; i++)
+		pthread_join(a->a_threads[i], NULL);
+#ifdef AIO_URING
+	if (a->a_uring)
+		aio_ring_teardown(&a->a_ring);
+#endif
+	pthread_cond_destroy(&a->a_done);
+	pthread_cond_destroy(&a->a_work);
+	pthread_mutex_destroy(&a->a_lock);
+	free(a);
+	disk->d_aio = NULL;
+}
@@ -0,0 +1,321 @@
+//
+//  aio_test.c
+//  libufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Checks bwrite_async() and bread_async() against a copy kept in memory:
+// batches of writes and then reads at random sectors, lengths and buffer
+// alignments, more of them than there are request slots, both through
+// the buffer cache and with direct I/O where the file system under the
+// image allows it. With -b it times them against bwrite() and bread()
+// over the rest of the image, sequentially and with random 4k reads.
+//
+// The image has to be made by newfs first, since direct I/O is only set
+// up on a disk with a superblock. Everything in it past the cylinder
+// group summary is overwritten.
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#include "bench.h"
+
+#define	CHECKSIZE	(16 * 1024 * 1024)
+#define	MAXREQ		200		/* requests per batch */
+#define	MAXIO		(64 * 1024)
+#define	MAXALIGN	64
+
+#define	BLKSIZE		(64 * 1024)	/* sequential passes */
+#define	RANDSIZE	4096		/* random reads */
+#define	NRAND		20000
+#define	WINDOW		64		/* async per flush */
+
+struct req {
+	off_t	r_off;
+	size_t	r_len;
+	char	*r_buf;
+};
+
+static off_t base;		/* first byte we may write */
+static off_t end;		/* end of the file system */
+static char *shadow;		/* CHECKSIZE bytes from base */
+
+static int
+disk_open(struct uufsd *disk, const char *path, int direct)
+{
+
+	memset(disk, 0, sizeof(*disk));
+	if (direct)
+		return (ufs_disk_fillout_direct(disk, path));
+	return (ufs_disk_fillout(disk, path));
+}
+
+static const char *
+mode(int direct)
+{
+
+	return (direct ? "direct" : "buffered");
+}
+
+/*
+ * A random request inside slot i of n, so the requests in a batch don't
+ * overlap and the order they complete in doesn't matter. It starts on a
+ * sector, since that's what a block number addresses, but only half are
+ * a whole number of sectors long, and the buffer is misaligned by up to
+ * MAXALIGN bytes.
+ */
+static void
+randreq(struct req *r, char *mem, int i, int n)
+{
+	off_t lo, hi;
+
+	lo = (off_t)CHECKSIZE / n * i / DEV_BSIZE * DEV_BSIZE;
+	hi = (off_t)CHECKSIZE / n * (i + 1) / DEV_BSIZE * DEV_BSIZE;
+	r->r_len = 1 + bench_uniform(MIN(MAXIO, hi - lo));
+	if (bench_uniform(2) == 0)
+		r->r_len = roundup(r->r_len, DEV_BSIZE);
+	r->r_off = lo +
+	    bench_uniform((hi - lo - r->r_len) / DEV_BSIZE + 1) * DEV_BSIZE;
+	r->r_buf = mem + bench_uniform(MAXALIGN);
+}
+
+static void
+check(const char *path, int direct, int rounds)
+{
+	static struct req reqs[MAXREQ];
+	struct uufsd disk;
+	struct req *r;
+	char *mem;
+	int i, n, round;
+
+	if (disk_open(&disk, path, direct) == -1) {
+		printf("%s: %s, not checked\n", mode(direct), disk.d_error);
+		return;
+	}
+	if (ufs_disk_write(&disk) == -1)
+		errx(2, "%s: %s", path, disk.d_error);
+	mem = malloc((size_t)MAXREQ * (MAXIO + MAXALIGN));
+	if (mem == NULL)
+		err(2, "malloc");
+	for (round = 0; round < rounds; round++) {
+		n = 1 + (int)bench_uniform(MAXREQ);
+		for (i = 0; i < n; i++) {
+			r = &reqs[i];
+			randreq(r, mem + (size_t)i * (MAXIO + MAXALIGN), i, n);
+			bench_fill(r->r_buf, r->r_len);
+			memcpy(shadow + r->r_off, r->r_buf, r->r_len);
+			if (bwrite_async(&disk, (base + r->r_off) /
+			    disk.d_bsize, r->r_buf, r->r_len) == -1)
+				bench_fail("bwrite_async: %s", disk.d_error);
+		}
+		if (ufs_disk_flush(&disk) == -1)
+			bench_fail("flush after writes: %s", disk.d_error);
+
+		/* Read back somewhere else, into other buffers. */
+		n = 1 + (int)bench_uniform(MAXREQ);
+		for (i = 0; i < n; i++) {
+			r = &reqs[i];
+			randreq(r, mem + (size_t)i * (MAXIO + MAXALIGN), i, n);
+			memset(r->r_buf, 0xa5, r->r_len);
+			if (bread_async(&disk, (base + r->r_off) /
+			    disk.d_bsize, r->r_buf, r->r_len) == -1)
+				bench_fail("bread_async: %s", disk.d_error);
+		}
+		if (ufs_disk_flush(&disk) == -1)
+			bench_fail("flush after reads: %s", disk.d_error);
+		for (i = 0; i < n; i++) {
+			r = &reqs[i];
+			if (memcmp(r->r_buf, shadow + r->r_off, r->r_len) != 0)
+				bench_fail("%s: read %zu at %jd: wrong data",
+				    mode(direct), r->r_len,
+				    (intmax_t)(base + r->r_off));
+		}
+	}
+	printf("%s: %d batches checked\n", mode(direct), rounds);
+	free(mem);
+	ufs_disk_close(&disk);
+}
+
+/* Start a read pass cold, as far as the kernel lets us. */
+static void
+dropcache(struct uufsd *disk)
+{
+
+	fsync(disk->d_fd);
+#ifdef POSIX_FADV_DONTNEED
+	posix_fadvise(disk->d_fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+/* Do or queue transfer i, flushing after every WINDOW queued. */
+static void
+xfer(struct uufsd *disk, long i, off_t off, void *buf, size_t len,
+    int write, int async)
+{
+	ufs2_daddr_t blkno;
+	ssize_t cnt;
+
+	blkno = off / disk->d_bsize;
+	if (async && write)
+		cnt = bwrite_async(disk, blkno, buf, len);
+	else if (async)
+		cnt = bread_async(disk, blkno, buf, len);
+	else if (write)
+		cnt = bwrite(disk, blkno, buf, len);
+	else
+		cnt = bread(disk, blkno, buf, len);
+	if (cnt == -1)
+		errx(2, "%s", disk->d_error);
+	if (async && i % WINDOW == WINDOW - 1 && ufs_disk_flush(disk) == -1)
+		errx(2, "%s", disk->d_error);
+}
+
+/*
+ * Sequential passes from base to the end of the file system in BLKSIZE
+ * transfers, then NRAND random RANDSIZE reads, each done with the
+ * synchronous calls and then the asynchronous ones.
+ */
+static void
+bench(const char *path, int direct)
+{
+	struct uufsd disk;
+	char *mem, name[64];
+	off_t *offs;
+	double start;
+	long i, n;
+	int async, write;
+
+	if (disk_open(&disk, path, direct) == -1) {
+		printf("%s: %s, not timed\n", mode(direct), disk.d_error);
+		return;
+	}
+	if (ufs_disk_write(&disk) == -1)
+		errx(2, "%s: %s", path, disk.d_error);
+	if (posix_memalign((void **)&mem, MAXALIGN, WINDOW * BLKSIZE) != 0)
+		err(2, "posix_memalign");
+	bench_fill(mem, WINDOW * BLKSIZE);
+	n = (end - base) / BLKSIZE;
+	for (write = 1; write >= 0; write--) {
+		for (async = 0; async <= 1; async++) {
+			if (!write)
+				dropcache(&disk);
+			start = bench_now();
+			for (i = 0; i < n; i++)
+				xfer(&disk, i, base + i * BLKSIZE,
+				    mem + (i % WINDOW) * BLKSIZE, BLKSIZE,
+				    write, async);
+			if (ufs_disk_flush(&disk) == -1)
+				errx(2, "%s", disk.d_error);
+			if (write)
+				fsync(disk.d_fd);
+			snprintf(name, sizeof(name), "%s %s %s %dk",
+			    mode(direct), write ? "write" : "read",
+			    async ? "async" : "sync", BLKSIZE / 1024);
+			bench_report(name, (bench_now() - start) / n, BLKSIZE);
+		}
+	}
+
+	if ((offs = malloc(NRAND * sizeof(*offs))) == NULL)
+		err(2, "malloc");
+	for (i = 0; i < NRAND; i++)
+		offs[i] = base +
+		    (off_t)bench_uniform((end - base) / RANDSIZE) * RANDSIZE;
+	for (async = 0; async <= 1; async++) {
+		dropcache(&disk);
+		start = bench_now();
+		for (i = 0; i < NRAND; i++)
+			xfer(&disk, i, offs[i], mem + (i % WINDOW) * RANDSIZE,
+			    RANDSIZE, 0, async);
+		if (ufs_disk_flush(&disk) == -1)
+			errx(2, "%s", disk.d_error);
+		snprintf(name, sizeof(name), "%s random read %s %dk",
+		    mode(direct), async ? "async" : "sync", RANDSIZE / 1024);
+		bench_report(name, (bench_now() - start) / NRAND, RANDSIZE);
+	}
+	free(offs);
+	free(mem);
+	ufs_disk_close(&disk);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: aio_test [-b] [-n batches] [-s seed] image\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct uufsd disk;
+	struct fs *fs;
+	const char *path;
+	char *seed;
+	int bflag, ch, n;
+
+	bflag = 0;
+	n = 20;
+	seed = NULL;
+	while ((ch = getopt(argc, argv, "bn:s:")) != -1)
+		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'n':
+			n = (int)strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = optarg;
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	path = argv[0];
+	bench_seed(seed);
+
+	/* Keep off the superblock and the summary sbread() reads. */
+	if (disk_open(&disk, path, 0) == -1)
+		errx(2, "%s: %s", path, disk.d_error);
+	if (ufs_disk_write(&disk) == -1)
+		errx(2, "%s: %s", path, disk.d_error);
+	fs = &disk.d_fs;
+	base = roundup((off_t)fs->fs_csaddr * fs->fs_fsize + fs->fs_cssize,
+	    1024 * 1024);
+	end = (off_t)fs->fs_size * fs->fs_fsize;
+	if (end - base < CHECKSIZE)
+		errx(2, "%s: too small, need %d bytes past %jd", path,
+		    CHECKSIZE, (intmax_t)base);
+	/* The check starts from zeroes. */
+	if ((shadow = calloc(1, CHECKSIZE)) == NULL)
+		err(2, "calloc");
+	if (bwrite(&disk, base / disk.d_bsize, shadow, CHECKSIZE) == -1)
+		errx(2, "%s: %s", path, disk.d_error);
+	ufs_disk_close(&disk);
+
+	check(path, 0, n);
+	check(path, 1, n);
+	free(shadow);
+	if (bflag) {
+		bench(path, 0);
+		bench(path, 1);
+	}
+	return (bench_done());
+}
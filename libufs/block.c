@@ -49,16 +49,38 @@ __FBSDID("$FreeBSD$");
 #include <string.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#endif
+
 #include <libufs.h>
 
+/*
+ * The reading part of bread(), which leaves the disk alone: a failure is
+ * reported in *errmsg instead of d_error and the inode block cache is not
+ * looked at. Several threads may call this on the same disk at once, see
+ * cursor.c.
+ */
 ssize_t
-bread(struct uufsd *disk, ufs2_daddr_t blockno, void *data, size_t size)
+ufs_disk_pread(struct uufsd *disk, ufs2_daddr_t blockno, void *data,
+    size_t size, const char **errmsg)
 {
 	void *p2;
-	ssize_t cnt, offset;
-
-	ERROR(disk, NULL);
+	off_t offset;
+	ssize_t cnt;
 
+	*errmsg = NULL;
+	if (disk->d_map != NULL) {
+		if ((p2 = ufs_disk_mapped(disk, blockno, size)) == NULL) {
+			*errmsg = "block outside of mapped disk";
+			memset(data, 0, size);
+			return (-1);
+		}
+		memcpy(data, p2, size);
+		return (size);
+	}
 	p2 = data;
 	/*
 	 * XXX: various disk controllers require alignment of our buffer
@@ -67,26 +89,30 @@ bread(struct uufsd *disk, ufs2_daddr_t blockno, void *data, size_t size)
 	 * XXX: this can be removed if/when the kernel is fixed
 	 */
 #ifndef __APPLE__
-	if (((intptr_t)data) & 0x3f) {
+	if (disk->d_dio == NULL && ((intptr_t)data) & 0x3f) {
 		p2 = malloc(size);
 		if (p2 == NULL) {
-			ERROR(disk, "allocate bounce buffer");
+			*errmsg = "allocate bounce buffer";
 			goto fail;
 		}
 	}
 #endif
-    offset = (blockno * disk->d_bsize);
-	cnt = pread(disk->d_fd, p2, size, offset);
+	offset = (off_t)blockno * disk->d_bsize;
+	/* Direct I/O bounces through its own buffers. */
+	if (disk->d_dio != NULL)
+		cnt = ufs_disk_dio(disk, p2, size, offset, 0);
+	else
+		cnt = pread(disk->d_fd, p2, size, offset);
 	if (cnt == -1) {
-		ERROR(disk, "read error from block device");
+		*errmsg = "read error from block device";
 		goto fail;
 	}
 	if (cnt == 0) {
-		ERROR(disk, "end of file from block device");
+		*errmsg = "end of file from block device";
 		goto fail;
 	}
 	if ((size_t)cnt != size) {
-		ERROR(disk, "short read or read error from block device");
+		*errmsg = "short read or read error from block device";
 		goto fail;
 	}
 	if (p2 != data) {
@@ -101,6 +127,23 @@ fail:	memset(data, 0, size);
 	return (-1);
 }
 
+ssize_t
+bread(struct uufsd *disk, ufs2_daddr_t blockno, void *data, size_t size)
+{
+	const char *errmsg;
+	ssize_t cnt;
+
+	ERROR(disk, NULL);
+
+	cnt = ufs_disk_pread(disk, blockno, data, size, &errmsg);
+	if (cnt == -1) {
+		ERROR(disk, errmsg);
+		return (-1);
+	}
+	ufs_disk_icache_sync(disk, blockno, data, size, 0);
+	return (cnt);
+}
+
 ssize_t
 bwrite(struct uufsd *disk, ufs2_daddr_t blockno, const void *data, size_t size)
 {
@@ -115,6 +158,7 @@ bwrite(struct uufsd *disk, ufs2_daddr_t blockno, const void *data, size_t size)
 		ERROR(disk, "failed to open disk for writing");
 		return (-1);
 	}
+	ufs_disk_icache_sync(disk, blockno, (void *)(uintptr_t)data, size, 1);
 #ifndef __APPLE__
 	/*
 	 * XXX: various disk controllers require alignment of our buffer
@@ -122,7 +166,7 @@ bwrite(struct uufsd *disk, ufs2_daddr_t blockno, const void *data, size_t size)
 	 * XXX: Bounce the buffer if not 64 byte aligned.
 	 * XXX: this can be removed if/when the kernel is fixed
 	 */
-	if (((intptr_t)data) & 0x3f) {
+	if (disk->d_dio == NULL && ((intptr_t)data) & 0x3f) {
 		p2 = malloc(size);
 		if (p2 == NULL) {
 			ERROR(disk, "allocate bounce buffer");
@@ -133,7 +177,11 @@ bwrite(struct uufsd *disk, ufs2_daddr_t blockno, const void *data, size_t size)
 	}
 #endif
     offset = (blockno * disk->d_bsize);
-	cnt = pwrite(disk->d_fd, data, size, offset);
+	if (disk->d_dio != NULL)
+		cnt = ufs_disk_dio(disk, (void *)(uintptr_t)data, size, offset,
+		    1);
+	else
+		cnt = pwrite(disk->d_fd, data, size, offset);
 	if (p2 != NULL)
 		free(p2);
 	if (cnt == -1) {
@@ -162,36 +210,105 @@ berase_helper(struct uufsd *disk, ufs2_daddr_t blockno, ufs2_daddr_t size)
 
 #else
 
+#define	ZEROSIZE	(1024 * 1024)
+
+/*
+ * Only ever written from. Being in bss it costs nothing until it is, and
+ * then the pages are all the same zero page.
+ */
+static char zerobuf[ZEROSIZE] __aligned(64);
+
+/*
+ * Have the kernel throw away [offset, offset + size) instead of writing
+ * zeros to it: discard it on a disk, like DIOCGDELETE, or punch it out of
+ * an image file, which then reads back as zeros. Returns -1 if that isn't
+ * possible here.
+ */
+static int
+berase_fast(struct uufsd *disk, off_t offset, off_t size)
+{
+	struct stat st;
+	off_t len;
+
+	if (fstat(disk->d_fd, &st) == -1)
+		return (-1);
+	if (S_ISREG(st.st_mode)) {
+		len = MIN(size, st.st_size - offset);
+		if (len > 0) {
+#ifdef __linux__
+			if (fallocate(disk->d_fd, FALLOC_FL_PUNCH_HOLE |
+			    FALLOC_FL_KEEP_SIZE, offset, len) == -1 &&
+			    fallocate(disk->d_fd, FALLOC_FL_ZERO_RANGE |
+			    FALLOC_FL_KEEP_SIZE, offset, len) == -1)
+				return (-1);
+#elif defined(F_PUNCHHOLE)
+			struct fpunchhole ph;
+
+			memset(&ph, 0, sizeof(ph));
+			ph.fp_offset = offset;
+			ph.fp_length = len;
+			if (fcntl(disk->d_fd, F_PUNCHHOLE, &ph) == -1)
+				return (-1);
+#else
+			return (-1);
+#endif
+		}
+		/* Writing the zeros would have grown the file. */
+		if (offset + size > st.st_size &&
+		    ftruncate(disk->d_fd, offset + size) == -1)
+			return (-1);
+		return (0);
+	}
+#ifdef __linux__
+	if (S_ISBLK(st.st_mode)) {
+		uint64_t range[2];
+
+		range[0] = offset;
+		range[1] = size;
+		if (ioctl(disk->d_fd, BLKDISCARD, range) == 0)
+			return (0);
+		return (ioctl(disk->d_fd, BLKZEROOUT, range));
+	}
+#elif defined(DKIOCUNMAP)
+	if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) {
+		dk_extent_t extent;
+		dk_unmap_t unmap;
+
+		memset(&unmap, 0, sizeof(unmap));
+		extent.offset = offset;
+		extent.length = size;
+		unmap.extents = &extent;
+		unmap.extentsCount = 1;
+		return (ioctl(disk->d_fd, DKIOCUNMAP, &unmap));
+	}
+#endif
+	return (-1);
+}
+
 static int
 berase_helper(struct uufsd *disk, ufs2_daddr_t blockno, ufs2_daddr_t size)
 {
-	char *zero_chunk;
-	off_t offset, zero_chunk_size, pwrite_size;
-	int rv;
+	off_t offset;
+	ssize_t cnt;
 
-    rv = 0;
 	offset = blockno * disk->d_bsize;
-	zero_chunk_size = 65536 * disk->d_bsize;
-	zero_chunk = calloc(1, zero_chunk_size);
-	if (zero_chunk == NULL) {
-		ERROR(disk, "failed to allocate memory");
-		return (-1);
-	}
-	while (size > 0) { 
-		pwrite_size = size;
-		if (pwrite_size > zero_chunk_size)
-			pwrite_size = zero_chunk_size;
-		rv = (int)pwrite(disk->d_fd, zero_chunk, pwrite_size, offset);
-		if (rv == -1) {
+	if (berase_fast(disk, offset, size) == 0)
+		return (0);
+	while (size > 0) {
+		if (disk->d_dio != NULL)
+			cnt = ufs_disk_dio(disk, zerobuf, MIN(size, ZEROSIZE),
+			    offset, 1);
+		else
+			cnt = pwrite(disk->d_fd, zerobuf, MIN(size, ZEROSIZE),
+			    offset);
+		if (cnt == -1) {
 			ERROR(disk, "failed writing to disk");
-			break;
+			return (-1);
 		}
-		size -= rv;
-		offset += rv;
-		rv = 0;
+		size -= cnt;
+		offset += cnt;
 	}
-	free(zero_chunk);
-	return (rv);
+	return (0);
 }
 
 #endif
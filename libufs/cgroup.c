@@ -32,6 +32,7 @@ __FBSDID("$FreeBSD$");
 
 #include <sys/param.h>
 #include <sys/mount.h>
+#include <sys/queue.h>
 #include <freebsd/disklabel.h>
 #include <freebsd/compat.h>
 #include <sys/stat.h>
@@ -51,31 +52,501 @@ __FBSDID("$FreeBSD$");
 
 #include <libufs.h>
 
-ufs2_daddr_t
-cgballoc(struct uufsd *disk)
+/*
+ * Short read/write error messages from cgget()/cgput(). Per thread, so
+ * that cgget() stays usable from several threads at once.
+ */
+static __thread const char *failmsg;
+
+/*
+ * Cylinder group cache. By default the only cylinder group in memory is
+ * d_cg, read by cgread1() and written straight back by cgwrite1(). After
+ * ufs_disk_cgcache() up to n groups are kept, looked up by number:
+ * cgread1() copies the cached group into d_cg and cgwrite1() copies it
+ * back and marks it dirty, while cgbfree() and the _any allocators work on
+ * the cached copy directly. Check-hashes are only computed when a dirty
+ * group is written, which happens when it is evicted and, for all of
+ * them in cg order as one batch, in ufs_disk_cgflush() and
+ * ufs_disk_close(). cgget() and cgput() go around the cache.
+ */
+struct cgcent {
+	TAILQ_ENTRY(cgcent) ce_lru;	/* most recently used first */
+	int		ce_cg;		/* -1 if empty */
+	int		ce_dirty;
+	struct cg	*ce_cgp;
+};
+
+struct uufsd_cgcache {
+	int		cc_size;
+	int		cc_ndirty;
+	struct cgcent	**cc_bycg;	/* fs_ncg entries */
+	TAILQ_HEAD(cgcent_lru, cgcent) cc_lru;
+	struct cgcent	*cc_ents;
+	caddr_t		cc_mem;
+};
+
+static int cgread_error(struct uufsd *);
+
+/*
+ * Write a cached group back, check-hash first.
+ */
+static int
+cgcache_writeback(struct uufsd *disk, struct cgcent *ce, int async)
 {
-	u_int8_t *blksfree;
+	struct fs *fs;
 	struct cg *cgp;
+	ufs2_daddr_t blkno;
+
+	fs = &disk->d_fs;
+	cgp = ce->ce_cgp;
+	if ((fs->fs_metackhash & CK_CYLGRP) != 0) {
+		cgp->cg_ckhash = 0;
+		cgp->cg_ckhash =
+		    calculate_crc32c(~0L, (void *)cgp, fs->fs_cgsize);
+	}
+	blkno = fsbtodb(fs, cgtod(fs, ce->ce_cg));
+	if (async)
+		return (bwrite_async(disk, blkno, cgp, fs->fs_cgsize));
+	if (bwrite(disk, blkno, cgp, fs->fs_cgsize) <= 0)
+		return (-1);
+	return (0);
+}
+
+/*
+ * The cached copy of group c, read in if need be.
+ */
+static struct cg *
+cgcache_get(struct uufsd *disk, int c)
+{
+	struct uufsd_cgcache *cc;
+	struct cgcent *ce;
+
+	cc = disk->d_cgcache;
+	if ((ce = cc->cc_bycg[c]) == NULL) {
+		ce = TAILQ_LAST(&cc->cc_lru, cgcent_lru);
+		if (ce->ce_cg != -1) {
+			if (ce->ce_dirty) {
+				if (cgcache_writeback(disk, ce, 0) == -1)
+					return (NULL);
+				ce->ce_dirty = 0;
+				cc->cc_ndirty--;
+			}
+			cc->cc_bycg[ce->ce_cg] = NULL;
+			ce->ce_cg = -1;
+		}
+		if (cgget(disk->d_fd, &disk->d_fs, c, ce->ce_cgp) != 0) {
+			cgread_error(disk);
+			return (NULL);
+		}
+		ce->ce_cg = c;
+		cc->cc_bycg[c] = ce;
+	}
+	if (TAILQ_FIRST(&cc->cc_lru) != ce) {
+		TAILQ_REMOVE(&cc->cc_lru, ce, ce_lru);
+		TAILQ_INSERT_HEAD(&cc->cc_lru, ce, ce_lru);
+	}
+	return (ce->ce_cgp);
+}
+
+static void
+cgcache_dirty(struct uufsd *disk, int c)
+{
+	struct cgcent *ce;
+
+	ce = disk->d_cgcache->cc_bycg[c];
+	if (!ce->ce_dirty) {
+		ce->ce_dirty = 1;
+		disk->d_cgcache->cc_ndirty++;
+	}
+}
+
+int
+ufs_disk_cgflush(struct uufsd *disk)
+{
+	struct uufsd_cgcache *cc;
+	struct cgcent *ce;
+	int c;
+
+	ERROR(disk, NULL);
+
+	if ((cc = disk->d_cgcache) == NULL || cc->cc_ndirty == 0)
+		return (0);
+	for (c = 0; c < disk->d_fs.fs_ncg; c++) {
+		if ((ce = cc->cc_bycg[c]) == NULL || !ce->ce_dirty)
+			continue;
+		if (cgcache_writeback(disk, ce, 1) == -1) {
+			(void)ufs_disk_flush(disk);
+			return (-1);
+		}
+	}
+	if (ufs_disk_flush(disk) == -1)
+		return (-1);
+	TAILQ_FOREACH(ce, &cc->cc_lru, ce_lru)
+		ce->ce_dirty = 0;
+	cc->cc_ndirty = 0;
+	return (0);
+}
+
+void
+ufs_disk_cgcache_release(struct uufsd *disk)
+{
+	struct uufsd_cgcache *cc;
+
+	if ((cc = disk->d_cgcache) == NULL)
+		return;
+	free(cc->cc_mem);
+	free(cc->cc_ents);
+	free(cc->cc_bycg);
+	free(cc);
+	disk->d_cgcache = NULL;
+}
+
+int
+ufs_disk_cgcache(struct uufsd *disk, int ncg)
+{
+	struct uufsd_cgcache *cc;
+	struct cgcent *ce;
 	struct fs *fs;
-	long bno;
+	int i;
+
+	ERROR(disk, NULL);
 
 	fs = &disk->d_fs;
-	cgp = &disk->d_cg;
-	blksfree = cg_blksfree(cgp);
-	for (bno = 0; bno < fs->fs_fpg / fs->fs_frag; bno++)
-		if (ffs_isblock(fs, blksfree, (ufs1_daddr_t)bno))
-			goto gotit;
+	if (disk->d_ufs == 0) {
+		errno = EINVAL;
+		ERROR(disk, "no superblock read");
+		return (-1);
+	}
+	if (ufs_disk_cgflush(disk) == -1)
+		return (-1);
+	ufs_disk_cgcache_release(disk);
+	if (ncg <= 0)
+		return (0);
+	ncg = MIN(ncg, fs->fs_ncg);
+
+	if ((cc = calloc(1, sizeof(*cc))) == NULL ||
+	    (cc->cc_bycg = calloc(fs->fs_ncg, sizeof(*cc->cc_bycg))) == NULL ||
+	    (cc->cc_ents = calloc(ncg, sizeof(*cc->cc_ents))) == NULL ||
+	    posix_memalign((void **)&cc->cc_mem, 64,
+	    (size_t)ncg * fs->fs_cgsize) != 0) {
+		if (cc != NULL) {
+			free(cc->cc_ents);
+			free(cc->cc_bycg);
+			free(cc);
+		}
+		ERROR(disk, "unable to allocate cylinder group cache");
+		return (-1);
+	}
+	cc->cc_size = ncg;
+	TAILQ_INIT(&cc->cc_lru);
+	for (i = 0; i < ncg; i++) {
+		ce = &cc->cc_ents[i];
+		ce->ce_cg = -1;
+		ce->ce_cgp = (struct cg *)(cc->cc_mem + (size_t)i * fs->fs_cgsize);
+		TAILQ_INSERT_TAIL(&cc->cc_lru, ce, ce_lru);
+	}
+	disk->d_cgcache = cc;
 	return (0);
-gotit:
+}
+
+/*
+ * Mark free block bno of cgp, counted in blocks from the start of the
+ * group, in use.
+ */
+static void
+cgballoc_blk(struct fs *fs, struct cg *cgp, long bno)
+{
+
 	fs->fs_cs(fs, cgp->cg_cgx).cs_nbfree--;
-	ffs_clrblock(fs, blksfree, (ufs1_daddr_t)bno);
+	ffs_clrblock(fs, cg_blksfree(cgp), (ufs1_daddr_t)bno);
 	ffs_clusteracct(fs, cgp, (ufs1_daddr_t)bno, -1);
 	cgp->cg_cs.cs_nbfree--;
 	fs->fs_cstotal.cs_nbfree--;
 	fs->fs_fmod = 1;
+}
+
+/*
+ * Take a free block from cgp.
+ */
+static ufs2_daddr_t
+cgballoc_cg(struct uufsd *disk, struct cg *cgp)
+{
+	struct fs *fs;
+	long bno;
+
+	fs = &disk->d_fs;
+	bno = ffs_bitmap_findblock(fs, cg_blksfree(cgp), 0,
+	    fs->fs_fpg / fs->fs_frag);
+	if (bno == -1)
+		return (0);
+	cgballoc_blk(fs, cgp, bno);
 	return (cgbase(fs, cgp->cg_cgx) + blkstofrags(fs, bno));
 }
 
+ufs2_daddr_t
+cgballoc(struct uufsd *disk)
+{
+
+	return (cgballoc_cg(disk, &disk->d_cg));
+}
+
+/*
+ * Take the block at bno, which has to be free, for a caller that picked
+ * it itself. Written back like cgbfree().
+ */
+int
+cgballoc_at(struct uufsd *disk, ufs2_daddr_t bno)
+{
+	struct fs *fs;
+	struct cg *cgp;
+	long cgbno;
+	int cg;
+
+	ERROR(disk, NULL);
+
+	fs = &disk->d_fs;
+	if (bno < 0 || bno >= fs->fs_size || fragnum(fs, bno) != 0) {
+		errno = EINVAL;
+		ERROR(disk, "block number out of range");
+		return (-1);
+	}
+	cg = dtog(fs, bno);
+	if (disk->d_cgcache != NULL) {
+		if ((cgp = cgcache_get(disk, cg)) == NULL)
+			return (-1);
+	} else {
+		if (cgread1(disk, cg) != 1)
+			return (-1);
+		cgp = &disk->d_cg;
+	}
+	cgbno = fragstoblks(fs, dtogd(fs, bno));
+	if (!ffs_isblock(fs, cg_blksfree(cgp), cgbno)) {
+		errno = EBUSY;
+		ERROR(disk, "block is not free");
+		return (-1);
+	}
+	cgballoc_blk(fs, cgp, cgbno);
+	if (disk->d_cgcache != NULL) {
+		cgcache_dirty(disk, cg);
+		return (0);
+	}
+	return cgwrite(disk);
+}
+
+/*
+ * Group c for an allocation, and its write-back, for the allocators below.
+ */
+static struct cg *
+cgalloc_get(struct uufsd *disk, int c)
+{
+
+	if (disk->d_cgcache != NULL)
+		return (cgcache_get(disk, c));
+	if (cgread1(disk, c) != 1)
+		return (NULL);
+	return (&disk->d_cg);
+}
+
+static int
+cgalloc_put(struct uufsd *disk, int c)
+{
+
+	if (disk->d_cgcache != NULL) {
+		cgcache_dirty(disk, c);
+		return (0);
+	}
+	return (cgwrite1(disk, c));
+}
+
+/*
+ * Take up to max blocks of the first run of at least min free blocks in
+ * group cg, looking from the group's rotor on and then from its start.
+ * The whole run is accounted for with one look-up of the group.
+ */
+long
+cgballoc_run(struct uufsd *disk, int cg, long min, long max,
+    ufs2_daddr_t *bnop)
+{
+	u_int8_t *blksfree;
+	struct fs *fs;
+	struct cg *cgp;
+	long b, end, n, nblks, start;
+	int pass;
+
+	ERROR(disk, NULL);
+
+	fs = &disk->d_fs;
+	if (cg < 0 || cg >= fs->fs_ncg || min <= 0 || max < min) {
+		errno = EINVAL;
+		ERROR(disk, "bad block run request");
+		return (-1);
+	}
+	if (fs->fs_cs(fs, cg).cs_nbfree < min)
+		return (0);
+	if ((cgp = cgalloc_get(disk, cg)) == NULL)
+		return (-1);
+	blksfree = cg_blksfree(cgp);
+	nblks = cgp->cg_ndblk / fs->fs_frag;
+	start = fragstoblks(fs, cgp->cg_rotor);
+	if (start >= nblks)
+		start = 0;
+	for (pass = 0; pass < 2; pass++) {
+		b = pass == 0 ? start : 0;
+		end = pass == 0 ? nblks : start;
+		while (b < end) {
+			if ((b = ffs_bitmap_findblock(fs, blksfree, b,
+			    end)) == -1)
+				break;
+			n = ffs_bitmap_ffc(blksfree, blkstofrags(fs, b),
+			    cgp->cg_ndblk);
+			if (n == -1)
+				n = cgp->cg_ndblk;
+			n = fragstoblks(fs, n) - b;
+			if (n >= min)
+				goto found;
+			b += n + 1;
+		}
+	}
+	return (0);
+found:
+	n = MIN(n, max);
+	for (end = b + n; b < end; b++)
+		cgballoc_blk(fs, cgp, b);
+	cgp->cg_rotor = blkstofrags(fs, end);
+	*bnop = cgbase(fs, cg) + blkstofrags(fs, end - n);
+	if (cgalloc_put(disk, cg) != 0)
+		return (-1);
+	return (n);
+}
+
+/*
+ * Take frags fragments at cgbno in cgp, inside one block, breaking the
+ * block up if it was free as a whole.
+ */
+static void
+cgfalloc_frags(struct fs *fs, struct cg *cgp, long cgbno, int frags)
+{
+	u_int8_t *blksfree;
+	long bbase;
+	int blk, i;
+
+	blksfree = cg_blksfree(cgp);
+	bbase = cgbno - fragnum(fs, cgbno);
+	if (ffs_isblock(fs, blksfree, fragstoblks(fs, bbase))) {
+		cgballoc_blk(fs, cgp, fragstoblks(fs, bbase));
+		for (i = 0; i < fs->fs_frag; i++)
+			if (bbase + i < cgbno || bbase + i >= cgbno + frags)
+				setbit(blksfree, bbase + i);
+		i = fs->fs_frag - frags;
+		cgp->cg_cs.cs_nffree += i;
+		fs->fs_cstotal.cs_nffree += i;
+		fs->fs_cs(fs, cgp->cg_cgx).cs_nffree += i;
+		blk = blkmap(fs, blksfree, bbase);
+		ffs_fragacct(fs, blk, (int *)cgp->cg_frsum, 1);
+		return;
+	}
+	blk = blkmap(fs, blksfree, bbase);
+	ffs_fragacct(fs, blk, (int *)cgp->cg_frsum, -1);
+	for (i = 0; i < frags; i++)
+		clrbit(blksfree, cgbno + i);
+	cgp->cg_cs.cs_nffree -= frags;
+	fs->fs_cstotal.cs_nffree -= frags;
+	fs->fs_cs(fs, cgp->cg_cgx).cs_nffree -= frags;
+	blk = blkmap(fs, blksfree, bbase);
+	ffs_fragacct(fs, blk, (int *)cgp->cg_frsum, 1);
+	fs->fs_fmod = 1;
+}
+
+/*
+ * First run of exactly len free fragments, within a block that isn't
+ * free as a whole, from cgp's fragment rotor on; -1 if there is none.
+ */
+static long
+cgfalloc_search(struct fs *fs, struct cg *cgp, int len)
+{
+	u_int8_t *blksfree;
+	long b, nblks, start;
+	int blk, full, i, n, pass;
+
+	blksfree = cg_blksfree(cgp);
+	full = (1 << fs->fs_frag) - 1;
+	nblks = cgp->cg_ndblk / fs->fs_frag;
+	start = fragstoblks(fs, cgp->cg_frotor);
+	if (start >= nblks)
+		start = 0;
+	for (pass = 0; pass < 2; pass++) {
+		for (b = pass == 0 ? start : 0;
+		    b < (pass == 0 ? nblks : start); b++) {
+			blk = blkmap(fs, blksfree, blkstofrags(fs, b));
+			if (blk == 0 || blk == full)
+				continue;
+			for (i = 0; i < fs->fs_frag; i += n + 1) {
+				for (n = 0; i + n < fs->fs_frag &&
+				    (blk & (1 << (i + n))) != 0; n++)
+					continue;
+				if (n == len)
+					return (blkstofrags(fs, b) + i);
+			}
+		}
+	}
+	return (-1);
+}
+
+/*
+ * Take frags fragments, fewer than a block, in group cg: at pref if that
+ * is in cg and free, else in the smallest run of free fragments that is
+ * large enough, else at the start of a free block. 0 if cg has no room.
+ */
+ufs2_daddr_t
+cgfalloc(struct uufsd *disk, int cg, ufs2_daddr_t pref, int frags)
+{
+	u_int8_t *blksfree;
+	struct fs *fs;
+	struct cg *cgp;
+	long b, cgbno;
+	int i, allocsiz;
+
+	ERROR(disk, NULL);
+
+	fs = &disk->d_fs;
+	if (cg < 0 || cg >= fs->fs_ncg || frags <= 0 ||
+	    frags >= fs->fs_frag) {
+		errno = EINVAL;
+		ERROR(disk, "bad fragment request");
+		return (0);
+	}
+	if (fs->fs_cs(fs, cg).cs_nbfree == 0 &&
+	    fs->fs_cs(fs, cg).cs_nffree < frags)
+		return (0);
+	if ((cgp = cgalloc_get(disk, cg)) == NULL)
+		return (0);
+	blksfree = cg_blksfree(cgp);
+	cgbno = -1;
+	if (pref > 0 && dtog(fs, pref) == cg &&
+	    fragnum(fs, pref) + frags <= fs->fs_frag) {
+		for (i = 0; i < frags; i++)
+			if (isclr(blksfree, dtogd(fs, pref) + i))
+				break;
+		if (i == frags)
+			cgbno = dtogd(fs, pref);
+	}
+	for (allocsiz = frags; cgbno == -1 && allocsiz < fs->fs_frag;
+	    allocsiz++)
+		if (cgp->cg_frsum[allocsiz] != 0)
+			cgbno = cgfalloc_search(fs, cgp, allocsiz);
+	if (cgbno == -1) {
+		if ((b = ffs_bitmap_findblock(fs, blksfree, 0,
+		    cgp->cg_ndblk / fs->fs_frag)) == -1)
+			return (0);
+		cgbno = blkstofrags(fs, b);
+	}
+	cgfalloc_frags(fs, cgp, cgbno, frags);
+	cgp->cg_frotor = cgbno;
+	if (cgalloc_put(disk, cg) != 0)
+		return (0);
+	return (cgbase(fs, cg) + cgbno);
+}
+
 int
 cgbfree(struct uufsd *disk, ufs2_daddr_t bno, long size)
 {
@@ -87,9 +558,14 @@ cgbfree(struct uufsd *disk, ufs2_daddr_t bno, long size)
 
 	fs = &disk->d_fs;
 	cg = dtog(fs, (ufs1_daddr_t)bno);
-	if (cgread1(disk, cg) != 1)
-		return (-1);
-	cgp = &disk->d_cg;
+	if (disk->d_cgcache != NULL) {
+		if ((cgp = cgcache_get(disk, cg)) == NULL)
+			return (-1);
+	} else {
+		if (cgread1(disk, cg) != 1)
+			return (-1);
+		cgp = &disk->d_cg;
+	}
 	cgbno = dtogd(fs, bno);
 	blksfree = cg_blksfree(cgp);
 	if (size == fs->fs_bsize) {
@@ -134,27 +610,31 @@ cgbfree(struct uufsd *disk, ufs2_daddr_t bno, long size)
 			fs->fs_cs(fs, cg).cs_nbfree++;
 		}
 	}
+	if (disk->d_cgcache != NULL) {
+		cgcache_dirty(disk, cg);
+		return (0);
+	}
 	return cgwrite(disk);
 }
 
-ino_t
-cgialloc(struct uufsd *disk)
+/*
+ * Take a free inode from cgp.
+ */
+static ino_t
+cgialloc_cg(struct uufsd *disk, struct cg *cgp)
 {
 	struct ufs2_dinode *dp2;
 	u_int8_t *inosused;
-	struct cg *cgp;
 	struct fs *fs;
 	ino_t ino;
 	int i;
 
 	fs = &disk->d_fs;
-	cgp = &disk->d_cg;
 	inosused = cg_inosused(cgp);
-	for (ino = 0; ino < fs->fs_ipg; ino++)
-		if (isclr(inosused, ino))
-			goto gotit;
-	return (0);
-gotit:
+	i = ffs_bitmap_ffc(inosused, 0, fs->fs_ipg);
+	if (i == -1)
+		return (0);
+	ino = i;
 	if (fs->fs_magic == FS_UFS2_MAGIC &&
 	    ino + INOPB(fs) > cgp->cg_initediblk &&
 	    cgp->cg_initediblk < cgp->cg_niblk) {
@@ -165,9 +645,9 @@ gotit:
 			dp2->di_gen = arc4random();
 			dp2++;
 		}
-		if (bwrite(disk, ino_to_fsba(fs,
-		    cgp->cg_cgx * fs->fs_ipg + cgp->cg_initediblk),
-		    block, fs->fs_bsize))
+		if (bwrite(disk, fsbtodb(fs, ino_to_fsba(fs,
+		    cgp->cg_cgx * fs->fs_ipg + cgp->cg_initediblk)),
+		    block, fs->fs_bsize) <= 0)
 			return (0);
 		cgp->cg_initediblk += INOPB(fs);
 	}
@@ -182,6 +662,145 @@ gotit:
 	return (ino + (cgp->cg_cgx * fs->fs_ipg));
 }
 
+ino_t
+cgialloc(struct uufsd *disk)
+{
+
+	return (cgialloc_cg(disk, &disk->d_cg));
+}
+
+/*
+ * Take a free inode from group cg, or from the first group after it with
+ * one, counting a directory in cs_ndir. UFS2 inode blocks brought into
+ * use are zeroed, generation numbers included, which the kernel replaces
+ * when it allocates them; that way a caller choosing generation numbers
+ * gets the same inode tables each time.
+ */
+ino_t
+cgialloc_pref(struct uufsd *disk, int cg, int mode)
+{
+	char block[MAXBSIZE];
+	u_int8_t *inosused;
+	struct fs *fs;
+	struct cg *cgp;
+	ufs2_daddr_t blkno;
+	ino_t ino;
+	int c, i, n;
+
+	ERROR(disk, NULL);
+
+	fs = &disk->d_fs;
+	if (cg < 0 || cg >= fs->fs_ncg) {
+		errno = EINVAL;
+		ERROR(disk, "cylinder group out of range");
+		return (0);
+	}
+	for (n = 0, c = cg; n < fs->fs_ncg; n++, c = (c + 1) % fs->fs_ncg) {
+		if (fs->fs_cs(fs, c).cs_nifree <= 0)
+			continue;
+		if ((cgp = cgalloc_get(disk, c)) == NULL)
+			return (0);
+		inosused = cg_inosused(cgp);
+		if ((i = ffs_bitmap_ffc(inosused, cgp->cg_irotor,
+		    fs->fs_ipg)) == -1 &&
+		    (i = ffs_bitmap_ffc(inosused, 0, fs->fs_ipg)) == -1)
+			continue;	/* summary was off */
+		ino = (ino_t)c * fs->fs_ipg;
+		while (fs->fs_magic == FS_UFS2_MAGIC &&
+		    i + INOPB(fs) > cgp->cg_initediblk &&
+		    cgp->cg_initediblk < cgp->cg_niblk) {
+			memset(block, 0, fs->fs_bsize);
+			blkno = fsbtodb(fs,
+			    ino_to_fsba(fs, ino + cgp->cg_initediblk));
+			if (bwrite(disk, blkno, block, fs->fs_bsize) <= 0)
+				return (0);
+			if (disk->d_inomin == ino + cgp->cg_initediblk)
+				disk->d_inomin = disk->d_inomax = 0;
+			cgp->cg_initediblk += INOPB(fs);
+		}
+		setbit(inosused, i);
+		cgp->cg_irotor = i;
+		cgp->cg_cs.cs_nifree--;
+		fs->fs_cstotal.cs_nifree--;
+		fs->fs_cs(fs, c).cs_nifree--;
+		if ((mode & IFMT) == IFDIR) {
+			cgp->cg_cs.cs_ndir++;
+			fs->fs_cstotal.cs_ndir++;
+			fs->fs_cs(fs, c).cs_ndir++;
+		}
+		fs->fs_fmod = 1;
+		if (cgalloc_put(disk, c) != 0)
+			return (0);
+		return (ino + i);
+	}
+	ERROR(disk, "no free inodes");
+	return (0);
+}
+
+/*
+ * Next group from the rotor on with something free according to the
+ * summary in fs_cs, brought in and handed to alloc; the group is
+ * written back, or marked dirty if it is cached.
+ */
+static uint64_t
+cgalloc_any(struct uufsd *disk, int inode)
+{
+	struct fs *fs;
+	struct csum *cs;
+	struct cg *cgp;
+	uint64_t r;
+	int c, i;
+
+	ERROR(disk, NULL);
+
+	fs = &disk->d_fs;
+	if (disk->d_ufs == 0 || fs->fs_ncg <= 0) {
+		ERROR(disk, "no superblock read");
+		return (0);
+	}
+	c = fs->fs_cgrotor;
+	for (i = 0; i < fs->fs_ncg; i++, c++) {
+		if (c >= fs->fs_ncg)
+			c = 0;
+		cs = &fs->fs_cs(fs, c);
+		if ((inode ? cs->cs_nifree : cs->cs_nbfree) <= 0)
+			continue;
+		if (disk->d_cgcache != NULL) {
+			if ((cgp = cgcache_get(disk, c)) == NULL)
+				return (0);
+		} else {
+			if (cgread1(disk, c) != 1)
+				return (0);
+			cgp = &disk->d_cg;
+		}
+		r = inode ? cgialloc_cg(disk, cgp) : cgballoc_cg(disk, cgp);
+		if (r == 0)
+			continue;	/* summary was off */
+		fs->fs_cgrotor = c;
+		if (disk->d_cgcache != NULL)
+			cgcache_dirty(disk, c);
+		else if (cgwrite1(disk, c) != 0)
+			return (0);
+		return (r);
+	}
+	ERROR(disk, inode ? "no free inodes" : "no free blocks");
+	return (0);
+}
+
+ufs2_daddr_t
+cgballoc_any(struct uufsd *disk)
+{
+
+	return ((ufs2_daddr_t)cgalloc_any(disk, 0));
+}
+
+ino_t
+cgialloc_any(struct uufsd *disk)
+{
+
+	return ((ino_t)cgalloc_any(disk, 1));
+}
+
 int
 cgread(struct uufsd *disk)
 {
@@ -191,33 +810,54 @@ cgread(struct uufsd *disk)
 	return (cgread1(disk, disk->d_ccg++));
 }
 
-/* Short read/write error messages from cgget()/cgput() */
-static const char *failmsg;
-
 int
 cgread1(struct uufsd *disk, int c)
 {
+	struct cg *cgp;
 
-	if (cgget(disk->d_fd, &disk->d_fs, c, &disk->d_cg) == 0) {
+	if (disk->d_cgcache != NULL) {
+		if (c < 0 || c >= disk->d_fs.fs_ncg) {
+			errno = EINVAL;
+			ERROR(disk, "cylinder group number out of range");
+			return (-1);
+		}
+		if ((cgp = cgcache_get(disk, c)) == NULL)
+			return (-1);
+		memcpy(&disk->d_cg, cgp, disk->d_fs.fs_cgsize);
 		disk->d_lcg = c;
 		return (1);
 	}
-	ERROR(disk, NULL);
-	if (failmsg != NULL) {
-		ERROR(disk, failmsg);
-		return (-1);
+	if (cgget(disk->d_fd, &disk->d_fs, c, &disk->d_cg) == 0) {
+		disk->d_lcg = c;
+		return (1);
 	}
+	return (cgread_error(disk));
+}
+
+/*
+ * What the last cgget() in this thread failed on, in words.
+ */
+const char *
+cgget_errmsg(void)
+{
+
+	if (failmsg != NULL)
+		return (failmsg);
 	switch (errno) {
 	case EINTEGRITY:
-		ERROR(disk, "cylinder group checks failed");
-		break;
+		return ("cylinder group checks failed");
 	case EIO:
-		ERROR(disk, "read error from block device");
-		break;
+		return ("read error from block device");
 	default:
-		ERROR(disk, strerror(errno));
-		break;
+		return (strerror(errno));
 	}
+}
+
+static int
+cgread_error(struct uufsd *disk)
+{
+
+	ERROR(disk, cgget_errmsg());
 	return (-1);
 }
 
@@ -228,7 +868,7 @@ cgget(int devfd, struct fs *fs, int cg, struct cg *cgp)
 	size_t cnt, offset;
 
 	failmsg = NULL;
-    offset = fsbtodb(fs, cgtod(fs, cg)) * (fs->fs_fsize / fsbtodb(fs,1));
+    offset = (off_t)fsbtodb(fs, cgtod(fs, cg)) * (fs->fs_fsize / fsbtodb(fs,1));
 	if ((cnt = pread(devfd, cgp, fs->fs_cgsize, offset)) < 0)
 		return (-1);
 	if (cnt == 0) {
@@ -267,7 +907,15 @@ int
 cgwrite1(struct uufsd *disk, int cg)
 {
 	static char errmsg[BUFSIZ];
+	struct cg *cgp;
 
+	if (cg == disk->d_cg.cg_cgx && disk->d_cgcache != NULL) {
+		if ((cgp = cgcache_get(disk, cg)) == NULL)
+			return (-1);
+		memcpy(cgp, &disk->d_cg, disk->d_fs.fs_cgsize);
+		cgcache_dirty(disk, cg);
+		return (0);
+	}
 	if (cg == disk->d_cg.cg_cgx) {
 		if (cgput(disk->d_fd, &disk->d_fs, &disk->d_cg) == 0)
 			return (0);
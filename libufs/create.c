@@ -0,0 +1,806 @@
+//
+//  create.c
+//  libufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Building files on a file system that isn't mounted, as newfs -D does.
+// ufs_inode_create() takes an inode, ufs_dir_create() and ufs_dir_add()
+// gather a directory's entries in memory and ufs_dir_close() writes them,
+// and ufs_file_create() writes a file from start to end.
+//
+// A file's size is given up front, so all of its blocks can be taken
+// before the first byte is written: one run of them with cgballoc_run()
+// if there is one, indirect blocks where FFS puts them, right before the
+// data they map, and the last few fragments right after the last block
+// when it is a small file. The indirect blocks are written there and
+// then, and the data goes out in writes of up to FILE_IOSIZE bytes.
+//
+// Link counts are kept as entries are made: an entry counts a link on
+// the inode it names, so ".." counts one on the parent.
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ufs/dir.h>
+#include <ufs/ffs/fs.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libufs.h>
+
+#define	FILE_IOSIZE	(1024 * 1024)	/* most file data written at once */
+
+/* Where a stretch of the file's data goes. */
+struct fext {
+	off_t		 fe_off;	/* in the file */
+	off_t		 fe_len;	/* bytes, the last rounded to a frag */
+	ufs2_daddr_t	 fe_blkno;	/* first frag on disk */
+};
+
+struct uufsd_file {
+	struct uufsd	*f_disk;
+	ino_t		 f_ino;
+	off_t		 f_size;	/* as given to ufs_file_create() */
+	off_t		 f_off;		/* written so far */
+	int64_t		 f_nfrags;	/* taken, indirect blocks too */
+	ufs2_daddr_t	 f_db[UFS_NDADDR];
+	ufs2_daddr_t	 f_ib[UFS_NIADDR];
+	struct fext	*f_ext;
+	int		 f_next;	/* entries in f_ext */
+	int		 f_cur;		/* entry being written */
+	caddr_t		 f_buf;
+	size_t		 f_bufsize;
+	size_t		 f_buflen;
+	/* Only while the blocks are being taken. */
+	int		 f_cg;		/* group of the last run */
+	ufs2_daddr_t	 f_run;		/* next block of the last run */
+	int64_t		 f_runlen;	/* blocks left in it */
+	int64_t		 f_left;	/* blocks still to take */
+	caddr_t		 f_ind[UFS_NIADDR]; /* open indirect block by level */
+	ufs2_daddr_t	 f_indblk[UFS_NIADDR];
+};
+
+struct uufsd_dir {
+	struct uufsd	*dr_disk;
+	ino_t		 dr_ino;
+	caddr_t		 dr_buf;
+	size_t		 dr_len;	/* in use, whole DIRBLKSIZ chunks */
+	size_t		 dr_size;	/* allocated */
+	size_t		 dr_last;	/* offset of the last entry */
+};
+
+/*
+ * The group to put a new directory under parent in, the way ffs_dirpref()
+ * picks it from the summaries: directories in the root are spread out to
+ * the group with the fewest directories that has at least the average
+ * free inodes and blocks; others go in their parent's group or the next
+ * one that isn't short of either. The kernel starts the first search at
+ * a random group and also limits how many directories in a row go in one
+ * group; here the choice only depends on the summaries.
+ */
+int
+ufs_dirpref(struct uufsd *disk, ino_t parent)
+{
+	struct fs *fs;
+	struct csum *cs;
+	int64_t avgbfree, avgifree, avgndir, maxndir, minbfree, minifree;
+	int cg, i, mincg, minndir, prefcg;
+
+	ERROR(disk, NULL);
+
+	fs = &disk->d_fs;
+	avgifree = fs->fs_cstotal.cs_nifree / fs->fs_ncg;
+	avgbfree = fs->fs_cstotal.cs_nbfree / fs->fs_ncg;
+	avgndir = fs->fs_cstotal.cs_ndir / fs->fs_ncg;
+	if (parent == UFS_ROOTINO) {
+		mincg = 0;
+		minndir = fs->fs_ipg;
+		for (cg = 0; cg < fs->fs_ncg; cg++) {
+			cs = &fs->fs_cs(fs, cg);
+			if (cs->cs_ndir < minndir &&
+			    cs->cs_nifree >= avgifree &&
+			    cs->cs_nbfree >= avgbfree) {
+				mincg = cg;
+				minndir = cs->cs_ndir;
+			}
+		}
+		return (mincg);
+	}
+	maxndir = MIN(avgndir + fs->fs_ipg / 16, fs->fs_ipg);
+	minifree = MAX(avgifree - avgifree / 4, 1);
+	minbfree = MAX(avgbfree - avgbfree / 4, 1);
+	prefcg = ino_to_cg(fs, parent);
+	for (i = 0; i < fs->fs_ncg; i++) {
+		cs = &fs->fs_cs(fs, (prefcg + i) % fs->fs_ncg);
+		if (cs->cs_ndir < maxndir && cs->cs_nifree >= minifree &&
+		    cs->cs_nbfree >= minbfree)
+			return ((prefcg + i) % fs->fs_ncg);
+	}
+	for (i = 0; i < fs->fs_ncg; i++) {
+		cs = &fs->fs_cs(fs, (prefcg + i) % fs->fs_ncg);
+		if (cs->cs_nifree >= avgifree)
+			return ((prefcg + i) % fs->fs_ncg);
+	}
+	return (prefcg);
+}
+
+ino_t
+ufs_inode_create(struct uufsd *disk, int cg, int mode, uint32_t gen)
+{
+	union dinodep dp;
+	ino_t ino;
+
+	if ((ino = cgialloc_pref(disk, cg, mode)) == 0)
+		return (0);
+	if (getinode(disk, &dp, ino) == -1)
+		return (0);
+	if (disk->d_ufs == 1) {
+		memset(dp.dp1, 0, sizeof(*dp.dp1));
+		dp.dp1->di_mode = mode;
+		dp.dp1->di_gen = gen;
+	} else {
+		memset(dp.dp2, 0, sizeof(*dp.dp2));
+		dp.dp2->di_mode = mode;
+		dp.dp2->di_gen = gen;
+	}
+	if (putinode(disk) == -1)
+		return (0);
+	return (ino);
+}
+
+/*
+ * Indirect blocks needed to map nblk data blocks.
+ */
+static int64_t
+file_nindir(struct fs *fs, int64_t nblk)
+{
+	int64_t m, n, nind, pw, span;
+	int lvl;
+
+	nind = 0;
+	n = nblk - UFS_NDADDR;
+	for (lvl = 0, span = NINDIR(fs); n > 0 && lvl < UFS_NIADDR;
+	    lvl++, span *= NINDIR(fs)) {
+		m = MIN(n, span);
+		for (pw = NINDIR(fs); pw <= span; pw *= NINDIR(fs))
+			nind += howmany(m, pw);
+		n -= m;
+	}
+	return (nind);
+}
+
+/*
+ * Next block of the file in disk order. A new run is looked for in the
+ * group of the last one and the groups after it, first one long enough
+ * for all the blocks still to take, then any.
+ */
+static ufs2_daddr_t
+file_nextblk(struct uufsd_file *f)
+{
+	struct uufsd *disk;
+	struct fs *fs;
+	ufs2_daddr_t bno;
+	long n;
+	int c, i, pass;
+
+	disk = f->f_disk;
+	fs = &disk->d_fs;
+	pass = f->f_left <= fs->fs_fpg / fs->fs_frag ? 0 : 1;
+	for (; f->f_runlen == 0 && pass < 2; pass++) {
+		for (i = 0; i < fs->fs_ncg; i++) {
+			c = (f->f_cg + i) % fs->fs_ncg;
+			n = cgballoc_run(disk, c, pass == 0 ? f->f_left : 1,
+			    f->f_left, &f->f_run);
+			if (n == -1)
+				return (0);
+			if (n > 0) {
+				f->f_runlen = n;
+				f->f_cg = c;
+				break;
+			}
+		}
+	}
+	if (f->f_runlen == 0) {
+		errno = ENOSPC;
+		ERROR(disk, "no free blocks");
+		return (0);
+	}
+	bno = f->f_run;
+	f->f_run += fs->fs_frag;
+	f->f_runlen--;
+	f->f_left--;
+	f->f_nfrags += fs->fs_frag;
+	return (bno);
+}
+
+/*
+ * Note that len bytes of the file at off go to the frags at bno.
+ */
+static int
+file_addext(struct uufsd_file *f, off_t off, ufs2_daddr_t bno, off_t len)
+{
+	struct fext *fe;
+	struct fs *fs;
+
+	fs = &f->f_disk->d_fs;
+	if (f->f_next > 0) {
+		fe = &f->f_ext[f->f_next - 1];
+		if (fe->fe_off + fe->fe_len == off &&
+		    fe->fe_blkno + numfrags(fs, fe->fe_len) == bno) {
+			fe->fe_len += len;
+			return (0);
+		}
+	}
+	if ((f->f_next & (f->f_next - 1)) == 0) {
+		fe = realloc(f->f_ext, MAX(2 * f->f_next, 4) * sizeof(*fe));
+		if (fe == NULL) {
+			ERROR(f->f_disk, "unable to allocate file map");
+			return (-1);
+		}
+		f->f_ext = fe;
+	}
+	fe = &f->f_ext[f->f_next++];
+	fe->fe_off = off;
+	fe->fe_len = len;
+	fe->fe_blkno = bno;
+	return (0);
+}
+
+/*
+ * Write the open level lvl indirect block, if there is one.
+ */
+static int
+file_indwrite(struct uufsd_file *f, int lvl)
+{
+	struct fs *fs;
+
+	fs = &f->f_disk->d_fs;
+	if (f->f_indblk[lvl] == 0)
+		return (0);
+	if (bwrite(f->f_disk, fsbtodb(fs, f->f_indblk[lvl]), f->f_ind[lvl],
+	    fs->fs_bsize) <= 0)
+		return (-1);
+	f->f_indblk[lvl] = 0;
+	return (0);
+}
+
+/*
+ * Open a new level lvl indirect block at bno, writing the last one.
+ */
+static int
+file_indopen(struct uufsd_file *f, int lvl, ufs2_daddr_t bno)
+{
+	struct fs *fs;
+
+	fs = &f->f_disk->d_fs;
+	if (f->f_ind[lvl] == NULL &&
+	    (f->f_ind[lvl] = malloc(fs->fs_bsize)) == NULL) {
+		ERROR(f->f_disk, "unable to allocate indirect block");
+		return (-1);
+	}
+	if (file_indwrite(f, lvl) == -1)
+		return (-1);
+	memset(f->f_ind[lvl], 0, fs->fs_bsize);
+	f->f_indblk[lvl] = bno;
+	return (0);
+}
+
+static void
+file_indset(struct uufsd_file *f, int lvl, int64_t i, ufs2_daddr_t bno)
+{
+
+	if (f->f_disk->d_ufs == 1)
+		((ufs1_daddr_t *)f->f_ind[lvl])[i] = bno;
+	else
+		((ufs2_daddr_t *)f->f_ind[lvl])[i] = bno;
+}
+
+/*
+ * Take the blocks of nblk full data blocks and the indirect blocks they
+ * need, and tail more frags after them, writing the indirect blocks.
+ */
+static int
+file_layout(struct uufsd_file *f, int64_t nblk, int tail)
+{
+	struct uufsd *disk;
+	struct fs *fs;
+	ufs2_daddr_t bno;
+	int64_t k, lbn, pw, span;
+	int c, i, l, lvl;
+
+	disk = f->f_disk;
+	fs = &disk->d_fs;
+	f->f_left = nblk + file_nindir(fs, nblk);
+	for (lbn = 0; lbn < nblk; lbn++) {
+		if (lbn < UFS_NDADDR) {
+			if ((bno = file_nextblk(f)) == 0)
+				return (-1);
+			f->f_db[lbn] = bno;
+			if (file_addext(f, lbn * fs->fs_bsize, bno,
+			    fs->fs_bsize) == -1)
+				return (-1);
+			continue;
+		}
+		/* Which tree of indirect blocks, and how far into it. */
+		k = lbn - UFS_NDADDR;
+		for (lvl = 0, span = NINDIR(fs); k >= span; lvl++) {
+			k -= span;
+			span *= NINDIR(fs);
+		}
+		/* Indirect blocks that start here, top down. */
+		for (l = lvl, pw = span; l >= 0; l--, pw /= NINDIR(fs)) {
+			if (k % pw != 0)
+				continue;
+			if ((bno = file_nextblk(f)) == 0 ||
+			    file_indopen(f, l, bno) == -1)
+				return (-1);
+			if (l == lvl)
+				f->f_ib[lvl] = bno;
+			else
+				file_indset(f, l + 1, (k / pw) % NINDIR(fs),
+				    bno);
+		}
+		if ((bno = file_nextblk(f)) == 0)
+			return (-1);
+		file_indset(f, 0, k % NINDIR(fs), bno);
+		if (file_addext(f, lbn * fs->fs_bsize, bno, fs->fs_bsize) == -1)
+			return (-1);
+	}
+	for (l = 0; l < UFS_NIADDR; l++)
+		if (file_indwrite(f, l) == -1)
+			return (-1);
+	if (tail == 0)
+		return (0);
+	/* Right after the last block, or with other small files' tails. */
+	bno = nblk > 0 ? f->f_db[nblk - 1] + fs->fs_frag : 0;
+	c = nblk > 0 ? dtog(fs, bno) : ino_to_cg(fs, f->f_ino);
+	for (i = 0; i < fs->fs_ncg; i++) {
+		if ((bno = cgfalloc(disk, (c + i) % fs->fs_ncg, bno,
+		    tail)) != 0)
+			break;
+		if (disk->d_error != NULL)
+			return (-1);
+	}
+	if (bno == 0) {
+		errno = ENOSPC;
+		ERROR(disk, "no free fragments");
+		return (-1);
+	}
+	f->f_db[nblk] = bno;
+	f->f_nfrags += tail;
+	return (file_addext(f, nblk * fs->fs_bsize, bno,
+	    (off_t)tail * fs->fs_fsize));
+}
+
+static void
+file_free(struct uufsd_file *f)
+{
+	int l;
+
+	for (l = 0; l < UFS_NIADDR; l++)
+		free(f->f_ind[l]);
+	free(f->f_ext);
+	free(f->f_buf);
+	free(f);
+}
+
+struct uufsd_file *
+ufs_file_create(struct uufsd *disk, ino_t ino, off_t size)
+{
+	struct uufsd_file *f;
+	union dinodep dp;
+	struct fs *fs;
+	int64_t nblk;
+	int tail;
+
+	ERROR(disk, NULL);
+
+	fs = &disk->d_fs;
+	if (size < 0 || (uint64_t)size > fs->fs_maxfilesize) {
+		errno = EFBIG;
+		ERROR(disk, "file too large");
+		return (NULL);
+	}
+	if (getinode(disk, &dp, ino) == -1)
+		return (NULL);
+	if ((disk->d_ufs == 1 ? dp.dp1->di_size : dp.dp2->di_size) != 0) {
+		errno = EINVAL;
+		ERROR(disk, "inode already has data");
+		return (NULL);
+	}
+	if ((f = calloc(1, sizeof(*f))) == NULL) {
+		ERROR(disk, "unable to allocate file");
+		return (NULL);
+	}
+	f->f_disk = disk;
+	f->f_ino = ino;
+	f->f_size = size;
+	f->f_cg = ino_to_cg(fs, ino);
+	f->f_bufsize = MIN(FILE_IOSIZE, fragroundup(fs, size));
+	if (f->f_bufsize > 0 &&
+	    posix_memalign((void **)&f->f_buf, getpagesize(),
+	    f->f_bufsize) != 0) {
+		free(f);
+		ERROR(disk, "unable to allocate file buffer");
+		return (NULL);
+	}
+	/* Small files end in a fragment, those with indirect blocks don't. */
+	tail = 0;
+	nblk = lblkno(fs, size);
+	if (nblk < UFS_NDADDR)
+		tail = numfrags(fs, fragroundup(fs, blkoff(fs, size)));
+	else
+		nblk = lblkno(fs, blkroundup(fs, size));
+	if (tail == fs->fs_frag) {
+		nblk++;
+		tail = 0;
+	}
+	if (file_layout(f, nblk, tail) == -1) {
+		file_free(f);
+		return (NULL);
+	}
+	return (f);
+}
+
+/*
+ * Write out the buffer, which ends at f_off.
+ */
+static int
+file_flush(struct uufsd_file *f)
+{
+	struct fext *fe;
+	struct fs *fs;
+	size_t len;
+	off_t off;
+
+	fs = &f->f_disk->d_fs;
+	fe = &f->f_ext[f->f_cur];
+	off = f->f_off - f->f_buflen;
+	len = fragroundup(fs, f->f_buflen);
+	memset(f->f_buf + f->f_buflen, 0, len - f->f_buflen);
+	if (bwrite(f->f_disk, fsbtodb(fs, fe->fe_blkno +
+	    numfrags(fs, off - fe->fe_off)), f->f_buf, len) <= 0)
+		return (-1);
+	f->f_buflen = 0;
+	return (0);
+}
+
+ssize_t
+ufs_file_write(struct uufsd_file *f, const void *buf, size_t len)
+{
+	struct fext *fe;
+	size_t done, n;
+	off_t end;
+
+	ERROR(f->f_disk, NULL);
+
+	if (len > (uint64_t)(f->f_size - f->f_off)) {
+		errno = EFBIG;
+		ERROR(f->f_disk, "write past the end of the file");
+		return (-1);
+	}
+	for (done = 0; done < len; done += n) {
+		fe = &f->f_ext[f->f_cur];
+		end = MIN(fe->fe_off + fe->fe_len, f->f_size);
+		n = MIN(len - done, f->f_bufsize - f->f_buflen);
+		n = MIN(n, (size_t)(end - f->f_off));
+		memcpy(f->f_buf + f->f_buflen, (const char *)buf + done, n);
+		f->f_buflen += n;
+		f->f_off += n;
+		if (f->f_buflen == f->f_bufsize || f->f_off == end) {
+			if (file_flush(f) == -1)
+				return (-1);
+			if (f->f_off == end)
+				f->f_cur++;
+		}
+	}
+	return ((ssize_t)len);
+}
+
+int
+ufs_file_close(struct uufsd_file *f)
+{
+	struct uufsd *disk;
+	union dinodep dp;
+	struct fs *fs;
+	int i, ret;
+
+	disk = f->f_disk;
+	fs = &disk->d_fs;
+	ret = -1;
+	ERROR(disk, NULL);
+	if (f->f_off != f->f_size) {
+		errno = EIO;
+		ERROR(disk, "file closed before all of it was written");
+		goto out;
+	}
+	if (getinode(disk, &dp, f->f_ino) == -1)
+		goto out;
+	if (disk->d_ufs == 1) {
+		dp.dp1->di_size = f->f_size;
+		for (i = 0; i < UFS_NDADDR; i++)
+			dp.dp1->di_db[i] = f->f_db[i];
+		for (i = 0; i < UFS_NIADDR; i++)
+			dp.dp1->di_ib[i] = f->f_ib[i];
+		dp.dp1->di_blocks += f->f_nfrags * (fs->fs_fsize / DEV_BSIZE);
+	} else {
+		dp.dp2->di_size = f->f_size;
+		for (i = 0; i < UFS_NDADDR; i++)
+			dp.dp2->di_db[i] = f->f_db[i];
+		for (i = 0; i < UFS_NIADDR; i++)
+			dp.dp2->di_ib[i] = f->f_ib[i];
+		dp.dp2->di_blocks += f->f_nfrags * (fs->fs_fsize / DEV_BSIZE);
+	}
+	ret = putinode(disk);
+out:
+	file_free(f);
+	return (ret);
+}
+
+/*
+ * Add delta to the link count of ino.
+ */
+static int
+dir_link(struct uufsd *disk, ino_t ino, int delta)
+{
+	union dinodep dp;
+	int nlink;
+
+	if (getinode(disk, &dp, ino) == -1)
+		return (-1);
+	nlink = (disk->d_ufs == 1 ? dp.dp1->di_nlink : dp.dp2->di_nlink) +
+	    delta;
+	if (nlink > UFS_LINK_MAX) {
+		errno = EMLINK;
+		ERROR(disk, "too many links");
+		return (-1);
+	}
+	if (disk->d_ufs == 1)
+		dp.dp1->di_nlink = nlink;
+	else
+		dp.dp2->di_nlink = nlink;
+	return (putinode(disk));
+}
+
+static struct uufsd_dir *
+dir_alloc(struct uufsd *disk, ino_t ino, size_t size)
+{
+	struct uufsd_dir *dr;
+
+	if ((dr = calloc(1, sizeof(*dr))) == NULL ||
+	    (dr->dr_buf = calloc(1, size)) == NULL) {
+		free(dr);
+		ERROR(disk, "unable to allocate directory");
+		return (NULL);
+	}
+	dr->dr_disk = disk;
+	dr->dr_ino = ino;
+	dr->dr_size = size;
+	return (dr);
+}
+
+static void
+dir_free(struct uufsd_dir *dr)
+{
+
+	free(dr->dr_buf);
+	free(dr);
+}
+
+struct uufsd_dir *
+ufs_dir_create(struct uufsd *disk, ino_t ino, ino_t parent)
+{
+	struct uufsd_dir *dr;
+
+	ERROR(disk, NULL);
+
+	if ((dr = dir_alloc(disk, ino, DIRBLKSIZ)) == NULL)
+		return (NULL);
+	if (ufs_dir_add(dr, ".", ino, DT_DIR) == -1 ||
+	    ufs_dir_add(dr, "..", parent, DT_DIR) == -1) {
+		dir_free(dr);
+		return (NULL);
+	}
+	return (dr);
+}
+
+/* Everything a directory's blocks are, gathered by ufs_dir_open(). */
+struct dir_extents {
+	struct ufs_extent *de_ext;
+	int		 de_n;
+};
+
+static int
+dir_extent(void *arg, const struct ufs_extent *ue)
+{
+	struct dir_extents *de;
+	struct ufs_extent *p;
+
+	de = arg;
+	if ((ue->ue_flags & UFS_EXTENT_EXTATTR) != 0)
+		return (0);
+	if ((de->de_n & (de->de_n - 1)) == 0) {
+		p = realloc(de->de_ext, MAX(2 * de->de_n, 4) * sizeof(*p));
+		if (p == NULL)
+			return (-1);
+		de->de_ext = p;
+	}
+	de->de_ext[de->de_n++] = *ue;
+	return (0);
+}
+
+struct uufsd_dir *
+ufs_dir_open(struct uufsd *disk, ino_t ino)
+{
+	struct dir_extents de;
+	struct ufs_extent *ue;
+	struct uufsd_dir *dr;
+	union dinodep dp;
+	struct fs *fs;
+	struct direct *d;
+	ufs2_daddr_t bno;
+	int64_t freed, n;
+	size_t len, off;
+	int i, k;
+
+	ERROR(disk, NULL);
+
+	fs = &disk->d_fs;
+	if (getinode(disk, &dp, ino) == -1)
+		return (NULL);
+	len = disk->d_ufs == 1 ? dp.dp1->di_size : dp.dp2->di_size;
+	if (((disk->d_ufs == 1 ? dp.dp1->di_mode : dp.dp2->di_mode) &
+	    IFMT) != IFDIR || len == 0 || len % DIRBLKSIZ != 0) {
+		errno = ENOTDIR;
+		ERROR(disk, "not a directory");
+		return (NULL);
+	}
+	memset(&de, 0, sizeof(de));
+	if (ufs_file_extents(disk, dp, UFS_EXTENTS_INDIR, dir_extent,
+	    &de) != 0) {
+		if (disk->d_error == NULL)
+			ERROR(disk, "unable to allocate directory map");
+		free(de.de_ext);
+		return (NULL);
+	}
+	if ((dr = dir_alloc(disk, ino, blkroundup(fs, len))) == NULL)
+		goto fail;
+	/* Read it in, then give all of its blocks back. */
+	for (i = 0; i < de.de_n; i++) {
+		ue = &de.de_ext[i];
+		if ((ue->ue_flags & UFS_EXTENT_INDIR) == 0 &&
+		    bread(disk, fsbtodb(fs, ue->ue_blkno),
+		    dr->dr_buf + ue->ue_lbn * fs->fs_bsize,
+		    ue->ue_nfrags * fs->fs_fsize) == -1)
+			goto fail;
+	}
+	freed = 0;
+	for (i = 0; i < de.de_n; i++) {
+		ue = &de.de_ext[i];
+		for (bno = ue->ue_blkno; bno < ue->ue_blkno + ue->ue_nfrags;
+		    bno += n) {
+			n = MIN(fs->fs_frag - fragnum(fs, bno),
+			    ue->ue_blkno + ue->ue_nfrags - bno);
+			if (cgbfree(disk, bno, n * fs->fs_fsize) == -1)
+				goto fail;
+			freed += n;
+		}
+	}
+	free(de.de_ext);
+	de.de_ext = NULL;
+	if (getinode(disk, &dp, ino) == -1)
+		goto fail;
+	if (disk->d_ufs == 1) {
+		dp.dp1->di_size = 0;
+		memset(dp.dp1->di_db, 0, sizeof(dp.dp1->di_db));
+		memset(dp.dp1->di_ib, 0, sizeof(dp.dp1->di_ib));
+		dp.dp1->di_blocks -= freed * (fs->fs_fsize / DEV_BSIZE);
+	} else {
+		dp.dp2->di_size = 0;
+		memset(dp.dp2->di_db, 0, sizeof(dp.dp2->di_db));
+		memset(dp.dp2->di_ib, 0, sizeof(dp.dp2->di_ib));
+		dp.dp2->di_blocks -= freed * (fs->fs_fsize / DEV_BSIZE);
+	}
+	if (putinode(disk) == -1)
+		goto fail;
+	/* The last entry runs to the end of the last chunk. */
+	dr->dr_len = len;
+	for (off = len - DIRBLKSIZ; ; off += k) {
+		d = (struct direct *)(dr->dr_buf + off);
+		k = d->d_reclen;
+		if (k < DIRSIZ(0, d) || off + k > len) {
+			errno = EINVAL;
+			ERROR(disk, "bad directory entry");
+			goto fail;
+		}
+		if (off + k == len)
+			break;
+	}
+	dr->dr_last = off;
+	return (dr);
+fail:
+	free(de.de_ext);
+	if (dr != NULL)
+		dir_free(dr);
+	return (NULL);
+}
+
+int
+ufs_dir_add(struct uufsd_dir *dr, const char *name, ino_t ino, int type)
+{
+	struct direct *d, *last;
+	size_t namlen, need, off, size;
+	caddr_t p;
+	int reclen;
+
+	ERROR(dr->dr_disk, NULL);
+
+	namlen = strlen(name);
+	if (namlen == 0 || namlen > UFS_MAXNAMLEN) {
+		errno = ENAMETOOLONG;
+		ERROR(dr->dr_disk, "bad file name length");
+		return (-1);
+	}
+	need = DIRECTSIZ(namlen);
+	last = (struct direct *)(dr->dr_buf + dr->dr_last);
+	if (dr->dr_len > 0 && last->d_reclen - DIRSIZ(0, last) >= need) {
+		off = dr->dr_last + DIRSIZ(0, last);
+		reclen = last->d_reclen - DIRSIZ(0, last);
+		last->d_reclen = DIRSIZ(0, last);
+	} else {
+		if (dr->dr_len + DIRBLKSIZ > dr->dr_size) {
+			size = 2 * dr->dr_size;
+			if ((p = realloc(dr->dr_buf, size)) == NULL) {
+				ERROR(dr->dr_disk,
+				    "unable to allocate directory");
+				return (-1);
+			}
+			dr->dr_buf = p;
+			dr->dr_size = size;
+		}
+		off = dr->dr_len;
+		reclen = DIRBLKSIZ;
+		memset(dr->dr_buf + off, 0, DIRBLKSIZ);
+		dr->dr_len += DIRBLKSIZ;
+	}
+	d = (struct direct *)(dr->dr_buf + off);
+	memset(d, 0, need);
+	d->d_ino = ino;
+	d->d_reclen = reclen;
+	d->d_type = type;
+	d->d_namlen = namlen;
+	memcpy(d->d_name, name, namlen);
+	dr->dr_last = off;
+	return (dir_link(dr->dr_disk, ino, 1));
+}
+
+int
+ufs_dir_close(struct uufsd_dir *dr)
+{
+	struct uufsd_file *f;
+	int ret;
+
+	ret = -1;
+	if ((f = ufs_file_create(dr->dr_disk, dr->dr_ino, dr->dr_len)) !=
+	    NULL) {
+		if (ufs_file_write(f, dr->dr_buf, dr->dr_len) == -1)
+			file_free(f);
+		else
+			ret = ufs_file_close(f);
+	}
+	dir_free(dr);
+	return (ret);
+}
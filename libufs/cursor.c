@@ -0,0 +1,191 @@
+//
+//  cursor.c
+//  libufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Cursors, for reading one disk from several threads. struct uufsd holds
+// the geometry of the file system, which never changes once sbread() is
+// done, next to the inode block, cylinder group and error string that
+// every getinode(), cgread1() and bread() overwrites, so two threads can't
+// share it. A cursor has its own copy of the latter and only reads the
+// disk it was opened on, so each thread can be handed one and the scans
+// don't have to take turns.
+//
+// Cursors read the disk itself (or the mapping), not the inode and
+// cylinder group caches; ufs_cursor_open() writes those back so there is
+// nothing newer in them, and so has to be called by whoever owns the
+// disk, before the threads start. While cursors are in use nobody may
+// change that disk: no writes, no sbread(), no ufs_disk_close().
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <freebsd/disklabel.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+struct uufsd_cursor *
+ufs_cursor_open(struct uufsd *disk)
+{
+	struct uufsd_cursor *cur;
+	struct fs *fs;
+	long pgsz;
+
+	ERROR(disk, NULL);
+
+	fs = &disk->d_fs;
+	if (disk->d_ufs == 0) {
+		errno = EINVAL;
+		ERROR(disk, "no superblock read");
+		return (NULL);
+	}
+	if (ufs_disk_inosync(disk) == -1 || ufs_disk_cgflush(disk) == -1)
+		return (NULL);
+	/*
+	 * A mapped disk's inode blocks are looked at where they are; others
+	 * are read into page aligned memory, which direct I/O needn't bounce.
+	 */
+	pgsz = sysconf(_SC_PAGESIZE);
+	if ((cur = calloc(1, sizeof(*cur))) == NULL ||
+	    posix_memalign((void **)&cur->c_cg, 64, fs->fs_cgsize) != 0 ||
+	    (disk->d_map == NULL && posix_memalign((void **)&cur->c_inoblock,
+	    pgsz, fs->fs_bsize) != 0)) {
+		if (cur != NULL)
+			free(cur->c_cg);
+		free(cur);
+		ERROR(disk, "unable to allocate cursor");
+		return (NULL);
+	}
+	cur->c_disk = disk;
+	cur->c_lcg = -1;
+	return (cur);
+}
+
+void
+ufs_cursor_close(struct uufsd_cursor *cur)
+{
+
+	if (cur == NULL)
+		return;
+	if (cur->c_disk->d_map == NULL)
+		free(cur->c_inoblock);
+	free(cur->c_cg);
+	free(cur);
+}
+
+ssize_t
+ufs_cursor_bread(struct uufsd_cursor *cur, ufs2_daddr_t blockno, void *data,
+    size_t size)
+{
+	const char *errmsg;
+	ssize_t cnt;
+
+	CURSOR_ERROR(cur, NULL);
+
+	cnt = ufs_disk_pread(cur->c_disk, blockno, data, size, &errmsg);
+	if (cnt == -1)
+		CURSOR_ERROR(cur, errmsg);
+	return (cnt);
+}
+
+int
+ufs_cursor_cgread(struct uufsd_cursor *cur, int c)
+{
+	struct uufsd *disk;
+
+	CURSOR_ERROR(cur, NULL);
+
+	disk = cur->c_disk;
+	if (c < 0 || c >= disk->d_fs.fs_ncg) {
+		errno = EINVAL;
+		CURSOR_ERROR(cur, "cylinder group number out of range");
+		return (-1);
+	}
+	if (cgget(disk->d_fd, &disk->d_fs, c, cur->c_cg) != 0) {
+		cur->c_lcg = -1;
+		CURSOR_ERROR(cur, cgget_errmsg());
+		return (-1);
+	}
+	cur->c_lcg = c;
+	return (1);
+}
+
+int
+ufs_cursor_getinode(struct uufsd_cursor *cur, union dinodep *dp, ino_t inum)
+{
+	struct uufsd *disk;
+	struct fs *fs;
+	ufs2_daddr_t blkno;
+	const char *errmsg;
+	caddr_t inoblock;
+
+	CURSOR_ERROR(cur, NULL);
+
+	disk = cur->c_disk;
+	fs = &disk->d_fs;
+	if (inum >= (ino_t)fs->fs_ipg * fs->fs_ncg) {
+		CURSOR_ERROR(cur, "inode number out of range");
+		return (-1);
+	}
+	if (inum < cur->c_inomin || inum >= cur->c_inomax) {
+		cur->c_inomin = cur->c_inomax = 0;
+		blkno = fsbtodb(fs, ino_to_fsba(fs, inum));
+		if (disk->d_map != NULL) {
+			/* Point straight into the mapped inode block. */
+			inoblock = ufs_disk_mapped(disk, blkno, fs->fs_bsize);
+			if (inoblock == NULL) {
+				CURSOR_ERROR(cur,
+				    "block outside of mapped disk");
+				return (-1);
+			}
+			cur->c_inoblock = inoblock;
+		} else if (ufs_disk_pread(disk, blkno, cur->c_inoblock,
+		    fs->fs_bsize, &errmsg) == -1) {
+			CURSOR_ERROR(cur, errmsg);
+			return (-1);
+		}
+		cur->c_inomin = inum - (inum % INOPB(fs));
+		cur->c_inomax = cur->c_inomin + INOPB(fs);
+	}
+	inoblock = cur->c_inoblock;
+	switch (disk->d_ufs) {
+	case 1:
+		cur->c_dp.dp1 =
+		    &((struct ufs1_dinode *)inoblock)[inum - cur->c_inomin];
+		if (dp != NULL)
+			*dp = cur->c_dp;
+		return (0);
+	case 2:
+		cur->c_dp.dp2 =
+		    &((struct ufs2_dinode *)inoblock)[inum - cur->c_inomin];
+		if (dp != NULL)
+			*dp = cur->c_dp;
+		if (ffs_verify_dinode_ckhash(fs, cur->c_dp.dp2) == 0)
+			return (0);
+		CURSOR_ERROR(cur,
+		    "check-hash failed for inode read from disk");
+		return (-1);
+	default:
+		break;
+	}
+	CURSOR_ERROR(cur, "unknown UFS filesystem type");
+	return (-1);
+}
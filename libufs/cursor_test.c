@@ -0,0 +1,278 @@
+//
+//  cursor_test.c
+//  libufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Scans every inode and cylinder group of an image with cursors, the
+// groups handed out to threads from a shared counter, and checks that
+// each group comes out the same as getinode() and cgread1() see it from
+// a single thread, reading the disk and through a mapping of it. With
+// -b it times the scan at 1, 2, 4 and so on up to -t threads, looking
+// at one field of each inode instead of hashing all of them.
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#include "bench.h"
+
+#define	MAXTHREADS	64
+
+struct scan {
+	struct uufsd	*s_disk;
+	struct uufsd_cursor *s_cur[MAXTHREADS];
+	int		s_nthreads;
+	int		s_check;	/* hash everything, not just look */
+	int		s_nextcg;	/* next group to hand out */
+	uint64_t	*s_sum;		/* per group */
+};
+
+/* FNV-1a, over what a group's inodes and summary look like. */
+static uint64_t
+hash(uint64_t h, const void *buf, size_t len)
+{
+	const unsigned char *p;
+
+	if (h == 0)
+		h = 0xcbf29ce484222325ULL;
+	for (p = buf; len-- > 0; p++)
+		h = (h ^ *p) * 0x100000001b3ULL;
+	return (h);
+}
+
+/*
+ * Fold inode ino into h. An inode that fails its check-hash still
+ * counts, flagged; one that couldn't be read at all is a failure.
+ */
+static uint64_t
+hashinode(uint64_t h, struct uufsd *disk, union dinodep dp, int ret,
+    ino_t ino, const char *error)
+{
+
+	if (dp.dp2 == NULL) {
+		bench_fail("inode %ju: %s", (uintmax_t)ino, error);
+		return (h);
+	}
+	h = hash(h, &ret, sizeof(ret));
+	return (hash(h, dp.dp2, disk->d_ufs == 1 ?
+	    sizeof(struct ufs1_dinode) : sizeof(struct ufs2_dinode)));
+}
+
+static uint64_t
+hashcg(uint64_t h, const struct cg *cgp)
+{
+
+	h = hash(h, &cgp->cg_cs, sizeof(cgp->cg_cs));
+	return (hash(h, &cgp->cg_initediblk, sizeof(cgp->cg_initediblk)));
+}
+
+/* The reference: getinode() and cgread1() on the disk itself. */
+static void
+scan_disk(struct uufsd *disk, uint64_t *sum)
+{
+	struct fs *fs;
+	union dinodep dp;
+	ino_t ino;
+	uint64_t h;
+	int cg, ret;
+
+	fs = &disk->d_fs;
+	for (cg = 0; cg < fs->fs_ncg; cg++) {
+		h = 0;
+		for (ino = (ino_t)cg * fs->fs_ipg;
+		    ino < (ino_t)(cg + 1) * fs->fs_ipg; ino++) {
+			dp.dp2 = NULL;
+			ret = getinode(disk, &dp, ino);
+			h = hashinode(h, disk, dp, ret, ino, disk->d_error);
+		}
+		if (cgread1(disk, cg) != 1)
+			bench_fail("cg %d: %s", cg, disk->d_error);
+		else
+			h = hashcg(h, &disk->d_cg);
+		sum[cg] = h;
+	}
+}
+
+static void *
+scan_worker(void *arg)
+{
+	struct scan *s;
+	struct uufsd_cursor *cur;
+	struct fs *fs;
+	union dinodep dp;
+	ino_t ino;
+	uint64_t h;
+	int cg, ret;
+
+	s = arg;
+	fs = &s->s_disk->d_fs;
+	/* Our cursor is the first one no one has taken. */
+	cur = NULL;
+	for (cg = 0; cg < s->s_nthreads && cur == NULL; cg++)
+		cur = __atomic_exchange_n(&s->s_cur[cg], NULL,
+		    __ATOMIC_ACQ_REL);
+	for (;;) {
+		cg = __atomic_fetch_add(&s->s_nextcg, 1, __ATOMIC_RELAXED);
+		if (cg >= fs->fs_ncg)
+			break;
+		h = 0;
+		for (ino = (ino_t)cg * fs->fs_ipg;
+		    ino < (ino_t)(cg + 1) * fs->fs_ipg; ino++) {
+			dp.dp2 = NULL;
+			ret = ufs_cursor_getinode(cur, &dp, ino);
+			if (s->s_check)
+				h = hashinode(h, s->s_disk, dp, ret, ino,
+				    cur->c_error);
+			else if (dp.dp2 != NULL)
+				h += s->s_disk->d_ufs == 1 ?
+				    dp.dp1->di_size : dp.dp2->di_size;
+		}
+		if (ufs_cursor_cgread(cur, cg) != 1)
+			bench_fail("cg %d: %s", cg, cur->c_error);
+		else
+			h = hashcg(h, cur->c_cg);
+		s->s_sum[cg] = h;
+	}
+	return (cur);
+}
+
+/* Scan the whole disk on s_nthreads threads, each with a new cursor. */
+static void
+scan_run(void *arg)
+{
+	struct scan *s;
+	pthread_t tids[MAXTHREADS];
+	void *cur;
+	int i;
+
+	s = arg;
+	for (i = 0; i < s->s_nthreads; i++)
+		if ((s->s_cur[i] = ufs_cursor_open(s->s_disk)) == NULL)
+			errx(2, "%s", s->s_disk->d_error);
+	s->s_nextcg = 0;
+	for (i = 0; i < s->s_nthreads; i++)
+		if ((errno = pthread_create(&tids[i], NULL, scan_worker,
+		    s)) != 0)
+			err(2, "pthread_create");
+	for (i = 0; i < s->s_nthreads; i++) {
+		pthread_join(tids[i], &cur);
+		ufs_cursor_close(cur);
+	}
+}
+
+static int
+disk_open(struct uufsd *disk, const char *path, int mapped)
+{
+
+	memset(disk, 0, sizeof(*disk));
+	if (mapped)
+		return (ufs_disk_fillout_mmap(disk, path, UFS_MMAP_READ));
+	return (ufs_disk_fillout(disk, path));
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: cursor_test [-b] [-t threads] image\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct uufsd disk;
+	struct scan s;
+	struct fs *fs;
+	uint64_t *want;
+	const char *path;
+	char name[64];
+	size_t bytes;
+	int bflag, ch, cg, mapped, maxthreads, n;
+
+	bflag = 0;
+	maxthreads = 8;
+	while ((ch = getopt(argc, argv, "bt:")) != -1)
+		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 't':
+			maxthreads = (int)strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || maxthreads < 1 || maxthreads > MAXTHREADS)
+		usage();
+	path = argv[0];
+
+	if (disk_open(&disk, path, 0) == -1)
+		errx(2, "%s: %s", path, disk.d_error);
+	fs = &disk.d_fs;
+	if ((want = calloc(fs->fs_ncg, sizeof(*want))) == NULL)
+		err(2, "calloc");
+	scan_disk(&disk, want);
+	ufs_disk_close(&disk);
+
+	for (mapped = 0; mapped <= 1; mapped++) {
+		if (disk_open(&disk, path, mapped) == -1)
+			errx(2, "%s: %s", path, disk.d_error);
+		fs = &disk.d_fs;
+		memset(&s, 0, sizeof(s));
+		s.s_disk = &disk;
+		s.s_check = 1;
+		if ((s.s_sum = calloc(fs->fs_ncg, sizeof(*s.s_sum))) == NULL)
+			err(2, "calloc");
+		for (n = 1; n <= maxthreads; n *= 2) {
+			s.s_nthreads = n;
+			memset(s.s_sum, 0, fs->fs_ncg * sizeof(*s.s_sum));
+			scan_run(&s);
+			for (cg = 0; cg < fs->fs_ncg; cg++)
+				if (s.s_sum[cg] != want[cg])
+					bench_fail("%s, %d threads: cg %d "
+					    "differs", mapped ? "mmap" :
+					    "pread", n, cg);
+		}
+		printf("%s: %d cylinder groups checked at 1 to %d threads\n",
+		    mapped ? "mmap" : "pread", fs->fs_ncg, maxthreads);
+		if (bflag) {
+			s.s_check = 0;
+			bytes = (size_t)fs->fs_ncg * fs->fs_ipg *
+			    (disk.d_ufs == 1 ? sizeof(struct ufs1_dinode) :
+			    sizeof(struct ufs2_dinode));
+			for (n = 1; n <= maxthreads; n *= 2) {
+				s.s_nthreads = n;
+				snprintf(name, sizeof(name),
+				    "scan %s %d thread%s",
+				    mapped ? "mmap" : "pread", n,
+				    n == 1 ? "" : "s");
+				bench_report(name, bench_time(scan_run, &s),
+				    bytes);
+			}
+		}
+		free(s.s_sum);
+		ufs_disk_close(&disk);
+	}
+	free(want);
+	return (bench_done());
+}
@@ -0,0 +1,307 @@
+//
+//  direct.c
+//  libufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Direct I/O. A disk opened with ufs_disk_fillout_direct() gets a second
+// descriptor that bypasses the buffer cache (O_DIRECT, or F_NOCACHE on
+// macOS), and bread(), bwrite(), the asynchronous calls and cursors do
+// their I/O through it, so scanning a whole device neither copies every
+// block through the cache nor pushes everything else out of it. sbget(),
+// cgget() and the other calls that are only handed d_fd keep going
+// through the cache, which the kernel keeps coherent with the direct
+// descriptor.
+//
+// O_DIRECT wants the buffer, the offset and the length aligned to the
+// device's logical block size. Whatever isn't is bounced through one of
+// UFS_DIO_NBUF buffers allocated when the disk is opened, so nothing is
+// allocated while doing I/O: a read covers the aligned span and copies
+// out what was asked for, a write first reads the partial blocks at
+// either end.
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/disk.h>
+#include <freebsd/compat.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <libufs.h>
+
+struct uufsd_dio {
+	int		 dio_fd;	/* descriptor bypassing the cache */
+	size_t		 dio_align;	/* of buffers, offsets and lengths */
+	char		*dio_mem;	/* the bounce buffers */
+	char		*dio_free[UFS_DIO_NBUF];
+	int		 dio_nfree;
+	pthread_mutex_t	 dio_lock;
+	pthread_cond_t	 dio_freed;
+};
+
+static int
+dio_open(struct uufsd *disk, int flags)
+{
+	int fd;
+
+#ifdef O_DIRECT
+	fd = open(disk->d_name, flags | O_DIRECT);
+#else
+	fd = open(disk->d_name, flags);
+#ifdef F_NOCACHE
+	if (fd != -1 && fcntl(fd, F_NOCACHE, 1) == -1) {
+		close(fd);
+		fd = -1;
+	}
+#endif
+#endif
+	return (fd);
+}
+
+/*
+ * What the direct descriptor's I/O has to be aligned to: the logical
+ * block size of a device, and for an image file a page, which is at
+ * least what any file system underneath asks for.
+ */
+static size_t
+dio_alignment(int fd)
+{
+	struct stat st;
+	long pgsz;
+#ifdef __linux__
+	int ssize;
+#else
+	uint32_t ssize;
+#endif
+
+	pgsz = sysconf(_SC_PAGESIZE);
+	if (fstat(fd, &st) == -1 || S_ISREG(st.st_mode))
+		return (pgsz);
+#ifdef __linux__
+	if (ioctl(fd, BLKSSZGET, &ssize) == 0 && ssize > 0 &&
+	    powerof2(ssize))
+		return (ssize);
+#else
+	if (ioctl(fd, DKIOCGETBLOCKSIZE, &ssize) == 0 && ssize > 0 &&
+	    powerof2(ssize))
+		return (ssize);
+#endif
+	return (pgsz);
+}
+
+int
+ufs_disk_fillout_direct(struct uufsd *disk, const char *name)
+{
+	struct uufsd_dio *dio;
+	int i;
+
+	if (ufs_disk_fillout_blank(disk, name) == -1)
+		return (-1);
+	if ((dio = calloc(1, sizeof(*dio))) == NULL) {
+		ERROR(disk, "could not allocate direct I/O state");
+		goto fail;
+	}
+	if ((dio->dio_fd = dio_open(disk, O_RDONLY)) == -1) {
+		free(dio);
+		ERROR(disk, "could not open disk for direct I/O");
+		goto fail;
+	}
+	dio->dio_align = dio_alignment(dio->dio_fd);
+	if (UFS_DIO_BUFSIZE % dio->dio_align != 0 ||
+	    posix_memalign((void **)&dio->dio_mem, dio->dio_align,
+	    UFS_DIO_NBUF * UFS_DIO_BUFSIZE) != 0) {
+		close(dio->dio_fd);
+		free(dio);
+		ERROR(disk, "could not allocate bounce buffers");
+		goto fail;
+	}
+	for (i = 0; i < UFS_DIO_NBUF; i++)
+		dio->dio_free[i] = dio->dio_mem + i * UFS_DIO_BUFSIZE;
+	dio->dio_nfree = UFS_DIO_NBUF;
+	pthread_mutex_init(&dio->dio_lock, NULL);
+	pthread_cond_init(&dio->dio_freed, NULL);
+	disk->d_dio = dio;
+	if (sbread(disk) == -1) {
+		ERROR(disk, "could not read superblock to fill out disk");
+		goto fail;
+	}
+	return (0);
+fail:
+	ufs_disk_close(disk);
+	return (-1);
+}
+
+/*
+ * Reopen the direct descriptor for writing, for ufs_disk_write().
+ */
+int
+ufs_disk_dio_reopen(struct uufsd *disk)
+{
+	struct uufsd_dio *dio;
+	int fd;
+
+	if ((dio = disk->d_dio) == NULL)
+		return (0);
+	if ((fd = dio_open(disk, O_RDWR)) == -1)
+		return (-1);
+	close(dio->dio_fd);
+	dio->dio_fd = fd;
+	return (0);
+}
+
+void
+ufs_disk_dio_release(struct uufsd *disk)
+{
+	struct uufsd_dio *dio;
+
+	if ((dio = disk->d_dio) == NULL)
+		return;
+	close(dio->dio_fd);
+	pthread_cond_destroy(&dio->dio_freed);
+	pthread_mutex_destroy(&dio->dio_lock);
+	free(dio->dio_mem);
+	free(dio);
+	disk->d_dio = NULL;
+}
+
+int
+ufs_disk_dio_fd(struct uufsd *disk)
+{
+
+	return (disk->d_dio != NULL ? disk->d_dio->dio_fd : disk->d_fd);
+}
+
+/*
+ * Whether size bytes at offset can go through the direct descriptor as
+ * they are; data may be NULL to only ask about offset and size.
+ */
+int
+ufs_disk_dio_aligned(struct uufsd *disk, const void *data, size_t size,
+    off_t offset)
+{
+	size_t align;
+
+	align = disk->d_dio->dio_align;
+	return ((uintptr_t)data % align == 0 && size % align == 0 &&
+	    offset % align == 0);
+}
+
+/*
+ * A bounce buffer of UFS_DIO_BUFSIZE bytes, or NULL if all are in use and
+ * wait is 0.
+ */
+void *
+ufs_disk_dio_get(struct uufsd_dio *dio, int wait)
+{
+	void *buf;
+
+	pthread_mutex_lock(&dio->dio_lock);
+	while (dio->dio_nfree == 0 && wait)
+		pthread_cond_wait(&dio->dio_freed, &dio->dio_lock);
+	buf = NULL;
+	if (dio->dio_nfree > 0)
+		buf = dio->dio_free[--dio->dio_nfree];
+	pthread_mutex_unlock(&dio->dio_lock);
+	return (buf);
+}
+
+void
+ufs_disk_dio_put(struct uufsd_dio *dio, void *buf)
+{
+
+	pthread_mutex_lock(&dio->dio_lock);
+	dio->dio_free[dio->dio_nfree++] = buf;
+	pthread_cond_signal(&dio->dio_freed);
+	pthread_mutex_unlock(&dio->dio_lock);
+}
+
+/*
+ * pread() or pwrite() through the direct descriptor, bouncing what isn't
+ * aligned a buffer at a time. Returns what pread() or pwrite() would
+ * have, the bytes moved or -1 with errno set. Safe to call from several
+ * threads at once.
+ */
+ssize_t
+ufs_disk_dio(struct uufsd *disk, void *data, size_t size, off_t offset,
+    int write)
+{
+	struct uufsd_dio *dio;
+	char *buf;
+	off_t start, end, pos, tail;
+	size_t align, done, len, skip;
+	ssize_t cnt;
+
+	dio = disk->d_dio;
+	if (ufs_disk_dio_aligned(disk, data, size, offset))
+		return (write ? pwrite(dio->dio_fd, data, size, offset) :
+		    pread(dio->dio_fd, data, size, offset));
+	align = dio->dio_align;
+	buf = ufs_disk_dio_get(dio, 1);
+	cnt = 0;
+	for (done = 0; done < size; done += len) {
+		pos = offset + done;
+		start = pos - pos % align;
+		skip = pos - start;
+		len = MIN(size - done, UFS_DIO_BUFSIZE - skip);
+		end = roundup(pos + len, align);
+		if (!write) {
+			cnt = pread(dio->dio_fd, buf, end - start, start);
+			if (cnt < (ssize_t)(skip + len)) {
+				if (cnt > (ssize_t)skip) {
+					memcpy((char *)data + done, buf + skip,
+					    cnt - skip);
+					done += cnt - skip;
+				}
+				break;
+			}
+			memcpy((char *)data + done, buf + skip, len);
+			continue;
+		}
+		/* Past the end of an image the partial blocks read short. */
+		if (skip != 0 || (size_t)(end - start) != len) {
+			memset(buf, 0, end - start);
+			if (skip != 0 &&
+			    (cnt = pread(dio->dio_fd, buf, align, start)) == -1)
+				break;
+			tail = end - align;
+			if ((pos + len) % align != 0 &&
+			    (skip == 0 || tail != start) &&
+			    (cnt = pread(dio->dio_fd, buf + (tail - start),
+			    align, tail)) == -1)
+				break;
+		}
+		memcpy(buf + skip, (char *)data + done, len);
+		cnt = pwrite(dio->dio_fd, buf, end - start, start);
+		if (cnt != end - start) {
+			if (cnt > (ssize_t)skip)
+				done += MIN(cnt - skip, len);
+			break;
+		}
+	}
+	ufs_disk_dio_put(dio, buf);
+	if (cnt == -1 && done == 0)
+		return (-1);
+	return (done);
+}
@@ -0,0 +1,379 @@
+//
+//  extent.c
+//  libufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Where a file's blocks are. ufs_file_extents() walks an inode's block
+// pointers and hands back runs of blocks that follow each other both in
+// the file and on disk, so the caller can read or copy a run at a time
+// and never has to know about indirect blocks.
+//
+// Only the run being built is kept, so a file of any size is mapped in
+// constant memory. Indirect blocks are read EXT_BATCH at a time with
+// bread_async(), siblings that are next to each other on disk in one
+// request, so a big file costs one wait per batch rather than one per
+// indirect block. On a mapped disk they are looked at where they are.
+//
+// ufs_cursor_file_extents() does the same through a cursor, for threads
+// sharing a disk. The asynchronous queue belongs to the disk, so there
+// each run of siblings is read with ufs_cursor_bread() instead.
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libufs.h>
+
+#define	EXT_BATCH	16	/* indirect blocks read at once */
+
+/* An indirect block and the part of the file it maps. */
+struct indir {
+	ufs2_daddr_t	 in_blkno;
+	int64_t		 in_lbn;	/* first block mapped */
+	int		 in_level;	/* 0 maps data blocks */
+	caddr_t		 in_data;
+};
+
+struct walk {
+	struct uufsd	*w_disk;
+	struct uufsd_cursor *w_cur;	/* read through this if set */
+	struct fs	*w_fs;
+	int		 w_flags;
+	int64_t		 w_lastlbn;	/* last block before EOF */
+	struct ufs_extent w_run;	/* being built, not reported yet */
+	int		(*w_fn)(void *, const struct ufs_extent *);
+	void		*w_arg;
+	caddr_t		 w_buf[UFS_NIADDR]; /* EXT_BATCH blocks per depth */
+};
+
+static int walk_batch(struct walk *, int, struct indir *, int);
+static int walk_file(struct walk *, union dinodep);
+
+/*
+ * ERROR() for the disk or the cursor walked through.
+ */
+static void
+walk_error(struct walk *w, const char *str)
+{
+
+	if (w->w_cur != NULL)
+		CURSOR_ERROR(w->w_cur, str);
+	else
+		ERROR(w->w_disk, str);
+}
+
+/*
+ * Add frags [blkno, blkno + nfrags) at block lbn to the run being built,
+ * reporting the run first if they don't continue it.
+ */
+static int
+walk_add(struct walk *w, int64_t lbn, ufs2_daddr_t blkno, int64_t nfrags,
+    int flags)
+{
+	struct ufs_extent *run;
+	int ret;
+
+	run = &w->w_run;
+	if (run->ue_nfrags != 0 && run->ue_flags == flags &&
+	    run->ue_nfrags % w->w_fs->fs_frag == 0 &&
+	    run->ue_lbn + run->ue_nfrags / w->w_fs->fs_frag == lbn &&
+	    run->ue_blkno + run->ue_nfrags == blkno) {
+		run->ue_nfrags += nfrags;
+		return (0);
+	}
+	if (run->ue_nfrags != 0 && (ret = w->w_fn(w->w_arg, run)) != 0)
+		return (ret);
+	run->ue_lbn = lbn;
+	run->ue_blkno = blkno;
+	run->ue_nfrags = nfrags;
+	run->ue_flags = flags;
+	return (0);
+}
+
+/*
+ * The data blocks mapped by level 0 indirect block ip. Every block in a
+ * file's indirect blocks is a full one, so a block that continues the
+ * run just makes it longer; this is where nearly all of a big file's
+ * blocks go by, and the only place they are looked at one at a time.
+ */
+static int
+walk_data(struct walk *w, struct indir *ip)
+{
+	struct ufs_extent *run;
+	ufs2_daddr_t bn, next;
+	int64_t lbn, nextlbn;
+	int frag, i, n, ret;
+
+	frag = w->w_fs->fs_frag;
+	n = MIN(NINDIR(w->w_fs), w->w_lastlbn - ip->in_lbn + 1);
+	run = &w->w_run;
+	for (i = 0; i < n; i++) {
+		/* Where the run would go on, if it is made of full blocks. */
+		nextlbn = run->ue_lbn + run->ue_nfrags / frag;
+		next = run->ue_blkno + run->ue_nfrags;
+		if (run->ue_flags != 0 || run->ue_nfrags % frag != 0)
+			nextlbn = -1;
+		lbn = ip->in_lbn + i;
+		if (w->w_disk->d_ufs == 1) {
+			for (; i < n; i++, lbn++, next += frag) {
+				bn = ((ufs1_daddr_t *)ip->in_data)[i];
+				if (bn != next || lbn != nextlbn)
+					break;
+				nextlbn++;
+			}
+		} else {
+			for (; i < n; i++, lbn++, next += frag) {
+				bn = ((ufs2_daddr_t *)ip->in_data)[i];
+				if (bn != next || lbn != nextlbn)
+					break;
+				nextlbn++;
+			}
+		}
+		run->ue_nfrags = next - run->ue_blkno;
+		if (i == n)
+			break;
+		if (bn != 0 && (ret = walk_add(w, lbn, bn, frag, 0)) != 0)
+			return (ret);
+	}
+	return (0);
+}
+
+/*
+ * The block pointers in indirect block ip: indirect blocks are collected
+ * and walked a batch at a time.
+ */
+static int
+walk_indir(struct walk *w, int depth, struct indir *ip)
+{
+	struct indir kids[EXT_BATCH];
+	struct fs *fs;
+	ufs2_daddr_t bn;
+	int64_t lbn, span;
+	int i, n, ret;
+
+	if (ip->in_level == 0)
+		return (walk_data(w, ip));
+	fs = w->w_fs;
+	for (span = 1, i = 0; i < ip->in_level; i++)
+		span *= NINDIR(fs);
+	n = 0;
+	lbn = ip->in_lbn;
+	for (i = 0; i < NINDIR(fs) && lbn <= w->w_lastlbn; i++, lbn += span) {
+		bn = w->w_disk->d_ufs == 1 ? ((ufs1_daddr_t *)ip->in_data)[i] :
+		    ((ufs2_daddr_t *)ip->in_data)[i];
+		if (bn == 0)
+			continue;
+		kids[n].in_blkno = bn;
+		kids[n].in_lbn = lbn;
+		kids[n].in_level = ip->in_level - 1;
+		if (++n == EXT_BATCH) {
+			if ((ret = walk_batch(w, depth + 1, kids, n)) != 0)
+				return (ret);
+			n = 0;
+		}
+	}
+	if (n > 0)
+		return (walk_batch(w, depth + 1, kids, n));
+	return (0);
+}
+
+/*
+ * Read the n indirect blocks at ind, found at the given depth below the
+ * inode, and walk each of them.
+ */
+static int
+walk_batch(struct walk *w, int depth, struct indir *ind, int n)
+{
+	struct uufsd *disk;
+	struct ufs_extent ext;
+	struct fs *fs;
+	caddr_t buf;
+	int i, j, ret;
+
+	disk = w->w_disk;
+	fs = w->w_fs;
+	for (i = 0; i < n; i++) {
+		if (ind[i].in_blkno < 0 || ind[i].in_blkno >= fs->fs_size) {
+			errno = EINVAL;
+			walk_error(w, "indirect block out of range");
+			return (-1);
+		}
+	}
+	if (disk->d_map != NULL) {
+		for (i = 0; i < n; i++) {
+			ind[i].in_data = ufs_disk_mapped(disk,
+			    fsbtodb(fs, ind[i].in_blkno), fs->fs_bsize);
+			if (ind[i].in_data == NULL) {
+				walk_error(w, "block outside of mapped disk");
+				return (-1);
+			}
+		}
+	} else {
+		if ((buf = w->w_buf[depth]) == NULL &&
+		    (buf = w->w_buf[depth] = malloc((size_t)EXT_BATCH *
+		    fs->fs_bsize)) == NULL) {
+			walk_error(w, "unable to allocate indirect blocks");
+			return (-1);
+		}
+		/* Blocks next to each other on disk are read together. */
+		for (i = 0; i < n; i = j) {
+			for (j = i + 1; j < n && ind[j].in_blkno ==
+			    ind[j - 1].in_blkno + fs->fs_frag; j++)
+				continue;
+			if (w->w_cur != NULL) {
+				if (ufs_cursor_bread(w->w_cur,
+				    fsbtodb(fs, ind[i].in_blkno),
+				    buf + (size_t)i * fs->fs_bsize,
+				    (size_t)(j - i) * fs->fs_bsize) == -1)
+					return (-1);
+			} else if (bread_async(disk,
+			    fsbtodb(fs, ind[i].in_blkno),
+			    buf + (size_t)i * fs->fs_bsize,
+			    (size_t)(j - i) * fs->fs_bsize) == -1) {
+				(void)ufs_disk_flush(disk);
+				return (-1);
+			}
+		}
+		if (w->w_cur == NULL && ufs_disk_flush(disk) == -1)
+			return (-1);
+		for (i = 0; i < n; i++)
+			ind[i].in_data = buf + (size_t)i * fs->fs_bsize;
+	}
+	for (i = 0; i < n; i++) {
+		if (w->w_flags & UFS_EXTENTS_INDIR) {
+			ext.ue_lbn = ind[i].in_lbn;
+			ext.ue_blkno = ind[i].in_blkno;
+			ext.ue_nfrags = fs->fs_frag;
+			ext.ue_flags = UFS_EXTENT_INDIR;
+			if ((ret = w->w_fn(w->w_arg, &ext)) != 0)
+				return (ret);
+		}
+		if ((ret = walk_indir(w, depth, &ind[i])) != 0)
+			return (ret);
+	}
+	return (0);
+}
+
+/*
+ * Walk the blocks of inode dp, set up in w.
+ */
+static int
+walk_file(struct walk *w, union dinodep dp)
+{
+	struct indir top[UFS_NIADDR];
+	struct fs *fs;
+	ufs2_daddr_t bn;
+	uint64_t size;
+	int64_t lbn, span, last;
+	int i, n, ret, ufs1;
+
+	fs = w->w_fs;
+	ufs1 = w->w_disk->d_ufs == 1;
+	size = ufs1 ? dp.dp1->di_size : dp.dp2->di_size;
+	w->w_lastlbn = lblkno(fs, size + fs->fs_bsize - 1) - 1;
+	/* Devices keep a number in di_db, short symlinks their target. */
+	switch ((ufs1 ? dp.dp1->di_mode : dp.dp2->di_mode) & IFMT) {
+	case IFREG:
+	case IFDIR:
+		break;
+	case IFLNK:
+		if (size < (uint64_t)fs->fs_maxsymlinklen ||
+		    (fs->fs_maxsymlinklen == 0 && (ufs1 ?
+		    dp.dp1->di_blocks : dp.dp2->di_blocks) == 0))
+			w->w_lastlbn = -1;
+		break;
+	default:
+		w->w_lastlbn = -1;
+		break;
+	}
+	ret = 0;
+	for (lbn = 0; lbn < UFS_NDADDR && lbn <= w->w_lastlbn; lbn++) {
+		bn = ufs1 ? dp.dp1->di_db[lbn] : dp.dp2->di_db[lbn];
+		if (bn != 0 && (ret = walk_add(w, lbn, bn,
+		    numfrags(fs, sblksize(fs, size, lbn)), 0)) != 0)
+			goto done;
+	}
+	n = 0;
+	span = NINDIR(fs);
+	for (i = 0; i < UFS_NIADDR && lbn <= w->w_lastlbn; i++) {
+		bn = ufs1 ? dp.dp1->di_ib[i] : dp.dp2->di_ib[i];
+		if (bn != 0) {
+			top[n].in_blkno = bn;
+			top[n].in_lbn = lbn;
+			top[n].in_level = i;
+			n++;
+		}
+		lbn += span;
+		span *= NINDIR(fs);
+	}
+	if (n > 0 && (ret = walk_batch(w, 0, top, n)) != 0)
+		goto done;
+	if (!ufs1 && dp.dp2->di_extsize > 0) {
+		size = dp.dp2->di_extsize;
+		last = lblkno(fs, size + fs->fs_bsize - 1) - 1;
+		for (lbn = 0; lbn < UFS_NXADDR && lbn <= last; lbn++) {
+			bn = dp.dp2->di_extb[lbn];
+			if (bn != 0 && (ret = walk_add(w, lbn, bn,
+			    numfrags(fs, sblksize(fs, size, lbn)),
+			    UFS_EXTENT_EXTATTR)) != 0)
+				goto done;
+		}
+	}
+	if (w->w_run.ue_nfrags != 0)
+		ret = w->w_fn(w->w_arg, &w->w_run);
+done:
+	for (i = 0; i < UFS_NIADDR; i++)
+		free(w->w_buf[i]);
+	return (ret);
+}
+
+int
+ufs_file_extents(struct uufsd *disk, union dinodep dp, int flags,
+    int (*fn)(void *, const struct ufs_extent *), void *arg)
+{
+	struct walk w;
+
+	ERROR(disk, NULL);
+
+	memset(&w, 0, sizeof(w));
+	w.w_disk = disk;
+	w.w_fs = &disk->d_fs;
+	w.w_flags = flags;
+	w.w_fn = fn;
+	w.w_arg = arg;
+	return (walk_file(&w, dp));
+}
+
+int
+ufs_cursor_file_extents(struct uufsd_cursor *cur, union dinodep dp,
+    int flags, int (*fn)(void *, const struct ufs_extent *), void *arg)
+{
+	struct walk w;
+
+	CURSOR_ERROR(cur, NULL);
+
+	memset(&w, 0, sizeof(w));
+	w.w_disk = cur->c_disk;
+	w.w_cur = cur;
+	w.w_fs = &cur->c_disk->d_fs;
+	w.w_flags = flags;
+	w.w_fn = fn;
+	w.w_arg = arg;
+	return (walk_file(&w, dp));
+}
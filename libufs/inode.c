@@ -31,7 +31,9 @@
 __FBSDID("$FreeBSD$");
 
 #include <sys/param.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
+#include <sys/queue.h>
 #include <freebsd/disklabel.h>
 #include <sys/stat.h>
 
@@ -50,6 +52,269 @@ __FBSDID("$FreeBSD$");
 
 #include <libufs.h>
 
+/*
+ * Inode block cache. By default getinode() keeps only the last inode
+ * block it read and putinode() writes it straight back. After
+ * ufs_disk_inocache() the last n blocks used are kept instead, and
+ * putinode() only marks its block dirty; dirty blocks go back to the disk
+ * when they fall off the end of the LRU, and all of them, sorted and
+ * queued together, on ufs_disk_inosync() and ufs_disk_close().
+ *
+ * bwrite() updates cached copies of what it writes, and bread() sees
+ * dirty inode blocks that haven't been written back yet.
+ */
+struct icblk {
+	TAILQ_ENTRY(icblk) ib_lru;	/* most recently used first */
+	LIST_ENTRY(icblk) ib_hash;
+	ufs2_daddr_t	ib_blkno;	/* -1 if empty */
+	int		ib_dirty;
+	caddr_t		ib_data;
+};
+
+struct uufsd_icache {
+	int		ic_nblocks;
+	int		ic_ndirty;
+	u_long		ic_hashmask;
+	LIST_HEAD(, icblk) *ic_hash;
+	TAILQ_HEAD(icblk_lru, icblk) ic_lru;
+	struct icblk	*ic_cur;	/* block d_dp points into */
+	struct icblk	*ic_blks;
+	struct icblk	**ic_sort;	/* scratch for ufs_disk_inosync() */
+	caddr_t		ic_mem;
+};
+
+#define	ICHASH(ic, blkno)	(&(ic)->ic_hash[(blkno) & (ic)->ic_hashmask])
+
+static struct icblk *
+icache_lookup(struct uufsd_icache *ic, ufs2_daddr_t blkno)
+{
+	struct icblk *ib;
+
+	LIST_FOREACH(ib, ICHASH(ic, blkno), ib_hash)
+		if (ib->ib_blkno == blkno)
+			return (ib);
+	return (NULL);
+}
+
+/*
+ * Make the inode block at blkno the current one, reading it in and
+ * writing back the least recently used block if need be.
+ */
+static struct icblk *
+icache_get(struct uufsd *disk, ufs2_daddr_t blkno)
+{
+	struct uufsd_icache *ic;
+	struct icblk *ib;
+	struct fs *fs;
+
+	ic = disk->d_icache;
+	fs = &disk->d_fs;
+	if ((ib = icache_lookup(ic, blkno)) == NULL) {
+		ib = TAILQ_LAST(&ic->ic_lru, icblk_lru);
+		if (ib->ib_blkno != -1) {
+			LIST_REMOVE(ib, ib_hash);
+			if (ib->ib_dirty) {
+				if (bwrite(disk, ib->ib_blkno, ib->ib_data,
+				    fs->fs_bsize) <= 0) {
+					LIST_INSERT_HEAD(ICHASH(ic, ib->ib_blkno),
+					    ib, ib_hash);
+					return (NULL);
+				}
+				ib->ib_dirty = 0;
+				ic->ic_ndirty--;
+			}
+			ib->ib_blkno = -1;
+			if (ic->ic_cur == ib) {
+				ic->ic_cur = NULL;
+				disk->d_inomin = 0;
+				disk->d_inomax = 0;
+			}
+		}
+		if (bread(disk, blkno, ib->ib_data, fs->fs_bsize) == -1)
+			return (NULL);
+		ib->ib_blkno = blkno;
+		LIST_INSERT_HEAD(ICHASH(ic, blkno), ib, ib_hash);
+	}
+	if (TAILQ_FIRST(&ic->ic_lru) != ib) {
+		TAILQ_REMOVE(&ic->ic_lru, ib, ib_lru);
+		TAILQ_INSERT_HEAD(&ic->ic_lru, ib, ib_lru);
+	}
+	ic->ic_cur = ib;
+	return (ib);
+}
+
+static void
+icache_copy(struct uufsd *disk, struct icblk *ib, off_t off, off_t end,
+    char *data, int write)
+{
+	off_t boff, lo, hi;
+
+	if (ib->ib_blkno == -1 || (!write && !ib->ib_dirty))
+		return;
+	boff = ib->ib_blkno * disk->d_bsize;
+	lo = MAX(off, boff);
+	hi = MIN(end, boff + disk->d_fs.fs_bsize);
+	/* Writing a cached block back from its own buffer copies nothing. */
+	if (lo >= hi || ib->ib_data + (lo - boff) == data + (lo - off))
+		return;
+	if (write)
+		memcpy(ib->ib_data + (lo - boff), data + (lo - off), hi - lo);
+	else
+		memcpy(data + (lo - off), ib->ib_data + (lo - boff), hi - lo);
+}
+
+/*
+ * Keep cached inode blocks and the I/O at blockno coherent: a write
+ * replaces the cached copy of what it covers, a read gets the contents
+ * of dirty blocks that are newer than the disk.
+ */
+void
+ufs_disk_icache_sync(struct uufsd *disk, ufs2_daddr_t blockno, void *data,
+    size_t size, int write)
+{
+	struct uufsd_icache *ic;
+	struct icblk *ib;
+	off_t off, end, bsize, a;
+	int i;
+
+	if ((ic = disk->d_icache) == NULL || (!write && ic->ic_ndirty == 0))
+		return;
+	bsize = disk->d_fs.fs_bsize;
+	off = blockno * disk->d_bsize;
+	end = off + size;
+	/* Inode blocks are fs_bsize aligned; look them up if that's less work. */
+	if (size / bsize + 2 <= (size_t)ic->ic_nblocks) {
+		for (a = off - off % bsize; a < end; a += bsize)
+			if ((ib = icache_lookup(ic, a / disk->d_bsize)) != NULL)
+				icache_copy(disk, ib, off, end, data, write);
+	} else {
+		for (i = 0; i < ic->ic_nblocks; i++)
+			icache_copy(disk, &ic->ic_blks[i], off, end, data,
+			    write);
+	}
+}
+
+static int
+icache_cmp(const void *a, const void *b)
+{
+	const struct icblk *ia = *(struct icblk * const *)a;
+	const struct icblk *ib = *(struct icblk * const *)b;
+
+	if (ia->ib_blkno != ib->ib_blkno)
+		return (ia->ib_blkno < ib->ib_blkno ? -1 : 1);
+	return (0);
+}
+
+int
+ufs_disk_inosync(struct uufsd *disk)
+{
+	struct uufsd_icache *ic;
+	struct icblk *ib;
+	int i, n;
+
+	ERROR(disk, NULL);
+
+	if ((ic = disk->d_icache) == NULL || ic->ic_ndirty == 0)
+		return (0);
+	n = 0;
+	for (i = 0; i < ic->ic_nblocks; i++)
+		if (ic->ic_blks[i].ib_dirty)
+			ic->ic_sort[n++] = &ic->ic_blks[i];
+	qsort(ic->ic_sort, n, sizeof(*ic->ic_sort), icache_cmp);
+	for (i = 0; i < n; i++) {
+		ib = ic->ic_sort[i];
+		if (bwrite_async(disk, ib->ib_blkno, ib->ib_data,
+		    disk->d_fs.fs_bsize) == -1) {
+			(void)ufs_disk_flush(disk);
+			return (-1);
+		}
+	}
+	if (ufs_disk_flush(disk) == -1)
+		return (-1);
+	for (i = 0; i < n; i++)
+		ic->ic_sort[i]->ib_dirty = 0;
+	ic->ic_ndirty = 0;
+	return (0);
+}
+
+void
+ufs_disk_icache_release(struct uufsd *disk)
+{
+	struct uufsd_icache *ic;
+
+	if ((ic = disk->d_icache) == NULL)
+		return;
+	free(ic->ic_mem);
+	free(ic->ic_sort);
+	free(ic->ic_blks);
+	free(ic->ic_hash);
+	free(ic);
+	disk->d_icache = NULL;
+	disk->d_inomin = 0;
+	disk->d_inomax = 0;
+}
+
+int
+ufs_disk_inocache(struct uufsd *disk, int nblocks)
+{
+	struct uufsd_icache *ic;
+	struct icblk *ib;
+	u_long nhash;
+	int i;
+
+	ERROR(disk, NULL);
+
+	if (disk->d_map != NULL) {
+		errno = EINVAL;
+		ERROR(disk, "mapped disks don't use the inode cache");
+		return (-1);
+	}
+	if (disk->d_ufs == 0) {
+		errno = EINVAL;
+		ERROR(disk, "no superblock read");
+		return (-1);
+	}
+	if (ufs_disk_inosync(disk) == -1)
+		return (-1);
+	ufs_disk_icache_release(disk);
+	/* Whatever is in d_inoblock may be stale now. */
+	disk->d_inomin = 0;
+	disk->d_inomax = 0;
+	if (nblocks <= 0)
+		return (0);
+
+	for (nhash = 1; nhash < (u_long)nblocks; nhash <<= 1)
+		;
+	if ((ic = calloc(1, sizeof(*ic))) == NULL ||
+	    (ic->ic_hash = calloc(nhash, sizeof(*ic->ic_hash))) == NULL ||
+	    (ic->ic_blks = calloc(nblocks, sizeof(*ic->ic_blks))) == NULL ||
+	    (ic->ic_sort = calloc(nblocks, sizeof(*ic->ic_sort))) == NULL ||
+	    posix_memalign((void **)&ic->ic_mem, 64,
+	    (size_t)nblocks * disk->d_fs.fs_bsize) != 0) {
+		if (ic != NULL) {
+			free(ic->ic_sort);
+			free(ic->ic_blks);
+			free(ic->ic_hash);
+			free(ic);
+		}
+		ERROR(disk, "unable to allocate inode cache");
+		return (-1);
+	}
+	ic->ic_nblocks = nblocks;
+	ic->ic_hashmask = nhash - 1;
+	for (i = 0; i < (int)nhash; i++)
+		LIST_INIT(&ic->ic_hash[i]);
+	TAILQ_INIT(&ic->ic_lru);
+	for (i = 0; i < nblocks; i++) {
+		ib = &ic->ic_blks[i];
+		ib->ib_blkno = -1;
+		ib->ib_data = ic->ic_mem + (size_t)i * disk->d_fs.fs_bsize;
+		TAILQ_INSERT_TAIL(&ic->ic_lru, ib, ib_lru);
+	}
+	disk->d_icache = ic;
+	return (0);
+}
+
 int
 getinode(struct uufsd *disk, union dinodep *dp, ino_t inum)
 {
@@ -68,7 +333,19 @@ getinode(struct uufsd *disk, union dinodep *dp, ino_t inum)
 	min = disk->d_inomin;
 	max = disk->d_inomax;
 
-	if (inoblock == NULL) {
+	if (disk->d_icache != NULL) {
+		if (inum < min || inum >= max) {
+			if (icache_get(disk,
+			    fsbtodb(fs, ino_to_fsba(fs, inum))) == NULL)
+				return (-1);
+			disk->d_inomin = min = inum - (inum % INOPB(fs));
+			disk->d_inomax = min + INOPB(fs);
+		}
+		inoblock = disk->d_icache->ic_cur->ib_data;
+		goto gotit;
+	}
+
+	if (inoblock == NULL && disk->d_map == NULL) {
 		inoblock = malloc(fs->fs_bsize);
 		if (inoblock == NULL) {
 			ERROR(disk, "unable to allocate inode block");
@@ -78,7 +355,16 @@ getinode(struct uufsd *disk, union dinodep *dp, ino_t inum)
 	}
 	if (inum >= min && inum < max)
 		goto gotit;
-	bread(disk, fsbtodb(fs, ino_to_fsba(fs, inum)), inoblock, fs->fs_bsize);
+	if (disk->d_map != NULL) {
+		/* Point straight into the mapped inode block. */
+		inoblock = ufs_disk_map(disk, fsbtodb(fs, ino_to_fsba(fs, inum)),
+		    fs->fs_bsize);
+		if (inoblock == NULL)
+			return (-1);
+		disk->d_inoblock = inoblock;
+	} else
+		bread(disk, fsbtodb(fs, ino_to_fsba(fs, inum)), inoblock,
+		    fs->fs_bsize);
 	disk->d_inomin = min = (int) inum - (inum % INOPB(fs));
 	disk->d_inomax = max = (int) min + INOPB(fs);
 gotit:	switch (disk->d_ufs) {
@@ -109,6 +395,34 @@ putinode(struct uufsd *disk)
 	struct fs *fs;
 
 	fs = &disk->d_fs;
+	if (disk->d_map != NULL) {
+		/* The inode was changed in place, only the hash is left. */
+		if ((disk->d_mapprot & PROT_WRITE) == 0) {
+			errno = EROFS;
+			ERROR(disk, "disk is mapped read-only");
+			return (-1);
+		}
+		if (disk->d_ufs == 2)
+			ffs_update_dinode_ckhash(fs, disk->d_dp.dp2);
+		return (0);
+	}
+	if (disk->d_icache != NULL) {
+		struct icblk *ib;
+
+		if ((ib = disk->d_icache->ic_cur) == NULL) {
+			ERROR(disk, "No inode block allocated");
+			return (-1);
+		}
+		if (ufs_disk_write(disk) == -1)
+			return (-1);
+		if (disk->d_ufs == 2)
+			ffs_update_dinode_ckhash(fs, disk->d_dp.dp2);
+		if (!ib->ib_dirty) {
+			ib->ib_dirty = 1;
+			disk->d_icache->ic_ndirty++;
+		}
+		return (0);
+	}
 	if (disk->d_inoblock == NULL) {
 		ERROR(disk, "No inode block allocated");
 		return (-1);
@@ -67,11 +67,63 @@ struct uufsd {
 	const char *d_error;		/* human readable disk error */
 	off_t	d_sblockloc;		/* where to look for the superblock */
 	int d_mine;			/* internal flags */
+	struct uufsd_aio *d_aio;	/* asynchronous I/O state */
+	struct uufsd_icache *d_icache;	/* inode block cache */
+	struct uufsd_cgcache *d_cgcache; /* cylinder group cache */
+	char *d_map;			/* mapped disk, see mmap.c */
+	off_t d_maplen;			/* bytes mapped at d_map */
+	int d_mapprot;			/* PROT_ bits of the mapping */
+	struct uufsd_dio *d_dio;	/* direct I/O state */
 #define	d_fs	d_sbunion.d_fs
 #define	d_sb	d_sbunion.d_sb
 #define	d_cg	d_cgunion.d_cg
 };
 
+/*
+ * Per-thread view of a disk, see cursor.c. The disk it is opened on is
+ * shared and only read through it; everything a read changes lives here.
+ */
+struct uufsd_cursor {
+	struct uufsd *c_disk;		/* shared disk */
+	caddr_t c_inoblock;		/* inode block */
+	ino_t c_inomin;			/* low ino in c_inoblock */
+	ino_t c_inomax;			/* high ino in c_inoblock */
+	union dinodep c_dp;		/* pointer to currently active inode */
+	struct cg *c_cg;		/* cylinder group, fs_cgsize bytes */
+	int c_lcg;			/* last cylinder group (in c_cg) */
+	const char *c_error;		/* human readable error */
+};
+
+/*
+ * A file being written and a directory being filled, see create.c.
+ */
+struct uufsd_file;
+struct uufsd_dir;
+
+/*
+ * A run of blocks of a file that are contiguous on disk, see extent.c.
+ */
+struct ufs_extent {
+	int64_t ue_lbn;			/* first logical block */
+	ufs2_daddr_t ue_blkno;		/* first frag on disk */
+	int64_t ue_nfrags;		/* frags in the run */
+	int ue_flags;			/* UFS_EXTENT_ flags */
+};
+
+#define	UFS_EXTENT_EXTATTR	0x01	/* in the extended attribute area */
+#define	UFS_EXTENT_INDIR	0x02	/* an indirect block */
+
+/*
+ * ufs_file_extents() flags.
+ */
+#define	UFS_EXTENTS_INDIR	0x01	/* report indirect blocks too */
+
+/*
+ * ufs_disk_fillout_mmap() flags.
+ */
+#define	UFS_MMAP_READ	0x00		/* map read-only */
+#define	UFS_MMAP_WRITE	0x01		/* map read-write */
+
 /*
  * libufs macros (internal, non-exported).
  */
@@ -95,6 +147,68 @@ ERROR(struct uufsd *u, const char *str)
 	if (u != NULL)
 		u->d_error = str;
 }
+
+/*
+ * ERROR() for cursors, see cursor.c.
+ */
+static inline void
+CURSOR_ERROR(struct uufsd_cursor *cur, const char *str)
+{
+
+	if (str != NULL) {
+		fprintf(stderr, "libufs: %s", str);
+		if (errno != 0)
+			fprintf(stderr, ": %s", strerror(errno));
+		fprintf(stderr, "\n");
+	}
+	cur->c_error = str;
+}
+
+/*
+ * Drain and tear down asynchronous I/O state, see aio.c.
+ */
+void	ufs_disk_aio_release(struct uufsd *);
+
+/*
+ * Cylinder group cache, see cgroup.c.
+ */
+void	ufs_disk_cgcache_release(struct uufsd *);
+
+/*
+ * Inode block cache, see inode.c.
+ */
+void	ufs_disk_icache_release(struct uufsd *);
+void	ufs_disk_icache_sync(struct uufsd *, ufs2_daddr_t, void *, size_t,
+	    int);
+
+/*
+ * Direct I/O, see direct.c. Bounce buffers are UFS_DIO_BUFSIZE bytes and
+ * each disk has UFS_DIO_NBUF of them.
+ */
+#define	UFS_DIO_BUFSIZE	(128 * 1024)
+#define	UFS_DIO_NBUF	16
+ssize_t	ufs_disk_dio(struct uufsd *, void *, size_t, off_t, int);
+int	ufs_disk_dio_aligned(struct uufsd *, const void *, size_t, off_t);
+int	ufs_disk_dio_fd(struct uufsd *);
+void	*ufs_disk_dio_get(struct uufsd_dio *, int);
+void	ufs_disk_dio_put(struct uufsd_dio *, void *);
+void	ufs_disk_dio_release(struct uufsd *);
+int	ufs_disk_dio_reopen(struct uufsd *);
+
+/*
+ * Unmap a disk mapped by ufs_disk_fillout_mmap(), and find a block in
+ * the mapping without setting d_error, see mmap.c.
+ */
+void	*ufs_disk_mapped(struct uufsd *, ufs2_daddr_t, size_t);
+void	ufs_disk_unmap(struct uufsd *);
+
+/*
+ * Reads that don't touch the disk structure, for cursors, see block.c and
+ * cgroup.c.
+ */
+const char *cgget_errmsg(void);
+ssize_t	ufs_disk_pread(struct uufsd *, ufs2_daddr_t, void *, size_t,
+	    const char **);
 #endif	/* _LIBUFS */
 
 __BEGIN_DECLS
@@ -103,12 +217,29 @@ __BEGIN_DECLS
  * libufs prototypes.
  */
 
+/*
+ * ffs_bitmap.c
+ */
+int	ffs_bitmap_count(const u_char *, int, int);
+int	ffs_bitmap_ffc(const u_char *, int, int);
+int	ffs_bitmap_ffs(const u_char *, int, int);
+int	ffs_bitmap_findblock(struct fs *, const u_char *, int, int);
+int	ffs_bitmap_findrun(const u_char *, int, int, int);
+int	ffs_bitmap_flc(const u_char *, int, int);
+
 /*
  * ffs_subr.c
  */
 void	ffs_clrblock(struct fs *, u_char *, ufs1_daddr_t);
 void	ffs_clusteracct(struct fs *, struct cg *, ufs1_daddr_t, int);
 void	ffs_fragacct(struct fs *, int, int32_t [], int);
+void	ffs_fragtree_init(struct fs *, struct ffs_fragtree *, u_char *,
+	    u_char *);
+int	ffs_fragtree_search(struct fs *, struct ffs_fragtree *, u_char *, int,
+	    int);
+int	ffs_fragtree_size(struct fs *);
+void	ffs_fragtree_update(struct fs *, struct ffs_fragtree *, u_char *,
+	    ufs1_daddr_t, int);
 int	ffs_isblock(struct fs *, u_char *, ufs1_daddr_t);
 int	ffs_isfreeblock(struct fs *, u_char *, ufs1_daddr_t);
 void	ffs_setblock(struct fs *, u_char *, ufs1_daddr_t);
@@ -126,24 +257,86 @@ ssize_t bread(struct uufsd *, ufs2_daddr_t, void *, size_t);
 ssize_t bwrite(struct uufsd *, ufs2_daddr_t, const void *, size_t);
 int berase(struct uufsd *, ufs2_daddr_t, ufs2_daddr_t);
 
+/*
+ * aio.c
+ */
+int bread_async(struct uufsd *, ufs2_daddr_t, void *, size_t);
+int bwrite_async(struct uufsd *, ufs2_daddr_t, const void *, size_t);
+int ufs_disk_flush(struct uufsd *);
+
 /*
  * cgroup.c
  */
 ufs2_daddr_t cgballoc(struct uufsd *);
+ufs2_daddr_t cgballoc_any(struct uufsd *);
+int cgballoc_at(struct uufsd *, ufs2_daddr_t);
+long cgballoc_run(struct uufsd *, int, long, long, ufs2_daddr_t *);
 int cgbfree(struct uufsd *, ufs2_daddr_t, long);
+ufs2_daddr_t cgfalloc(struct uufsd *, int, ufs2_daddr_t, int);
 ino_t cgialloc(struct uufsd *);
+ino_t cgialloc_any(struct uufsd *);
+ino_t cgialloc_pref(struct uufsd *, int, int);
 int cgget(int, struct fs *, int, struct cg *);
 int cgput(int, struct fs *, struct cg *);
 int cgread(struct uufsd *);
 int cgread1(struct uufsd *, int);
 int cgwrite(struct uufsd *);
 int cgwrite1(struct uufsd *, int);
+int ufs_disk_cgcache(struct uufsd *, int);
+int ufs_disk_cgflush(struct uufsd *);
+
+/*
+ * create.c
+ */
+int ufs_dir_add(struct uufsd_dir *, const char *, ino_t, int);
+int ufs_dir_close(struct uufsd_dir *);
+struct uufsd_dir *ufs_dir_create(struct uufsd *, ino_t, ino_t);
+struct uufsd_dir *ufs_dir_open(struct uufsd *, ino_t);
+int ufs_dirpref(struct uufsd *, ino_t);
+int ufs_file_close(struct uufsd_file *);
+struct uufsd_file *ufs_file_create(struct uufsd *, ino_t, off_t);
+ssize_t ufs_file_write(struct uufsd_file *, const void *, size_t);
+ino_t ufs_inode_create(struct uufsd *, int, int, uint32_t);
+
+/*
+ * cursor.c
+ */
+ssize_t ufs_cursor_bread(struct uufsd_cursor *, ufs2_daddr_t, void *,
+	    size_t);
+int ufs_cursor_cgread(struct uufsd_cursor *, int);
+void ufs_cursor_close(struct uufsd_cursor *);
+int ufs_cursor_file_extents(struct uufsd_cursor *, union dinodep, int,
+	    int (*)(void *, const struct ufs_extent *), void *);
+int ufs_cursor_getinode(struct uufsd_cursor *, union dinodep *, ino_t);
+struct uufsd_cursor *ufs_cursor_open(struct uufsd *);
+
+/*
+ * direct.c
+ */
+int ufs_disk_fillout_direct(struct uufsd *, const char *);
+
+/*
+ * extent.c
+ */
+int ufs_file_extents(struct uufsd *, union dinodep, int,
+	    int (*)(void *, const struct ufs_extent *), void *);
 
 /*
  * inode.c
  */
 int getinode(struct uufsd *, union dinodep *, ino_t);
 int putinode(struct uufsd *);
+int ufs_disk_inocache(struct uufsd *, int);
+int ufs_disk_inosync(struct uufsd *);
+
+/*
+ * mmap.c
+ */
+struct cg *cgmap(struct uufsd *, int);
+struct fs *sbmap(struct uufsd *);
+int ufs_disk_advise(struct uufsd *, ufs2_daddr_t, off_t, int);
+int ufs_disk_fillout_mmap(struct uufsd *, const char *, int);
+void *ufs_disk_map(struct uufsd *, ufs2_daddr_t, size_t);
 
 /*
  * sblock.c
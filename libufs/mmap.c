@@ -0,0 +1,249 @@
+//
+//  mmap.c
+//  libufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Memory mapped disks. A disk opened with ufs_disk_fillout_mmap() has the
+// whole image or device mapped at d_map, and the accessors hand out
+// pointers into it instead of copying into the buffers in struct uufsd:
+// getinode() points d_dp straight at the inode block, cgmap() and sbmap()
+// return the cylinder group and superblock as they are on disk, and
+// bread() becomes a memcpy. Walking all the metadata of a big image then
+// costs page faults and no system calls at all.
+//
+// A read-only mapping may not be written through; bwrite() and friends
+// still go to the descriptor, which the mapping stays coherent with.
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#ifndef __linux__
+#include <sys/disk.h>
+#endif
+#include <freebsd/compat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+/*
+ * Size of what d_fd refers to, in bytes.
+ */
+static off_t
+mmap_mediasize(struct uufsd *disk)
+{
+	struct stat st;
+	uint64_t count;
+#ifndef __linux__
+	uint32_t size;
+#endif
+
+	if (fstat(disk->d_fd, &st) == -1)
+		return (-1);
+	if (S_ISREG(st.st_mode))
+		return (st.st_size);
+#ifdef __linux__
+	if (ioctl(disk->d_fd, BLKGETSIZE64, &count) == 0)
+		return ((off_t)count);
+#else
+	if (ioctl(disk->d_fd, DKIOCGETBLOCKSIZE, &size) == 0 &&
+	    ioctl(disk->d_fd, DKIOCGETBLOCKCOUNT, &count) == 0)
+		return ((off_t)count * size);
+#endif
+	return (lseek(disk->d_fd, 0, SEEK_END));
+}
+
+int
+ufs_disk_fillout_mmap(struct uufsd *disk, const char *name, int flags)
+{
+	off_t size;
+	void *map;
+	int prot;
+
+	if (ufs_disk_fillout_blank(disk, name) == -1)
+		return (-1);
+	prot = PROT_READ;
+	if (flags & UFS_MMAP_WRITE) {
+		if (ufs_disk_write(disk) == -1)
+			goto fail;
+		prot |= PROT_WRITE;
+	}
+	if ((size = mmap_mediasize(disk)) <= 0) {
+		ERROR(disk, "could not get size of disk to map");
+		goto fail;
+	}
+	if ((off_t)(size_t)size != size) {
+		errno = EFBIG;
+		ERROR(disk, "disk too big to map");
+		goto fail;
+	}
+	map = mmap(NULL, (size_t)size, prot, MAP_SHARED, disk->d_fd, 0);
+	if (map == MAP_FAILED) {
+		ERROR(disk, "could not map disk");
+		goto fail;
+	}
+	disk->d_map = map;
+	disk->d_maplen = size;
+	disk->d_mapprot = prot;
+	if (sbread(disk) == -1) {
+		ERROR(disk, "could not read superblock to fill out disk");
+		goto fail;
+	}
+	return (0);
+fail:
+	ufs_disk_close(disk);
+	return (-1);
+}
+
+void
+ufs_disk_unmap(struct uufsd *disk)
+{
+
+	if (disk->d_map == NULL)
+		return;
+	if (disk->d_mapprot & PROT_WRITE)
+		(void)msync(disk->d_map, (size_t)disk->d_maplen, MS_SYNC);
+	(void)munmap(disk->d_map, (size_t)disk->d_maplen);
+	disk->d_map = NULL;
+	disk->d_maplen = 0;
+	disk->d_mapprot = 0;
+}
+
+/*
+ * Where the size bytes at blockno are mapped, or NULL with errno set.
+ * Doesn't touch the disk, so cursors can use it too.
+ */
+void *
+ufs_disk_mapped(struct uufsd *disk, ufs2_daddr_t blockno, size_t size)
+{
+	off_t offset;
+
+	if (disk->d_map == NULL) {
+		errno = ENXIO;
+		return (NULL);
+	}
+	offset = blockno * disk->d_bsize;
+	if (blockno < 0 || offset > disk->d_maplen ||
+	    (off_t)size > disk->d_maplen - offset) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	return (disk->d_map + offset);
+}
+
+void *
+ufs_disk_map(struct uufsd *disk, ufs2_daddr_t blockno, size_t size)
+{
+	void *p;
+
+	ERROR(disk, NULL);
+
+	if ((p = ufs_disk_mapped(disk, blockno, size)) == NULL) {
+		if (disk->d_map == NULL)
+			ERROR(disk, "disk is not mapped");
+		else
+			ERROR(disk, "block outside of mapped disk");
+	}
+	return (p);
+}
+
+int
+ufs_disk_advise(struct uufsd *disk, ufs2_daddr_t blockno, off_t size,
+    int advice)
+{
+	off_t offset, pgoff;
+	long pgsz;
+
+	ERROR(disk, NULL);
+
+	if (ufs_disk_map(disk, blockno, 0) == NULL)
+		return (-1);
+	offset = blockno * disk->d_bsize;
+	if (size == 0 || size > disk->d_maplen - offset)
+		size = disk->d_maplen - offset;
+	/* madvise() wants a page aligned start. */
+	pgsz = sysconf(_SC_PAGESIZE);
+	pgoff = offset % pgsz;
+	if (madvise(disk->d_map + offset - pgoff, (size_t)(size + pgoff),
+	    advice) == -1) {
+		ERROR(disk, "madvise failed");
+		return (-1);
+	}
+	return (0);
+}
+
+struct fs *
+sbmap(struct uufsd *disk)
+{
+
+	ERROR(disk, NULL);
+
+	if (disk->d_ufs == 0) {
+		errno = EINVAL;
+		ERROR(disk, "no superblock read");
+		return (NULL);
+	}
+	return (ufs_disk_map(disk, disk->d_sblock, disk->d_fs.fs_sbsize));
+}
+
+struct cg *
+cgmap(struct uufsd *disk, int c)
+{
+	struct fs *fs;
+	struct cg *cgp;
+	uint32_t calchash, zero;
+	size_t off;
+
+	ERROR(disk, NULL);
+
+	fs = &disk->d_fs;
+	if (c < 0 || c >= fs->fs_ncg) {
+		errno = EINVAL;
+		ERROR(disk, "cylinder group number out of range");
+		return (NULL);
+	}
+	cgp = ufs_disk_map(disk, fsbtodb(fs, cgtod(fs, c)), fs->fs_cgsize);
+	if (cgp == NULL)
+		return (NULL);
+	calchash = cgp->cg_ckhash;
+	if ((fs->fs_metackhash & CK_CYLGRP) != 0) {
+		/* Same as cgget(), but we can't clear cg_ckhash in place. */
+		zero = 0;
+		off = offsetof(struct cg, cg_ckhash);
+		calchash = calculate_crc32c(~0L, (void *)cgp, off);
+		calchash = calculate_crc32c(calchash, &zero, sizeof(zero));
+		off += sizeof(zero);
+		calchash = calculate_crc32c(calchash, (char *)cgp + off,
+		    fs->fs_cgsize - off);
+	}
+	if (cgp->cg_ckhash != calchash || !cg_chkmagic(cgp) ||
+	    cgp->cg_cgx != c) {
+		errno = EINTEGRITY;
+		ERROR(disk, "cylinder group checks failed");
+		return (NULL);
+	}
+	return (cgp);
+}
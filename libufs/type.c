@@ -60,13 +60,23 @@ __FBSDID("$FreeBSD$");
 int
 ufs_disk_close(struct uufsd *disk)
 {
+	int error;
+
 	ERROR(disk, NULL);
+	error = ufs_disk_inosync(disk);
+	if (ufs_disk_cgflush(disk) == -1)
+		error = -1;
+	ufs_disk_icache_release(disk);
+	ufs_disk_cgcache_release(disk);
+	ufs_disk_aio_release(disk);
+	ufs_disk_dio_release(disk);
 	close(disk->d_fd);
 	disk->d_fd = -1;
-	if (disk->d_inoblock != NULL) {
+	/* A mapped disk's inode block is in the mapping. */
+	if (disk->d_inoblock != NULL && disk->d_map == NULL)
 		free(disk->d_inoblock);
-		disk->d_inoblock = NULL;
-	}
+	disk->d_inoblock = NULL;
+	ufs_disk_unmap(disk);
 	if (disk->d_mine & MINE_NAME) {
 		free((char *)(uintptr_t)disk->d_name);
 		disk->d_name = NULL;
@@ -76,7 +86,7 @@ ufs_disk_close(struct uufsd *disk)
 		free(disk->d_si);
 		disk->d_si = NULL;
 	}
-	return (0);
+	return (error);
 }
 
 int
@@ -151,7 +161,6 @@ again:	if ((ret = stat(name, &st)) < 0) {
 		ERROR(disk, "could not find special device 2");
 		return (-1);
 	}
-    printf("opening %s\n", name);
 	fd = open(name, O_RDONLY);
 	if (fd == -1) {
 		ERROR(disk, "could not open special device 3");
@@ -170,6 +179,13 @@ again:	if ((ret = stat(name, &st)) < 0) {
 	disk->d_error = NULL;
 	disk->d_si = NULL;
 	disk->d_sblockloc = STDSB;
+	disk->d_aio = NULL;
+	disk->d_icache = NULL;
+	disk->d_cgcache = NULL;
+	disk->d_map = NULL;
+	disk->d_maplen = 0;
+	disk->d_mapprot = 0;
+	disk->d_dio = NULL;
 
 	if (oname != name) {
 		name = strdup(name);
@@ -194,6 +210,10 @@ ufs_disk_write(struct uufsd *disk)
 	if (disk->d_mine & MINE_WRITE)
 		return (0);
 
+	/* Queued requests still reference the read-only descriptor. */
+	if (ufs_disk_flush(disk) == -1)
+		return (-1);
+
 	fd = open(disk->d_name, O_RDWR);
 	if (fd < 0) {
 		ERROR(disk, "failed to open disk for writing");
@@ -202,6 +222,10 @@ ufs_disk_write(struct uufsd *disk)
 
 	close(disk->d_fd);
 	disk->d_fd = fd;
+	if (ufs_disk_dio_reopen(disk) == -1) {
+		ERROR(disk, "failed to open disk for direct writing");
+		return (-1);
+	}
 	disk->d_mine |= MINE_WRITE;
 
 	return (0);
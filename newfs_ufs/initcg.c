@@ -0,0 +1,487 @@
+/*-
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright (c) 2002 Networks Associates Technology, Inc.
+ * All rights reserved.
+ *
+ * This software was developed for the FreeBSD Project by Marshall
+ * Kirk McKusick and Network Associates Laboratories, the Security
+ * Research Division of Network Associates, Inc. under DARPA/SPAWAR
+ * contract N66001-01-C-8035 ("CBOSS"), as part of the DARPA CHATS
+ * research program.
+ *
+ * Copyright (c) 1980, 1989, 1993
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Cylinder group initialization, shared by newfs and growfs. Moved out
+ * of mkfs.c so that growfs builds the groups it adds the same way newfs
+ * builds all of them.
+ */
+#include <sys/param.h>
+#include <freebsd/disklabel.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+#include <libufs/libufs.h>
+
+#include "newfs.h"
+
+#define	sblock	disk.d_fs
+
+static pthread_mutex_t cglock = PTHREAD_MUTEX_INITIALIZER;
+static int nextcg;		/* next group for a worker, under cglock */
+static caddr_t lastbuf;		/* where the last group's iobuf goes */
+u_int32_t nextgen = 1;		/* next -R value from newfs_random() */
+
+static u_int initcg_ngen(int);
+static void *initcg_worker(void *);
+static u_int32_t cg_random(struct cgctx *);
+static void cgwtfs(ufs2_daddr_t, int, char *);
+static void setblock(struct fs *, unsigned char *, int);
+
+/*
+ * Initialize a cylinder group.
+ */
+void
+initcg(int cylno, time_t utime, struct cgctx *cc)
+{
+	long blkno, start, size;
+	uint i, j, d, dlower, dupper;
+	ufs2_daddr_t cbase, dmax;
+	struct ufs1_dinode *dp1;
+	struct ufs2_dinode *dp2;
+	struct csum *cs;
+	struct cg *cgp;
+	caddr_t iobuf;
+	long iobufsize;
+
+	/*
+	 * Determine block bounds for cylinder group.
+	 * Allow space for super block summary information in the
+	 * cylinder group it starts at the data of, the first one for
+	 * newfs, wherever growfs moved it to otherwise.
+	 */
+	cbase = cgbase(&sblock, cylno);
+	dmax = cbase + sblock.fs_fpg;
+	if (dmax > sblock.fs_size)
+		dmax = sblock.fs_size;
+	dlower = cgsblock(&sblock, cylno) - cbase;
+	dupper = cgdmin(&sblock, cylno) - cbase;
+	if (sblock.fs_csaddr == cgdmin(&sblock, cylno))
+		dupper += howmany(sblock.fs_cssize, sblock.fs_fsize);
+	cs = &cc->cc_csp[cylno];
+	cgp = cc->cc_cg;
+	iobuf = cc->cc_iobuf;
+	iobufsize = 2 * sblock.fs_bsize;
+	memset(cgp, 0, sblock.fs_cgsize);
+	cgp->cg_time = utime;
+	cgp->cg_magic = CG_MAGIC;
+	cgp->cg_cgx = cylno;
+	cgp->cg_niblk = sblock.fs_ipg;
+	cgp->cg_initediblk = initcg_ngen(cylno);
+	cgp->cg_ndblk = dmax - cbase;
+	if (sblock.fs_contigsumsize > 0)
+		cgp->cg_nclusterblks = cgp->cg_ndblk / sblock.fs_frag;
+	start = &cgp->cg_space[0] - (u_char *)(&cgp->cg_firstfield);
+	if (Oflag == 2) {
+		cgp->cg_iusedoff = start;
+	} else {
+		cgp->cg_old_ncyl = sblock.fs_old_cpg;
+		cgp->cg_old_time = cgp->cg_time;
+		cgp->cg_time = 0;
+		cgp->cg_old_niblk = cgp->cg_niblk;
+		cgp->cg_niblk = 0;
+		cgp->cg_initediblk = 0;
+		cgp->cg_old_btotoff = start;
+		cgp->cg_old_boff = cgp->cg_old_btotoff +
+		    sblock.fs_old_cpg * sizeof(int32_t);
+		cgp->cg_iusedoff = cgp->cg_old_boff +
+		    sblock.fs_old_cpg * sizeof(u_int16_t);
+	}
+	cgp->cg_freeoff = cgp->cg_iusedoff + howmany(sblock.fs_ipg, CHAR_BIT);
+	cgp->cg_nextfreeoff = cgp->cg_freeoff + howmany(sblock.fs_fpg, CHAR_BIT);
+	if (sblock.fs_contigsumsize > 0) {
+		cgp->cg_clustersumoff =
+		    roundup(cgp->cg_nextfreeoff, sizeof(u_int32_t));
+		cgp->cg_clustersumoff -= sizeof(u_int32_t);
+		cgp->cg_clusteroff = cgp->cg_clustersumoff +
+		    (sblock.fs_contigsumsize + 1) * sizeof(u_int32_t);
+		cgp->cg_nextfreeoff = cgp->cg_clusteroff +
+		    howmany(fragstoblks(&sblock, sblock.fs_fpg), CHAR_BIT);
+	}
+	if (cgp->cg_nextfreeoff > (unsigned)sblock.fs_cgsize) {
+		printf("Panic: cylinder group too big\n");
+		exit(37);
+	}
+	cgp->cg_cs.cs_nifree += sblock.fs_ipg;
+	if (cylno == 0)
+		for (i = 0; i < (long)UFS_ROOTINO; i++) {
+			setbit(cg_inosused(cgp), i);
+			cgp->cg_cs.cs_nifree--;
+		}
+	if (cylno > 0) {
+		/*
+		 * In cylno 0, beginning space is reserved
+		 * for boot and super blocks.
+		 */
+		for (d = 0; d < dlower; d += sblock.fs_frag) {
+			blkno = d / sblock.fs_frag;
+			setblock(&sblock, cg_blksfree(cgp), blkno);
+			if (sblock.fs_contigsumsize > 0)
+				setbit(cg_clustersfree(cgp), blkno);
+			cgp->cg_cs.cs_nbfree++;
+		}
+	}
+	if ((i = dupper % sblock.fs_frag)) {
+		cgp->cg_frsum[sblock.fs_frag - i]++;
+		for (d = dupper + sblock.fs_frag - i; dupper < d; dupper++) {
+			setbit(cg_blksfree(cgp), dupper);
+			cgp->cg_cs.cs_nffree++;
+		}
+	}
+	for (d = dupper; d + sblock.fs_frag <= cgp->cg_ndblk;
+	     d += sblock.fs_frag) {
+		blkno = d / sblock.fs_frag;
+		setblock(&sblock, cg_blksfree(cgp), blkno);
+		if (sblock.fs_contigsumsize > 0)
+			setbit(cg_clustersfree(cgp), blkno);
+		cgp->cg_cs.cs_nbfree++;
+	}
+	if (d < cgp->cg_ndblk) {
+		cgp->cg_frsum[cgp->cg_ndblk - d]++;
+		for (; d < cgp->cg_ndblk; d++) {
+			setbit(cg_blksfree(cgp), d);
+			cgp->cg_cs.cs_nffree++;
+		}
+	}
+	if (sblock.fs_contigsumsize > 0) {
+		int32_t *sump = cg_clustersum(cgp);
+		u_char *mapp = cg_clustersfree(cgp);
+		int map = *mapp++;
+		int bit = 1;
+		int run = 0;
+
+		for (i = 0; i < cgp->cg_nclusterblks; i++) {
+			if ((map & bit) != 0)
+				run++;
+			else if (run != 0) {
+				if (run > sblock.fs_contigsumsize)
+					run = sblock.fs_contigsumsize;
+				sump[run]++;
+				run = 0;
+			}
+			if ((i & (CHAR_BIT - 1)) != CHAR_BIT - 1)
+				bit <<= 1;
+			else {
+				map = *mapp++;
+				bit = 1;
+			}
+		}
+		if (run != 0) {
+			if (run > sblock.fs_contigsumsize)
+				run = sblock.fs_contigsumsize;
+			sump[run]++;
+		}
+	}
+	*cs = cgp->cg_cs;
+	/*
+	 * Write out the duplicate super block. Then write the cylinder
+	 * group map and two blocks worth of inodes in a single write.
+	 * The duplicate comes from the caller's copy of sblock, which has
+	 * no summary information, so sblock itself is never changed here
+	 * and the summary is left to the caller's final sbwrite().
+	 */
+	cc->cc_fs->fs_sblockactualloc =
+	    dbtob(fsbtodb(&sblock, cgsblock(&sblock, cylno)), disk.d_bsize);
+	if ((errno = sbput(disk.d_fd, cc->cc_fs, 0)) != 0)
+		err(1, "initcg: sbput: cylinder group %d", cylno);
+	if (cgput(disk.d_fd, &sblock, cgp) != 0)
+		err(1, "initcg: cgput: cylinder group %d", cylno);
+	start = 0;
+	dp1 = (struct ufs1_dinode *)(&iobuf[start]);
+	dp2 = (struct ufs2_dinode *)(&iobuf[start]);
+	for (i = 0; i < cgp->cg_initediblk; i++) {
+		if (sblock.fs_magic == FS_UFS1_MAGIC) {
+			dp1->di_gen = cg_random(cc);
+			dp1++;
+		} else {
+			dp2->di_gen = cg_random(cc);
+			dp2++;
+		}
+	}
+	size = iobufsize;
+	if (Oflag == 2 && Iflag)
+		size = howmany(cgp->cg_initediblk, INOPB(&sblock)) *
+		    sblock.fs_bsize;
+	if (size > 0)
+		cgwtfs(fsbtodb(&sblock, cgimin(&sblock, cylno)), size, iobuf);
+	/*
+	 * For the old file system, we have to initialize all the inodes.
+	 */
+	if (Oflag == 1) {
+		for (i = 2 * sblock.fs_frag;
+		     i < sblock.fs_ipg / INOPF(&sblock);
+		     i += sblock.fs_frag) {
+			dp1 = (struct ufs1_dinode *)(&iobuf[start]);
+			for (j = 0; j < INOPB(&sblock); j++) {
+				dp1->di_gen = cg_random(cc);
+				dp1++;
+			}
+			cgwtfs(fsbtodb(&sblock, cgimin(&sblock, cylno) + i),
+			    sblock.fs_bsize, &iobuf[start]);
+		}
+	}
+}
+
+/*
+ * Number of inode generation numbers initcg() draws for a cylinder group.
+ * For UFS2 this is also the number of inodes it initializes: two blocks
+ * worth, or with -I just the block holding the root inodes in group 0,
+ * leaving the rest for the kernel to initialize as they are allocated.
+ */
+static u_int
+initcg_ngen(int cylno)
+{
+	u_int i, n;
+
+	if (Oflag == 2 && Iflag)
+		return (cylno == 0 ? MIN(sblock.fs_ipg, INOPB(&sblock)) : 0);
+	if (Oflag == 2)
+		return (MIN(sblock.fs_ipg, 2 * INOPB(&sblock)));
+	n = 0;
+	for (i = 2 * sblock.fs_frag; i < sblock.fs_ipg / INOPF(&sblock);
+	     i += sblock.fs_frag)
+		n += INOPB(&sblock);
+	return (n);
+}
+
+/*
+ * First -R generation number used by a cylinder group. Only group 0 can
+ * draw a different count from the rest.
+ */
+u_int32_t
+initcg_genbase(int cylno)
+{
+
+	if (cylno == 0)
+		return (nextgen);
+	return (nextgen + initcg_ngen(0) + (cylno - 1) * initcg_ngen(1));
+}
+
+/*
+ * Initialize cylinder groups first through fs_ncg - 1 on nthreads
+ * workers. Each group only touches its own fs_csp[] slot and
+ * fs_cstotal was computed up front, so the summary comes out the same
+ * whatever order the groups finish in. The iobuf the last group leaves
+ * behind is copied to buf, if it is not NULL.
+ */
+void
+initcg_parallel(int first, time_t utime, caddr_t buf)
+{
+	pthread_t *tids;
+	int i, n;
+
+	n = MIN(nthreads, sblock.fs_ncg - first);
+	if ((tids = calloc(n, sizeof(*tids))) == NULL)
+		errx(38, "calloc failed");
+	nextcg = first;
+	lastbuf = buf;
+	for (i = 0; i < n; i++)
+		if ((errno = pthread_create(&tids[i], NULL, initcg_worker,
+		    &utime)) != 0)
+			err(38, "pthread_create");
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+static void *
+initcg_worker(void *arg)
+{
+	struct cgctx cc;
+	struct ufs1_dinode *dp1;
+	u_int ngen, j;
+	int cylno, lastcg;
+
+	ngen = initcg_ngen(1);
+	/* With -I only group 0 leaves anything behind in iobuf. */
+	lastcg = Oflag == 2 && Iflag ? 0 : sblock.fs_ncg - 1;
+	cgctx_init(&cc, calloc(1, sblock.fs_bsize),
+	    calloc(1, 2 * sblock.fs_bsize));
+	if (cc.cc_cg == NULL || cc.cc_iobuf == NULL)
+		errx(38, "Cannot allocate I/O buffer");
+	for (;;) {
+		pthread_mutex_lock(&cglock);
+		cylno = nextcg++;
+		pthread_mutex_unlock(&cglock);
+		if (cylno >= sblock.fs_ncg)
+			break;
+		cc.cc_gen = initcg_genbase(cylno);
+		/*
+		 * The UFS1 path writes its first two inode blocks straight
+		 * from iobuf, which the serial loop leaves holding the last
+		 * inode block of the previous group. Recreate that so -R
+		 * output does not depend on the number of threads.
+		 */
+		if (Rflag && Oflag == 1 && ngen > 0) {
+			dp1 = (struct ufs1_dinode *)cc.cc_iobuf;
+			for (j = 0; j < INOPB(&sblock); j++, dp1++)
+				dp1->di_gen = cylno == 0 ? 0 :
+				    cc.cc_gen - INOPB(&sblock) + j;
+		}
+		initcg(cylno, *(time_t *)arg, &cc);
+		/* fsinit() reuses iobuf, leave it as the serial loop would. */
+		if (cylno == lastcg && lastbuf != NULL)
+			memcpy(lastbuf, cc.cc_iobuf, 2 * sblock.fs_bsize);
+	}
+	free(cc.cc_iobuf);
+	free(cc.cc_cg);
+	cgctx_free(&cc);
+	return (NULL);
+}
+
+/*
+ * Set up cc to build groups in cgp with iobuf. The summary array and the
+ * copy of sblock the duplicate super blocks are written from are taken
+ * here, once the caller is done setting sblock up, so that initcg()
+ * never has to go through sblock.fs_si.
+ */
+void
+cgctx_init(struct cgctx *cc, struct cg *cgp, caddr_t iobuf)
+{
+
+	cc->cc_cg = cgp;
+	cc->cc_iobuf = iobuf;
+	cc->cc_gen = 0;
+	cc->cc_csp = sblock.fs_csp;
+	if ((cc->cc_fs = malloc(sblock.fs_sbsize)) == NULL)
+		errx(38, "Cannot allocate super block copy");
+	memcpy(cc->cc_fs, &sblock, sblock.fs_sbsize);
+	cc->cc_fs->fs_si = NULL;
+}
+
+void
+cgctx_free(struct cgctx *cc)
+{
+
+	free(cc->cc_fs);
+	cc->cc_fs = NULL;
+}
+
+/*
+ * Inode generation numbers for initcg(). Under -R each cylinder group
+ * draws from its own slice of the newfs_random() sequence.
+ */
+static u_int32_t
+cg_random(struct cgctx *cc)
+{
+
+	if (Rflag)
+		return (cc->cc_gen++);
+	return (arc4random());
+}
+
+/*
+ * possibly write to disk
+ */
+void
+wtfs(ufs2_daddr_t bno, int size, char *bf)
+{
+	if (Nflag)
+		return;
+	if (bwrite(&disk, part_ofs + bno, bf, size) < 0)
+		err(36, "wtfs: %d bytes at sector %jd", size, (intmax_t)bno);
+}
+
+/*
+ * wtfs() for initcg(). bwrite() reports errors in the shared
+ * disk.d_error, so workers write with pwrite() and report their own.
+ */
+static void
+cgwtfs(ufs2_daddr_t bno, int size, char *bf)
+{
+	ssize_t n;
+
+	if (Nflag)
+		return;
+	n = pwrite(disk.d_fd, bf, size, (part_ofs + bno) * disk.d_bsize);
+	if (n == size)
+		return;
+	if (n >= 0)
+		errno = EIO;
+	err(36, "wtfs: %d bytes at sector %jd", size, (intmax_t)bno);
+}
+
+/*
+ * put a block into the map
+ */
+static void
+setblock(struct fs *fs, unsigned char *cp, int h)
+{
+	switch (fs->fs_frag) {
+	case 8:
+		cp[h] = 0xff;
+		return;
+	case 4:
+		cp[h >> 1] |= (0x0f << ((h & 0x1) << 2));
+		return;
+	case 2:
+		cp[h >> 2] |= (0x03 << ((h & 0x3) << 1));
+		return;
+	case 1:
+		cp[h >> 3] |= (0x01 << (h & 0x7));
+		return;
+	default:
+		fprintf(stderr, "setblock bad fs_frag %d\n", fs->fs_frag);
+		return;
+	}
+}
+
+/*
+ * For the regression test, return predictable random values.
+ * Otherwise use a true random number generator.
+ */
+u_int32_t
+newfs_random(void)
+{
+
+	if (Rflag)
+		return (nextgen++);
+	return (arc4random());
+}
@@ -93,18 +93,15 @@ union dinode {
 
 static caddr_t iobuf;
 static long iobufsize;
+
 static ufs2_daddr_t alloc(int size, int mode);
 static int charsperline(void);
 static void clrblock(struct fs *, unsigned char *, int);
 static void fsinit(time_t);
 static int ilog2(int);
-static void initcg(int, time_t);
 static int isblock(struct fs *, unsigned char *, int);
 static void iput(union dinode *, ino_t);
 static int makedir(struct direct *, int);
-static void setblock(struct fs *, unsigned char *, int);
-static void wtfs(ufs2_daddr_t, int, char *);
-static u_int32_t newfs_random(void);
 
 void
 mkfs(struct partition *pp, char *fsys)
@@ -118,6 +115,7 @@ mkfs(struct partition *pp, char *fsys)
 	ino_t maxinum;
 	int minfragsperinode;	/* minimum ratio of frags to inodes */
 	char tmpbuf[100];	/* XXX this will break in about 2,500 years */
+	struct cgctx cc;
 	struct fsrecovery *fsr;
 	char *fsrbuf;
 	union {
@@ -524,9 +522,9 @@ restart:
 #	undef B2MBFACTOR
 
 	if (Eflag && !Nflag) {
-        printf("Erasing sectors [%lld...%d]\n", 
-		    sblock.fs_sblockloc / disk.d_bsize,
-		    fsbtodb(&sblock, sblock.fs_size) - 1);
+        printf("Erasing sectors [%jd...%jd]\n",
+		    (intmax_t)(sblock.fs_sblockloc / disk.d_bsize),
+		    (intmax_t)fsbtodb(&sblock, sblock.fs_size) - 1);
 		berase(&disk, sblock.fs_sblockloc / disk.d_bsize,
 		    sblock.fs_size * sblock.fs_fsize - sblock.fs_sblockloc);
 	}
@@ -585,9 +583,15 @@ restart:
 	/*
 	 * Write out all the cylinder groups and backup superblocks.
 	 */
+	if (!Nflag && nthreads > 1)
+		initcg_parallel(0, utime, iobuf);
+	if (!Nflag && nthreads <= 1)
+		cgctx_init(&cc, &acg, iobuf);
 	for (cg = 0; cg < sblock.fs_ncg; cg++) {
-		if (!Nflag)
-			initcg(cg, utime);
+		if (!Nflag && nthreads <= 1) {
+			cc.cc_gen = initcg_genbase(cg);
+			initcg(cg, utime, &cc);
+		}
 		j = snprintf(tmpbuf, sizeof(tmpbuf), " %jd%s",
 		    (intmax_t)fsbtodb(&sblock, cgsblock(&sblock, cg)),
 		    cg < (sblock.fs_ncg-1) ? "," : "");
@@ -604,11 +608,17 @@ restart:
 	printf("\n");
 	if (Nflag)
 		exit(0);
+	if (nthreads <= 1)
+		cgctx_free(&cc);
+	if (Rflag)
+		nextgen = initcg_genbase(sblock.fs_ncg);
 	/*
 	 * Now construct the initial file system,
 	 * then write out the super-block.
 	 */
     fsinit(utime);
+	if (srcpath != NULL)
+		populate(utime);
 	if (Oflag == 1) {
 		sblock.fs_old_cstotal.cs_ndir = sblock.fs_cstotal.cs_ndir;
 		sblock.fs_old_cstotal.cs_nbfree = sblock.fs_cstotal.cs_nbfree;
@@ -668,188 +678,6 @@ restart:
 	}
 }
 
-/*
- * Initialize a cylinder group.
- */
-void
-initcg(int cylno, time_t utime)
-{
-	long blkno, start;
-	off_t savedactualloc;
-	uint i, j, d, dlower, dupper;
-	ufs2_daddr_t cbase, dmax;
-	struct ufs1_dinode *dp1;
-	struct ufs2_dinode *dp2;
-	struct csum *cs;
-
-	/*
-	 * Determine block bounds for cylinder group.
-	 * Allow space for super block summary information in first
-	 * cylinder group.
-	 */
-	cbase = cgbase(&sblock, cylno);
-	dmax = cbase + sblock.fs_fpg;
-	if (dmax > sblock.fs_size)
-		dmax = sblock.fs_size;
-	dlower = cgsblock(&sblock, cylno) - cbase;
-	dupper = cgdmin(&sblock, cylno) - cbase;
-	if (cylno == 0)
-		dupper += howmany(sblock.fs_cssize, sblock.fs_fsize);
-	cs = &fscs[cylno];
-	memset(&acg, 0, sblock.fs_cgsize);
-	acg.cg_time = utime;
-	acg.cg_magic = CG_MAGIC;
-	acg.cg_cgx = cylno;
-	acg.cg_niblk = sblock.fs_ipg;
-	acg.cg_initediblk = MIN(sblock.fs_ipg, 2 * INOPB(&sblock));
-	acg.cg_ndblk = dmax - cbase;
-	if (sblock.fs_contigsumsize > 0)
-		acg.cg_nclusterblks = acg.cg_ndblk / sblock.fs_frag;
-	start = &acg.cg_space[0] - (u_char *)(&acg.cg_firstfield);
-	if (Oflag == 2) {
-		acg.cg_iusedoff = start;
-	} else {
-		acg.cg_old_ncyl = sblock.fs_old_cpg;
-		acg.cg_old_time = acg.cg_time;
-		acg.cg_time = 0;
-		acg.cg_old_niblk = acg.cg_niblk;
-		acg.cg_niblk = 0;
-		acg.cg_initediblk = 0;
-		acg.cg_old_btotoff = start;
-		acg.cg_old_boff = acg.cg_old_btotoff +
-		    sblock.fs_old_cpg * sizeof(int32_t);
-		acg.cg_iusedoff = acg.cg_old_boff +
-		    sblock.fs_old_cpg * sizeof(u_int16_t);
-	}
-	acg.cg_freeoff = acg.cg_iusedoff + howmany(sblock.fs_ipg, CHAR_BIT);
-	acg.cg_nextfreeoff = acg.cg_freeoff + howmany(sblock.fs_fpg, CHAR_BIT);
-	if (sblock.fs_contigsumsize > 0) {
-		acg.cg_clustersumoff =
-		    roundup(acg.cg_nextfreeoff, sizeof(u_int32_t));
-		acg.cg_clustersumoff -= sizeof(u_int32_t);
-		acg.cg_clusteroff = acg.cg_clustersumoff +
-		    (sblock.fs_contigsumsize + 1) * sizeof(u_int32_t);
-		acg.cg_nextfreeoff = acg.cg_clusteroff +
-		    howmany(fragstoblks(&sblock, sblock.fs_fpg), CHAR_BIT);
-	}
-	if (acg.cg_nextfreeoff > (unsigned)sblock.fs_cgsize) {
-		printf("Panic: cylinder group too big\n");
-		exit(37);
-	}
-	acg.cg_cs.cs_nifree += sblock.fs_ipg;
-	if (cylno == 0)
-		for (i = 0; i < (long)UFS_ROOTINO; i++) {
-			setbit(cg_inosused(&acg), i);
-			acg.cg_cs.cs_nifree--;
-		}
-	if (cylno > 0) {
-		/*
-		 * In cylno 0, beginning space is reserved
-		 * for boot and super blocks.
-		 */
-		for (d = 0; d < dlower; d += sblock.fs_frag) {
-			blkno = d / sblock.fs_frag;
-			setblock(&sblock, cg_blksfree(&acg), blkno);
-			if (sblock.fs_contigsumsize > 0)
-				setbit(cg_clustersfree(&acg), blkno);
-			acg.cg_cs.cs_nbfree++;
-		}
-	}
-	if ((i = dupper % sblock.fs_frag)) {
-		acg.cg_frsum[sblock.fs_frag - i]++;
-		for (d = dupper + sblock.fs_frag - i; dupper < d; dupper++) {
-			setbit(cg_blksfree(&acg), dupper);
-			acg.cg_cs.cs_nffree++;
-		}
-	}
-	for (d = dupper; d + sblock.fs_frag <= acg.cg_ndblk;
-	     d += sblock.fs_frag) {
-		blkno = d / sblock.fs_frag;
-		setblock(&sblock, cg_blksfree(&acg), blkno);
-		if (sblock.fs_contigsumsize > 0)
-			setbit(cg_clustersfree(&acg), blkno);
-		acg.cg_cs.cs_nbfree++;
-	}
-	if (d < acg.cg_ndblk) {
-		acg.cg_frsum[acg.cg_ndblk - d]++;
-		for (; d < acg.cg_ndblk; d++) {
-			setbit(cg_blksfree(&acg), d);
-			acg.cg_cs.cs_nffree++;
-		}
-	}
-	if (sblock.fs_contigsumsize > 0) {
-		int32_t *sump = cg_clustersum(&acg);
-		u_char *mapp = cg_clustersfree(&acg);
-		int map = *mapp++;
-		int bit = 1;
-		int run = 0;
-
-		for (i = 0; i < acg.cg_nclusterblks; i++) {
-			if ((map & bit) != 0)
-				run++;
-			else if (run != 0) {
-				if (run > sblock.fs_contigsumsize)
-					run = sblock.fs_contigsumsize;
-				sump[run]++;
-				run = 0;
-			}
-			if ((i & (CHAR_BIT - 1)) != CHAR_BIT - 1)
-				bit <<= 1;
-			else {
-				map = *mapp++;
-				bit = 1;
-			}
-		}
-		if (run != 0) {
-			if (run > sblock.fs_contigsumsize)
-				run = sblock.fs_contigsumsize;
-			sump[run]++;
-		}
-	}
-	*cs = acg.cg_cs;
-	/*
-	 * Write out the duplicate super block. Then write the cylinder
-	 * group map and two blocks worth of inodes in a single write.
-	 */
-	savedactualloc = sblock.fs_sblockactualloc;
-	sblock.fs_sblockactualloc =
-    dbtob(fsbtodb(&sblock, cgsblock(&sblock, cylno)), disk.d_bsize);
-	if (sbwrite(&disk, 0) != 0)
-		err(1, "sbwrite: %s", disk.d_error);
-	sblock.fs_sblockactualloc = savedactualloc;
-	if (cgwrite(&disk) != 0)
-		err(1, "initcg: cgwrite: %s", disk.d_error);
-	start = 0;
-	dp1 = (struct ufs1_dinode *)(&iobuf[start]);
-	dp2 = (struct ufs2_dinode *)(&iobuf[start]);
-	for (i = 0; i < acg.cg_initediblk; i++) {
-		if (sblock.fs_magic == FS_UFS1_MAGIC) {
-			dp1->di_gen = newfs_random();
-			dp1++;
-		} else {
-			dp2->di_gen = newfs_random();
-			dp2++;
-		}
-	}
-	wtfs(fsbtodb(&sblock, cgimin(&sblock, cylno)), iobufsize, iobuf);
-	/*
-	 * For the old file system, we have to initialize all the inodes.
-	 */
-	if (Oflag == 1) {
-		for (i = 2 * sblock.fs_frag;
-		     i < sblock.fs_ipg / INOPF(&sblock);
-		     i += sblock.fs_frag) {
-			dp1 = (struct ufs1_dinode *)(&iobuf[start]);
-			for (j = 0; j < INOPB(&sblock); j++) {
-				dp1->di_gen = newfs_random();
-				dp1++;
-			}
-			wtfs(fsbtodb(&sblock, cgimin(&sblock, cylno) + i),
-			    sblock.fs_bsize, &iobuf[start]);
-		}
-	}
-}
-
 /*
  * initialize the file system
  */
@@ -1059,18 +887,6 @@ iput(union dinode *ip, ino_t ino)
 	putinode(&disk);
 }
 
-/*
- * possibly write to disk
- */
-static void
-wtfs(ufs2_daddr_t bno, int size, char *bf)
-{
-	if (Nflag)
-		return;
-	if (bwrite(&disk, part_ofs + bno, bf, size) < 0)
-		err(36, "wtfs: %d bytes at sector %jd", size, (intmax_t)bno);
-}
-
 /*
  * check if a block is available
  */
@@ -1121,32 +937,6 @@ clrblock(struct fs *fs, unsigned char *cp, int h)
 		return;
 	}
 }
-
-/*
- * put a block into the map
- */
-static void
-setblock(struct fs *fs, unsigned char *cp, int h)
-{
-	switch (fs->fs_frag) {
-	case 8:
-		cp[h] = 0xff;
-		return;
-	case 4:
-		cp[h >> 1] |= (0x0f << ((h & 0x1) << 2));
-		return;
-	case 2:
-		cp[h >> 2] |= (0x03 << ((h & 0x3) << 1));
-		return;
-	case 1:
-		cp[h >> 3] |= (0x01 << (h & 0x7));
-		return;
-	default:
-		fprintf(stderr, "setblock bad fs_frag %d\n", fs->fs_frag);
-		return;
-	}
-}
-
 /*
  * Determine the number of characters in a
  * single line.
@@ -1179,17 +969,3 @@ ilog2(int val)
 			return (n);
 	errx(1, "ilog2: %d is not a power of 2\n", val);
 }
-
-/*
- * For the regression test, return predictable random values.
- * Otherwise use a true random number generator.
- */
-static u_int32_t
-newfs_random(void)
-{
-	static int nextnum = 1;
-
-	if (Rflag)
-		return (nextnum++);
-	return (arc4random());
-}
@@ -88,6 +88,7 @@ __FBSDID("$FreeBSD$");
 #include "newfs.h"
 
 int	Eflag;			/* Erase previous disk contents */
+int	Iflag;			/* initialize inode blocks lazily */
 int	Lflag;			/* add a volume label */
 int	Nflag;			/* run without writing file system */
 int	Oflag = 2;		/* file system format (1 => UFS1, 2 => UFS2) */
@@ -99,6 +100,7 @@ int	Jflag;			/* enable gjournal for file system */
 int	lflag;			/* enable multilabel for file system */
 int	nflag;			/* do not create .snap directory */
 int	tflag;			/* enable TRIM */
+int	nthreads = 1;		/* cylinder group initialization threads */
 intmax_t fssize;		/* file system size */
 off_t	mediasize;		/* device size */
 int	sectorsize;		/* bytes/sector */
@@ -117,6 +119,7 @@ int	maxbpg;			/* maximum blocks per file in a cyl group */
 int	avgfilesize = AVFILESIZ;/* expected average file size */
 int	avgfilesperdir = AFPDIR;/* expected number of files per directory */
 u_char	*volumelabel = NULL;	/* volume label for filesystem */
+char	*srcpath;		/* directory or tar file to copy in */
 struct uufsd disk;		/* libufs disk structure */
 
 static char	device[MAXPATHLEN];
@@ -146,11 +149,17 @@ main(int argc, char *argv[])
 	part_name = 'c';
 	reserved = 0;
 	while ((ch = getopt(argc, argv,
-	    "EJL:NO:RS:T:UXa:b:c:d:e:f:g:h:i:jk:lm:no:p:r:s:t")) != -1)
+	    "D:EIJL:NO:P:RS:T:UXa:b:c:d:e:f:g:h:i:jk:lm:no:p:r:s:t")) != -1)
 		switch (ch) {
+		case 'D':
+			srcpath = optarg;
+			break;
 		case 'E':
 			Eflag = 1;
 			break;
+		case 'I':
+			Iflag = 1;
+			break;
 		case 'J':
 			Jflag = 1;
 			break;
@@ -177,6 +186,11 @@ main(int argc, char *argv[])
 				errx(1, "%s: bad file system format value",
 				    optarg);
 			break;
+		case 'P':
+			rval = expand_number_int(optarg, &nthreads);
+			if (rval < 0 || nthreads <= 0)
+				errx(1, "%s: bad thread count", optarg);
+			break;
 		case 'R':
 			Rflag = 1;
 			break;
@@ -311,6 +325,8 @@ main(int argc, char *argv[])
 
 	if (argc != 1)
 		usage();
+	if (Iflag && Oflag != 2)
+		errx(1, "lazy inode initialization requires UFS2");
 
 	special = argv[0];
 	if (!special[0])
@@ -390,6 +406,12 @@ main(int argc, char *argv[])
 		if (is_file)
 			part_ofs = pp->p_offset;
 	}
+	if (srcpath != NULL && part_ofs != 0)
+		errx(1, "%s: -D needs the file system at the start of the file",
+		    special);
+	if (srcpath != NULL && strcmp(srcpath, "-") != 0 &&
+	    access(srcpath, R_OK) != 0)
+		err(1, "%s", srcpath);
 	if (sectorsize <= 0)
 		errx(1, "%s: no default sector size", special);
 	if (fsize <= 0)
@@ -468,11 +490,14 @@ usage(void)
 	    getprogname(),
 	    " [device-type]");
 	fprintf(stderr, "where fsoptions are:\n");
+	fprintf(stderr, "\t-D directory or tar file (- for stdin) to copy in\n");
 	fprintf(stderr, "\t-E Erase previous disk content\n");
+	fprintf(stderr, "\t-I initialize inode blocks lazily (UFS2 only)\n");
 	fprintf(stderr, "\t-J Enable journaling via gjournal\n");
 	fprintf(stderr, "\t-L volume label to add to superblock\n");
 	fprintf(stderr, "\t-N do not create file system, just print out parameters\n");
 	fprintf(stderr, "\t-O file system format: 1 => UFS1, 2 => UFS2\n");
+	fprintf(stderr, "\t-P threads used to initialize cylinder groups\n");
 	fprintf(stderr, "\t-R regression test, suppress random factors\n");
 	fprintf(stderr, "\t-S sector size\n");
 	fprintf(stderr, "\t-T disktype\n");
@@ -78,6 +78,7 @@
  * variables set up by front end.
  */
 extern int	Eflag;		/* Erase previous disk contents */
+extern int	Iflag;		/* initialize inode blocks lazily */
 extern int	Lflag;		/* add a volume label */
 extern int	Nflag;		/* run mkfs without writing file system */
 extern int	Oflag;		/* build UFS1 format file system */
@@ -89,6 +90,7 @@ extern int	Jflag;		/* enable gjournal for file system */
 extern int	lflag;		/* enable multilabel MAC for file system */
 extern int	nflag;		/* do not create .snap directory */
 extern int	tflag;		/* enable TRIM */
+extern int	nthreads;	/* cylinder group initialization threads */
 extern intmax_t	fssize;		/* file system size */
 extern off_t	mediasize;	/* device size */
 extern int	sectorsize;	/* bytes/sector */
@@ -106,6 +108,7 @@ extern int	maxbpg;		/* maximum blocks per file in a cyl group */
 extern int	avgfilesize;	/* expected average file size */
 extern int	avgfilesperdir;	/* expected number of files per directory */
 extern u_char	*volumelabel;	/* volume label for filesystem */
+extern char	*srcpath;	/* directory or tar file to copy in */
 extern struct uufsd disk;	/* libufs disk structure */
 
 /*
@@ -124,4 +127,26 @@ extern struct uufsd disk;	/* libufs disk structure */
  */
 extern ufs2_daddr_t part_ofs;	/* partition offset in blocks */
 
+/*
+ * State for one initcg() caller, set up by cgctx_init(). The serial path
+ * hands in the global cylinder group and iobuf, each -P worker brings
+ * its own.
+ */
+struct cgctx {
+	struct cg	*cc_cg;		/* cylinder group being built */
+	caddr_t		 cc_iobuf;	/* two blocks worth of inodes */
+	u_int32_t	 cc_gen;	/* next -R inode generation number */
+	struct csum	*cc_csp;	/* sblock.fs_csp, one slot per group */
+	struct fs	*cc_fs;		/* sblock copy for duplicate writes */
+};
+extern u_int32_t nextgen;	/* next -R value from newfs_random() */
+
+void cgctx_free(struct cgctx *);
+void cgctx_init(struct cgctx *, struct cg *, caddr_t);
+void initcg(int, time_t, struct cgctx *);
+u_int32_t initcg_genbase(int);
+void initcg_parallel(int, time_t, caddr_t);
 void mkfs (struct partition *, char *);
+u_int32_t newfs_random(void);
+void populate(time_t);
+void wtfs(ufs2_daddr_t, int, char *);
@@ -0,0 +1,234 @@
+//
+//  newfs_test.c
+//  newfs_ufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Runs newfs on an image with and without -I and checks what -I leaves
+// behind: the same geometry and free counts, every cylinder group but
+// the first with no initialized inode blocks, and the first with just
+// the one holding the root inodes. With -b it times both, from a fresh
+// sparse image to the data on disk, and reports the bytes each wrote.
+//
+// The image has to carry a BSD label, as newfs wants of a file, and the
+// options have to name its partition with -p. Everything past the label
+// area is thrown away before each run.
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#include "bench.h"
+
+#define	LABELSIZE	8192		/* boot area and label */
+
+static const char *newfs;
+static const char *image;
+static char **opts;
+static int nopts;
+static char label[LABELSIZE];
+static off_t size;
+
+/* Back to the label and a hole, as a new image would be. */
+static void
+fresh(void)
+{
+	int fd;
+
+	if ((fd = open(image, O_RDWR | O_TRUNC)) == -1)
+		err(2, "%s", image);
+	if (pwrite(fd, label, LABELSIZE, 0) != LABELSIZE ||
+	    ftruncate(fd, size) == -1)
+		err(2, "%s", image);
+	close(fd);
+}
+
+/*
+ * Run newfs, with -I if lazy, and wait for what it wrote to reach the
+ * disk. Returns the bytes the image gained.
+ */
+static off_t
+run(int lazy)
+{
+	struct stat st;
+	char **argv;
+	pid_t pid;
+	int fd, i, n, status;
+
+	if ((argv = calloc(nopts + 4, sizeof(*argv))) == NULL)
+		err(2, "calloc");
+	n = 0;
+	argv[n++] = (char *)newfs;
+	if (lazy)
+		argv[n++] = "-I";
+	for (i = 0; i < nopts; i++)
+		argv[n++] = opts[i];
+	argv[n++] = (char *)image;
+	fflush(stdout);
+	if ((pid = fork()) == -1)
+		err(2, "fork");
+	if (pid == 0) {
+		if ((fd = open("/dev/null", O_WRONLY)) != -1)
+			dup2(fd, STDOUT_FILENO);
+		execv(newfs, argv);
+		err(2, "%s", newfs);
+	}
+	free(argv);
+	if (waitpid(pid, &status, 0) == -1)
+		err(2, "waitpid");
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(2, "%s%s failed", newfs, lazy ? " -I" : "");
+	if ((fd = open(image, O_RDWR)) == -1)
+		err(2, "%s", image);
+	if (fsync(fd) == -1 || fstat(fd, &st) == -1)
+		err(2, "%s", image);
+	close(fd);
+	return ((off_t)st.st_blocks * S_BLKSIZE - LABELSIZE);
+}
+
+/* What the file system says about itself, for comparing the two runs. */
+struct shape {
+	int32_t		s_ncg;
+	int32_t		s_ipg;
+	int64_t		s_size;
+	struct csum_total s_cstotal;
+};
+
+/*
+ * Check the inode blocks each cylinder group says are initialized, and
+ * fill in what the two runs should agree on.
+ */
+static void
+check(int lazy, struct shape *sh)
+{
+	struct uufsd disk;
+	struct fs *fs;
+	int32_t want;
+	int cg;
+
+	memset(&disk, 0, sizeof(disk));
+	if (ufs_disk_fillout(&disk, image) == -1)
+		errx(2, "%s: %s", image, disk.d_error);
+	fs = &disk.d_fs;
+	memset(sh, 0, sizeof(*sh));
+	sh->s_ncg = fs->fs_ncg;
+	sh->s_ipg = fs->fs_ipg;
+	sh->s_size = fs->fs_size;
+	sh->s_cstotal = fs->fs_cstotal;
+	for (cg = 0; cg < fs->fs_ncg; cg++) {
+		if (cgread1(&disk, cg) != 1) {
+			bench_fail("cg %d: %s", cg, disk.d_error);
+			continue;
+		}
+		if (fs->fs_magic != FS_UFS2_MAGIC)
+			continue;
+		if (!lazy)
+			want = MIN(fs->fs_ipg, 2 * INOPB(fs));
+		else if (cg == 0)
+			want = MIN(fs->fs_ipg, INOPB(fs));
+		else
+			want = 0;
+		if (disk.d_cg.cg_initediblk != want)
+			bench_fail("%s: cg %d: %d inodes initialized, want %d",
+			    lazy ? "-I" : "default", cg,
+			    disk.d_cg.cg_initediblk, want);
+	}
+	ufs_disk_close(&disk);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: newfs_test [-b] [-n runs] newfs image [newfs options]\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct shape sh[2];
+	struct stat st;
+	char name[64];
+	double best, secs, start;
+	off_t bytes[2];
+	int bflag, ch, fd, i, lazy, n;
+
+	bflag = 0;
+	n = 3;
+	/* The '+' keeps glibc from taking newfs's options for ours. */
+	while ((ch = getopt(argc, argv, "+bn:")) != -1)
+		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'n':
+			n = (int)strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc < 2 || n < 1)
+		usage();
+	newfs = argv[0];
+	image = argv[1];
+	opts = argv + 2;
+	nopts = argc - 2;
+
+	if ((fd = open(image, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+		err(2, "%s", image);
+	if (!S_ISREG(st.st_mode))
+		errx(2, "%s: not an image file", image);
+	if (pread(fd, label, LABELSIZE, 0) != LABELSIZE)
+		err(2, "%s: can't read the label", image);
+	close(fd);
+	size = st.st_size;
+
+	for (lazy = 0; lazy <= 1; lazy++) {
+		fresh();
+		bytes[lazy] = run(lazy);
+		check(lazy, &sh[lazy]);
+		printf("%s: %d cylinder groups, %jd bytes written\n",
+		    lazy ? "-I" : "default", sh[lazy].s_ncg,
+		    (intmax_t)bytes[lazy]);
+	}
+	if (memcmp(&sh[0], &sh[1], sizeof(sh[0])) != 0)
+		bench_fail("-I changed the geometry or the free counts");
+	if (bytes[1] > bytes[0])
+		bench_fail("-I wrote more than the default");
+	if (!bflag)
+		return (bench_done());
+
+	/* Best of n, each from a fresh image. */
+	for (lazy = 0; lazy <= 1; lazy++) {
+		best = 0;
+		for (i = 0; i < n; i++) {
+			fresh();
+			start = bench_now();
+			run(lazy);
+			secs = bench_now() - start;
+			if (i == 0 || secs < best)
+				best = secs;
+		}
+		snprintf(name, sizeof(name), "newfs %s %jdMB",
+		    lazy ? "-I" : "default", (intmax_t)(size >> 20));
+		bench_report(name, best, 0);
+	}
+	return (bench_done());
+}
@@ -0,0 +1,831 @@
+//
+//  populate.c
+//  newfs_ufs
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// newfs -D: copy a directory tree or a tar archive into the new file
+// system, with the file creation functions of libufs (create.c there).
+//
+// Placement follows FFS: a directory goes in the cylinder group
+// ufs_dirpref() picks for it, anything else in its directory's group,
+// and each file gets one run of blocks where there is room. A source
+// directory is read in name order; its entries are written first, then
+// the files in it, then its subdirectories one by one. An archive is
+// taken in its own order, and since a directory in it can gain entries
+// up to the end, the directories are written last.
+//
+// With -R the result depends only on the source: generation numbers
+// come from newfs_random(), and the access and change times, which
+// reading the source moves, are set to the modification time.
+
+#include <sys/param.h>
+#include <freebsd/disklabel.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ufs/dir.h>
+#include <ufs/ffs/fs.h>
+#include <libufs/libufs.h>
+#include "newfs.h"
+
+#define	sblock	disk.d_fs
+
+#define	IOSIZE		(1024 * 1024)	/* source data read at once */
+#define	NHASH		(1 << 16)	/* name and link hash buckets */
+#define	TBLOCK		512		/* tar block */
+
+/* What a new inode takes from its source. */
+struct attr {
+	mode_t		 a_mode;
+	uid_t		 a_uid;
+	gid_t		 a_gid;
+	time_t		 a_atime;
+	time_t		 a_mtime;
+	time_t		 a_ctime;
+	dev_t		 a_rdev;
+};
+
+/* A name made from an archive, found by its directory and name. */
+struct pent {
+	struct pent	*pe_next;	/* hash chain */
+	struct pent	*pe_dnext;	/* directories, in creation order */
+	ino_t		 pe_parent;
+	ino_t		 pe_ino;
+	mode_t		 pe_mode;
+	struct uufsd_dir *pe_dir;	/* directories only */
+	char		 pe_name[];
+};
+
+/* A source file with more than one link, by device and inode. */
+struct hlink {
+	struct hlink	*hl_next;
+	dev_t		 hl_dev;
+	ino_t		 hl_srcino;
+	ino_t		 hl_ino;
+};
+
+/* ustar header. */
+struct tarhdr {
+	char	th_name[100];
+	char	th_mode[8];
+	char	th_uid[8];
+	char	th_gid[8];
+	char	th_size[12];
+	char	th_mtime[12];
+	char	th_chksum[8];
+	char	th_type;
+	char	th_linkname[100];
+	char	th_magic[6];
+	char	th_version[2];
+	char	th_uname[32];
+	char	th_gname[32];
+	char	th_devmajor[8];
+	char	th_devminor[8];
+	char	th_prefix[155];
+	char	th_pad[12];
+};
+
+static time_t	 now;
+static char	*iobuf;
+static struct pent *names[NHASH];
+static struct pent rootent;
+static struct pent **dirtail = &rootent.pe_dnext;
+static struct hlink *links[NHASH];
+static uintmax_t ndirs, nfiles, nbytes;
+
+static void
+fserr(const char *what)
+{
+
+	errx(1, "%s: %s", what,
+	    disk.d_error != NULL ? disk.d_error : strerror(errno));
+}
+
+static void
+setattr(ino_t ino, const struct attr *a)
+{
+	union dinodep dp;
+
+	if (getinode(&disk, &dp, ino) == -1)
+		fserr("getinode");
+	if (Oflag == 1) {
+		dp.dp1->di_mode = a->a_mode;
+		dp.dp1->di_uid = a->a_uid;
+		dp.dp1->di_gid = a->a_gid;
+		dp.dp1->di_atime = Rflag ? a->a_mtime : a->a_atime;
+		dp.dp1->di_mtime = a->a_mtime;
+		dp.dp1->di_ctime = Rflag ? a->a_mtime : a->a_ctime;
+		if (S_ISCHR(a->a_mode) || S_ISBLK(a->a_mode))
+			dp.dp1->di_rdev = a->a_rdev;
+	} else {
+		dp.dp2->di_mode = a->a_mode;
+		dp.dp2->di_uid = a->a_uid;
+		dp.dp2->di_gid = a->a_gid;
+		dp.dp2->di_atime = Rflag ? a->a_mtime : a->a_atime;
+		dp.dp2->di_mtime = a->a_mtime;
+		dp.dp2->di_ctime = Rflag ? a->a_mtime : a->a_ctime;
+		dp.dp2->di_birthtime = now;
+		if (S_ISCHR(a->a_mode) || S_ISBLK(a->a_mode))
+			dp.dp2->di_rdev = a->a_rdev;
+	}
+	if (putinode(&disk) == -1)
+		fserr("putinode");
+}
+
+/*
+ * A new inode for name in directory dr, whose inode is parent.
+ */
+static ino_t
+mkinode(struct uufsd_dir *dr, ino_t parent, const char *name,
+    const struct attr *a)
+{
+	ino_t ino;
+	int cg;
+
+	if (S_ISDIR(a->a_mode)) {
+		cg = ufs_dirpref(&disk, parent);
+		ndirs++;
+	} else {
+		cg = ino_to_cg(&sblock, parent);
+		nfiles++;
+	}
+	if ((ino = ufs_inode_create(&disk, cg, a->a_mode,
+	    newfs_random())) == 0 ||
+	    ufs_dir_add(dr, name, ino, IFTODT(a->a_mode)) == -1)
+		fserr(name);
+	setattr(ino, a);
+	return (ino);
+}
+
+/*
+ * Read up to len bytes, fewer only at the end of the file.
+ */
+static size_t
+readfull(int fd, const char *name, void *buf, size_t len)
+{
+	ssize_t n;
+	size_t done;
+
+	for (done = 0; done < len; done += n) {
+		if ((n = read(fd, (char *)buf + done, len - done)) == -1)
+			err(1, "%s", name);
+		if (n == 0)
+			break;
+	}
+	return (done);
+}
+
+/*
+ * Copy size bytes from fd into ino.
+ */
+static void
+copydata(int fd, const char *name, ino_t ino, off_t size)
+{
+	struct uufsd_file *f;
+	size_t n;
+	off_t off;
+
+	if ((f = ufs_file_create(&disk, ino, size)) == NULL)
+		fserr(name);
+	for (off = 0; off < size; off += n) {
+		n = readfull(fd, name, iobuf, MIN(IOSIZE, size - off));
+		if (n == 0)
+			errx(1, "%s: ends before its %jd bytes", name,
+			    (intmax_t)size);
+		if (ufs_file_write(f, iobuf, n) == -1)
+			fserr(name);
+	}
+	if (ufs_file_close(f) == -1)
+		fserr(name);
+	nbytes += size;
+}
+
+/*
+ * Point the symbolic link ino at target, in the inode if it fits.
+ */
+static void
+setlink(ino_t ino, const char *name, const char *target)
+{
+	struct uufsd_file *f;
+	union dinodep dp;
+	size_t len;
+
+	len = strlen(target);
+	if (len >= (size_t)sblock.fs_maxsymlinklen) {
+		if ((f = ufs_file_create(&disk, ino, len)) == NULL ||
+		    ufs_file_write(f, target, len) == -1 ||
+		    ufs_file_close(f) == -1)
+			fserr(name);
+		return;
+	}
+	if (getinode(&disk, &dp, ino) == -1)
+		fserr(name);
+	if (Oflag == 1) {
+		memcpy(dp.dp1->di_db, target, len);
+		dp.dp1->di_size = len;
+	} else {
+		memcpy(dp.dp2->di_db, target, len);
+		dp.dp2->di_size = len;
+	}
+	if (putinode(&disk) == -1)
+		fserr(name);
+}
+
+/*
+ * The name newfs keeps for itself in the root.
+ */
+static int
+reserved(ino_t parent, const char *name, const char *path)
+{
+
+	if (parent != UFS_ROOTINO || nflag || strcmp(name, ".snap") != 0)
+		return (0);
+	warnx("%s: skipped, the new file system has its own", path);
+	return (1);
+}
+
+static void
+stattoattr(const struct stat *st, struct attr *a)
+{
+
+	a->a_mode = st->st_mode;
+	a->a_uid = st->st_uid;
+	a->a_gid = st->st_gid;
+	a->a_atime = st->st_atime;
+	a->a_mtime = st->st_mtime;
+	a->a_ctime = st->st_ctime;
+	a->a_rdev = st->st_rdev;
+}
+
+static ino_t
+hl_find(dev_t dev, ino_t srcino)
+{
+	struct hlink *hl;
+
+	for (hl = links[srcino % NHASH]; hl != NULL; hl = hl->hl_next)
+		if (hl->hl_dev == dev && hl->hl_srcino == srcino)
+			return (hl->hl_ino);
+	return (0);
+}
+
+static void
+hl_add(dev_t dev, ino_t srcino, ino_t ino)
+{
+	struct hlink *hl;
+
+	if ((hl = malloc(sizeof(*hl))) == NULL)
+		err(1, "hard link table");
+	hl->hl_dev = dev;
+	hl->hl_srcino = srcino;
+	hl->hl_ino = ino;
+	hl->hl_next = links[srcino % NHASH];
+	links[srcino % NHASH] = hl;
+}
+
+static int
+namecmp(const void *a, const void *b)
+{
+
+	return (strcmp(*(char * const *)a, *(char * const *)b));
+}
+
+static void
+subpath(char *buf, const char *path, const char *name)
+{
+
+	if (snprintf(buf, MAXPATHLEN, "%s/%s", path, name) >= MAXPATHLEN)
+		errx(1, "%s/%s: path too long", path, name);
+}
+
+/*
+ * Copy the directory path into dino, a directory of the new file system
+ * already entered in parent.
+ */
+static void
+copydir(const char *path, ino_t dino, ino_t parent)
+{
+	char sub[MAXPATHLEN], target[MAXPATHLEN];
+	struct uufsd_dir *dr;
+	struct dirent *de;
+	struct stat st;
+	struct attr a;
+	DIR *d;
+	char **list;
+	ino_t *inos;
+	mode_t *modes;
+	off_t *sizes;
+	size_t i, n, size;
+	ssize_t len;
+	int fd;
+
+	if ((d = opendir(path)) == NULL)
+		err(1, "%s", path);
+	list = NULL;
+	n = size = 0;
+	while ((errno = 0, de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0)
+			continue;
+		if (n == size) {
+			size = MAX(2 * size, 64);
+			if ((list = realloc(list, size * sizeof(*list))) ==
+			    NULL)
+				err(1, "%s", path);
+		}
+		if ((list[n++] = strdup(de->d_name)) == NULL)
+			err(1, "%s", path);
+	}
+	if (errno != 0)
+		err(1, "%s", path);
+	closedir(d);
+	qsort(list, n, sizeof(*list), namecmp);
+
+	/* Its entries, and the inodes they name. */
+	if ((inos = calloc(n + 1, sizeof(*inos))) == NULL ||
+	    (modes = calloc(n + 1, sizeof(*modes))) == NULL ||
+	    (sizes = calloc(n + 1, sizeof(*sizes))) == NULL)
+		err(1, "%s", path);
+	dr = dino == UFS_ROOTINO ? ufs_dir_open(&disk, dino) :
+	    ufs_dir_create(&disk, dino, parent);
+	if (dr == NULL)
+		fserr(path);
+	for (i = 0; i < n; i++) {
+		subpath(sub, path, list[i]);
+		if (lstat(sub, &st) == -1)
+			err(1, "%s", sub);
+		if (reserved(dino, list[i], sub))
+			continue;
+		if (!S_ISDIR(st.st_mode) && st.st_nlink > 1 &&
+		    (inos[i] = hl_find(st.st_dev, st.st_ino)) != 0) {
+			if (ufs_dir_add(dr, list[i], inos[i],
+			    IFTODT(st.st_mode)) == -1)
+				fserr(sub);
+			inos[i] = 0;	/* already copied */
+			continue;
+		}
+		stattoattr(&st, &a);
+		inos[i] = mkinode(dr, dino, list[i], &a);
+		modes[i] = st.st_mode;
+		sizes[i] = st.st_size;
+		if (!S_ISDIR(st.st_mode) && st.st_nlink > 1)
+			hl_add(st.st_dev, st.st_ino, inos[i]);
+	}
+	if (ufs_dir_close(dr) == -1)
+		fserr(path);
+
+	/* The files in it, then its subdirectories. */
+	for (i = 0; i < n; i++) {
+		if (inos[i] == 0)
+			continue;
+		subpath(sub, path, list[i]);
+		if (S_ISREG(modes[i])) {
+			if ((fd = open(sub, O_RDONLY)) == -1)
+				err(1, "%s", sub);
+			copydata(fd, sub, inos[i], sizes[i]);
+			close(fd);
+		} else if (S_ISLNK(modes[i])) {
+			if ((len = readlink(sub, target,
+			    sizeof(target) - 1)) == -1)
+				err(1, "%s", sub);
+			target[len] = '\0';
+			setlink(inos[i], sub, target);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (inos[i] != 0 && S_ISDIR(modes[i])) {
+			subpath(sub, path, list[i]);
+			copydir(sub, inos[i], dino);
+		}
+		free(list[i]);
+	}
+	free(list);
+	free(inos);
+	free(modes);
+	free(sizes);
+}
+
+static u_int
+pe_hash(ino_t parent, const char *name)
+{
+	u_int h;
+
+	for (h = (u_int)parent; *name != '\0'; name++)
+		h = h * 31 + (u_char)*name;
+	return (h % NHASH);
+}
+
+static struct pent *
+pe_find(ino_t parent, const char *name)
+{
+	struct pent *pe;
+
+	for (pe = names[pe_hash(parent, name)]; pe != NULL; pe = pe->pe_next)
+		if (pe->pe_parent == parent && strcmp(pe->pe_name, name) == 0)
+			return (pe);
+	return (NULL);
+}
+
+static struct pent *
+pe_add(ino_t parent, const char *name, ino_t ino, mode_t mode)
+{
+	struct pent *pe;
+	u_int h;
+
+	if ((pe = calloc(1, sizeof(*pe) + strlen(name) + 1)) == NULL)
+		err(1, "%s", name);
+	strcpy(pe->pe_name, name);
+	pe->pe_parent = parent;
+	pe->pe_ino = ino;
+	pe->pe_mode = mode;
+	h = pe_hash(parent, name);
+	pe->pe_next = names[h];
+	names[h] = pe;
+	return (pe);
+}
+
+/*
+ * A new directory from an archive, written when the archive ends.
+ */
+static struct pent *
+tar_mkdir(struct pent *dir, const char *name, const struct attr *a)
+{
+	struct pent *pe;
+	ino_t ino;
+
+	ino = mkinode(dir->pe_dir, dir->pe_ino, name, a);
+	pe = pe_add(dir->pe_ino, name, ino, a->a_mode);
+	if ((pe->pe_dir = ufs_dir_create(&disk, ino, dir->pe_ino)) == NULL)
+		fserr(name);
+	*dirtail = pe;
+	dirtail = &pe->pe_dnext;
+	return (pe);
+}
+
+/*
+ * The directory the archive path is in and, in *namep, its last name.
+ * Directories on the way that the archive hasn't had yet are made when
+ * create is set. NULL for the root itself and for paths to skip.
+ */
+static struct pent *
+tar_lookup(char *path, int create, char **namep)
+{
+	struct pent *dir, *pe;
+	struct attr a;
+	char *last, *name, *next;
+
+	memset(&a, 0, sizeof(a));
+	a.a_mode = S_IFDIR | 0755;
+	a.a_atime = a.a_mtime = a.a_ctime = now;
+	dir = &rootent;
+	last = NULL;
+	for (name = strtok_r(path, "/", &next); name != NULL;
+	    name = strtok_r(NULL, "/", &next)) {
+		if (strcmp(name, ".") == 0)
+			continue;
+		if (strcmp(name, "..") == 0) {
+			warnx("%s: skipped, it has \"..\" in it", path);
+			return (NULL);
+		}
+		if (last != NULL) {
+			if ((pe = pe_find(dir->pe_ino, last)) == NULL) {
+				if (!create || reserved(dir->pe_ino, last,
+				    last))
+					return (NULL);
+				pe = tar_mkdir(dir, last, &a);
+			}
+			if (!S_ISDIR(pe->pe_mode))
+				errx(1, "%s: %s is not a directory", path,
+				    last);
+			dir = pe;
+		}
+		last = name;
+	}
+	if (last == NULL || reserved(dir->pe_ino, last, last))
+		return (NULL);
+	*namep = last;
+	return (dir);
+}
+
+/*
+ * A number field of a tar header: octal, or GNU base-256 when the top
+ * bit of the first byte is set.
+ */
+static int64_t
+tar_num(const char *p, size_t len)
+{
+	int64_t v;
+	size_t i;
+
+	if (((u_char)*p & 0x80) != 0) {
+		v = (u_char)*p & 0x3f;
+		for (i = 1; i < len; i++)
+			v = v << 8 | (u_char)p[i];
+		return (v);
+	}
+	for (i = 0; i < len && p[i] == ' '; i++)
+		continue;
+	for (v = 0; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+		v = v * 8 + p[i] - '0';
+	return (v);
+}
+
+static void
+tar_skip(int fd, int64_t len)
+{
+	size_t n;
+
+	for (; len > 0; len -= n)
+		if ((n = readfull(fd, srcpath, iobuf, MIN(IOSIZE, len))) == 0)
+			errx(1, "%s: unexpected end of archive", srcpath);
+}
+
+/*
+ * The len bytes of a long name or extended header, and their padding.
+ */
+static char *
+tar_data(int fd, int64_t len)
+{
+	char *p;
+
+	if (len < 0 || len > 1024 * 1024 || (p = malloc(len + 1)) == NULL)
+		errx(1, "%s: bad extended header", srcpath);
+	if (readfull(fd, srcpath, p, len) != (size_t)len)
+		errx(1, "%s: unexpected end of archive", srcpath);
+	p[len] = '\0';
+	tar_skip(fd, roundup(len, TBLOCK) - len);
+	return (p);
+}
+
+/* What pax and GNU extended headers say about the next entry. */
+struct tarext {
+	char	*te_path;
+	char	*te_link;
+	int64_t	 te_size;	/* -1 if not given */
+	int64_t	 te_mtime;
+	int64_t	 te_uid;
+	int64_t	 te_gid;
+};
+
+static void
+tar_pax(char *p, struct tarext *te)
+{
+	char *end, *key, *rec, *val;
+	long len;
+
+	for (rec = p; *rec != '\0'; rec += len) {
+		len = strtol(rec, &key, 10);
+		if (len <= 0 || *key != ' ' || (size_t)len > strlen(rec) ||
+		    rec[len - 1] != '\n')
+			errx(1, "%s: bad pax header", srcpath);
+		key++;
+		rec[len - 1] = '\0';
+		if ((val = strchr(key, '=')) == NULL)
+			errx(1, "%s: bad pax header", srcpath);
+		*val++ = '\0';
+		if (strcmp(key, "path") == 0) {
+			free(te->te_path);
+			te->te_path = strdup(val);
+		} else if (strcmp(key, "linkpath") == 0) {
+			free(te->te_link);
+			te->te_link = strdup(val);
+		} else if (strcmp(key, "size") == 0)
+			te->te_size = strtoll(val, &end, 10);
+		else if (strcmp(key, "mtime") == 0)
+			te->te_mtime = strtoll(val, &end, 10);
+		else if (strcmp(key, "uid") == 0)
+			te->te_uid = strtoll(val, &end, 10);
+		else if (strcmp(key, "gid") == 0)
+			te->te_gid = strtoll(val, &end, 10);
+	}
+}
+
+/*
+ * One archive entry, h with what te says over it. Returns how much of its
+ * data was read.
+ */
+static int64_t
+tar_entry(int fd, struct tarhdr *h, struct tarext *te, int64_t size)
+{
+	char path[MAXPATHLEN], link[MAXPATHLEN];
+	struct pent *dir, *pe, *target;
+	struct attr a;
+	char *name, *tname;
+	ino_t ino;
+
+	if (te->te_path != NULL)
+		strlcpy(path, te->te_path, sizeof(path));
+	else if (h->th_prefix[0] != '\0' && memcmp(h->th_magic, "ustar", 5) ==
+	    0)
+		snprintf(path, sizeof(path), "%.155s/%.100s", h->th_prefix,
+		    h->th_name);
+	else
+		snprintf(path, sizeof(path), "%.100s", h->th_name);
+	if (te->te_link != NULL)
+		strlcpy(link, te->te_link, sizeof(link));
+	else
+		snprintf(link, sizeof(link), "%.100s", h->th_linkname);
+
+	memset(&a, 0, sizeof(a));
+	a.a_mode = tar_num(h->th_mode, sizeof(h->th_mode)) & 07777;
+	a.a_uid = te->te_uid != -1 ? te->te_uid :
+	    tar_num(h->th_uid, sizeof(h->th_uid));
+	a.a_gid = te->te_gid != -1 ? te->te_gid :
+	    tar_num(h->th_gid, sizeof(h->th_gid));
+	a.a_mtime = te->te_mtime != -1 ? te->te_mtime :
+	    tar_num(h->th_mtime, sizeof(h->th_mtime));
+	a.a_atime = a.a_ctime = a.a_mtime;
+	switch (h->th_type) {
+	case '0':
+	case '\0':
+	case '7':
+		a.a_mode |= S_IFREG;
+		break;
+	case '1':
+		break;
+	case '2':
+		a.a_mode |= S_IFLNK;
+		break;
+	case '3':
+	case '4':
+		a.a_mode |= h->th_type == '3' ? S_IFCHR : S_IFBLK;
+		a.a_rdev = makedev(tar_num(h->th_devmajor,
+		    sizeof(h->th_devmajor)), tar_num(h->th_devminor,
+		    sizeof(h->th_devminor)));
+		break;
+	case '5':
+		a.a_mode |= S_IFDIR;
+		break;
+	case '6':
+		a.a_mode |= S_IFIFO;
+		break;
+	default:
+		warnx("%s: skipped, tar type '%c' is not supported", path,
+		    h->th_type);
+		return (0);
+	}
+
+	if ((dir = tar_lookup(path, 1, &name)) == NULL)
+		return (0);
+	if ((pe = pe_find(dir->pe_ino, name)) != NULL) {
+		/* A directory can come again, to set what it is like. */
+		if (S_ISDIR(pe->pe_mode) && S_ISDIR(a.a_mode))
+			setattr(pe->pe_ino, &a);
+		else
+			warnx("%s: skipped, it is in the archive twice", path);
+		return (0);
+	}
+	if (h->th_type == '1') {
+		if ((target = tar_lookup(link, 0, &tname)) == NULL ||
+		    (target = pe_find(target->pe_ino, tname)) == NULL ||
+		    S_ISDIR(target->pe_mode)) {
+			warnx("%s: skipped, link to %s which isn't there",
+			    path, te->te_link != NULL ? te->te_link :
+			    h->th_linkname);
+			return (0);
+		}
+		if (ufs_dir_add(dir->pe_dir, name, target->pe_ino,
+		    IFTODT(target->pe_mode)) == -1)
+			fserr(name);
+		pe_add(dir->pe_ino, name, target->pe_ino, target->pe_mode);
+		return (0);
+	}
+	if (S_ISDIR(a.a_mode)) {
+		tar_mkdir(dir, name, &a);
+		return (0);
+	}
+	ino = mkinode(dir->pe_dir, dir->pe_ino, name, &a);
+	pe_add(dir->pe_ino, name, ino, a.a_mode);
+	if (S_ISLNK(a.a_mode))
+		setlink(ino, name, link);
+	else if (S_ISREG(a.a_mode)) {
+		copydata(fd, name, ino, size);
+		return (size);
+	}
+	return (0);
+}
+
+static int
+tar_cksum(struct tarhdr *h)
+{
+	u_char *p;
+	int64_t sum;
+	size_t i;
+
+	p = (u_char *)h;
+	for (sum = 0, i = 0; i < TBLOCK; i++)
+		sum += i >= offsetof(struct tarhdr, th_chksum) &&
+		    i < offsetof(struct tarhdr, th_type) ? ' ' : p[i];
+	return (sum == tar_num(h->th_chksum, sizeof(h->th_chksum)));
+}
+
+static void
+copytar(int fd)
+{
+	struct tarext te;
+	struct tarhdr h;
+	struct pent *pe;
+	int64_t done, hsize, size;
+	size_t n;
+	char *p;
+
+	memset(&te, 0, sizeof(te));
+	te.te_size = te.te_mtime = te.te_uid = te.te_gid = -1;
+	for (;;) {
+		if ((n = readfull(fd, srcpath, &h, TBLOCK)) == 0)
+			break;
+		if (n != TBLOCK)
+			errx(1, "%s: unexpected end of archive", srcpath);
+		for (p = (char *)&h; p < (char *)&h + TBLOCK && *p == '\0';
+		    p++)
+			continue;
+		if (p == (char *)&h + TBLOCK)
+			break;
+		if (!tar_cksum(&h))
+			errx(1, "%s: bad header checksum", srcpath);
+		hsize = tar_num(h.th_size, sizeof(h.th_size));
+		switch (h.th_type) {
+		case 'L':
+			free(te.te_path);
+			te.te_path = tar_data(fd, hsize);
+			continue;
+		case 'K':
+			free(te.te_link);
+			te.te_link = tar_data(fd, hsize);
+			continue;
+		case 'x':
+			p = tar_data(fd, hsize);
+			tar_pax(p, &te);
+			free(p);
+			continue;
+		case 'g':
+			free(tar_data(fd, hsize));
+			continue;
+		}
+		size = te.te_size != -1 ? te.te_size : hsize;
+		done = tar_entry(fd, &h, &te, size);
+		tar_skip(fd, roundup(size, TBLOCK) - done);
+		free(te.te_path);
+		free(te.te_link);
+		memset(&te, 0, sizeof(te));
+		te.te_size = te.te_mtime = te.te_uid = te.te_gid = -1;
+	}
+	for (pe = rootent.pe_dnext; pe != NULL; pe = pe->pe_dnext)
+		if (ufs_dir_close(pe->pe_dir) == -1)
+			fserr(pe->pe_name);
+	if (ufs_dir_close(rootent.pe_dir) == -1)
+		fserr("/");
+}
+
+void
+populate(time_t utime)
+{
+	struct stat st;
+	int fd, i;
+
+	now = utime;
+	if ((iobuf = malloc(IOSIZE)) == NULL)
+		err(1, "populate");
+	/* Kept up by the cluster accounting of allocations and frees. */
+	if ((sblock.fs_maxcluster = calloc(sblock.fs_ncg,
+	    sizeof(*sblock.fs_maxcluster))) == NULL)
+		err(1, "populate");
+	for (i = 0; i < sblock.fs_ncg; i++)
+		sblock.fs_maxcluster[i] = sblock.fs_contigsumsize;
+	if (ufs_disk_cgcache(&disk, 1024) == -1 ||
+	    ufs_disk_inocache(&disk, 1024) == -1)
+		fserr("populate");
+	if (strcmp(srcpath, "-") != 0 && stat(srcpath, &st) == 0 &&
+	    S_ISDIR(st.st_mode))
+		copydir(srcpath, UFS_ROOTINO, UFS_ROOTINO);
+	else {
+		if (strcmp(srcpath, "-") == 0)
+			fd = STDIN_FILENO;
+		else if ((fd = open(srcpath, O_RDONLY)) == -1)
+			err(1, "%s", srcpath);
+		rootent.pe_ino = UFS_ROOTINO;
+		rootent.pe_mode = S_IFDIR;
+		if ((rootent.pe_dir = ufs_dir_open(&disk, UFS_ROOTINO)) ==
+		    NULL)
+			fserr("/");
+		copytar(fd);
+		if (fd != STDIN_FILENO)
+			close(fd);
+	}
+	if (ufs_disk_inosync(&disk) == -1 || ufs_disk_cgflush(&disk) == -1)
+		fserr("populate");
+	free(iobuf);
+	printf("copied %s: %ju directories, %ju files, %.1fMB\n", srcpath,
+	    ndirs, nfiles, (double)nbytes / (1024 * 1024));
+}
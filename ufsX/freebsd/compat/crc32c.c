@@ -54,7 +54,12 @@ __FBSDID("$FreeBSD$");
 
 #define e_rounddown(x, y) (((x)/(y))*(y))
 
-uint32_t sse42_crc32c(uint32_t crc, const unsigned char *buf, unsigned len);
+#if defined(__x86_64__) || defined(__aarch64__) || defined(__arm64__)
+#define CRC32C_HW
+/* crc32c_hw.c */
+uint32_t crc32c_hw(uint32_t crc, const unsigned char *buf, unsigned int len);
+int crc32c_hw_probe(void);
+#endif
 
 /*
  * A function that calculates the CRC-32 based on the table above is
@@ -710,6 +715,10 @@ uint32_t calculate_crc32c(uint32_t crc32c,
                           const unsigned char *buffer,
                           unsigned int length)
 {
+#ifdef CRC32C_HW
+    if (crc32c_hw_probe())
+        return (crc32c_hw(crc32c, buffer, length));
+#endif
     if (length < 4) {
         return (singletable_crc32c(crc32c, buffer, length));
     } else {
@@ -0,0 +1,340 @@
+//
+//  crc32c_hw.c
+//  ufsX
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// CRC32C using the SSE4.2 crc32 instruction on x86_64 and the ARMv8 CRC
+// extension on arm64. calculate_crc32c() asks crc32c_hw_probe() once and
+// falls back to the slice-by-8 tables if neither is there.
+//
+// One crc32 instruction has a latency of three cycles but a throughput of
+// one, so long buffers are cut in three streams that are hashed side by
+// side and then stitched back together. Stitching means advancing a crc
+// over the zeros of the streams after it, which is a multiplication by
+// x^(8n) mod P. In userland on x86_64 with PCLMULQDQ that's a carry-less
+// multiply followed by one more crc32; everywhere else (and always in the
+// kernel, where we don't touch the vector registers) it goes through a
+// table built on first use, like FreeBSD's crc32_sse42.c.
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#ifdef _KERNEL
+#include <sys/systm.h>
+#include <libkern/libkern.h>
+#endif
+
+#include <sys/param.h>
+
+#if !defined(_KERNEL) && defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#if !defined(_KERNEL) && defined(__arm64__) && defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+#if !defined(_KERNEL) && defined(__x86_64__)
+#include <wmmintrin.h>
+#define	CRC32C_CLMUL
+#endif
+
+#if defined(__x86_64__) || defined(__aarch64__) || defined(__arm64__)
+
+uint32_t crc32c_hw(uint32_t crc, const unsigned char *buf, unsigned int len);
+int crc32c_hw_probe(void);
+
+#define	CRC32C_POLY	0x82f63b78	/* Castagnoli, bit reversed */
+
+/* Bytes per stream for the long and short interleaved loops. */
+#define	LONG	1024
+#define	SHORT	128
+
+#define	HW_UNKNOWN	0
+#define	HW_NONE		1
+#define	HW_CRC		2	/* crc instruction, table shifts */
+#define	HW_CRC_CLMUL	3	/* crc instruction, carry-less shifts */
+
+static int crc32c_hwmode = HW_UNKNOWN;
+
+/* Advance a crc over LONG / SHORT zero bytes, one table per byte. */
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+/* Same shifts for the carry-less multiply: x^(8n-33) mod P for n, 2n. */
+static uint64_t crc32c_klong[2];
+static uint64_t crc32c_kshort[2];
+
+#if defined(__x86_64__)
+
+static inline uint32_t
+crc32c_u8(uint32_t crc, uint8_t v)
+{
+
+	__asm__("crc32b %1, %0" : "+r" (crc) : "rm" (v));
+	return (crc);
+}
+
+static inline uint64_t
+crc32c_u64(uint64_t crc, uint64_t v)
+{
+
+	__asm__("crc32q %1, %0" : "+r" (crc) : "rm" (v));
+	return (crc);
+}
+
+static inline void
+crc32c_cpuid(uint32_t leaf, uint32_t regs[4])
+{
+
+	__asm__ volatile("cpuid"
+	    : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+	    : "a" (leaf), "c" (0));
+}
+
+#else	/* arm64 */
+
+static inline uint32_t
+crc32c_u8(uint32_t crc, uint8_t v)
+{
+
+	__asm__(".arch_extension crc\n\tcrc32cb %w0, %w0, %w1"
+	    : "+r" (crc) : "r" (v));
+	return (crc);
+}
+
+static inline uint64_t
+crc32c_u64(uint64_t crc, uint64_t v)
+{
+	uint32_t c;
+
+	c = (uint32_t)crc;
+	__asm__(".arch_extension crc\n\tcrc32cx %w0, %w0, %x1"
+	    : "+r" (c) : "r" (v));
+	return (c);
+}
+
+#endif
+
+/*
+ * Multiply a and b modulo P, both bit reversed (x^0 is the top bit).
+ */
+static uint32_t
+crc32c_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m, p;
+
+	m = 1U << 31;
+	p = 0;
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return (p);
+}
+
+/*
+ * x^n mod P.
+ */
+static uint32_t
+crc32c_xpow(uint32_t n)
+{
+	uint32_t p, sq;
+
+	p = 1U << 31;			/* x^0 */
+	sq = 1U << 30;			/* x^1 */
+	while (n != 0) {
+		if (n & 1)
+			p = crc32c_multmodp(sq, p);
+		sq = crc32c_multmodp(sq, sq);
+		n >>= 1;
+	}
+	return (p);
+}
+
+static void
+crc32c_shift_table(uint32_t table[4][256], uint32_t len)
+{
+	uint32_t op;
+	int i, j;
+
+	op = crc32c_xpow(8 * len);
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 256; j++)
+			table[i][j] = crc32c_multmodp(op,
+			    (uint32_t)j << (8 * i));
+}
+
+static inline uint32_t
+crc32c_shift(uint32_t table[4][256], uint32_t crc)
+{
+
+	return (table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+	    table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24]);
+}
+
+#ifdef CRC32C_CLMUL
+/*
+ * crc0 advanced over 2n bytes, crc1 over n, plus crc2. A carry-less
+ * product with x^(8n-33) leaves a 64 bit value that one crc32 reduces to
+ * the crc advanced by n bytes.
+ */
+__attribute__((target("pclmul")))
+static uint32_t
+crc32c_clmul_combine(uint64_t k[2], uint32_t crc0, uint32_t crc1,
+    uint32_t crc2)
+{
+	__m128i t0, t1;
+
+	t0 = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc0),
+	    _mm_cvtsi64_si128((long long)k[1]), 0x00);
+	t1 = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc1),
+	    _mm_cvtsi64_si128((long long)k[0]), 0x00);
+	t0 = _mm_xor_si128(t0, t1);
+	return ((uint32_t)crc32c_u64(0, (uint64_t)_mm_cvtsi128_si64(t0)) ^
+	    crc2);
+}
+#endif
+
+static inline uint32_t
+crc32c_combine(uint32_t table[4][256], uint64_t *k, uint32_t crc0,
+    uint32_t crc1, uint32_t crc2)
+{
+
+#ifdef CRC32C_CLMUL
+	if (__atomic_load_n(&crc32c_hwmode, __ATOMIC_RELAXED) == HW_CRC_CLMUL)
+		return (crc32c_clmul_combine(k, crc0, crc1, crc2));
+#endif
+	crc0 = crc32c_shift(table, crc0) ^ crc1;
+	return (crc32c_shift(table, crc0) ^ crc2);
+}
+
+/*
+ * Returns non-zero if crc32c_hw() may be used. The shift tables are
+ * filled in before the mode is published with a release store, and read
+ * after an acquire load of it, so a racing caller either sees HW_UNKNOWN
+ * and does the (idempotent) work itself or sees everything ready.
+ */
+int
+crc32c_hw_probe(void)
+{
+	int mode;
+
+	mode = __atomic_load_n(&crc32c_hwmode, __ATOMIC_ACQUIRE);
+	if (mode != HW_UNKNOWN)
+		return (mode != HW_NONE);
+	mode = HW_NONE;
+#if defined(__x86_64__)
+	{
+		uint32_t regs[4];
+
+		crc32c_cpuid(1, regs);
+		if (regs[2] & (1U << 20))		/* SSE4.2 */
+			mode = HW_CRC;
+#ifdef CRC32C_CLMUL
+		if (mode == HW_CRC && (regs[2] & (1U << 1)))	/* PCLMULQDQ */
+			mode = HW_CRC_CLMUL;
+#endif
+	}
+#elif defined(_KERNEL)
+	/* Every arm64 Mac has the CRC extension. */
+	mode = HW_CRC;
+#elif defined(__linux__)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		mode = HW_CRC;
+#elif defined(__APPLE__)
+	{
+		int val;
+		size_t len;
+
+		len = sizeof(val);
+		if (sysctlbyname("hw.optional.armv8_crc32", &val, &len,
+		    NULL, 0) == 0 && val != 0)
+			mode = HW_CRC;
+	}
+#endif
+	if (mode != HW_NONE) {
+		crc32c_shift_table(crc32c_long, LONG);
+		crc32c_shift_table(crc32c_short, SHORT);
+		crc32c_klong[0] = crc32c_xpow(8 * LONG - 33);
+		crc32c_klong[1] = crc32c_xpow(8 * 2 * LONG - 33);
+		crc32c_kshort[0] = crc32c_xpow(8 * SHORT - 33);
+		crc32c_kshort[1] = crc32c_xpow(8 * 2 * SHORT - 33);
+	}
+	__atomic_store_n(&crc32c_hwmode, mode, __ATOMIC_RELEASE);
+	return (mode != HW_NONE);
+}
+
+uint32_t
+crc32c_hw(uint32_t crc, const unsigned char *buf, unsigned int len)
+{
+	const unsigned char *next, *end;
+	uint64_t crc0, crc1, crc2;
+
+	next = buf;
+	crc0 = crc;
+
+	/* Get to an 8 byte boundary. */
+	while (len > 0 && ((uintptr_t)next & 7) != 0) {
+		crc0 = crc32c_u8((uint32_t)crc0, *next++);
+		len--;
+	}
+
+	/* Three streams of LONG bytes at a time. */
+	while (len >= 3 * LONG) {
+		crc1 = 0;
+		crc2 = 0;
+		end = next + LONG;
+		do {
+			crc0 = crc32c_u64(crc0, *(const uint64_t *)next);
+			crc1 = crc32c_u64(crc1,
+			    *(const uint64_t *)(next + LONG));
+			crc2 = crc32c_u64(crc2,
+			    *(const uint64_t *)(next + 2 * LONG));
+			next += 8;
+		} while (next < end);
+		crc0 = crc32c_combine(crc32c_long, crc32c_klong,
+		    (uint32_t)crc0, (uint32_t)crc1, (uint32_t)crc2);
+		next += 2 * LONG;
+		len -= 3 * LONG;
+	}
+
+	/* Same again with SHORT byte streams. */
+	while (len >= 3 * SHORT) {
+		crc1 = 0;
+		crc2 = 0;
+		end = next + SHORT;
+		do {
+			crc0 = crc32c_u64(crc0, *(const uint64_t *)next);
+			crc1 = crc32c_u64(crc1,
+			    *(const uint64_t *)(next + SHORT));
+			crc2 = crc32c_u64(crc2,
+			    *(const uint64_t *)(next + 2 * SHORT));
+			next += 8;
+		} while (next < end);
+		crc0 = crc32c_combine(crc32c_short, crc32c_kshort,
+		    (uint32_t)crc0, (uint32_t)crc1, (uint32_t)crc2);
+		next += 2 * SHORT;
+		len -= 3 * SHORT;
+	}
+
+	/* Whatever is left, 8 bytes and then 1 byte at a time. */
+	end = next + (len & ~7U);
+	while (next < end) {
+		crc0 = crc32c_u64(crc0, *(const uint64_t *)next);
+		next += 8;
+	}
+	len &= 7;
+	while (len > 0) {
+		crc0 = crc32c_u8((uint32_t)crc0, *next++);
+		len--;
+	}
+	return ((uint32_t)crc0);
+}
+
+#endif
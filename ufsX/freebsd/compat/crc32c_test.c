@@ -0,0 +1,224 @@
+//
+//  crc32c_test.c
+//  ufsX
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Checks crc32c_hw() and calculate_crc32c() against the slice-by-8 and
+// single table code and against a bit at a time reference, over random
+// buffers, lengths, alignments and starting values, and with -b times
+// each of them on the buffer sizes the check-hashes are taken over.
+//
+// crc32c.c is included rather than linked so that the table functions,
+// which are static there, can be called on their own.
+
+#include "crc32c.c"
+
+#include <unistd.h>
+
+#include "bench.h"
+
+#define	MAXLEN		(64 * 1024)
+#define	MAXALIGN	16
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+static uint32_t
+crc32c_bitwise(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	int i;
+
+	while (len-- > 0) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+	}
+	return (crc);
+}
+
+static uint32_t
+crc32c_single(uint32_t crc, const unsigned char *buf, unsigned int len)
+{
+
+	return (singletable_crc32c(crc, buf, len));
+}
+
+/* What calculate_crc32c() does without the hardware. */
+static uint32_t
+crc32c_table(uint32_t crc, const unsigned char *buf, unsigned int len)
+{
+
+	if (len < 4)
+		return (singletable_crc32c(crc, buf, len));
+	return (multitable_crc32c(crc, buf, len));
+}
+
+/*
+ * A random length, weighted towards the edges of the hardware loops:
+ * the 8 byte alignment prologue, 3 x 128 and 3 x 1024 byte streams and
+ * the 8 and 1 byte tails.
+ */
+static unsigned int
+randlen(void)
+{
+	static const unsigned int edges[] = { 0, 1, 7, 8, 9, 383, 384, 385,
+	    3071, 3072, 3073, 3 * 1024 + 3 * 128, 6144 + 7 };
+
+	switch (bench_uniform(4)) {
+	case 0:
+		return (edges[bench_uniform(nitems(edges))] +
+		    (unsigned int)bench_uniform(3) - 1) % MAXLEN;
+	case 1:
+		return ((unsigned int)bench_uniform(64));
+	case 2:
+		return ((unsigned int)bench_uniform(8192));
+	default:
+		return ((unsigned int)bench_uniform(MAXLEN));
+	}
+}
+
+static void
+check(unsigned char *mem, unsigned int len, unsigned int align,
+    uint32_t crc, int hw)
+{
+	const unsigned char *buf;
+	uint32_t want, got;
+	unsigned int split;
+
+	buf = mem + align;
+	want = crc32c_bitwise(crc, buf, len);
+	if ((got = crc32c_table(crc, buf, len)) != want)
+		bench_fail("table: len %u align %u crc %08x: %08x, want %08x",
+		    len, align, crc, got, want);
+#ifdef CRC32C_HW
+	if (hw && (got = crc32c_hw(crc, buf, len)) != want)
+		bench_fail("hw: len %u align %u crc %08x: %08x, want %08x",
+		    len, align, crc, got, want);
+#endif
+	if ((got = calculate_crc32c(crc, buf, len)) != want)
+		bench_fail("calculate_crc32c: len %u align %u crc %08x: "
+		    "%08x, want %08x", len, align, crc, got, want);
+	/* Hashing in two pieces gives the same result. */
+	split = (unsigned int)bench_uniform(len + 1);
+	got = calculate_crc32c(calculate_crc32c(crc, buf, split), buf + split,
+	    len - split);
+	if (got != want)
+		bench_fail("calculate_crc32c: len %u split at %u align %u: "
+		    "%08x, want %08x", len, split, align, got, want);
+}
+
+struct crcbench {
+	uint32_t	(*cb_fn)(uint32_t, const unsigned char *,
+			    unsigned int);
+	const unsigned char *cb_buf;
+	unsigned int	cb_len;
+	uint32_t	cb_crc;
+};
+
+static void
+crcbench_run(void *arg)
+{
+	struct crcbench *cb;
+
+	cb = arg;
+	cb->cb_crc = cb->cb_fn(cb->cb_crc, cb->cb_buf, cb->cb_len);
+}
+
+static void
+bench(unsigned char *mem, int hw)
+{
+	/* Dinode, 4k / 32k cylinder groups, and larger blocks. */
+	static const unsigned int sizes[] = { 256, 4096, 32768, 65536 };
+	struct crcbench cb;
+	char name[64];
+	size_t i;
+
+	bench_fill(mem, MAXLEN + MAXALIGN);
+	for (i = 0; i < nitems(sizes); i++) {
+		cb.cb_buf = mem;
+		cb.cb_len = sizes[i];
+		cb.cb_crc = ~0U;
+		cb.cb_fn = crc32c_single;
+		snprintf(name, sizeof(name), "single table %u", sizes[i]);
+		bench_report(name, bench_time(crcbench_run, &cb), sizes[i]);
+		cb.cb_fn = crc32c_table;
+		snprintf(name, sizeof(name), "slice-by-8 %u", sizes[i]);
+		bench_report(name, bench_time(crcbench_run, &cb), sizes[i]);
+#ifdef CRC32C_HW
+		if (hw) {
+			cb.cb_fn = crc32c_hw;
+			snprintf(name, sizeof(name), "hardware %u", sizes[i]);
+			bench_report(name, bench_time(crcbench_run, &cb),
+			    sizes[i]);
+		}
+#endif
+	}
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: crc32c_test [-b] [-n count] [-s seed]\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const unsigned char check_string[] = "123456789";
+	unsigned char *mem;
+	char *seed;
+	unsigned int len;
+	long i, n;
+	int bflag, ch, hw;
+
+	bflag = 0;
+	n = 20000;
+	seed = NULL;
+	while ((ch = getopt(argc, argv, "bn:s:")) != -1)
+		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = optarg;
+			break;
+		default:
+			usage();
+		}
+	if (argc != optind)
+		usage();
+#ifdef CRC32C_HW
+	hw = crc32c_hw_probe();
+#else
+	hw = 0;
+#endif
+	printf("hardware crc32c: %s\n", hw ? "yes" : "no");
+	if ((mem = malloc(MAXLEN + MAXALIGN)) == NULL) {
+		perror("malloc");
+		return (2);
+	}
+	bench_seed(seed);
+
+	/* The check value from the iSCSI and ext4 specifications. */
+	if ((calculate_crc32c(~0U, check_string, 9) ^ ~0U) != 0xe3069283)
+		bench_fail("calculate_crc32c(\"123456789\") != e3069283");
+	for (i = 0; i < n; i++) {
+		len = randlen();
+		bench_fill(mem, len + MAXALIGN);
+		check(mem, len, (unsigned int)bench_uniform(MAXALIGN),
+		    (uint32_t)bench_random(), hw);
+	}
+	printf("%ld random buffers checked\n", n);
+	if (bflag)
+		bench(mem, hw);
+	free(mem);
+	return (bench_done());
+}
@@ -17,20 +17,17 @@
 
 #include <ufs/ufs/dinode.h>
 #include <ufs/ufs/ufs_extern.h>
-
-static lck_spin_t *buf_lock = NULL;
-static char log_buf[10240];
+#include <freebsd/compat/trace.h>
 
 char *u_basename(const char *path);
 
 void log_debug_init(){
     printf("ufsX DEBUG %p (%s, %d): %s(): entered\n", current_thread(), u_basename(__FILE__), __LINE__, __func__);
-    buf_lock = lck_spin_alloc_init(ffs_lock_group, LCK_ATTR_NULL);
+    ufs_trace_init();
 }
 
 void log_debug_uninit(){
-    lck_spin_destroy(buf_lock, ffs_lock_group);
-    lck_spin_free(buf_lock, ffs_lock_group);
+    ufs_trace_uninit();
 }
 
 char*
@@ -53,10 +50,9 @@ void __log_debug(thread_t thread, const char *file,
                   const char *fmt, ...)
 {
     va_list args;
+    char log_buf[512];
     const char *filename = u_basename(file);
     
-    lck_spin_lock(buf_lock);
-    memset(log_buf, 0x0, sizeof(log_buf));
     va_start(args, fmt);
     vsnprintf(log_buf, sizeof(log_buf), fmt, args);
     va_end(args);
@@ -65,7 +61,6 @@ void __log_debug(thread_t thread, const char *file,
            filename ? filename : "",
            line,
            function ? function : "", log_buf);
-    lck_spin_unlock(buf_lock);
 }
 
 #define VPRINT_PTR          "ufs-fs DEBUG %p (%s, %d): %s(): vnode=%p :%s\n"
@@ -16,17 +16,20 @@ extern thread_t
 current_thread(void) __attribute__((const));
 #endif
 
+#include <freebsd/compat/trace.h>
+
 void __log_debug(thread_t, const char*, int, const char*, const char*, ...) __printflike(5, 6);
 #define log_debug(fmt, a...) __log_debug(current_thread(), __FILE__, __LINE__, __func__, fmt, ##a)
 
+// function entry and exit go to the trace rings, see trace.h
 #define trace_return(v) ({                            \
     int __r__ = (v);                                  \
-    log_debug("returning %llu", (uint64_t)(__r__));  \
+    UFS_TRACE(UFS_TRACE_RETURN, __r__);               \
     return __r__;                                     \
 })
 
 #define trace_enter() ({            \
-    log_debug("ENTER");            \
+    UFS_TRACE(UFS_TRACE_ENTER, 0);  \
 })
 
 #endif /* debug_h */
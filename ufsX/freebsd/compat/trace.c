@@ -0,0 +1,271 @@
+//
+//  trace.c
+//  ufsX
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Per-CPU trace rings, see trace.h.
+//
+// Writers never take a lock: a record slot is claimed by bumping the
+// ring's count atomically, and tr_site is stored last so a dump can tell
+// a finished record from one still being written. Threads can be
+// preempted and moved between claiming and filling a slot, which is why
+// the count is atomic and not just per-CPU. The rings are allocated the
+// first time the mask is set, under ufs_trace_lck since the sysctl can be
+// written from several threads at once, and stay until the kext is
+// unloaded.
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/malloc.h>
+#include <sys/sysctl.h>
+#include <kern/locks.h>
+#include <kern/thread.h>
+#include <mach/mach_time.h>
+#include <libkern/libkern.h>
+#include <libkern/OSAtomic.h>
+
+#include <freebsd/compat/trace.h>
+
+extern int cpu_number(void);
+char *u_basename(const char *path);
+extern lck_grp_t *ffs_lock_group;
+
+#define	UFS_TRACE_MAXCPU	64
+#define	UFS_TRACE_NRECS		8192		/* per CPU, power of 2 */
+#define	UFS_TRACE_MAXSITES	4096
+
+#define	SITE_BUSY		0xffffffffU
+
+struct ufs_trace_ring {
+	volatile uint64_t	tr_count;
+	struct ufs_trace_rec	tr_recs[UFS_TRACE_NRECS];
+};
+
+volatile uint32_t ufs_trace_mask;
+
+static struct ufs_trace_ring *ufs_trace_rings[UFS_TRACE_MAXCPU];
+static int ufs_trace_ncpu;
+static lck_mtx_t *ufs_trace_lck;
+static struct ufs_trace_site *ufs_trace_sites[UFS_TRACE_MAXSITES];
+static volatile SInt32 ufs_trace_nsites;
+static mach_timebase_info_data_t ufs_trace_timebase;
+
+/*
+ * Subsystem and class bits of a site, from its file name and event.
+ */
+static uint32_t
+ufs_trace_sitemask(struct ufs_trace_site *ts)
+{
+	const char *file;
+	uint32_t mask;
+
+	file = u_basename(ts->ts_file);
+	if (strncmp(file, "ffs_softdep", 11) == 0)
+		mask = UFS_TRACE_SOFTDEP;
+	else if (strncmp(file, "ffs_", 4) == 0)
+		mask = UFS_TRACE_FFS;
+	else if (strncmp(file, "ufs_", 4) == 0)
+		mask = UFS_TRACE_UFS;
+	else
+		mask = UFS_TRACE_OTHER;
+	if (ts->ts_event == UFS_TRACE_ENTER || ts->ts_event == UFS_TRACE_RETURN)
+		mask |= UFS_TRACE_FUNC;
+	else
+		mask |= UFS_TRACE_LOCK;
+	return (mask);
+}
+
+/*
+ * Give a site its number. Whoever loses the race for it drops the
+ * event rather than wait.
+ */
+static uint32_t
+ufs_trace_register(struct ufs_trace_site *ts)
+{
+	SInt32 id;
+
+	if (!OSCompareAndSwap(0, SITE_BUSY, &ts->ts_id))
+		return (0);
+	id = OSIncrementAtomic(&ufs_trace_nsites);
+	if (id >= UFS_TRACE_MAXSITES) {
+		OSDecrementAtomic(&ufs_trace_nsites);
+		/* Leave it busy, it will never be recorded. */
+		return (0);
+	}
+	ts->ts_mask = ufs_trace_sitemask(ts);
+	ufs_trace_sites[id] = ts;
+	OSMemoryBarrier();
+	ts->ts_id = id + 1;
+	return (id + 1);
+}
+
+void
+ufs_trace(struct ufs_trace_site *ts, uint64_t arg)
+{
+	struct ufs_trace_ring *ring;
+	struct ufs_trace_rec *rec;
+	uint64_t slot;
+	uint32_t id, mask;
+	int cpu;
+
+	id = ts->ts_id;
+	if (id == 0)
+		id = ufs_trace_register(ts);
+	if (id == 0 || id == SITE_BUSY)
+		return;
+	mask = ufs_trace_mask & ts->ts_mask;
+	if ((mask & UFS_TRACE_SUBSYS) == 0 || (mask & UFS_TRACE_CLASS) == 0)
+		return;
+	cpu = cpu_number();
+	if (cpu < 0 || ufs_trace_ncpu == 0)
+		return;
+	ring = ufs_trace_rings[cpu % ufs_trace_ncpu];
+	if (ring == NULL)
+		return;
+	slot = OSIncrementAtomic64((volatile SInt64 *)&ring->tr_count);
+	rec = &ring->tr_recs[slot & (UFS_TRACE_NRECS - 1)];
+	rec->tr_site = 0;
+	OSMemoryBarrier();
+	rec->tr_time = mach_absolute_time();
+	rec->tr_thread = thread_tid(current_thread());
+	rec->tr_arg = arg;
+	rec->tr_cpu = cpu;
+	OSMemoryBarrier();
+	rec->tr_site = id;
+}
+
+static int
+ufs_trace_alloc(void)
+{
+	struct ufs_trace_ring *ring;
+	size_t len;
+	int i, ncpu;
+
+	lck_mtx_lock(ufs_trace_lck);
+	if (ufs_trace_ncpu != 0) {
+		lck_mtx_unlock(ufs_trace_lck);
+		return (0);
+	}
+	len = sizeof(ncpu);
+	if (sysctlbyname("hw.ncpu", &ncpu, &len, NULL, 0) != 0 || ncpu <= 0)
+		ncpu = 1;
+	ncpu = MIN(ncpu, UFS_TRACE_MAXCPU);
+	for (i = 0; i < ncpu; i++) {
+		ring = _MALLOC(sizeof(*ring), M_TEMP, M_WAITOK | M_ZERO);
+		if (ring == NULL) {
+			while (--i >= 0) {
+				_FREE(ufs_trace_rings[i], M_TEMP);
+				ufs_trace_rings[i] = NULL;
+			}
+			lck_mtx_unlock(ufs_trace_lck);
+			return (ENOMEM);
+		}
+		ufs_trace_rings[i] = ring;
+	}
+	/* ufs_trace() reads the rings once it sees ufs_trace_ncpu set. */
+	OSMemoryBarrier();
+	ufs_trace_ncpu = ncpu;
+	lck_mtx_unlock(ufs_trace_lck);
+	return (0);
+}
+
+static int
+sysctl_ufs_trace_mask SYSCTL_HANDLER_ARGS
+{
+	uint32_t mask;
+	int error;
+
+	mask = ufs_trace_mask;
+	error = sysctl_handle_int(oidp, &mask, 0, req);
+	if (error || req->newptr == USER_ADDR_NULL)
+		return (error);
+	if (mask != 0 && (error = ufs_trace_alloc()) != 0)
+		return (error);
+	ufs_trace_mask = mask;
+	return (0);
+}
+
+static int
+sysctl_ufs_trace_dump SYSCTL_HANDLER_ARGS
+{
+	struct ufs_trace_hdr hdr;
+	struct ufs_trace_sitedesc sd;
+	struct ufs_trace_site *ts;
+	uint64_t count;
+	int error, i, nsites;
+
+	nsites = MIN(ufs_trace_nsites, UFS_TRACE_MAXSITES);
+	bzero(&hdr, sizeof(hdr));
+	hdr.th_magic = UFS_TRACE_MAGIC;
+	hdr.th_version = UFS_TRACE_VERSION;
+	hdr.th_ncpu = ufs_trace_ncpu;
+	hdr.th_nrecs = UFS_TRACE_NRECS;
+	hdr.th_nsites = nsites;
+	hdr.th_numer = ufs_trace_timebase.numer;
+	hdr.th_denom = ufs_trace_timebase.denom;
+	if ((error = SYSCTL_OUT(req, &hdr, sizeof(hdr))) != 0)
+		return (error);
+	for (i = 0; i < nsites; i++) {
+		bzero(&sd, sizeof(sd));
+		if ((ts = ufs_trace_sites[i]) != NULL) {
+			sd.sd_event = ts->ts_event;
+			sd.sd_mask = ts->ts_mask;
+			sd.sd_line = ts->ts_line;
+			strlcpy(sd.sd_file, u_basename(ts->ts_file),
+			    sizeof(sd.sd_file));
+			strlcpy(sd.sd_func, ts->ts_func, sizeof(sd.sd_func));
+		}
+		if ((error = SYSCTL_OUT(req, &sd, sizeof(sd))) != 0)
+			return (error);
+	}
+	for (i = 0; i < ufs_trace_ncpu; i++) {
+		count = ufs_trace_rings[i]->tr_count;
+		if ((error = SYSCTL_OUT(req, &count, sizeof(count))) != 0)
+			return (error);
+		if ((error = SYSCTL_OUT(req, ufs_trace_rings[i]->tr_recs,
+		    sizeof(ufs_trace_rings[i]->tr_recs))) != 0)
+			return (error);
+	}
+	return (0);
+}
+
+SYSCTL_DECL(_debug);
+SYSCTL_NODE(_debug, OID_AUTO, ufs_trace, CTLFLAG_RW | CTLFLAG_LOCKED, 0,
+    "ufsX event tracing");
+SYSCTL_PROC(_debug_ufs_trace, OID_AUTO, mask,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED, 0, 0, sysctl_ufs_trace_mask,
+    "IU", "Subsystems and classes of events to record");
+SYSCTL_PROC(_debug_ufs_trace, OID_AUTO, dump,
+    CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_LOCKED, 0, 0, sysctl_ufs_trace_dump,
+    "S,ufs_trace_hdr", "Site table and trace rings");
+
+void
+ufs_trace_init(void)
+{
+
+	clock_timebase_info(&ufs_trace_timebase);
+	ufs_trace_lck = lck_mtx_alloc_init(ffs_lock_group, LCK_ATTR_NULL);
+	sysctl_register_oid(&sysctl__debug_ufs_trace);
+	sysctl_register_oid(&sysctl__debug_ufs_trace_mask);
+	sysctl_register_oid(&sysctl__debug_ufs_trace_dump);
+}
+
+void
+ufs_trace_uninit(void)
+{
+	int i;
+
+	ufs_trace_mask = 0;
+	sysctl_unregister_oid(&sysctl__debug_ufs_trace_dump);
+	sysctl_unregister_oid(&sysctl__debug_ufs_trace_mask);
+	sysctl_unregister_oid(&sysctl__debug_ufs_trace);
+	for (i = 0; i < ufs_trace_ncpu; i++) {
+		_FREE(ufs_trace_rings[i], M_TEMP);
+		ufs_trace_rings[i] = NULL;
+	}
+	ufs_trace_ncpu = 0;
+	lck_mtx_free(ufs_trace_lck, ffs_lock_group);
+	ufs_trace_lck = NULL;
+}
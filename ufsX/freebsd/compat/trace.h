@@ -0,0 +1,110 @@
+//
+//  trace.h
+//  ufsX
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Binary event tracing. Each call site is a static ufs_trace_site that
+// gets a small number the first time it fires; an event is that number,
+// a timestamp, the thread and one argument, written to the ring of the
+// CPU it happens on. Nothing is formatted in the kernel: the rings and
+// the site table are read out through the debug.ufs_trace.dump sysctl
+// and turned into text by ufstrace(1).
+//
+// The layout below is the dump format and is shared with ufstrace.
+
+#ifndef ufs_trace_h
+#define ufs_trace_h
+
+#include <stdint.h>
+
+#define	UFS_TRACE_MAGIC		0x54534655	/* "UFST" */
+#define	UFS_TRACE_VERSION	1
+
+/* Events */
+#define	UFS_TRACE_ENTER		1	/* function entered */
+#define	UFS_TRACE_RETURN	2	/* function returns arg */
+#define	UFS_TRACE_XLOCK		3	/* inode lock, arg is the inode */
+#define	UFS_TRACE_SLOCK		4
+#define	UFS_TRACE_LOCKPAIR	5
+#define	UFS_TRACE_UNLOCKPAIR	6
+#define	UFS_TRACE_UPGRADE	7
+#define	UFS_TRACE_DOWNGRADE	8
+#define	UFS_TRACE_UNLOCK	9
+
+/*
+ * Enable mask (debug.ufs_trace.mask): an event is recorded when both the
+ * bit of the subsystem it comes from and the bit of its class are set.
+ */
+#define	UFS_TRACE_UFS		0x0001	/* ufs_*.c */
+#define	UFS_TRACE_FFS		0x0002	/* ffs_*.c, but softdep */
+#define	UFS_TRACE_SOFTDEP	0x0004	/* ffs_softdep.c */
+#define	UFS_TRACE_OTHER		0x0008	/* compat and the rest */
+#define	UFS_TRACE_FUNC		0x0100	/* ENTER, RETURN */
+#define	UFS_TRACE_LOCK		0x0200	/* inode lock operations */
+#define	UFS_TRACE_SUBSYS	0x00ff
+#define	UFS_TRACE_CLASS		0xff00
+#define	UFS_TRACE_ALL		0x030f
+
+struct ufs_trace_hdr {
+	uint32_t	th_magic;
+	uint32_t	th_version;
+	uint32_t	th_ncpu;	/* rings that follow */
+	uint32_t	th_nrecs;	/* records per ring */
+	uint32_t	th_nsites;	/* site descriptions that follow */
+	uint32_t	th_numer;	/* mach_timebase_info, to get ns */
+	uint32_t	th_denom;
+	uint32_t	th_pad;
+};
+
+struct ufs_trace_sitedesc {
+	uint16_t	sd_event;
+	uint16_t	sd_mask;	/* subsystem | class */
+	uint32_t	sd_line;
+	char		sd_file[48];
+	char		sd_func[72];
+};
+
+/*
+ * After the sites come th_ncpu rings, each a uint64_t count of records
+ * ever written to it followed by th_nrecs records; record i lives at
+ * i % th_nrecs. A record with tr_site 0 was never written or was being
+ * written when the dump was taken. Site n is sitedesc[n - 1].
+ */
+struct ufs_trace_rec {
+	uint64_t	tr_time;	/* mach_absolute_time() */
+	uint64_t	tr_thread;	/* thread_tid() */
+	uint64_t	tr_arg;
+	uint32_t	tr_site;
+	uint32_t	tr_cpu;
+};
+
+#ifdef KERNEL
+
+struct ufs_trace_site {
+	const char	*ts_file;
+	const char	*ts_func;
+	int		ts_line;
+	int		ts_event;
+	volatile uint32_t ts_id;	/* 0 until the site first fires */
+	uint32_t	ts_mask;
+};
+
+extern volatile uint32_t ufs_trace_mask;
+
+void	ufs_trace(struct ufs_trace_site *, uint64_t);
+void	ufs_trace_init(void);
+void	ufs_trace_uninit(void);
+
+#define	UFS_TRACE(ev, arg) do {						\
+	static struct ufs_trace_site __ts = {				\
+		__FILE__, __func__, __LINE__, (ev), 0, 0		\
+	};								\
+	if (__builtin_expect(ufs_trace_mask != 0, 0))			\
+		ufs_trace(&__ts, (uint64_t)(arg));			\
+} while (0)
+
+#endif /* KERNEL */
+
+#endif /* ufs_trace_h */
@@ -118,7 +118,9 @@ static ufs2_daddr_t	ffs_hashalloc
 		(struct inode *, u_int, ufs2_daddr_t, int, int, allocfcn_t *);
 static ufs2_daddr_t ffs_nodealloccg(struct inode *, u_int, ufs2_daddr_t, int,
 		    int);
-static ufs1_daddr_t ffs_mapsearch(struct fs *, struct cg *, ufs2_daddr_t, int);
+static struct ffs_fragtree *ffs_getfragtree(struct ufsmount *, struct cg *);
+static ufs1_daddr_t ffs_mapsearch(struct fs *, struct cg *, struct ffs_fragtree *,
+	    ufs2_daddr_t, int);
 static int __unused ffs_reallocblks_ufs1(struct vnop_reallocblks_args *);
 static int __unused ffs_reallocblks_ufs2(struct vnop_reallocblks_args *);
 static void	ffs_ckhash_cg(struct buf *);
@@ -1697,6 +1699,8 @@ ffs_fragextend(struct inode *ip, u_int cg, ufs2_daddr_t bprev, int osize, int ns
 		cgp->cg_cs.cs_nffree--;
 		nffree++;
 	}
+	ffs_fragtree_update(fs, ffs_getfragtree(ump, cgp), blksfree,
+	    bno + numfrags(fs, osize), nffree);
 	UFS_LOCK(ump);
 	fs->fs_cstotal.cs_nffree -= nffree;
 	fs->fs_cs(fs, cg).cs_nffree -= nffree;
@@ -1776,11 +1780,14 @@ ffs_alloccg(struct inode *ip, u_int cg, ufs2_daddr_t bpref, int size, int rsize)
 	}
 	ASSERT(size == rsize,
 	    ("ffs_alloccg: size(%d) != rsize(%d)", size, rsize));
-	bno = ffs_mapsearch(fs, cgp, bpref, allocsiz);
+	bno = ffs_mapsearch(fs, cgp, ffs_getfragtree(ump, cgp), bpref,
+	    allocsiz);
 	if (bno < 0)
 		goto fail;
 	for (i = 0; i < frags; i++)
 		clrbit(blksfree, bno + i);
+	ffs_fragtree_update(fs, ffs_getfragtree(ump, cgp), blksfree, bno,
+	    frags);
 	cgp->cg_cs.cs_nffree -= frags;
 	cgp->cg_frsum[allocsiz]--;
 	if (frags != allocsiz)
@@ -1848,7 +1855,8 @@ ffs_alloccgblk(struct inode *ip, struct buf *bp, ufs2_daddr_t bpref, int size)
 	/*
 	 * Take the next available block in this cylinder group.
 	 */
-	bno = ffs_mapsearch(fs, cgp, bpref, (int)fs->fs_frag);
+	bno = ffs_mapsearch(fs, cgp, ffs_getfragtree(ump, cgp), bpref,
+	    (int)fs->fs_frag);
 	if (bno < 0)
 		return (0);
 	/* Update cg_rotor only if allocated from the data zone */
@@ -1878,6 +1886,8 @@ gotit:
 		fs->fs_fmod = 1;
 		cgp->cg_frsum[i]++;
 	}
+	ffs_fragtree_update(fs, ffs_getfragtree(ump, cgp), blksfree,
+	    dtogd(fs, blkno), fs->fs_frag);
 	/* XXX Fixme. */
 	UFS_UNLOCK(ump);
 	if (DOINGSOFTDEP(ITOV(ip)))
@@ -2301,6 +2311,10 @@ ffs_blkfree_cg(struct ufsmount *ump, struct fs *fs, struct vnode *devvp, ufs2_da
 			fs->fs_cs(fs, cg).cs_nbfree++;
 		}
 	}
+	/* A snapshot's copy of the map is not the one the summary covers. */
+	if (vnode_vtype(devvp) != VREG)
+		ffs_fragtree_update(fs, ffs_getfragtree(ump, cgp), blksfree,
+		    cgbno, (int)numfrags(fs, size));
 	fs->fs_fmod = 1;
 	ACTIVECLEAR(fs, cg);
 	UFS_UNLOCK(ump);
@@ -2809,6 +2823,57 @@ ffs_checkfreefile(struct fs *fs, struct vnode *devvp, ino_t ino)
 	return (ret);
 }
 
+/*
+ * Return the free fragment summary of a cylinder group, building it the
+ * first time the group is looked at. The caller holds the cg buffer,
+ * which is what keeps the summary of that group from changing under it.
+ * NULL if there's no memory for it; ffs_mapsearch() then just scans.
+ */
+static struct ffs_fragtree *
+ffs_getfragtree(struct ufsmount *ump, struct cg *cgp)
+{
+	struct ffs_fragtree *ft;
+	struct fs *fs;
+	u_char *node;
+
+	fs = ump->um_fs;
+	if (ump->um_fragtree == NULL || (u_int)cgp->cg_cgx >= fs->fs_ncg)
+		return (NULL);
+	ft = &ump->um_fragtree[cgp->cg_cgx];
+	if (ft->ft_node == NULL) {
+		node = malloc(ffs_fragtree_size(fs), M_UFSMNT, M_NOWAIT);
+		if (node == NULL)
+			return (NULL);
+		ffs_fragtree_init(fs, ft, node, cg_blksfree(cgp));
+	}
+	return (ft);
+}
+
+/*
+ * Set up and tear down the per-cg summaries of a mount.
+ */
+void
+ffs_fragtree_mount(struct ufsmount *ump)
+{
+
+	ump->um_fragtree = malloc(ump->um_fs->fs_ncg *
+	    sizeof(struct ffs_fragtree), M_UFSMNT, M_WAITOK | M_ZERO);
+}
+
+void
+ffs_fragtree_unmount(struct ufsmount *ump)
+{
+	u_int cg;
+
+	if (ump->um_fragtree == NULL)
+		return;
+	for (cg = 0; cg < ump->um_fs->fs_ncg; cg++)
+		if (ump->um_fragtree[cg].ft_node != NULL)
+			free(ump->um_fragtree[cg].ft_node, M_UFSMNT);
+	free(ump->um_fragtree, M_UFSMNT);
+	ump->um_fragtree = NULL;
+}
+
 /*
  * Find a block of the specified size in the specified cylinder group.
  *
@@ -2816,7 +2881,8 @@ ffs_checkfreefile(struct fs *fs, struct vnode *devvp, ino_t ino)
  * available.
  */
 static ufs1_daddr_t
-ffs_mapsearch(struct fs *fs, struct cg *cgp, ufs2_daddr_t bpref, int allocsiz)
+ffs_mapsearch(struct fs *fs, struct cg *cgp, struct ffs_fragtree *ft,
+    ufs2_daddr_t bpref, int allocsiz)
 {
 	ufs1_daddr_t bno;
 	int start, len, loc, i;
@@ -2832,6 +2898,13 @@ ffs_mapsearch(struct fs *fs, struct cg *cgp, ufs2_daddr_t bpref, int allocsiz)
 	else
 		start = cgp->cg_frotor / NBBY;
 	blksfree = cg_blksfree(cgp);
+	if (ft != NULL) {
+		loc = ffs_fragtree_search(fs, ft, blksfree, start, allocsiz);
+		if (loc != -1) {
+			bno = loc * NBBY;
+			goto found;
+		}
+	}
 	len = howmany(fs->fs_fpg, NBBY) - start;
 	loc = scanc((u_int)len, (u_char *)&blksfree[start],
 		fragtbl[fs->fs_frag],
@@ -2850,6 +2923,10 @@ ffs_mapsearch(struct fs *fs, struct cg *cgp, ufs2_daddr_t bpref, int allocsiz)
 		}
 	}
 	bno = (start + len - loc) * NBBY;
+	/* The summary missed it, so it is out of date; start it over. */
+	if (ft != NULL)
+		ffs_fragtree_init(fs, ft, ft->ft_node, blksfree);
+found:
 	cgp->cg_frotor = bno;
 	/*
 	 * found the byte in the map
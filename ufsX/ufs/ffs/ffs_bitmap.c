@@ -0,0 +1,298 @@
+//
+//  ffs_bitmap.c
+//  ufsX
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Scanning of the cylinder group bitmaps (cg_blksfree, cg_inosused,
+// cg_clustersfree), shared by the kext and libufs. Bit i of a map is bit
+// i % NBBY of byte i / NBBY, so on a little endian machine eight bytes
+// loaded as a uint64_t hold bits 64k..64k+63 in order and a whole word
+// can be tested at once.
+//
+// Long stretches of all-free or all-used bytes are skipped before that,
+// 16 bytes at a time with SSE2 or NEON in userland, and a word at a time
+// in the kernel, where we don't touch the vector registers.
+//
+// Ranges are in bits, [start, end), and a miss is -1.
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <sys/param.h>
+
+#ifndef _KERNEL
+#include <stdint.h>
+#include <string.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#define	BITMAP_SSE2
+#elif defined(__aarch64__) || defined(__arm64__)
+#include <arm_neon.h>
+#define	BITMAP_NEON
+#endif
+#else /* _KERNEL */
+#include <sys/systm.h>
+#include <libkern/libkern.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ffs/ffs_extern.h>
+#endif /* _KERNEL */
+
+#if BYTE_ORDER != LITTLE_ENDIAN
+#error ffs_bitmap.c assumes a little endian machine
+#endif
+
+#define	WBITS		64
+
+/*
+ * Word w of the map, i.e. bytes 8w..8w+7, without reading past nbytes.
+ */
+static inline uint64_t
+bitmap_word(const u_char *map, int w, int nbytes)
+{
+	uint64_t v;
+	int i, off;
+
+	off = w * sizeof(v);
+	if (off + (int)sizeof(v) <= nbytes) {
+		memcpy(&v, map + off, sizeof(v));
+		return (v);
+	}
+	v = 0;
+	for (i = 0; off + i < nbytes; i++)
+		v |= (uint64_t)map[off + i] << (NBBY * i);
+	return (v);
+}
+
+/*
+ * The bits of word w that are inside [start, end).
+ */
+static inline uint64_t
+bitmap_range(int w, int start, int end)
+{
+	uint64_t mask;
+	int lo, hi;
+
+	mask = ~(uint64_t)0;
+	lo = w * WBITS;
+	hi = lo + WBITS;
+	if (start > lo)
+		mask &= ~(uint64_t)0 << (start - lo);
+	if (end < hi)
+		mask &= ~(uint64_t)0 >> (hi - end);
+	return (mask);
+}
+
+/*
+ * First byte in [from, to) that isn't c, or to.
+ */
+static int
+bitmap_skip(const u_char *map, int from, int to, u_char c)
+{
+	uint64_t pat, v;
+
+#if defined(BITMAP_SSE2)
+	__m128i vc;
+
+	vc = _mm_set1_epi8((char)c);
+	while (from + 16 <= to) {
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(vc,
+		    _mm_loadu_si128((const __m128i *)(map + from)))) != 0xffff)
+			break;
+		from += 16;
+	}
+#elif defined(BITMAP_NEON)
+	uint8x16_t vc;
+
+	vc = vdupq_n_u8(c);
+	while (from + 16 <= to) {
+		if (vminvq_u8(vceqq_u8(vc, vld1q_u8(map + from))) != 0xff)
+			break;
+		from += 16;
+	}
+#endif
+	pat = c * 0x0101010101010101ULL;
+	while (from + (int)sizeof(v) <= to) {
+		memcpy(&v, map + from, sizeof(v));
+		if (v != pat)
+			break;
+		from += sizeof(v);
+	}
+	while (from < to && map[from] == c)
+		from++;
+	return (from);
+}
+
+/*
+ * Common body of ffs_bitmap_ffs() and ffs_bitmap_ffc(): first bit in
+ * [start, end) that is set in the map xor'ed with flip.
+ */
+static int
+bitmap_first(const u_char *map, int start, int end, uint64_t flip)
+{
+	uint64_t raw, v;
+	int nbytes, w, b;
+
+	if (start >= end)
+		return (-1);
+	nbytes = howmany(end, NBBY);
+	w = start / WBITS;
+	for (;;) {
+		raw = bitmap_word(map, w, nbytes) ^ flip;
+		v = raw & bitmap_range(w, start, end);
+		if (v != 0)
+			return (w * WBITS + __builtin_ctzll(v));
+		if (++w * WBITS >= end)
+			return (-1);
+		if (raw != 0)
+			continue;
+		/* Jump over whole bytes that have nothing for us. */
+		b = bitmap_skip(map, w * (int)sizeof(v), nbytes, (u_char)flip);
+		w = b / (int)sizeof(v);
+		if (w * WBITS >= end)
+			return (-1);
+	}
+}
+
+/*
+ * First set bit in [start, end).
+ */
+int
+ffs_bitmap_ffs(const u_char *map, int start, int end)
+{
+
+	return (bitmap_first(map, start, end, 0));
+}
+
+/*
+ * First clear bit in [start, end).
+ */
+int
+ffs_bitmap_ffc(const u_char *map, int start, int end)
+{
+
+	return (bitmap_first(map, start, end, ~(uint64_t)0));
+}
+
+/*
+ * Last clear bit in [start, end).
+ */
+int
+ffs_bitmap_flc(const u_char *map, int start, int end)
+{
+	uint64_t v;
+	int nbytes, w;
+
+	if (start >= end)
+		return (-1);
+	nbytes = howmany(end, NBBY);
+	for (w = (end - 1) / WBITS; w * WBITS + WBITS > start; w--) {
+		v = ~bitmap_word(map, w, nbytes) & bitmap_range(w, start, end);
+		if (v != 0)
+			return (w * WBITS + WBITS - 1 - __builtin_clzll(v));
+		if (w == 0)
+			break;
+	}
+	return (-1);
+}
+
+/*
+ * Number of set bits in [start, end).
+ */
+int
+ffs_bitmap_count(const u_char *map, int start, int end)
+{
+	int nbytes, w, n;
+
+	if (start >= end)
+		return (0);
+	nbytes = howmany(end, NBBY);
+	n = 0;
+	for (w = start / WBITS; w * WBITS < end; w++)
+		n += __builtin_popcountll(bitmap_word(map, w, nbytes) &
+		    bitmap_range(w, start, end));
+	return (n);
+}
+
+/*
+ * First run of len set bits inside [start, end).
+ */
+int
+ffs_bitmap_findrun(const u_char *map, int start, int end, int len)
+{
+	int run, stop;
+
+	if (len <= 0)
+		return (-1);
+	while (start + len <= end) {
+		if ((run = ffs_bitmap_ffs(map, start, end)) == -1)
+			return (-1);
+		if (run + len > end)
+			return (-1);
+		stop = ffs_bitmap_ffc(map, run, run + len);
+		if (stop == -1)
+			return (run);
+		start = stop + 1;
+	}
+	return (-1);
+}
+
+/*
+ * First free block in blocks [start, end) of cg_blksfree, as a block
+ * number within the cg. A block is free when all fs_frag of its bits
+ * are; folding each group of fs_frag bits into its lowest bit with and
+ * and shift finds them a word at a time whatever the block size.
+ */
+int
+ffs_bitmap_findblock(struct fs *fs, const u_char *blksfree, int start,
+    int end)
+{
+	uint64_t raw, v, lowbits;
+	int frag, nbytes, w, b, bit, lo, hi;
+
+	frag = fs->fs_frag;
+	switch (frag) {
+	case 8:
+		lowbits = 0x0101010101010101ULL;
+		break;
+	case 4:
+		lowbits = 0x1111111111111111ULL;
+		break;
+	case 2:
+		lowbits = 0x5555555555555555ULL;
+		break;
+	case 1:
+		lowbits = ~(uint64_t)0;
+		break;
+	default:
+		return (-1);
+	}
+	lo = start * frag;
+	hi = end * frag;
+	if (lo >= hi)
+		return (-1);
+	nbytes = howmany(hi, NBBY);
+	w = lo / WBITS;
+	for (;;) {
+		raw = bitmap_word(blksfree, w, nbytes);
+		v = raw & bitmap_range(w, lo, hi);
+		for (bit = 1; bit < frag; bit <<= 1)
+			v &= v >> bit;
+		v &= lowbits;
+		if (v != 0)
+			return ((w * WBITS + __builtin_ctzll(v)) / frag);
+		if (++w * WBITS >= hi)
+			return (-1);
+		if (raw != 0)
+			continue;
+		/* Skip over bytes with nothing free in them. */
+		b = bitmap_skip(blksfree, w * (int)sizeof(v), nbytes, 0);
+		w = b / (int)sizeof(v);
+		if (w * WBITS >= hi)
+			return (-1);
+	}
+}
@@ -0,0 +1,323 @@
+//
+//  ffs_bitmap_test.c
+//  ufsX
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Checks the ffs_bitmap_*() searches against bit at a time versions over
+// random maps, ranges, fill ratios and fragment sizes, and with -b times
+// both on a 16KB map, the size of a cg_blksfree with 128k fragments, at
+// several fill ratios.
+//
+// Each map is placed at the end of its own allocation, so reading a byte
+// past the range shows up under a memory checker.
+
+#include <sys/param.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#include "bench.h"
+
+#define	MAXBITS		(128 * 1024)
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+static const double fills[] = { 0, 0.5, 0.9, 0.99, 0.999, 1 };
+
+static int
+naive_ffs(const u_char *map, int start, int end)
+{
+	int i;
+
+	for (i = start; i < end; i++)
+		if (isset(map, i))
+			return (i);
+	return (-1);
+}
+
+static int
+naive_ffc(const u_char *map, int start, int end)
+{
+	int i;
+
+	for (i = start; i < end; i++)
+		if (isclr(map, i))
+			return (i);
+	return (-1);
+}
+
+static int
+naive_flc(const u_char *map, int start, int end)
+{
+	int i;
+
+	for (i = end - 1; i >= start; i--)
+		if (isclr(map, i))
+			return (i);
+	return (-1);
+}
+
+static int
+naive_count(const u_char *map, int start, int end)
+{
+	int i, n;
+
+	n = 0;
+	for (i = start; i < end; i++)
+		if (isset(map, i))
+			n++;
+	return (n);
+}
+
+static int
+naive_findrun(const u_char *map, int start, int end, int len)
+{
+	int i, run;
+
+	if (len <= 0)
+		return (-1);
+	run = 0;
+	for (i = start; i < end; i++) {
+		run = isset(map, i) ? run + 1 : 0;
+		if (run == len)
+			return (i - len + 1);
+	}
+	return (-1);
+}
+
+/* What cgballoc() did: test each block in turn. */
+static int
+naive_findblock(struct fs *fs, const u_char *map, int start, int end)
+{
+	int b, i;
+
+	for (b = start; b < end; b++) {
+		for (i = 0; i < fs->fs_frag; i++)
+			if (isclr(map, b * fs->fs_frag + i))
+				break;
+		if (i == fs->fs_frag)
+			return (b);
+	}
+	return (-1);
+}
+
+/*
+ * Fill nbits of map, a bit set with probability p. Half the maps are
+ * built from runs instead, which is what allocation leaves behind and
+ * what the skip loops are for.
+ */
+static void
+fillmap(u_char *map, int nbits, double p)
+{
+	int i, len, set;
+
+	memset(map, 0, howmany(nbits, NBBY));
+	if (bench_uniform(2) == 0) {
+		for (i = 0; i < nbits; i++)
+			if (bench_uniform(1000000) < p * 1000000)
+				setbit(map, i);
+		return;
+	}
+	for (i = 0; i < nbits; i += len) {
+		len = 1 + (int)bench_uniform(bench_uniform(2) ? 8 : 2048);
+		set = bench_uniform(1000000) < p * 1000000;
+		for (; len > 0 && i < nbits; len--, i++)
+			if (set)
+				setbit(map, i);
+	}
+}
+
+#define	CHECK(what, got, want) do {				\
+	if ((got) != (want))						\
+		bench_fail("%s: [%d, %d) of %d fill %g: %d, want %d",	\
+		    what, start, end, nbits, fill, got, want);		\
+} while (0)
+
+static void
+check(void)
+{
+	static const int frags[] = { 1, 2, 4, 8 };
+	struct fs fs;
+	u_char *map;
+	double fill;
+	int nbits, nbytes, start, end, len;
+
+	nbits = 1 + (int)bench_uniform(bench_uniform(2) ? 256 : MAXBITS);
+	nbytes = howmany(nbits, NBBY);
+	fill = fills[bench_uniform(nitems(fills))];
+	if ((map = malloc(nbytes)) == NULL) {
+		perror("malloc");
+		exit(2);
+	}
+	fillmap(map, nbits, fill);
+	start = (int)bench_uniform(nbits + 1);
+	end = start + (int)bench_uniform(nbits - start + 1);
+	CHECK("ffs", ffs_bitmap_ffs(map, start, end),
+	    naive_ffs(map, start, end));
+	CHECK("ffc", ffs_bitmap_ffc(map, start, end),
+	    naive_ffc(map, start, end));
+	CHECK("flc", ffs_bitmap_flc(map, start, end),
+	    naive_flc(map, start, end));
+	CHECK("count", ffs_bitmap_count(map, start, end),
+	    naive_count(map, start, end));
+	len = 1 + (int)bench_uniform(bench_uniform(2) ? 8 : 200);
+	CHECK("findrun", ffs_bitmap_findrun(map, start, end, len),
+	    naive_findrun(map, start, end, len));
+
+	/* The same range in blocks, rounded in to whole blocks. */
+	memset(&fs, 0, sizeof(fs));
+	fs.fs_frag = frags[bench_uniform(nitems(frags))];
+	start = howmany(start, fs.fs_frag);
+	end = end / fs.fs_frag;
+	CHECK("findblock", ffs_bitmap_findblock(&fs, map, start, end),
+	    naive_findblock(&fs, map, start, end));
+	free(map);
+}
+
+struct mapbench {
+	struct fs	mb_fs;
+	const u_char	*mb_map;
+	int		mb_nbits;
+	int		mb_naive;
+	int		mb_res;
+};
+
+static void
+bench_findblock(void *arg)
+{
+	struct mapbench *mb;
+	int nblks;
+
+	mb = arg;
+	nblks = mb->mb_nbits / mb->mb_fs.fs_frag;
+	mb->mb_res = mb->mb_naive ?
+	    naive_findblock(&mb->mb_fs, mb->mb_map, 0, nblks) :
+	    ffs_bitmap_findblock(&mb->mb_fs, mb->mb_map, 0, nblks);
+}
+
+static void
+bench_ffc(void *arg)
+{
+	struct mapbench *mb;
+
+	mb = arg;
+	mb->mb_res = mb->mb_naive ? naive_ffc(mb->mb_map, 0, mb->mb_nbits) :
+	    ffs_bitmap_ffc(mb->mb_map, 0, mb->mb_nbits);
+}
+
+static void
+bench_count(void *arg)
+{
+	struct mapbench *mb;
+
+	mb = arg;
+	mb->mb_res = mb->mb_naive ? naive_count(mb->mb_map, 0, mb->mb_nbits) :
+	    ffs_bitmap_count(mb->mb_map, 0, mb->mb_nbits);
+}
+
+static void
+bench(void)
+{
+	static const struct {
+		const char	*name;
+		void		(*fn)(void *);
+		int		free;	/* set bits are free ones */
+		int		whole;	/* reads all of the map */
+	} ops[] = {
+		{ "findblock", bench_findblock, 1, 0 },
+		{ "ffc", bench_ffc, 0, 0 },
+		{ "count", bench_count, 0, 1 },
+	};
+	struct mapbench mb;
+	u_char *map;
+	char name[64];
+	uint64_t cut;
+	size_t f, i;
+	int j, naive, used;
+
+	if ((map = malloc(MAXBITS / NBBY)) == NULL) {
+		perror("malloc");
+		exit(2);
+	}
+	memset(&mb, 0, sizeof(mb));
+	mb.mb_fs.fs_frag = 8;
+	mb.mb_map = map;
+	mb.mb_nbits = MAXBITS;
+	for (f = 1; f < nitems(fills) - 1; f++) {
+		cut = fills[f] * 1000000;
+		for (i = 0; i < nitems(ops); i++) {
+			/*
+			 * Independent bits, so a free block is rare past half
+			 * full and each search runs well into the map.
+			 */
+			memset(map, 0, MAXBITS / NBBY);
+			for (j = 0; j < MAXBITS; j++) {
+				used = bench_uniform(1000000) < cut;
+				if (used != ops[i].free)
+					setbit(map, j);
+			}
+			for (naive = 1; naive >= 0; naive--) {
+				mb.mb_naive = naive;
+				snprintf(name, sizeof(name), "%s %s %g",
+				    ops[i].name, naive ? "bitwise" : "bitmap",
+				    fills[f]);
+				bench_report(name, bench_time(ops[i].fn, &mb),
+				    ops[i].whole ? MAXBITS / NBBY : 0);
+			}
+		}
+	}
+	free(map);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: ffs_bitmap_test [-b] [-n count] [-s seed]\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *seed;
+	long i, n;
+	int bflag, ch;
+
+	bflag = 0;
+	n = 20000;
+	seed = NULL;
+	while ((ch = getopt(argc, argv, "bn:s:")) != -1)
+		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = optarg;
+			break;
+		default:
+			usage();
+		}
+	if (argc != optind)
+		usage();
+	bench_seed(seed);
+	for (i = 0; i < n; i++)
+		check();
+	printf("%ld random maps checked\n", n);
+	if (bflag)
+		bench();
+	return (bench_done());
+}
@@ -45,6 +45,7 @@ struct bufobj;
 struct cg;
 struct fid;
 struct fs;
+struct ffs_fragtree;
 struct inode;
 struct malloc_type;
 struct mount;
@@ -64,6 +65,12 @@ int	ffs_balloc_ufs1(struct vnode *a_vp, off_t a_startoffset, int a_size,
             struct vfs_context *a_context, int a_flags, struct buf **a_bpp);
 int	ffs_balloc_ufs2(struct vnode *a_vp, off_t a_startoffset, int a_size,
             struct vfs_context *a_context, int a_flags, struct buf **a_bpp);
+int	ffs_bitmap_count(const u_char *, int, int);
+int	ffs_bitmap_ffc(const u_char *, int, int);
+int	ffs_bitmap_ffs(const u_char *, int, int);
+int	ffs_bitmap_findblock(struct fs *, const u_char *, int, int);
+int	ffs_bitmap_findrun(const u_char *, int, int, int);
+int	ffs_bitmap_flc(const u_char *, int, int);
 void	ffs_blkfree(struct ufsmount *, struct fs *, struct vnode *,
 	    ufs2_daddr_t, long, ino_t, enum vtype, struct workhead *, u_long);
 ufs2_daddr_t ffs_blkpref_ufs1(struct inode *, ufs_lbn_t, int, ufs1_daddr_t *);
@@ -78,6 +85,15 @@ void	ffs_bdflush(struct bufobj *, struct buf *);
 int	ffs_copyonwrite(struct vnode *, struct buf *);
 int	ffs_flushfiles(struct mount *, int, struct vfs_context *);
 void	ffs_fragacct(struct fs *, int, int32_t [], int);
+void	ffs_fragtree_mount(struct ufsmount *);
+void	ffs_fragtree_init(struct fs *, struct ffs_fragtree *, u_char *,
+	    u_char *);
+int	ffs_fragtree_search(struct fs *, struct ffs_fragtree *, u_char *, int,
+	    int);
+int	ffs_fragtree_size(struct fs *);
+void	ffs_fragtree_unmount(struct ufsmount *);
+void	ffs_fragtree_update(struct fs *, struct ffs_fragtree *, u_char *,
+	    ufs1_daddr_t, int);
 int	ffs_freefile(struct ufsmount *, struct fs *, struct vnode *, ino_t,
 	    int, struct workhead *);
 void	ffs_fserr(struct fs *, ino_t, char *);
@@ -233,7 +249,7 @@ struct ialloc_critical* ialloc_critical_new(void);
 void ialloc_critical_free(struct ialloc_critical *crit);
 void ialloc_critical_wait(struct ialloc_critical* crit, ino64_t ino);
 bool ialloc_is_critical(struct ialloc_critical* crit, ino64_t ino);
-void ialloc_critical_enter(struct ialloc_critical* crit, ino64_t ino);
+bool ialloc_critical_enter(struct ialloc_critical* crit, ino64_t ino);
 void ialloc_critical_leave(struct ialloc_critical* crit, ino64_t ino);
 __END_DECLS
 
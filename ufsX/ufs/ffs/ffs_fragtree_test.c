@@ -0,0 +1,371 @@
+//
+//  ffs_fragtree_test.c
+//  ufsX
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Replays an allocation trace against one cylinder group's free map the
+// way ffs_alloccg() and ffs_blkfree_cg() change it, and checks at every
+// fragment allocation that ffs_fragtree_search() finds the byte scanc()
+// finds. With -b the same trace is timed with each of them doing the
+// searches, at a few fill levels.
+//
+// The trace comes from the seed: allocations of 1 to fs_frag - 1 frags,
+// or a whole block when no run that size or bigger is free, and frees of
+// random earlier allocations, chosen to hold the group near a fill level.
+
+#include <sys/param.h>
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#include "bench.h"
+
+#define	FPG		(128 * 1024)	/* frags in the group */
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+struct extent {
+	int	e_bno;
+	int	e_len;
+};
+
+struct replay {
+	struct fs	r_fs;
+	struct ffs_fragtree r_ft;
+	u_char		*r_map;		/* cg_blksfree */
+	u_char		*r_node;	/* fragtree nodes */
+	int32_t		r_frsum[MAXFRAG];
+	int		r_rotor;	/* cg_frotor */
+	int		r_nfree;
+	struct extent	*r_ext;		/* allocations still held */
+	int		r_next;
+	/* The trace. */
+	uint64_t	r_seed;
+	long		r_nops;
+	double		r_fill;
+	/* How to search, and what was found. */
+	int		r_tree;
+	int		r_check;
+	long		r_nsearch;
+	/* Run sizes the group has left, for timing searches alone. */
+	int		r_sizes[MAXFRAG];
+	int		r_nsizes;
+	int		r_found;
+};
+
+/* libkern's scanc(): bytes left from the first match, or 0. */
+static int
+scanc_ref(u_int size, const u_char *cp, const u_char *table, u_char mask)
+{
+	const u_char *end;
+
+	for (end = cp + size; cp < end && (table[*cp] & mask) == 0; cp++)
+		;
+	return (end - cp);
+}
+
+/* What ffs_mapsearch() did before the fragtree: scanc, then wrap. */
+static int
+search_scanc(struct replay *r, int start, int allocsiz)
+{
+	struct fs *fs;
+	u_char mask;
+	int len, loc;
+
+	fs = &r->r_fs;
+	mask = (u_char)(1 << (allocsiz - 1 + (fs->fs_frag % NBBY)));
+	len = howmany(fs->fs_fpg, NBBY) - start;
+	loc = scanc_ref(len, &r->r_map[start], fragtbl[fs->fs_frag], mask);
+	if (loc != 0)
+		return (start + len - loc);
+	len = start + 1;
+	loc = scanc_ref(len, r->r_map, fragtbl[fs->fs_frag], mask);
+	return (loc != 0 ? len - loc : -1);
+}
+
+/*
+ * Set or clear cnt frags at bno, keeping r_frsum and the tree current as
+ * ffs_alloccg() and ffs_blkfree_cg() do.
+ */
+static void
+change(struct replay *r, int bno, int cnt, int free)
+{
+	struct fs *fs;
+	int blk, i;
+
+	fs = &r->r_fs;
+	blk = bno - bno % fs->fs_frag;
+	ffs_fragacct(fs, blkmap(fs, r->r_map, blk), r->r_frsum, -1);
+	for (i = bno; i < bno + cnt; i++) {
+		if (free)
+			setbit(r->r_map, i);
+		else
+			clrbit(r->r_map, i);
+	}
+	ffs_fragacct(fs, blkmap(fs, r->r_map, blk), r->r_frsum, 1);
+	r->r_nfree += free ? cnt : -cnt;
+	ffs_fragtree_update(fs, &r->r_ft, r->r_map, bno, cnt);
+}
+
+/*
+ * The first run of exactly allocsiz free frags in the byte at loc, as
+ * ffs_mapsearch() sifts for it.
+ */
+static int
+siftbyte(struct replay *r, int loc, int allocsiz)
+{
+	struct fs *fs;
+	int bno, i, run;
+
+	fs = &r->r_fs;
+	for (bno = loc * NBBY; bno < (loc + 1) * NBBY; bno += fs->fs_frag) {
+		run = 0;
+		for (i = 0; i <= fs->fs_frag; i++) {
+			if (i < fs->fs_frag && isset(r->r_map, bno + i)) {
+				run++;
+				continue;
+			}
+			if (run == allocsiz)
+				return (bno + i - run);
+			run = 0;
+		}
+	}
+	return (-1);
+}
+
+/* Allocate frags frags; returns 0 if the group is out of space. */
+static int
+alloc(struct replay *r, int frags)
+{
+	struct fs *fs;
+	int allocsiz, bno, loc, want;
+
+	fs = &r->r_fs;
+	for (allocsiz = frags; allocsiz < fs->fs_frag; allocsiz++)
+		if (r->r_frsum[allocsiz] != 0)
+			break;
+	if (allocsiz == fs->fs_frag) {
+		/* Take a whole block and give back what isn't needed. */
+		bno = ffs_bitmap_findblock(fs, r->r_map, 0,
+		    fs->fs_fpg / fs->fs_frag);
+		if (bno == -1)
+			return (0);
+		bno *= fs->fs_frag;
+		change(r, bno, frags, 0);
+		goto done;
+	}
+	r->r_nsearch++;
+	if (r->r_tree)
+		loc = ffs_fragtree_search(fs, &r->r_ft, r->r_map,
+		    r->r_rotor / NBBY, allocsiz);
+	else
+		loc = search_scanc(r, r->r_rotor / NBBY, allocsiz);
+	if (r->r_check &&
+	    (want = search_scanc(r, r->r_rotor / NBBY, allocsiz)) != loc)
+		bench_fail("frag %d rotor %d allocsiz %d: found byte %d, "
+		    "want %d", fs->fs_frag, r->r_rotor, allocsiz, loc, want);
+	if (loc == -1 || (bno = siftbyte(r, loc, allocsiz)) == -1) {
+		bench_fail("frag %d allocsiz %d: frsum has a run the map "
+		    "doesn't", fs->fs_frag, allocsiz);
+		return (0);
+	}
+	r->r_rotor = loc * NBBY;
+	change(r, bno, frags, 0);
+done:
+	r->r_ext[r->r_next].e_bno = bno;
+	r->r_ext[r->r_next].e_len = frags;
+	r->r_next++;
+	return (1);
+}
+
+static void
+release(struct replay *r)
+{
+	struct extent *e;
+
+	e = &r->r_ext[bench_uniform(r->r_next)];
+	change(r, e->e_bno, e->e_len, 1);
+	*e = r->r_ext[--r->r_next];
+}
+
+static void
+replay_init(struct replay *r, int frag, uint64_t seed, long nops,
+    double fill)
+{
+
+	memset(r, 0, sizeof(*r));
+	r->r_fs.fs_frag = frag;
+	r->r_fs.fs_fpg = FPG;
+	r->r_map = malloc(FPG / NBBY);
+	r->r_node = malloc(ffs_fragtree_size(&r->r_fs));
+	r->r_ext = malloc(FPG * sizeof(*r->r_ext));
+	if (r->r_map == NULL || r->r_node == NULL || r->r_ext == NULL) {
+		perror("malloc");
+		exit(2);
+	}
+	r->r_seed = seed;
+	r->r_nops = nops;
+	r->r_fill = fill;
+}
+
+static void
+replay_free(struct replay *r)
+{
+
+	free(r->r_map);
+	free(r->r_node);
+	free(r->r_ext);
+}
+
+/* Run the trace from an empty group. */
+static void
+replay_run(void *arg)
+{
+	struct replay *r;
+	uint64_t state;
+	long i;
+	int held, frags;
+
+	r = arg;
+	memset(r->r_map, 0xff, FPG / NBBY);
+	memset(r->r_frsum, 0, sizeof(r->r_frsum));
+	r->r_rotor = 0;
+	r->r_nfree = FPG;
+	r->r_next = 0;
+	r->r_nsearch = 0;
+	ffs_fragtree_init(&r->r_fs, &r->r_ft, r->r_node, r->r_map);
+	/* The same trace every time, whatever else used the generator. */
+	state = bench_state;
+	bench_state = r->r_seed;
+	for (i = 0; i < r->r_nops; i++) {
+		held = FPG - r->r_nfree;
+		if (held < r->r_fill * FPG || r->r_next == 0) {
+			frags = 1 + (int)bench_uniform(r->r_fs.fs_frag - 1);
+			if (alloc(r, frags))
+				continue;
+		}
+		release(r);
+	}
+	bench_state = state;
+}
+
+/*
+ * One search of the map the trace left, from a random byte, for a run
+ * size the group has.
+ */
+static void
+search_one(void *arg)
+{
+	struct replay *r;
+	int allocsiz, start;
+
+	r = arg;
+	allocsiz = r->r_sizes[bench_uniform(r->r_nsizes)];
+	start = (int)bench_uniform(FPG / NBBY);
+	if (r->r_tree)
+		r->r_found = ffs_fragtree_search(&r->r_fs, &r->r_ft, r->r_map,
+		    start, allocsiz);
+	else
+		r->r_found = search_scanc(r, start, allocsiz);
+}
+
+static void
+bench(struct replay *r, const char *what, void (*fn)(void *), long div)
+{
+	char name[64];
+	double secs;
+
+	r->r_tree = 0;
+	secs = bench_time(fn, r);
+	snprintf(name, sizeof(name), "%s scanc frag %d %g", what,
+	    r->r_fs.fs_frag, r->r_fill);
+	bench_report(name, secs / div, 0);
+	r->r_tree = 1;
+	secs = bench_time(fn, r);
+	snprintf(name, sizeof(name), "%s fragtree frag %d %g", what,
+	    r->r_fs.fs_frag, r->r_fill);
+	bench_report(name, secs / div, 0);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: ffs_fragtree_test [-b] [-n ops] [-s seed]\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int frags[] = { 8, 4, 2 };
+	static const double checkfills[] = { 0.5, 0.9, 0.99 };
+	static const double benchfills[] = { 0.9, 0.97, 0.99 };
+	struct replay r;
+	char *seed;
+	long n;
+	size_t f, i;
+	int bflag, ch, s;
+
+	bflag = 0;
+	n = 100000;
+	seed = NULL;
+	while ((ch = getopt(argc, argv, "bn:s:")) != -1)
+		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = optarg;
+			break;
+		default:
+			usage();
+		}
+	if (argc != optind)
+		usage();
+	bench_seed(seed);
+	for (i = 0; i < nitems(frags); i++) {
+		for (f = 0; f < nitems(checkfills); f++) {
+			replay_init(&r, frags[i], bench_random() | 1, n,
+			    checkfills[f]);
+			r.r_tree = 1;
+			r.r_check = 1;
+			replay_run(&r);
+			printf("frag %d fill %g: %ld searches checked\n",
+			    frags[i], checkfills[f], r.r_nsearch);
+			replay_free(&r);
+		}
+	}
+	if (!bflag)
+		return (bench_done());
+	for (i = 0; i < nitems(frags); i++) {
+		for (f = 0; f < nitems(benchfills); f++) {
+			replay_init(&r, frags[i], bench_random() | 1, n,
+			    benchfills[f]);
+			/* The trace, per search, with the upkeep in it. */
+			replay_run(&r);
+			bench(&r, "replay", replay_run, r.r_nsearch);
+			/* Then searches alone, on the map it leaves. */
+			for (s = 1; s < frags[i]; s++)
+				if (r.r_frsum[s] != 0)
+					r.r_sizes[r.r_nsizes++] = s;
+			if (r.r_nsizes > 0)
+				bench(&r, "search", search_one, 1);
+			replay_free(&r);
+		}
+	}
+	return (bench_done());
+}
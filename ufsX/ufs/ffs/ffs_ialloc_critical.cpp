@@ -16,10 +16,7 @@
 
 #include <sys/systm.h>
 #include <sys/lock.h>
-#include <libkern/c++/OSObject.h>
-#include <libkern/c++/OSArray.h>
 #include <libkern/libkern.h>
-#include <libkern/OSAtomic.h>
 
 #include <ufs/ufs/inode.h>
 #include <ufs/ffs/ffs_extern.h>
@@ -29,164 +26,159 @@
 
 extern lck_grp_t *ffs_lock_group;
 
-struct Node;
-typedef Node* NodeRef;
-typedef OSArray* OSArrayRef;
+/*
+ * Inodes in the critical stage live in a fixed hash table. Each bucket has
+ * its own lock and a handful of slots, so nothing is allocated per inode
+ * and a lookup only looks at the slots of one bucket. A slot is also the
+ * wait channel for the threads waiting on its inode. Only as many inodes
+ * as there are threads allocating can be in flight at once; if a bucket
+ * runs out of slots, ialloc_critical_enter() waits for one to free up.
+ * Another thread may enter the same inode while it waits, so it looks
+ * again after every sleep and gives up if it finds one.
+ */
+#define IC_HASHBITS     6
+#define IC_NBUCKETS     (1 << IC_HASHBITS)
+#define IC_NSLOTS       8
 
-struct Node : public OSObject {
-    OSDeclareDefaultStructors(Node)
-    
-public:
-    void initWithIno(int64_t ino){
-        this->ino = ino;
-        this->waiters = false;
-    }
-    
-    static NodeRef withIno(int64_t ino){
-        NodeRef node = new Node;
-        node->initWithIno(ino);
-        return node;
-    }
-    
-    void free() override {
-        OSObject::free();
-    }
-    
-public:
-    ino64_t ino;
-    int waiters;
+/*
+ * Fibonacci hashing: the low bits of an inode number are its index in its
+ * cylinder group, and ipg is a multiple of 64, so masking them would put
+ * inode k of every group in the same bucket.
+ */
+#define IC_HASH(ino)    ((uint64_t)(ino) * 0x9E3779B97F4A7C15ULL >> (64 - IC_HASHBITS))
+#define IC_BUCKET(crit, ino) (&(crit)->ic_buckets[IC_HASH(ino)])
+
+struct ic_slot {
+    ino64_t is_ino;
+    int     is_used;
+    int     is_waiters;
 };
 
-OSDefineMetaClassAndStructors(Node, OSObject)
+struct ic_bucket {
+    lck_mtx_t       *ib_lock;
+    int             ib_slotwait;    /* someone waits for a free slot */
+    struct ic_slot  ib_slots[IC_NSLOTS];
+};
 
-static bool ino_exists(OSArrayRef list, ino64_t ino, NodeRef *nodep, int *index){
-    NodeRef node;
-    bool exists = false;
-    
-    for (int i = 0; i < list->getCount(); i++) {
-        node = (NodeRef) list->getObject(i);
-        
-        if(node == nullptr) continue;
-        
-        if (node->ino == ino){
-            exists = true;
-            if (nodep) *nodep = node;
-            if (index) *index = i;
-            break;
-        }
-    }
-    return exists;
+struct ialloc_critical {
+    struct ic_bucket ic_buckets[IC_NBUCKETS];
+};
+
+static inline void hlock(struct ic_bucket *b) {
+    lck_mtx_lock(b->ib_lock);
 }
 
-static void inline ino_insert(OSArrayRef list, ino64_t ino){
-    NodeRef node;
-    
-    node = Node::withIno(ino);
-    node->ino = ino;
-    node->waiters = 0;
-    list->setObject(node); // set object handles the array's expansion.
+static inline void  hunlock(struct ic_bucket *b){
+    lck_mtx_unlock(b->ib_lock);
 }
 
-static void inline ino_remove(OSArrayRef list, ino64_t ino){
-    NodeRef node;
-    int index = -1; // we set to -1 just to ensure the sanity of the index value if node exists.
-    
-    if (ino_exists(list, ino, &node, &index)){
-        assert(index >= 0 && node != nullptr);
-        list->removeObject(index);
-        node->release();
+static struct ic_slot *ino_lookup(struct ic_bucket *b, ino64_t ino){
+    for (int i = 0; i < IC_NSLOTS; i++) {
+        if (b->ib_slots[i].is_used && b->ib_slots[i].is_ino == ino)
+            return &b->ib_slots[i];
     }
+    return nullptr;
 }
 
 #pragma mark -
 
-/*
- * Structures associated with inode caching.
- */
-struct ialloc_critical {
-    OSArrayRef ic_list;
-    lck_mtx_t *ic_lock;
-};
-
-static inline void hlock(struct ialloc_critical *crit) {
-    lck_mtx_lock(crit->ic_lock);
-}
-
-static inline void  hunlock(struct ialloc_critical *crit){
-    lck_mtx_unlock(crit->ic_lock);
-}
-
 struct ialloc_critical* ialloc_critical_new(void)
 {
     struct ialloc_critical *crit = new ialloc_critical;
-    crit->ic_lock = lck_mtx_alloc_init(ffs_lock_group, LCK_ATTR_NULL);
-    crit->ic_list = OSArray::withCapacity(USHRT_MAX);
+    bzero(crit, sizeof(*crit));
+    for (int i = 0; i < IC_NBUCKETS; i++)
+        crit->ic_buckets[i].ib_lock = lck_mtx_alloc_init(ffs_lock_group, LCK_ATTR_NULL);
     return crit;
 }
 
 void ialloc_critical_free(struct ialloc_critical *crit)
 {
-    OSArrayRef list;
-    NodeRef node;
     if (crit == NULL) return;
     
-    hlock(crit);
-    list = crit->ic_list;
-    for (int i = 0; i < list->getCount(); i++) {
-        node = (NodeRef) list->getObject(i);
-        if(node == nullptr) continue;
-        list->removeObject(i);
-        node->free();
+    for (int i = 0; i < IC_NBUCKETS; i++) {
+        lck_mtx_destroy(crit->ic_buckets[i].ib_lock, ffs_lock_group);
+        lck_mtx_free(crit->ic_buckets[i].ib_lock, ffs_lock_group);
     }
-    hunlock(crit);
-    
-    lck_mtx_destroy(crit->ic_lock, ffs_lock_group);
-    lck_mtx_free(crit->ic_lock, ffs_lock_group);
-    list->free();
     delete crit;
 }
 
 void ialloc_critical_wait(struct ialloc_critical* crit, ino64_t ino)
 {
-    NodeRef node;
-    hlock(crit);
-    if (ino_exists(crit->ic_list, ino, &node, nullptr)){
-        node->waiters += 1;
-        hunlock(crit);
-        msleep(node, NULL, PVFS | PCATCH, "ialloc_critical_wait", 0); // wait
+    struct ic_bucket *b = IC_BUCKET(crit, ino);
+    struct ic_slot *slot;
+    
+    hlock(b);
+    if ((slot = ino_lookup(b, ino)) != nullptr){
+        slot->is_waiters += 1;
+        // the bucket lock is dropped atomically with going to sleep
+        msleep(slot, b->ib_lock, PVFS | PCATCH | PDROP, "ialloc_critical_wait", 0);
     } else{
-        hunlock(crit);
+        hunlock(b);
     }
 }
 
 bool ialloc_is_critical(struct ialloc_critical* crit, ino64_t ino)
 {
-    bool exists = false;
-    hlock(crit);
-    if (ino_exists(crit->ic_list, ino, nullptr, nullptr)){
-        exists = true;
-    }
-    hunlock(crit);
+    struct ic_bucket *b = IC_BUCKET(crit, ino);
+    bool exists;
+    
+    hlock(b);
+    exists = ino_lookup(b, ino) != nullptr;
+    hunlock(b);
     return exists;
 }
 
-void ialloc_critical_enter(struct ialloc_critical* crit, ino64_t ino)
+/*
+ * Enter the critical stage for ino. Returns false, without entering, if
+ * another thread already has; the caller waits for it and starts over.
+ */
+bool ialloc_critical_enter(struct ialloc_critical* crit, ino64_t ino)
 {
-    hlock(crit);
-    assert(ino_exists(crit->ic_list, ino, nullptr, nullptr) == false);
-    ino_insert(crit->ic_list, ino);
-    hunlock(crit);
+    struct ic_bucket *b = IC_BUCKET(crit, ino);
+    struct ic_slot *slot;
+    
+    hlock(b);
+    for (;;) {
+        if (ino_lookup(b, ino) != nullptr) {
+            hunlock(b);
+            return false;
+        }
+        for (slot = &b->ib_slots[0]; slot < &b->ib_slots[IC_NSLOTS]; slot++)
+            if (!slot->is_used)
+                break;
+        if (slot < &b->ib_slots[IC_NSLOTS])
+            break;
+        b->ib_slotwait = 1;
+        msleep(b, b->ib_lock, PVFS, "ialloc_critical_slot", 0);
+    }
+    slot->is_ino = ino;
+    slot->is_used = 1;
+    slot->is_waiters = 0;
+    hunlock(b);
+    return true;
 }
 
 /* leave critical stage and wakeup waiters if they exist */
 void ialloc_critical_leave(struct ialloc_critical* crit, ino64_t ino)
 {
-    NodeRef node;
-    hlock(crit);
-    assert(ino_exists(crit->ic_list, ino, &node, nullptr) == true);
-    if (node->waiters > 0){
-        wakeup(node);
+    struct ic_bucket *b = IC_BUCKET(crit, ino);
+    struct ic_slot *slot;
+    
+    hlock(b);
+    slot = ino_lookup(b, ino);
+    assert(slot != nullptr);
+    if (slot == nullptr){
+        hunlock(b);
+        return;
+    }
+    if (slot->is_waiters > 0){
+        wakeup(slot);
+    }
+    slot->is_used = 0;
+    slot->is_waiters = 0;
+    if (b->ib_slotwait){
+        b->ib_slotwait = 0;
+        wakeup(b);
     }
-    ino_remove(crit->ic_list, ino);
-    hunlock(crit);
+    hunlock(b);
 }
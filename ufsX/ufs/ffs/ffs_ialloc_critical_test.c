@@ -0,0 +1,613 @@
+//
+//  ffs_ialloc_critical_test.c
+//  ufsX
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// The critical stage of ffs_ialloc_critical.cpp in user space, with
+// pthread mutexes for the lck_mtx locks and a condition variable per wait
+// channel for msleep() and wakeup(). The hashed slot table is copied as
+// it is; the OSArray it replaced is modelled as an array of pointers to
+// allocated nodes, searched from the front under one lock, with its
+// enter() given the same "already there" answer so callers can share the
+// ffs_vget() loop.
+//
+// First a full bucket is made to put an enter() to sleep, which a leave()
+// has to wake, and then another thread enters the sleeper's inode while
+// it waits, which it has to notice when it wakes. Then threads run the
+// ffs_vget() loop on inodes that mostly share a bucket, checking that no
+// two of them are ever inside with the same inode. With -b both tables
+// are timed under enter/leave at 1 to 64 threads, over inodes spread out
+// and over inodes all in one bucket; the time is per enter and leave of
+// all the threads together.
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define	IC_HASHBITS	6
+#define	IC_NBUCKETS	(1 << IC_HASHBITS)
+#define	IC_NSLOTS	8
+#define	IC_HASH(ino)	((uint64_t)(ino) * 0x9E3779B97F4A7C15ULL >> \
+			    (64 - IC_HASHBITS))
+
+#define	LIST_CAPACITY	65535		/* OSArray::withCapacity(USHRT_MAX) */
+
+#define	MAXTHREADS	64
+#define	NINOS		24		/* checked, two thirds in bucket 0 */
+#define	NSAME		(NINOS * 2 / 3)
+#define	BENCHINOS	(1 << 20)	/* timed, spread out */
+#define	NOPS		(1 << 18)	/* per timing, shared out */
+
+struct icops {
+	const char	*ic_name;
+	void		(*ic_wait)(uint64_t);
+	int		(*ic_is_critical)(uint64_t);
+	int		(*ic_enter)(uint64_t);
+	void		(*ic_leave)(uint64_t);
+};
+
+static long nwaits;		/* slept in wait() */
+static long nslotwaits;		/* slept in enter() for a slot */
+static long nrechecks;		/* found the inode after that sleep */
+
+/* The hashed slot table. */
+
+struct ic_slot {
+	uint64_t	is_ino;
+	int		is_used;
+	int		is_waiters;
+	pthread_cond_t	is_chan;
+};
+
+struct ic_bucket {
+	pthread_mutex_t	ib_lock;
+	int		ib_slotwait;	/* someone waits for a free slot */
+	pthread_cond_t	ib_chan;
+	struct ic_slot	ib_slots[IC_NSLOTS];
+};
+
+static struct ic_bucket ic_buckets[IC_NBUCKETS];
+
+#define	IC_BUCKET(ino)	(&ic_buckets[IC_HASH(ino)])
+
+static struct ic_slot *
+ino_lookup(struct ic_bucket *b, uint64_t ino)
+{
+	int i;
+
+	for (i = 0; i < IC_NSLOTS; i++)
+		if (b->ib_slots[i].is_used && b->ib_slots[i].is_ino == ino)
+			return (&b->ib_slots[i]);
+	return (NULL);
+}
+
+static void
+hash_wait(uint64_t ino)
+{
+	struct ic_bucket *b;
+	struct ic_slot *slot;
+
+	b = IC_BUCKET(ino);
+	pthread_mutex_lock(&b->ib_lock);
+	if ((slot = ino_lookup(b, ino)) != NULL) {
+		slot->is_waiters += 1;
+		/* msleep(slot, lock, PDROP) */
+		__atomic_fetch_add(&nwaits, 1, __ATOMIC_RELAXED);
+		pthread_cond_wait(&slot->is_chan, &b->ib_lock);
+	}
+	pthread_mutex_unlock(&b->ib_lock);
+}
+
+static int
+hash_is_critical(uint64_t ino)
+{
+	struct ic_bucket *b;
+	int exists;
+
+	b = IC_BUCKET(ino);
+	pthread_mutex_lock(&b->ib_lock);
+	exists = ino_lookup(b, ino) != NULL;
+	pthread_mutex_unlock(&b->ib_lock);
+	return (exists);
+}
+
+static int
+hash_enter(uint64_t ino)
+{
+	struct ic_bucket *b;
+	struct ic_slot *slot;
+	int slept;
+
+	b = IC_BUCKET(ino);
+	slept = 0;
+	pthread_mutex_lock(&b->ib_lock);
+	for (;;) {
+		if (ino_lookup(b, ino) != NULL) {
+			if (slept)
+				__atomic_fetch_add(&nrechecks, 1,
+				    __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&b->ib_lock);
+			return (0);
+		}
+		for (slot = &b->ib_slots[0]; slot < &b->ib_slots[IC_NSLOTS];
+		    slot++)
+			if (!slot->is_used)
+				break;
+		if (slot < &b->ib_slots[IC_NSLOTS])
+			break;
+		b->ib_slotwait = 1;
+		/* msleep(b, lock, 0) */
+		__atomic_fetch_add(&nslotwaits, 1, __ATOMIC_RELAXED);
+		pthread_cond_wait(&b->ib_chan, &b->ib_lock);
+		slept = 1;
+	}
+	slot->is_ino = ino;
+	slot->is_used = 1;
+	slot->is_waiters = 0;
+	pthread_mutex_unlock(&b->ib_lock);
+	return (1);
+}
+
+static void
+hash_leave(uint64_t ino)
+{
+	struct ic_bucket *b;
+	struct ic_slot *slot;
+
+	b = IC_BUCKET(ino);
+	pthread_mutex_lock(&b->ib_lock);
+	if ((slot = ino_lookup(b, ino)) == NULL) {
+		bench_fail("leave %ju: not entered", (uintmax_t)ino);
+		pthread_mutex_unlock(&b->ib_lock);
+		return;
+	}
+	if (slot->is_waiters > 0)
+		pthread_cond_broadcast(&slot->is_chan);
+	slot->is_used = 0;
+	slot->is_waiters = 0;
+	if (b->ib_slotwait) {
+		b->ib_slotwait = 0;
+		pthread_cond_broadcast(&b->ib_chan);
+	}
+	pthread_mutex_unlock(&b->ib_lock);
+}
+
+static const struct icops hash_ops = {
+	"hash", hash_wait, hash_is_critical, hash_enter, hash_leave
+};
+
+/*
+ * The OSArray: one lock, a node allocated per inode and the array
+ * searched from the front. Waiters sleep on their node, so wakeup()s for
+ * different inodes go to different channels; here the channel is picked
+ * by inode, the node being freed as soon as it is woken. The sleep drops
+ * the lock atomically, which the original did not do.
+ */
+
+struct node {
+	uint64_t	n_ino;
+	int		n_waiters;
+};
+
+static pthread_mutex_t list_lock;
+static pthread_cond_t list_chans[IC_NBUCKETS];
+static struct node **list_nodes;
+static int list_count;
+
+#define	LIST_CHAN(ino)	(&list_chans[IC_HASH(ino)])
+
+static struct node *
+ino_exists(uint64_t ino, int *index)
+{
+	int i;
+
+	for (i = 0; i < list_count; i++)
+		if (list_nodes[i]->n_ino == ino) {
+			if (index != NULL)
+				*index = i;
+			return (list_nodes[i]);
+		}
+	return (NULL);
+}
+
+static void
+list_wait(uint64_t ino)
+{
+	struct node *node;
+
+	pthread_mutex_lock(&list_lock);
+	if ((node = ino_exists(ino, NULL)) != NULL) {
+		node->n_waiters += 1;
+		__atomic_fetch_add(&nwaits, 1, __ATOMIC_RELAXED);
+		pthread_cond_wait(LIST_CHAN(ino), &list_lock);
+	}
+	pthread_mutex_unlock(&list_lock);
+}
+
+static int
+list_is_critical(uint64_t ino)
+{
+	int exists;
+
+	pthread_mutex_lock(&list_lock);
+	exists = ino_exists(ino, NULL) != NULL;
+	pthread_mutex_unlock(&list_lock);
+	return (exists);
+}
+
+static int
+list_enter(uint64_t ino)
+{
+	struct node *node;
+
+	pthread_mutex_lock(&list_lock);
+	if (ino_exists(ino, NULL) != NULL) {
+		pthread_mutex_unlock(&list_lock);
+		return (0);
+	}
+	if (list_count == LIST_CAPACITY)
+		errx(2, "list full");
+	if ((node = malloc(sizeof(*node))) == NULL)
+		err(2, "malloc");
+	node->n_ino = ino;
+	node->n_waiters = 0;
+	list_nodes[list_count++] = node;
+	pthread_mutex_unlock(&list_lock);
+	return (1);
+}
+
+static void
+list_leave(uint64_t ino)
+{
+	struct node *node;
+	int i;
+
+	pthread_mutex_lock(&list_lock);
+	if ((node = ino_exists(ino, &i)) == NULL) {
+		bench_fail("leave %ju: not entered", (uintmax_t)ino);
+		pthread_mutex_unlock(&list_lock);
+		return;
+	}
+	if (node->n_waiters > 0)
+		pthread_cond_broadcast(LIST_CHAN(ino));
+	/* OSArray::removeObject() closes the gap. */
+	memmove(&list_nodes[i], &list_nodes[i + 1],
+	    (list_count - i - 1) * sizeof(*list_nodes));
+	list_count--;
+	free(node);
+	pthread_mutex_unlock(&list_lock);
+}
+
+static const struct icops list_ops = {
+	"list", list_wait, list_is_critical, list_enter, list_leave
+};
+
+static void
+tables_init(void)
+{
+	struct ic_bucket *b;
+	int i, j;
+
+	for (i = 0; i < IC_NBUCKETS; i++) {
+		b = &ic_buckets[i];
+		memset(b, 0, sizeof(*b));
+		pthread_mutex_init(&b->ib_lock, NULL);
+		pthread_cond_init(&b->ib_chan, NULL);
+		for (j = 0; j < IC_NSLOTS; j++)
+			pthread_cond_init(&b->ib_slots[j].is_chan, NULL);
+		pthread_cond_init(&list_chans[i], NULL);
+	}
+	pthread_mutex_init(&list_lock, NULL);
+	if ((list_nodes = calloc(LIST_CAPACITY, sizeof(*list_nodes))) == NULL)
+		err(2, "calloc");
+	list_count = 0;
+}
+
+/* Nothing is left inside either table. */
+static void
+tables_check(void)
+{
+	struct ic_slot *slot;
+	int i, j;
+
+	for (i = 0; i < IC_NBUCKETS; i++)
+		for (j = 0; j < IC_NSLOTS; j++) {
+			slot = &ic_buckets[i].ib_slots[j];
+			if (slot->is_used)
+				bench_fail("bucket %d slot %d: %ju left in", i,
+				    j, (uintmax_t)slot->is_ino);
+		}
+	if (list_count != 0)
+		bench_fail("list: %d inodes left in", list_count);
+}
+
+/* The first n inode numbers from start that land in bucket 0. */
+static void
+samebucket(uint64_t *inos, int n, uint64_t start)
+{
+	uint64_t ino;
+	int i;
+
+	for (i = 0, ino = start; i < n; ino++)
+		if (IC_HASH(ino) == 0)
+			inos[i++] = ino;
+}
+
+struct enterer {
+	pthread_t	e_tid;
+	uint64_t	e_ino;
+	int		e_entered;
+};
+
+static void *
+enter_worker(void *arg)
+{
+	struct enterer *e;
+
+	e = arg;
+	e->e_entered = hash_enter(e->e_ino);
+	return (NULL);
+}
+
+/* Start a thread entering e_ino and wait for it to sleep for a slot. */
+static void
+enter_asleep(struct enterer *e)
+{
+	struct ic_bucket *b;
+	int asleep;
+
+	if ((errno = pthread_create(&e->e_tid, NULL, enter_worker, e)) != 0)
+		err(2, "pthread_create");
+	b = IC_BUCKET(e->e_ino);
+	do {
+		sched_yield();
+		/* It only lets go of the lock to sleep. */
+		pthread_mutex_lock(&b->ib_lock);
+		asleep = b->ib_slotwait;
+		pthread_mutex_unlock(&b->ib_lock);
+	} while (!asleep);
+}
+
+/*
+ * Fill bucket 0, so the next enter() has to sleep, and see that a leave()
+ * lets it in. Then, while it sleeps, leave and take its inode ourselves,
+ * and see that it notices instead of entering a second time; the thread
+ * that frees a slot usually gets the lock back before the sleeper, but
+ * when the sleeper wins we enter in its place, and try again.
+ */
+static void
+check_slots(void)
+{
+	struct enterer e;
+	uint64_t inos[IC_NSLOTS + 1];
+	long before;
+	int i, tries;
+
+	samebucket(inos, IC_NSLOTS + 1, 2);
+	for (i = 0; i < IC_NSLOTS; i++)
+		if (!hash_enter(inos[i]))
+			bench_fail("enter %ju: refused", (uintmax_t)inos[i]);
+
+	e.e_ino = inos[IC_NSLOTS];
+	enter_asleep(&e);
+	hash_leave(inos[0]);
+	pthread_join(e.e_tid, NULL);
+	if (!e.e_entered || !hash_is_critical(e.e_ino))
+		bench_fail("enter %ju after a slot wait: refused",
+		    (uintmax_t)e.e_ino);
+	hash_leave(e.e_ino);
+	if (!hash_enter(inos[0]))
+		bench_fail("enter %ju: refused", (uintmax_t)inos[0]);
+
+	before = nrechecks;
+	for (tries = 0; tries < 1000 && nrechecks == before; tries++) {
+		enter_asleep(&e);
+		hash_leave(inos[0]);
+		i = hash_enter(e.e_ino);
+		pthread_join(e.e_tid, NULL);
+		if (i + e.e_entered != 1)
+			bench_fail("enter %ju: entered %d times after a slot "
+			    "wait", (uintmax_t)e.e_ino, i + e.e_entered);
+		hash_leave(e.e_ino);
+		if (!hash_enter(inos[0]))
+			bench_fail("enter %ju: refused", (uintmax_t)inos[0]);
+	}
+	if (nrechecks == before)
+		bench_fail("the sleeper entered first %d times running",
+		    tries);
+	for (i = 0; i < IC_NSLOTS; i++)
+		hash_leave(inos[i]);
+	printf("hash: slot wait checked, recheck after it in %d tr%s\n",
+	    tries, tries == 1 ? "y" : "ies");
+}
+
+struct worker {
+	pthread_t	w_tid;
+	const struct icops *w_ops;
+	uint64_t	w_rand;		/* xorshift64* state */
+	long		w_nops;
+	const uint64_t	*w_inos;
+	int		w_ninos;
+	int		*w_inside;	/* per inode, for the check */
+};
+
+static uint64_t
+wrand(struct worker *w, uint64_t n)
+{
+
+	w->w_rand ^= w->w_rand >> 12;
+	w->w_rand ^= w->w_rand << 25;
+	w->w_rand ^= w->w_rand >> 27;
+	return (w->w_rand * 0x2545f4914f6cdd1dULL % n);
+}
+
+/* What ffs_vget() does before it builds the inode. */
+static void
+vget_enter(const struct icops *ops, uint64_t ino)
+{
+
+restart:
+	if (ops->ic_is_critical(ino)) {
+		ops->ic_wait(ino);
+		goto restart;
+	}
+	if (!ops->ic_enter(ino))
+		goto restart;
+}
+
+static void *
+vget_worker(void *arg)
+{
+	struct worker *w;
+	long i;
+	int k;
+
+	w = arg;
+	for (i = 0; i < w->w_nops; i++) {
+		k = (int)wrand(w, w->w_ninos);
+		vget_enter(w->w_ops, w->w_inos[k]);
+		if (w->w_inside != NULL) {
+			if (__atomic_exchange_n(&w->w_inside[k], 1,
+			    __ATOMIC_ACQ_REL) != 0)
+				bench_fail("%s: %ju entered twice",
+				    w->w_ops->ic_name, (uintmax_t)w->w_inos[k]);
+			sched_yield();
+			__atomic_store_n(&w->w_inside[k], 0, __ATOMIC_RELEASE);
+		}
+		w->w_ops->ic_leave(w->w_inos[k]);
+	}
+	return (NULL);
+}
+
+static void
+run(const struct icops *ops, const uint64_t *inos, int ninos,
+    int *inside, int nthreads, long nops)
+{
+	struct worker w[MAXTHREADS];
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		w[i].w_ops = ops;
+		w[i].w_rand = bench_random() | 1;
+		w[i].w_nops = nops;
+		w[i].w_inos = inos;
+		w[i].w_ninos = ninos;
+		w[i].w_inside = inside;
+		if ((errno = pthread_create(&w[i].w_tid, NULL, vget_worker,
+		    &w[i])) != 0)
+			err(2, "pthread_create");
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(w[i].w_tid, NULL);
+}
+
+/*
+ * More threads than a bucket has slots, on a few inodes of which most
+ * share a bucket, so they wait for each other's inodes and for slots.
+ */
+static void
+check(const struct icops *ops, int nthreads, long nops)
+{
+	uint64_t inos[NINOS];
+	int inside[NINOS];
+	int i;
+
+	samebucket(inos, NSAME, 2);
+	for (i = NSAME; i < NINOS; i++)
+		inos[i] = 2 + bench_uniform(1 << 30);
+	memset(inside, 0, sizeof(inside));
+	nwaits = nslotwaits = nrechecks = 0;
+	run(ops, inos, NINOS, inside, nthreads, nops);
+	tables_check();
+	printf("%s, %d threads: %ld entered, %ld waits, %ld slot waits, "
+	    "%ld rechecks\n", ops->ic_name, nthreads, nthreads * nops,
+	    nwaits, nslotwaits, nrechecks);
+}
+
+static void
+bench(const struct icops *ops, const uint64_t *inos, int ninos,
+    const char *what)
+{
+	char name[64];
+	double start;
+	int n;
+
+	for (n = 1; n <= MAXTHREADS; n *= 2) {
+		start = bench_now();
+		run(ops, inos, ninos, NULL, n, NOPS / n);
+		snprintf(name, sizeof(name), "%s %s %d thread%s",
+		    ops->ic_name, what, n, n == 1 ? "" : "s");
+		bench_report(name, (bench_now() - start) / NOPS, 0);
+	}
+	tables_check();
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: ffs_ialloc_critical_test [-b] [-n ops] "
+	    "[-s seed] [-t threads]\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t *inos;
+	char *seed;
+	long n;
+	int bflag, ch, i, nthreads;
+
+	bflag = 0;
+	n = 20000;
+	nthreads = 16;
+	seed = NULL;
+	while ((ch = getopt(argc, argv, "bn:s:t:")) != -1)
+		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = optarg;
+			break;
+		case 't':
+			nthreads = (int)strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	if (argc != optind || nthreads < 1 || nthreads > MAXTHREADS)
+		usage();
+	bench_seed(seed);
+	tables_init();
+	check_slots();
+	check(&list_ops, nthreads, n);
+	check(&hash_ops, nthreads, n);
+	if (bflag) {
+		if ((inos = malloc(BENCHINOS * sizeof(*inos))) == NULL)
+			err(2, "malloc");
+		for (i = 0; i < BENCHINOS; i++)
+			inos[i] = 2 + bench_random() % ((uint64_t)1 << 32);
+		bench(&list_ops, inos, BENCHINOS, "spread");
+		bench(&hash_ops, inos, BENCHINOS, "spread");
+		samebucket(inos, MAXTHREADS, 2);
+		bench(&list_ops, inos, MAXTHREADS, "one bucket");
+		bench(&hash_ops, inos, MAXTHREADS, "one bucket");
+		free(inos);
+	}
+	return (bench_done());
+}
@@ -26,91 +26,200 @@ extern "C"{
 }
 
 #include <libkern/libkern.h>
-#include <libkern/c++/OSString.h>
-#include <libkern/c++/OSDictionary.h>
 #include <libkern/OSAtomic.h>
 
 enum {
     LOCK_WAITING_EXCL = 0x10
 };
 
+/*
+ * Readers are tracked so inode_lock_owned() can tell whether the current
+ * thread holds the lock shared. The first INODE_LOCK_NREADERS readers get a
+ * slot in the lock itself, claimed with a compare and swap; only the owning
+ * thread ever clears its slot. Further readers spill into a table shared by
+ * every lock, under spill_lck, that is only searched for locks that have
+ * readers in it. The table is hashed by lock address, so a search only walks
+ * the readers of locks in one chain. Entries come from a free list that
+ * starts with INODE_LOCK_NSPILL of them and grows by that many whenever it
+ * runs out; it only shrinks on unload.
+ */
+#define INODE_LOCK_NREADERS     8
+#define INODE_LOCK_NSPILL       1024
+#define SPILL_HASHBITS          8
+#define SPILL_NCHAINS           (1 << SPILL_HASHBITS)
+
+/* Fibonacci hashing, as the low bits of a heap address are all alike. */
+#define SPILL_HASH(lock)        ((uint64_t)(uintptr_t)(lock) * 0x9E3779B97F4A7C15ULL >> (64 - SPILL_HASHBITS))
+
 struct inode_lock {
     lck_rw_t           *lock_Impl;          /* underlying system lock for implementation */
     long long           lock_rdcount;       /* number of readers in this lock */
     thread_t            lock_owner;         /* Owner of exclusive lock on the inode */
     int64_t             lock_flags;         /* lock flags */
-    OSDictionary        *lock_readers;       /* threads holding a read lock on inode */
+    volatile SInt32     lock_nspilled;      /* readers kept in spill_hash */
+    volatile UInt64     lock_readers[INODE_LOCK_NREADERS]; /* tids of readers, 0 if free */
 };
 
+struct reader_spill {
+    struct reader_spill *rs_next;           /* on a hash chain or spill_free */
+    struct inode_lock   *rs_lock;
+    uint64_t            rs_tid;
+};
+
+static struct spill_chunk {
+    struct spill_chunk  *sc_next;
+    struct reader_spill sc_ent[INODE_LOCK_NSPILL];
+} spill_first;
+static struct reader_spill *spill_hash[SPILL_NCHAINS];
+static struct reader_spill *spill_free;
+static lck_spin_t *spill_lck;
+
 #pragma mark - inode_lock RwReaders stuff
 
-void tid_string(char *result, long num){
-    char str[32] = {0};
-    char *p = result, *s = &str[0];
-    int n = 0; // digit count
-    
-    for (long i = num; i > 0 && s; i /= 10, s++, n++) {
-        *s = (i % 10) + 0x30; // 0x30 is index of 0 in ascii chart.
+static inline void spill_lock(void){
+    lck_spin_lock(spill_lck);
+}
+
+static inline void spill_unlock(void){
+    lck_spin_unlock(spill_lck);
+}
+
+// put a chunk's entries on the free list; call locked
+static void spill_addchunk(struct spill_chunk *sc){
+    for (int i = 0; i < INODE_LOCK_NSPILL; i++) {
+        sc->sc_ent[i].rs_next = spill_free;
+        spill_free = &sc->sc_ent[i];
     }
-    
-    for (s--; n > 0; n--, s--, p++) {
-        *p = *s;
+}
+
+// link to tid's entry for lock, or nullptr; call locked
+static struct reader_spill **spill_find(struct inode_lock *lock, uint64_t tid){
+    struct reader_spill **rsp, *rs;
+
+    for (rsp = &spill_hash[SPILL_HASH(lock)]; (rs = *rsp) != nullptr; rsp = &rs->rs_next) {
+        if (rs->rs_lock == lock && rs->rs_tid == tid)
+            return rsp;
     }
+    return nullptr;
 }
 
 static inline bool has_readlock(struct inode_lock *lock){
-    long tid = thread_tid(current_thread());
-//    assert_reader_bounds(tid);
-//    return lock->lock_readers[tid];
-    bool exists;
-    char tidString[32] = {0};
-    tid_string(tidString, tid);
-    OSString *str = OSString::withCStringNoCopy(tidString);
-    exists = lock->lock_readers->getObject(str) != nullptr;
-    str->free();
+    uint64_t tid = thread_tid(current_thread());
+    bool exists = false;
+    
+    for (int i = 0; i < INODE_LOCK_NREADERS; i++) {
+        if (lock->lock_readers[i] == tid)
+            return true;
+    }
+    if (lock->lock_nspilled == 0)
+        return false;
+    spill_lock();
+    exists = spill_find(lock, tid) != nullptr;
+    spill_unlock();
     return exists;
 }
 
 // set current thread to own readlock
 static inline void set_readlock(struct inode_lock *lock){
-    long tid = thread_tid(current_thread());
-//    assert_reader_bounds(tid);
-//    lock->lock_readers[tid] = true;
-    char tidString[32] = {0};
-    tid_string(tidString, tid);
-    OSString *tidStr = OSString::withCString(tidString);
-    lock->lock_readers->setObject(tidStr, tidStr);
+    uint64_t tid = thread_tid(current_thread());
+    struct spill_chunk *sc = nullptr;
+    struct reader_spill *rs, **chain;
+    
+    for (int i = 0; i < INODE_LOCK_NREADERS; i++) {
+        if (lock->lock_readers[i] == 0 &&
+            OSCompareAndSwap64(0, tid, &lock->lock_readers[i]))
+            return;
+    }
+    for (;;) {
+        spill_lock();
+        if (spill_free != nullptr)
+            break;
+        if (sc != nullptr) {
+            // still full: add the chunk allocated last time around
+            sc->sc_next = spill_first.sc_next;
+            spill_first.sc_next = sc;
+            spill_addchunk(sc);
+            sc = nullptr;
+            break;
+        }
+        // can't sleep holding a spin lock, allocate then look again
+        spill_unlock();
+        sc = (struct spill_chunk*)_MALLOC(sizeof(*sc), M_TEMP, M_ZERO | M_WAITOK);
+        if (sc == nullptr) panic("Could not allocate inode lock readers");
+    }
+    rs = spill_free;
+    spill_free = rs->rs_next;
+    rs->rs_lock = lock;
+    rs->rs_tid = tid;
+    chain = &spill_hash[SPILL_HASH(lock)];
+    rs->rs_next = *chain;
+    *chain = rs;
+    OSIncrementAtomic(&lock->lock_nspilled);
+    spill_unlock();
+    if (sc != nullptr)
+        _FREE(sc, M_TEMP);
 }
 
 // clear current thread to own readlock
 static inline void clear_readlock(struct inode_lock *lock){
-    long tid = thread_tid(current_thread());
-//    assert_reader_bounds(tid);
-//    lock->lock_readers[tid] = false;
-    char tidString[32] = {0};
-    tid_string(tidString, tid);
-    OSString *tidStr = OSString::withCStringNoCopy(tidString), *dictStr;
-    dictStr = (OSString *)lock->lock_readers->getObject(tidStr);
-    assert(dictStr != nullptr);
-    tidStr->free();
-    lock->lock_readers->removeObject(dictStr);
+    uint64_t tid = thread_tid(current_thread());
+    struct reader_spill **rsp, *rs;
+    
+    for (int i = 0; i < INODE_LOCK_NREADERS; i++) {
+        if (lock->lock_readers[i] == tid) {
+            OSCompareAndSwap64(tid, 0, &lock->lock_readers[i]);
+            return;
+        }
+    }
+    spill_lock();
+    rsp = spill_find(lock, tid);
+    assert(rsp != nullptr);
+    if (rsp != nullptr) {
+        rs = *rsp;
+        *rsp = rs->rs_next;
+        rs->rs_lock = nullptr;
+        rs->rs_tid = 0;
+        rs->rs_next = spill_free;
+        spill_free = rs;
+        OSDecrementAtomic(&lock->lock_nspilled);
+    }
+    spill_unlock();
 }
 
 #pragma mark - Exported functions
 
+void inode_lock_init(void)
+{
+    spill_lck = lck_spin_alloc_init(ffs_lock_group, LCK_ATTR_NULL);
+    spill_addchunk(&spill_first);
+}
+
+void inode_lock_uninit(void)
+{
+    struct spill_chunk *sc;
+
+    while ((sc = spill_first.sc_next) != nullptr) {
+        spill_first.sc_next = sc->sc_next;
+        _FREE(sc, M_TEMP);
+    }
+    bzero(spill_hash, sizeof(spill_hash));
+    spill_free = nullptr;
+    lck_spin_free(spill_lck, ffs_lock_group);
+    spill_lck = nullptr;
+}
+
 struct inode_lock *inode_lock_new(void)
 {
     struct inode_lock *lock = (struct inode_lock*)_MALLOC(sizeof(struct inode_lock), M_TEMP, M_ZERO | M_WAITOK);
     if(lock == nullptr) panic("Could not allocate inode lock");
     lock->lock_Impl = lck_rw_alloc_init(ffs_lock_group, LCK_ATTR_NULL);
-    lock->lock_readers = OSDictionary::withCapacity(256);
     return lock;
 }
 
 void inode_lock_free(struct inode *ip)
 {
+    assert(ip->i_lock->lock_nspilled == 0);
     lck_rw_destroy(ip->i_lock->lock_Impl, ffs_lock_group);
-    ip->i_lock->lock_readers->free();
     _FREE(ip->i_lock, M_TEMP);
 }
 
@@ -153,8 +262,10 @@ bool inode_lock_lock(struct inode *ip, lock_type_t locktype)
             lck_rw_lock_shared(lock->lock_Impl);
             ret = true;
         }
-        OSIncrementAtomic64(&lock->lock_rdcount);
-        set_readlock(lock);
+        if (ret) {
+            OSIncrementAtomic64(&lock->lock_rdcount);
+            set_readlock(lock);
+        }
         return ret;
     }
     panic("Unspecified lock request.");
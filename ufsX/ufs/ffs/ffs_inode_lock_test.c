@@ -0,0 +1,763 @@
+//
+//  ffs_inode_lock_test.c
+//  ufsX
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// The shared reader tracking of ffs_inode_lock.cpp in user space, with a
+// pthread rwlock for the lck_rw, a mutex for the spill_lck spin lock and
+// a thread local counter for thread_tid(). set_readlock(), clear_readlock()
+// and has_readlock() are copied twice: as they are, with the spilled
+// readers hashed by lock, and as they were, with every entry of every
+// 1024-entry chunk searched in turn.
+//
+// Threads take shared locks on the same locks, all held at once, so most
+// of their readers spill and the spill table has to grow past its first
+// chunk. Whether each thread owns each lock is checked while they hold
+// them and after they let go, and at the end every spilled reader has to
+// be gone. With -b both tables are timed on shared lock and unlock of one
+// lock at 1 to 64 threads, and on lock, owned and unlock of a lock whose
+// slots are taken, with thousands of readers of other locks spilled.
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define	INODE_LOCK_NREADERS	8
+#define	INODE_LOCK_NSPILL	1024
+#define	SPILL_HASHBITS		8
+#define	SPILL_NCHAINS		(1 << SPILL_HASHBITS)
+#define	SPILL_HASH(lock)	((uint64_t)(uintptr_t)(lock) * \
+		0x9E3779B97F4A7C15ULL >> (64 - SPILL_HASHBITS))
+
+#define	MAXTHREADS	64
+#define	NLOCKS		160		/* checked, held at once */
+#define	NOPS		(1 << 20)	/* per timing, shared out */
+#define	NOTHERS		512		/* timed, locks with readers spilled */
+#define	NOTHERREADERS	8		/* each */
+
+struct inode_lock {
+	pthread_rwlock_t lock_Impl;
+	long long	lock_rdcount;
+	int		lock_nspilled;
+	uint64_t	lock_readers[INODE_LOCK_NREADERS];
+};
+
+struct reader_spill {
+	struct reader_spill *rs_next;	/* on a hash chain or spill_free */
+	struct inode_lock *rs_lock;
+	uint64_t	rs_tid;
+};
+
+struct spill_chunk {
+	struct spill_chunk *sc_next;
+	struct reader_spill sc_ent[INODE_LOCK_NSPILL];
+};
+
+struct lockops {
+	const char	*lo_name;
+	void		(*lo_set)(struct inode_lock *);
+	void		(*lo_clear)(struct inode_lock *);
+	int		(*lo_has)(struct inode_lock *);
+};
+
+static pthread_mutex_t spill_lck = PTHREAD_MUTEX_INITIALIZER;
+static struct spill_chunk spill_first;
+static int nchunks;
+static int nspilled, maxspilled;
+
+static uint64_t nexttid = 1;
+static __thread uint64_t curtid;
+
+static uint64_t
+thread_tid(void)
+{
+
+	if (curtid == 0)
+		curtid = __atomic_fetch_add(&nexttid, 1, __ATOMIC_RELAXED);
+	return (curtid);
+}
+
+/* A chunk past the first, as set_readlock() allocates them. */
+static struct spill_chunk *
+chunk_alloc(void)
+{
+	struct spill_chunk *sc;
+
+	if ((sc = calloc(1, sizeof(*sc))) == NULL)
+		err(2, "calloc");
+	return (sc);
+}
+
+/* Call locked. */
+static void
+spilled(int n)
+{
+
+	nspilled += n;
+	if (nspilled > maxspilled)
+		maxspilled = nspilled;
+}
+
+/* The first thing either table looks at: the slots in the lock. */
+static int
+slot_set(struct inode_lock *lock, uint64_t tid)
+{
+	uint64_t zero;
+	int i;
+
+	for (i = 0; i < INODE_LOCK_NREADERS; i++) {
+		zero = 0;
+		if (__atomic_load_n(&lock->lock_readers[i],
+		    __ATOMIC_RELAXED) == 0 &&
+		    __atomic_compare_exchange_n(&lock->lock_readers[i], &zero,
+		    tid, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			return (1);
+	}
+	return (0);
+}
+
+static int
+slot_clear(struct inode_lock *lock, uint64_t tid)
+{
+	int i;
+
+	for (i = 0; i < INODE_LOCK_NREADERS; i++)
+		if (__atomic_load_n(&lock->lock_readers[i],
+		    __ATOMIC_RELAXED) == tid) {
+			__atomic_store_n(&lock->lock_readers[i], 0,
+			    __ATOMIC_SEQ_CST);
+			return (1);
+		}
+	return (0);
+}
+
+static int
+slot_has(struct inode_lock *lock, uint64_t tid)
+{
+	int i;
+
+	for (i = 0; i < INODE_LOCK_NREADERS; i++)
+		if (__atomic_load_n(&lock->lock_readers[i],
+		    __ATOMIC_RELAXED) == tid)
+			return (1);
+	return (0);
+}
+
+/* The table as it is: chains hashed by lock and a free list. */
+
+static struct reader_spill *spill_hash[SPILL_NCHAINS];
+static struct reader_spill *spill_free;
+
+static void
+spill_addchunk(struct spill_chunk *sc)
+{
+	int i;
+
+	for (i = 0; i < INODE_LOCK_NSPILL; i++) {
+		sc->sc_ent[i].rs_next = spill_free;
+		spill_free = &sc->sc_ent[i];
+	}
+	nchunks++;
+}
+
+static struct reader_spill **
+spill_find(struct inode_lock *lock, uint64_t tid)
+{
+	struct reader_spill **rsp, *rs;
+
+	for (rsp = &spill_hash[SPILL_HASH(lock)]; (rs = *rsp) != NULL;
+	    rsp = &rs->rs_next)
+		if (rs->rs_lock == lock && rs->rs_tid == tid)
+			return (rsp);
+	return (NULL);
+}
+
+static int
+hash_has(struct inode_lock *lock)
+{
+	uint64_t tid;
+	int exists;
+
+	tid = thread_tid();
+	if (slot_has(lock, tid))
+		return (1);
+	if (__atomic_load_n(&lock->lock_nspilled, __ATOMIC_RELAXED) == 0)
+		return (0);
+	pthread_mutex_lock(&spill_lck);
+	exists = spill_find(lock, tid) != NULL;
+	pthread_mutex_unlock(&spill_lck);
+	return (exists);
+}
+
+static void
+hash_set(struct inode_lock *lock)
+{
+	struct spill_chunk *sc;
+	struct reader_spill *rs, **chain;
+	uint64_t tid;
+
+	tid = thread_tid();
+	if (slot_set(lock, tid))
+		return;
+	sc = NULL;
+	for (;;) {
+		pthread_mutex_lock(&spill_lck);
+		if (spill_free != NULL)
+			break;
+		if (sc != NULL) {
+			sc->sc_next = spill_first.sc_next;
+			spill_first.sc_next = sc;
+			spill_addchunk(sc);
+			sc = NULL;
+			break;
+		}
+		pthread_mutex_unlock(&spill_lck);
+		sc = chunk_alloc();
+	}
+	rs = spill_free;
+	spill_free = rs->rs_next;
+	rs->rs_lock = lock;
+	rs->rs_tid = tid;
+	chain = &spill_hash[SPILL_HASH(lock)];
+	rs->rs_next = *chain;
+	*chain = rs;
+	__atomic_fetch_add(&lock->lock_nspilled, 1, __ATOMIC_SEQ_CST);
+	spilled(1);
+	pthread_mutex_unlock(&spill_lck);
+	free(sc);
+}
+
+static void
+hash_clear(struct inode_lock *lock)
+{
+	struct reader_spill **rsp, *rs;
+	uint64_t tid;
+
+	tid = thread_tid();
+	if (slot_clear(lock, tid))
+		return;
+	pthread_mutex_lock(&spill_lck);
+	if ((rsp = spill_find(lock, tid)) == NULL)
+		bench_fail("hash: tid %ju not a reader of %p",
+		    (uintmax_t)tid, lock);
+	else {
+		rs = *rsp;
+		*rsp = rs->rs_next;
+		rs->rs_lock = NULL;
+		rs->rs_tid = 0;
+		rs->rs_next = spill_free;
+		spill_free = rs;
+		__atomic_fetch_sub(&lock->lock_nspilled, 1, __ATOMIC_SEQ_CST);
+		spilled(-1);
+	}
+	pthread_mutex_unlock(&spill_lck);
+}
+
+static const struct lockops hash_ops = {
+	"hash", hash_set, hash_clear, hash_has
+};
+
+/* The table as it was: every chunk searched, a free entry included. */
+
+static struct reader_spill *
+linear_find(struct inode_lock *lock, uint64_t tid)
+{
+	struct spill_chunk *sc;
+	int i;
+
+	for (sc = &spill_first; sc != NULL; sc = sc->sc_next)
+		for (i = 0; i < INODE_LOCK_NSPILL; i++)
+			if (sc->sc_ent[i].rs_lock == lock &&
+			    sc->sc_ent[i].rs_tid == tid)
+				return (&sc->sc_ent[i]);
+	return (NULL);
+}
+
+static int
+linear_has(struct inode_lock *lock)
+{
+	uint64_t tid;
+	int exists;
+
+	tid = thread_tid();
+	if (slot_has(lock, tid))
+		return (1);
+	if (__atomic_load_n(&lock->lock_nspilled, __ATOMIC_RELAXED) == 0)
+		return (0);
+	pthread_mutex_lock(&spill_lck);
+	exists = linear_find(lock, tid) != NULL;
+	pthread_mutex_unlock(&spill_lck);
+	return (exists);
+}
+
+static void
+linear_set(struct inode_lock *lock)
+{
+	struct spill_chunk *sc;
+	struct reader_spill *rs;
+	uint64_t tid;
+
+	tid = thread_tid();
+	if (slot_set(lock, tid))
+		return;
+	sc = NULL;
+	for (;;) {
+		pthread_mutex_lock(&spill_lck);
+		if ((rs = linear_find(NULL, 0)) != NULL)
+			break;
+		if (sc != NULL) {
+			sc->sc_next = spill_first.sc_next;
+			spill_first.sc_next = sc;
+			nchunks++;
+			rs = &sc->sc_ent[0];
+			sc = NULL;
+			break;
+		}
+		pthread_mutex_unlock(&spill_lck);
+		sc = chunk_alloc();
+	}
+	rs->rs_lock = lock;
+	rs->rs_tid = tid;
+	__atomic_fetch_add(&lock->lock_nspilled, 1, __ATOMIC_SEQ_CST);
+	spilled(1);
+	pthread_mutex_unlock(&spill_lck);
+	free(sc);
+}
+
+static void
+linear_clear(struct inode_lock *lock)
+{
+	struct reader_spill *rs;
+	uint64_t tid;
+
+	tid = thread_tid();
+	if (slot_clear(lock, tid))
+		return;
+	pthread_mutex_lock(&spill_lck);
+	if ((rs = linear_find(lock, tid)) == NULL)
+		bench_fail("linear: tid %ju not a reader of %p",
+		    (uintmax_t)tid, lock);
+	else {
+		rs->rs_lock = NULL;
+		rs->rs_tid = 0;
+		__atomic_fetch_sub(&lock->lock_nspilled, 1, __ATOMIC_SEQ_CST);
+		spilled(-1);
+	}
+	pthread_mutex_unlock(&spill_lck);
+}
+
+static const struct lockops linear_ops = {
+	"linear", linear_set, linear_clear, linear_has
+};
+
+/* inode_lock_init(), for either table. */
+static void
+spill_init(const struct lockops *ops)
+{
+
+	memset(&spill_first, 0, sizeof(spill_first));
+	memset(spill_hash, 0, sizeof(spill_hash));
+	spill_free = NULL;
+	nchunks = 0;
+	nspilled = maxspilled = 0;
+	if (ops == &hash_ops)
+		spill_addchunk(&spill_first);
+	else
+		nchunks = 1;
+}
+
+/* Every spilled reader is gone, and the entries are all free again. */
+static void
+spill_uninit(const struct lockops *ops)
+{
+	struct spill_chunk *sc;
+	struct reader_spill *rs;
+	int i, nfree;
+
+	nfree = 0;
+	if (ops == &hash_ops) {
+		for (i = 0; i < SPILL_NCHAINS; i++)
+			if (spill_hash[i] != NULL)
+				bench_fail("hash: chain %d not empty", i);
+		for (rs = spill_free; rs != NULL; rs = rs->rs_next)
+			nfree++;
+	} else {
+		for (sc = &spill_first; sc != NULL; sc = sc->sc_next)
+			for (i = 0; i < INODE_LOCK_NSPILL; i++)
+				if (sc->sc_ent[i].rs_lock == NULL)
+					nfree++;
+	}
+	if (nfree != nchunks * INODE_LOCK_NSPILL)
+		bench_fail("%s: %d of %d entries free", ops->lo_name, nfree,
+		    nchunks * INODE_LOCK_NSPILL);
+	while ((sc = spill_first.sc_next) != NULL) {
+		spill_first.sc_next = sc->sc_next;
+		free(sc);
+	}
+}
+
+static void
+locks_init(struct inode_lock *locks, int n)
+{
+	int i;
+
+	memset(locks, 0, n * sizeof(*locks));
+	for (i = 0; i < n; i++)
+		pthread_rwlock_init(&locks[i].lock_Impl, NULL);
+}
+
+static void
+locks_free(struct inode_lock *locks, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (locks[i].lock_rdcount != 0 || locks[i].lock_nspilled != 0)
+			bench_fail("lock %d: %lld readers, %d spilled left", i,
+			    locks[i].lock_rdcount, locks[i].lock_nspilled);
+		pthread_rwlock_destroy(&locks[i].lock_Impl);
+	}
+}
+
+/* inode_lock_lock(UFS_LOCK_SHARED) and inode_lock_unlock(). */
+static void
+lock_shared(const struct lockops *ops, struct inode_lock *lock)
+{
+
+	pthread_rwlock_rdlock(&lock->lock_Impl);
+	__atomic_fetch_add(&lock->lock_rdcount, 1, __ATOMIC_SEQ_CST);
+	ops->lo_set(lock);
+}
+
+static void
+unlock_shared(const struct lockops *ops, struct inode_lock *lock)
+{
+
+	__atomic_fetch_sub(&lock->lock_rdcount, 1, __ATOMIC_SEQ_CST);
+	ops->lo_clear(lock);
+	pthread_rwlock_unlock(&lock->lock_Impl);
+}
+
+/* pthread_barrier_t, which macOS doesn't have. */
+struct barrier {
+	pthread_mutex_t	b_lock;
+	pthread_cond_t	b_cv;
+	int		b_count;
+	int		b_waiting;
+	unsigned	b_gen;
+};
+
+static void
+barrier_wait(struct barrier *b)
+{
+	unsigned gen;
+
+	pthread_mutex_lock(&b->b_lock);
+	gen = b->b_gen;
+	if (++b->b_waiting == b->b_count) {
+		b->b_waiting = 0;
+		b->b_gen++;
+		pthread_cond_broadcast(&b->b_cv);
+	} else
+		while (gen == b->b_gen)
+			pthread_cond_wait(&b->b_cv, &b->b_lock);
+	pthread_mutex_unlock(&b->b_lock);
+}
+
+struct worker {
+	pthread_t	w_tid;
+	int		w_index;
+	int		w_nthreads;
+	const struct lockops *w_ops;
+	uint64_t	w_rand;		/* xorshift64* state */
+	long		w_nops;
+	struct inode_lock *w_locks;
+	struct barrier	*w_barrier;
+};
+
+static uint64_t
+wrand(struct worker *w, uint64_t n)
+{
+
+	w->w_rand ^= w->w_rand >> 12;
+	w->w_rand ^= w->w_rand << 25;
+	w->w_rand ^= w->w_rand >> 27;
+	return (w->w_rand * 0x2545f4914f6cdd1dULL % n);
+}
+
+static void
+shuffle(struct worker *w, int *order, int n)
+{
+	int i, j, t;
+
+	for (i = n - 1; i > 0; i--) {
+		j = (int)wrand(w, i + 1);
+		t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+}
+
+/*
+ * Each round, take every lock shared but the one numbered after us, in
+ * a random order, and check them all once everyone has. Then let go in
+ * another order, checking as we go.
+ */
+static void *
+check_worker(void *arg)
+{
+	const struct lockops *ops;
+	struct worker *w;
+	struct inode_lock *lock;
+	int order[NLOCKS];
+	long long readers;
+	long round;
+	int i, owned, want;
+
+	w = arg;
+	ops = w->w_ops;
+	for (i = 0; i < NLOCKS; i++)
+		order[i] = i;
+	for (round = 0; round < w->w_nops; round++) {
+		shuffle(w, order, NLOCKS);
+		for (i = 0; i < NLOCKS; i++)
+			if (order[i] != w->w_index)
+				lock_shared(ops, &w->w_locks[order[i]]);
+		barrier_wait(w->w_barrier);
+		for (i = 0; i < NLOCKS; i++) {
+			lock = &w->w_locks[i];
+			owned = ops->lo_has(lock);
+			if (owned != (i != w->w_index))
+				bench_fail("%s: lock %d: owned %d, held %d",
+				    ops->lo_name, i, owned, i != w->w_index);
+			want = w->w_nthreads - (i < w->w_nthreads);
+			readers = __atomic_load_n(&lock->lock_rdcount,
+			    __ATOMIC_RELAXED);
+			if (w->w_index == 0 && readers != want)
+				bench_fail("%s: lock %d: %lld readers, want %d",
+				    ops->lo_name, i, readers, want);
+		}
+		barrier_wait(w->w_barrier);
+		shuffle(w, order, NLOCKS);
+		for (i = 0; i < NLOCKS; i++) {
+			if (order[i] == w->w_index)
+				continue;
+			lock = &w->w_locks[order[i]];
+			unlock_shared(ops, lock);
+			if (ops->lo_has(lock))
+				bench_fail("%s: lock %d: owned after unlock",
+				    ops->lo_name, order[i]);
+		}
+		barrier_wait(w->w_barrier);
+	}
+	return (NULL);
+}
+
+static void
+check(const struct lockops *ops, int nthreads, long rounds)
+{
+	static struct inode_lock locks[NLOCKS];
+	struct worker w[MAXTHREADS];
+	struct barrier b;
+	int i;
+
+	spill_init(ops);
+	locks_init(locks, NLOCKS);
+	memset(&b, 0, sizeof(b));
+	pthread_mutex_init(&b.b_lock, NULL);
+	pthread_cond_init(&b.b_cv, NULL);
+	b.b_count = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		w[i].w_index = i;
+		w[i].w_nthreads = nthreads;
+		w[i].w_ops = ops;
+		w[i].w_rand = bench_random() | 1;
+		w[i].w_nops = rounds;
+		w[i].w_locks = locks;
+		w[i].w_barrier = &b;
+		if ((errno = pthread_create(&w[i].w_tid, NULL, check_worker,
+		    &w[i])) != 0)
+			err(2, "pthread_create");
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(w[i].w_tid, NULL);
+	if (maxspilled > INODE_LOCK_NSPILL && nchunks < 2)
+		bench_fail("%s: %d spilled in one chunk", ops->lo_name,
+		    maxspilled);
+	printf("%s, %d threads: %ld rounds checked, %d spilled at once, "
+	    "%d chunk%s\n", ops->lo_name, nthreads, rounds, maxspilled,
+	    nchunks, nchunks == 1 ? "" : "s");
+	locks_free(locks, NLOCKS);
+	spill_uninit(ops);
+	pthread_mutex_destroy(&b.b_lock);
+	pthread_cond_destroy(&b.b_cv);
+}
+
+static void *
+bench_worker(void *arg)
+{
+	struct worker *w;
+	long i;
+
+	w = arg;
+	for (i = 0; i < w->w_nops; i++) {
+		lock_shared(w->w_ops, &w->w_locks[0]);
+		unlock_shared(w->w_ops, &w->w_locks[0]);
+	}
+	return (NULL);
+}
+
+struct spillbench {
+	const struct lockops *sb_ops;
+	struct inode_lock *sb_lock;
+};
+
+static void
+spillbench_run(void *arg)
+{
+	struct spillbench *sb;
+
+	sb = arg;
+	lock_shared(sb->sb_ops, sb->sb_lock);
+	if (!sb->sb_ops->lo_has(sb->sb_lock))
+		bench_fail("%s: not owned", sb->sb_ops->lo_name);
+	unlock_shared(sb->sb_ops, sb->sb_lock);
+}
+
+/*
+ * Fill the slots of every lock with readers that aren't us, and spill
+ * NOTHERREADERS more for each of the others, so ours always spills and
+ * the table has NOTHERS * NOTHERREADERS entries besides.
+ */
+static void
+spillbench(const struct lockops *ops)
+{
+	static struct inode_lock locks[NOTHERS + 1];
+	struct spillbench sb;
+	char name[64];
+	uint64_t me;
+	int i, j;
+
+	spill_init(ops);
+	locks_init(locks, NOTHERS + 1);
+	me = thread_tid();
+	for (i = 0; i <= NOTHERS; i++) {
+		for (j = 0; j < INODE_LOCK_NREADERS; j++)
+			locks[i].lock_readers[j] = (uint64_t)1 << 62 | j;
+		if (i == NOTHERS)
+			break;
+		for (j = 0; j < NOTHERREADERS; j++) {
+			curtid = (uint64_t)1 << 61 | j;
+			ops->lo_set(&locks[i]);
+		}
+	}
+	curtid = me;
+	sb.sb_ops = ops;
+	sb.sb_lock = &locks[NOTHERS];
+	snprintf(name, sizeof(name), "%s spilled, %d others", ops->lo_name,
+	    NOTHERS * NOTHERREADERS);
+	bench_report(name, bench_time(spillbench_run, &sb), 0);
+	for (i = 0; i < NOTHERS; i++) {
+		for (j = 0; j < NOTHERREADERS; j++) {
+			curtid = (uint64_t)1 << 61 | j;
+			ops->lo_clear(&locks[i]);
+		}
+	}
+	curtid = me;
+	for (i = 0; i <= NOTHERS; i++)
+		memset(locks[i].lock_readers, 0,
+		    sizeof(locks[i].lock_readers));
+	locks_free(locks, NOTHERS + 1);
+	spill_uninit(ops);
+}
+
+static void
+bench(const struct lockops *ops)
+{
+	struct inode_lock lock;
+	struct worker w[MAXTHREADS];
+	char name[64];
+	double start;
+	int i, n;
+
+	spill_init(ops);
+	locks_init(&lock, 1);
+	for (n = 1; n <= MAXTHREADS; n *= 2) {
+		start = bench_now();
+		for (i = 0; i < n; i++) {
+			w[i].w_ops = ops;
+			w[i].w_nops = NOPS / n;
+			w[i].w_locks = &lock;
+			if ((errno = pthread_create(&w[i].w_tid, NULL,
+			    bench_worker, &w[i])) != 0)
+				err(2, "pthread_create");
+		}
+		for (i = 0; i < n; i++)
+			pthread_join(w[i].w_tid, NULL);
+		snprintf(name, sizeof(name), "%s shared %d thread%s",
+		    ops->lo_name, n, n == 1 ? "" : "s");
+		bench_report(name, (bench_now() - start) / NOPS, 0);
+	}
+	locks_free(&lock, 1);
+	spill_uninit(ops);
+	spillbench(ops);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: ffs_inode_lock_test [-b] [-n rounds] [-s seed] "
+	    "[-t threads]\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *seed;
+	long n;
+	int bflag, ch, nthreads;
+
+	bflag = 0;
+	n = 20;
+	nthreads = 32;
+	seed = NULL;
+	while ((ch = getopt(argc, argv, "bn:s:t:")) != -1)
+		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = optarg;
+			break;
+		case 't':
+			nthreads = (int)strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	if (argc != optind || nthreads < 1 || nthreads > MAXTHREADS)
+		usage();
+	bench_seed(seed);
+	check(&linear_ops, nthreads, n);
+	check(&hash_ops, nthreads, n);
+	if (bflag) {
+		bench(&linear_ops);
+		bench(&hash_ops);
+	}
+	return (bench_done());
+}
@@ -48,6 +48,8 @@ __FBSDID("$FreeBSD$");
 
 uint32_t calculate_crc32c(uint32_t, const void *, size_t);
 uint32_t ffs_calc_sbhash(struct fs *);
+int ffs_bitmap_ffc(const u_char *, int, int);
+int ffs_bitmap_flc(const u_char *, int, int);
 struct malloc_type;
 #define UFS_MALLOC(size, type, flags) malloc(size)
 #define UFS_FREE(ptr, type) free(ptr)
@@ -84,7 +86,8 @@ struct malloc_type;
 int
 ffs_verify_dinode_ckhash(struct fs *fs, struct ufs2_dinode *dip)
 {
-	uint32_t ckhash, save_ckhash;
+	uint32_t ckhash, zero;
+	size_t off;
 
 	/*
 	 * Return success if unallocated or we are not doing inode check-hash.
@@ -94,12 +97,16 @@ ffs_verify_dinode_ckhash(struct fs *fs, struct ufs2_dinode *dip)
 	/*
 	 * Exclude di_ckhash from the crc32 calculation, e.g., always use
 	 * a check-hash value of zero when calculating the check-hash.
+	 * The inode is not modified, it may be in a read-only mapping.
 	 */
-	save_ckhash = dip->di_ckhash;
-	dip->di_ckhash = 0;
-	ckhash = calculate_crc32c(~0L, (void *)dip, sizeof(*dip));
-	dip->di_ckhash = save_ckhash;
-	if (save_ckhash == ckhash)
+	zero = 0;
+	off = __offsetof(struct ufs2_dinode, di_ckhash);
+	ckhash = calculate_crc32c(~0L, (void *)dip, off);
+	ckhash = calculate_crc32c(ckhash, (void *)&zero, sizeof(zero));
+	off += sizeof(zero);
+	ckhash = calculate_crc32c(ckhash, (u_char *)dip + off,
+	    sizeof(*dip) - off);
+	if (dip->di_ckhash == ckhash)
 		trace_return (0);
 	trace_return (EINVAL);
 }
@@ -423,6 +430,147 @@ ffs_fragacct(struct fs *fs, int fragmap, int32_t fraglist[], int cnt)
 	}
 }
 
+/*
+ * Free fragment summary.
+ *
+ * ffs_mapsearch() wants the first byte of cg_blksfree whose fragtbl[]
+ * entry has a free run of a given size, which scanc() finds one byte at
+ * a time. The fragtree keeps those entries as the leaves of a binary tree
+ * whose inner nodes OR their children together, so the same byte is
+ * found by walking O(log n) nodes, and a change to the map costs as much
+ * to account for. The tree is only a hint: a leaf it leads to is checked
+ * against the map, and a caller that gets -1 back still scans the map.
+ */
+int
+ffs_fragtree_size(struct fs *fs)
+{
+	int nleaves, size;
+
+	nleaves = howmany(fs->fs_fpg, NBBY);
+	for (size = 1; size < nleaves; size <<= 1)
+		;
+	return (2 * size);
+}
+
+/*
+ * Build the summary of blksfree in node, which must hold
+ * ffs_fragtree_size() bytes.
+ */
+void
+ffs_fragtree_init(struct fs *fs, struct ffs_fragtree *ft, u_char *node,
+    u_char *blksfree)
+{
+	u_char *tbl;
+	int i;
+
+	tbl = fragtbl[fs->fs_frag];
+	ft->ft_nleaves = howmany(fs->fs_fpg, NBBY);
+	ft->ft_size = ffs_fragtree_size(fs) / 2;
+	ft->ft_node = node;
+	memset(node, 0, 2 * ft->ft_size);
+	for (i = 0; i < ft->ft_nleaves; i++)
+		node[ft->ft_size + i] = tbl[blksfree[i]];
+	for (i = ft->ft_size - 1; i > 0; i--)
+		node[i] = node[2 * i] | node[2 * i + 1];
+}
+
+/*
+ * Account for a change to cnt frags of blksfree starting at bno.
+ */
+void
+ffs_fragtree_update(struct fs *fs, struct ffs_fragtree *ft, u_char *blksfree,
+    ufs1_daddr_t bno, int cnt)
+{
+	u_char *tbl, val;
+	int i, last, n;
+
+	if (ft == NULL || ft->ft_node == NULL || cnt <= 0)
+		return;
+	tbl = fragtbl[fs->fs_frag];
+	last = (bno + cnt - 1) / NBBY;
+	for (i = bno / NBBY; i <= last; i++) {
+		n = ft->ft_size + i;
+		val = tbl[blksfree[i]];
+		if (ft->ft_node[n] == val)
+			continue;
+		ft->ft_node[n] = val;
+		for (n >>= 1; n > 0; n >>= 1) {
+			val = ft->ft_node[2 * n] | ft->ft_node[2 * n + 1];
+			if (ft->ft_node[n] == val)
+				break;
+			ft->ft_node[n] = val;
+		}
+	}
+}
+
+/*
+ * First leaf at or after from whose summary has mask set, or -1.
+ */
+static int
+ffs_fragtree_next(struct ffs_fragtree *ft, int from, u_char mask)
+{
+	int n;
+
+	if (from >= ft->ft_nleaves)
+		return (-1);
+	n = ft->ft_size + from;
+	if ((ft->ft_node[n] & mask) == 0) {
+		/*
+		 * Climb until there is a right sibling with the bit set
+		 * and step over to it.
+		 */
+		for (;;) {
+			if (n == 1)
+				return (-1);
+			if ((n & 1) == 0 && (ft->ft_node[n + 1] & mask) != 0)
+				break;
+			n >>= 1;
+		}
+		n++;
+		/* Then go down to its leftmost leaf that has it. */
+		while (n < ft->ft_size)
+			n = (ft->ft_node[2 * n] & mask) ? 2 * n : 2 * n + 1;
+	}
+	n -= ft->ft_size;
+	return (n < ft->ft_nleaves ? n : -1);
+}
+
+/*
+ * Find the first byte of blksfree at or after start, wrapping around to
+ * the beginning of the map, that holds a free run of allocsiz frags.
+ * This is the byte scanc() would find if the summary is up to date;
+ * leaves that turn out not to be are fixed on the way. Returns the byte
+ * index or -1.
+ */
+int
+ffs_fragtree_search(struct fs *fs, struct ffs_fragtree *ft, u_char *blksfree,
+    int start, int allocsiz)
+{
+	u_char *tbl, mask;
+	int from, end, loc, wrapped;
+
+	tbl = fragtbl[fs->fs_frag];
+	mask = (u_char)(1 << (allocsiz - 1 + (fs->fs_frag % NBBY)));
+	from = start;
+	end = ft->ft_nleaves;
+	wrapped = 0;
+	for (;;) {
+		loc = ffs_fragtree_next(ft, from, mask);
+		if (loc == -1 || loc >= end) {
+			if (wrapped)
+				return (-1);
+			wrapped = 1;
+			from = 0;
+			end = start + 1;
+			continue;
+		}
+		if ((tbl[blksfree[loc]] & mask) != 0)
+			return (loc);
+		ffs_fragtree_update(fs, ft, blksfree, loc * NBBY, 1);
+		from = loc + 1;
+	}
+}
+
 /*
  * block operations
  *
@@ -545,9 +693,8 @@ ffs_clusteracct(struct fs *fs, struct cg *cgp, ufs1_daddr_t blkno, int cnt)
 {
 	int32_t *sump;
 	int32_t *lp;
-	u_char *freemapp, *mapp;
-	int i, start, end, forw, back, map;
-	u_int bit;
+	u_char *freemapp;
+	int i, start, end, forw, back;
 
 	if (fs->fs_contigsumsize <= 0)
 		return;
@@ -567,20 +714,8 @@ ffs_clusteracct(struct fs *fs, struct cg *cgp, ufs1_daddr_t blkno, int cnt)
 	end = start + fs->fs_contigsumsize;
 	if (end >= cgp->cg_nclusterblks)
 		end = cgp->cg_nclusterblks;
-	mapp = &freemapp[start / NBBY];
-	map = *mapp++;
-	bit = 1U << (start % NBBY);
-	for (i = start; i < end; i++) {
-		if ((map & bit) == 0)
-			break;
-		if ((i & (NBBY - 1)) != (NBBY - 1)) {
-			bit <<= 1;
-		} else {
-			map = *mapp++;
-			bit = 1;
-		}
-	}
-	forw = i - start;
+	i = ffs_bitmap_ffc(freemapp, start, end);
+	forw = (i == -1 ? end : i) - start;
 	/*
 	 * Find the size of the cluster going backward.
 	 */
@@ -588,20 +723,8 @@ ffs_clusteracct(struct fs *fs, struct cg *cgp, ufs1_daddr_t blkno, int cnt)
 	end = start - fs->fs_contigsumsize;
 	if (end < 0)
 		end = -1;
-	mapp = &freemapp[start / NBBY];
-	map = *mapp--;
-	bit = 1U << (start % NBBY);
-	for (i = start; i > end; i--) {
-		if ((map & bit) == 0)
-			break;
-		if ((i & (NBBY - 1)) != 0) {
-			bit >>= 1;
-		} else {
-			map = *mapp--;
-			bit = 1U << (NBBY - 1);
-		}
-	}
-	back = start - i;
+	i = ffs_bitmap_flc(freemapp, end + 1, start + 1);
+	back = start - (i == -1 ? end : i);
 	/*
 	 * Account for old cluster and the possibly new forward and
 	 * back clusters.
@@ -904,9 +904,9 @@ ffs_mountfs(struct vnode *devvp, struct mount *mp, vfs_context_t context)
 		ump->um_fstype = UFS2;
 		ump->um_balloc = ffs_balloc_ufs2;
 	}
-    ump->um_ihash_lock = lck_mtx_alloc_init(ffs_lock_group, LCK_ATTR_NULL);
     ump->um_vget_critical = ialloc_critical_new();
     ump->um_valloc_critical = ialloc_critical_new();
+    ffs_fragtree_mount(ump);
 	ump->um_blkatoff = ffs_blkatoff;
 	ump->um_truncate = ffs_truncate;
 	ump->um_update = ffs_update;
@@ -1058,6 +1058,8 @@ ffs_mountfs(struct vnode *devvp, struct mount *mp, vfs_context_t context)
 	ump->um_fsfail_task = etp;
 	return (0);
 out:
+	if (ump != NULL && fs != NULL)
+		ffs_fragtree_unmount(ump);
 	if (fs != NULL) {
         free(fs->fs_csp, M_UFSMNT);
         free(fs->fs_si, M_UFSMNT);
@@ -1073,10 +1075,6 @@ out:
             free(ump->um_compat, M_UFSMNT);
         }
 
-        if(ump->um_ihash_lock){
-            lck_mtx_destroy(ump->um_ihash_lock, ffs_lock_group);
-            lck_mtx_free(ump->um_ihash_lock, ffs_lock_group);
-        }
         if (ump->um_vget_critical)
             ialloc_critical_free(ump->um_vget_critical);
         if (ump->um_valloc_critical)
@@ -1301,8 +1299,7 @@ ffs_unmount(struct mount *mp, int mntflags, struct vfs_context *context)
     
     ialloc_critical_free(ump->um_vget_critical);
     ialloc_critical_free(ump->um_valloc_critical);
-    lck_mtx_destroy(ump->um_ihash_lock, ffs_lock_group);
-    lck_mtx_free(ump->um_ihash_lock, ffs_lock_group);
+    ffs_fragtree_unmount(ump);
 	lck_mtx_destroy(UFS_MTX(ump), ffs_lock_group);
     lck_mtx_free(UFS_MTX(ump), ffs_lock_group);
     free(fs->fs_csp, M_UFSMNT);
@@ -1705,7 +1702,8 @@ restart:
         goto restart;
     }
     
-    ialloc_critical_enter(ump->um_vget_critical, ino);
+    if (!ialloc_critical_enter(ump->um_vget_critical, ino))
+        goto restart;
     ip = malloc(sizeof(struct inode), 0,  M_WAITOK | M_ZERO);
     if (ip == NULL) {
         ialloc_critical_leave(ump->um_vget_critical, ino);
@@ -628,7 +628,7 @@ struct cg {
  * Turn filesystem block numbers into disk block addresses.
  * This maps filesystem blocks to device size blocks.
  */
-#define    fsbtodb(fs, b)    ((daddr_t)(b) << (fs)->fs_fsbtodb)
+#define    fsbtodb(fs, b)    ((ufs2_daddr_t)(b) << (fs)->fs_fsbtodb)
 #define    dbtofsb(fs, b)    ((b) >> (fs)->fs_fsbtodb)
 
 /*
@@ -880,6 +880,19 @@ CTASSERT(sizeof(union jrec) == JREC_SIZE);
 extern int inside[], around[];
 extern u_char *fragtbl[];
 
+/*
+ * In-memory summary of a cylinder group's free fragment map, used to find
+ * a free run of a given size without scanning the whole map. There is one
+ * leaf per byte of cg_blksfree holding its fragtbl[] entry; every inner
+ * node is the OR of its two children and node 1 is the root. Nothing of
+ * it is kept on disk.
+ */
+struct ffs_fragtree {
+	int	ft_nleaves;		/* bytes in cg_blksfree */
+	int	ft_size;		/* leaves rounded up to a power of 2 */
+	u_char	*ft_node;		/* 2 * ft_size nodes, [0] unused */
+};
+
 /*
  * IOCTLs used for filesystem write suspension.
  */
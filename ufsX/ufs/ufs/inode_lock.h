@@ -15,6 +15,7 @@
 
 #include <libkern/OSAtomic.h>
 #include <freebsd/compat/vnode.h>
+#include <freebsd/compat/trace.h>
 
 #include <ufs/ufs/dinode.h>
 #include <ufs/ufs/quota.h>
@@ -38,6 +39,8 @@ typedef enum {
 struct inode_lock;
 static thread_t UFS_THREAD_NULL  = (thread_t)0;
 
+void inode_lock_init(void);
+void inode_lock_uninit(void);
 struct inode_lock *inode_lock_new(void);
 void inode_lock_free(struct inode *ip);
 int  inode_lock_owned(struct inode *ip);
@@ -52,35 +55,35 @@ void inode_wakeup(struct inode *ip, int flag, int clearflag); // call with exclu
 
 /* Locking */
 #define ixlock(ip)      ({\
-    __log_debug(current_thread(), __FILE__, __LINE__, __func__,"acquiring exclusive lock");\
+    UFS_TRACE(UFS_TRACE_XLOCK, (ip));\
     inode_lock_lock((ip), UFS_LOCK_EXCLUSIVE);\
 })
 
 #define ilockpair(ip0, ip1, type)      ({\
-    __log_debug(current_thread(), __FILE__, __LINE__, __func__,"acquiring pair of exclusive locks");\
+    UFS_TRACE(UFS_TRACE_LOCKPAIR, (ip0));\
     inode_lock_lockpair((ip0), (ip1), type);\
 })
 
 #define iunlockpair(ip0, ip1)      ({\
-    __log_debug(current_thread(), __FILE__, __LINE__, __func__,"acquiring pair of exclusive locks");\
+    UFS_TRACE(UFS_TRACE_UNLOCKPAIR, (ip0));\
     inode_lock_unlockpair((ip0), (ip1));\
 })
 
 #define islock(ip)      ({\
-    __log_debug(current_thread(), __FILE__, __LINE__, __func__,"acquiring shared lock");\
+    UFS_TRACE(UFS_TRACE_SLOCK, (ip));\
     inode_lock_lock((ip), UFS_LOCK_SHARED);\
 })
 
 #define iupgradelock(ip)   ({\
-    __log_debug(current_thread(), __FILE__, __LINE__, __func__,"upgrading lock");\
+    UFS_TRACE(UFS_TRACE_UPGRADE, (ip));\
     inode_lock_upgrade((ip));\
 })
 #define idowngradelock(ip)   ({\
-    __log_debug(current_thread(), __FILE__, __LINE__, __func__,"downgrading lock");\
+    UFS_TRACE(UFS_TRACE_DOWNGRADE, (ip));\
     inode_lock_downgrade((ip));\
 })
 #define iunlock(ip)     ({\
-    __log_debug(current_thread(), __FILE__, __LINE__, __func__,"releasing lock"); \
+    UFS_TRACE(UFS_TRACE_UNLOCK, (ip));\
     inode_lock_unlock((ip));\
 })
 
@@ -51,18 +51,29 @@ char *u_basename(const char *path);
 
 /*
  * Structures associated with inode caching.
+ *
+ * The table is shared by every mount, so its locks go with the table
+ * and not with the mount. Each lock covers the buckets whose index is
+ * congruent to it modulo IHASH_NLOCKS; lookups of different inodes
+ * rarely meet on the same one.
  */
 static LIST_HEAD(ihashhead, inode) *ihashtbl;
 static u_long    ihash;        /* size of hash table - 1 */
 
-#define INOHASH(device, inum)    (&ihashtbl[(minor(device) + (inum)) & ihash])
+#define IHASH_NLOCKS    64    /* power of 2 */
+static lck_mtx_t *ihash_locks[IHASH_NLOCKS];
+
+#define INOHASHIDX(device, inum) ((minor(device) + (inum)) & ihash)
+#define INOHASH(device, inum)    (&ihashtbl[INOHASHIDX(device, inum)])
+#define INOHASHLOCK(device, inum) \
+    (ihash_locks[INOHASHIDX(device, inum) & (IHASH_NLOCKS - 1)])
 
-static inline void hlock(struct ufsmount *ump) {
-    lck_mtx_lock((ump)->um_ihash_lock);
+static inline void hlock(lck_mtx_t *lock) {
+    lck_mtx_lock(lock);
 }
 
-static inline void  hulock(struct ufsmount *ump){
-    lck_mtx_unlock((ump)->um_ihash_lock);
+static inline void  hulock(lck_mtx_t *lock){
+    lck_mtx_unlock(lock);
 }
 
 static inline void  _hashdestroy(struct ihashhead *tbl, int type, u_long cnt) {
@@ -73,14 +84,25 @@ static inline void  _hashdestroy(struct ihashhead *tbl, int type, u_long cnt) {
  * Initialize inode hash table.
  */
 void ufs_hash_init(){
+    int i;
+
     KASSERT(ihashtbl == NULL, ("ufs_ihashinit called twice for KEXT"));
     ihashtbl = hashinit(desiredvnodes, M_UFSMNT, &ihash);
+    for (i = 0; i < IHASH_NLOCKS; i++)
+        ihash_locks[i] = lck_mtx_alloc_init(ffs_lock_group, LCK_ATTR_NULL);
 }
 
 /*
  * Destroy the inode hash table.
  */
 void ufs_hash_uninit(){
+    int i;
+
+    for (i = 0; i < IHASH_NLOCKS; i++) {
+        lck_mtx_destroy(ihash_locks[i], ffs_lock_group);
+        lck_mtx_free(ihash_locks[i], ffs_lock_group);
+        ihash_locks[i] = NULL;
+    }
     _hashdestroy(ihashtbl, M_UFSMNT, ihash);
     ihashtbl = NULL;
 }
@@ -97,13 +119,15 @@ hashdestroy(void *tbl, int type, __unused size_t sz)
  */
 vnode_t ufs_hash_lookup(struct ufsmount *ump, dev_t dev, ino64_t inum){
     struct inode *ip;
+    lck_mtx_t *lock;
 
-    hlock(ump);
+    lock = INOHASHLOCK(dev, inum);
+    hlock(lock);
     LIST_FOREACH(ip, INOHASH(dev, inum), i_hash){
         if (inum == ip->i_number && dev == ip->i_ump->um_dev)
             break;
     }
-    hulock(ump);
+    hulock(lock);
 
     if (ip)
         return (ITOV(ip));
@@ -121,12 +145,13 @@ int ufs_hash_get(struct ufsmount *ump, ino64_t inum, int flags, vnode_t *vpp)
     vnode_t vp;
     uint32_t vid;
     dev_t dev = ump->um_dev;
+    lck_mtx_t *lock = INOHASHLOCK(dev, inum);
     int error = 0; // if we return 0 and *vpp == NULL, vget continues.
     
     *vpp = NULL;
 
 loop:
-    hlock(ump);
+    hlock(lock);
     LIST_FOREACH(ip, INOHASH(dev, inum), i_hash) {
         if (inum == ip->i_number && dev == ip->i_ump->um_dev) {
             if (ISSET(ip->i_lflags, INL_ALLOC | INL_TRANSIT)) {
@@ -140,12 +165,12 @@ loop:
 #if 0
                 lck_rw_sleep(ip->i_lock, LCK_SLEEP_UNLOCK, (event_t)ip, THREAD_ABORTSAFE);
 #else
-                msleep((caddr_t)ip, ump->um_ihash_lock, PINOD | PDROP, "ufs_hash_get", 0);
+                msleep((caddr_t)ip, lock, PINOD | PDROP, "ufs_hash_get", 0);
 #endif
                 goto loop;
             }
             
-            hulock(ump);
+            hulock(lock);
 
             // If we are no longer on the hash chain, init failed
             if (!error && 0 == (ip->i_lflags & INL_HASHED))
@@ -171,7 +196,7 @@ loop:
             trace_return (0);
         }
     }
-    hulock(ump);
+    hulock(lock);
     return (0);
 }
 
@@ -181,12 +206,14 @@ loop:
 void ufs_hash_insert(struct inode *ip)
 {
     struct ihashhead *ipp;
+    lck_mtx_t *lock;
     
-    hlock(ip->i_ump);
+    lock = INOHASHLOCK(ip->i_ump->um_dev, ip->i_number);
+    hlock(lock);
     ipp = INOHASH(ip->i_ump->um_dev, ip->i_number);
     LIST_INSERT_HEAD(ipp, ip, i_hash);
     ip->i_lflags |= INL_HASHED;
-    hulock(ip->i_ump);
+    hulock(lock);
 }
 
 /*
@@ -194,10 +221,13 @@ void ufs_hash_insert(struct inode *ip)
  */
 void ufs_hash_remove(struct inode *ip)
 {
-    hlock(ip->i_ump);
+    lck_mtx_t *lock;
+
+    lock = INOHASHLOCK(ip->i_ump->um_dev, ip->i_number);
+    hlock(lock);
     if (ip->i_lflags & INL_HASHED) {
         ip->i_lflags &= ~INL_HASHED;
         LIST_REMOVE(ip, i_hash);
     }
-    hulock(ip->i_ump);
+    hulock(lock);
 }
@@ -0,0 +1,424 @@
+//
+//  ufs_ihash_test.c
+//  ufsX
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// The inode hash of ufs_ihash.c in user space, with pthread mutexes for
+// the lck_mtx stripes and a condition variable per stripe for msleep()
+// and wakeup(). ufs_hash_get(), _lookup(), _insert() and _remove() are
+// copied as they are, less the vnode calls, so either lock layout can be
+// run: one lock for the whole table, as um_ihash_lock was, or the 64
+// stripes.
+//
+// Threads insert, remove, look up and get random inodes, new ones marked
+// INL_ALLOC until they are finished the way ffs_vget() finishes them, so
+// gets have to sleep and be woken. Each result is checked, and at the end
+// so is the table. With -b a full table is timed under gets alone, at 1
+// to 64 threads, with each lock layout; the time is per get of all the
+// threads together, so its inverse is the lookup rate.
+
+#include <sys/param.h>
+#include <sys/queue.h>
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define	INL_ALLOC	0x000002	/* inode is being created */
+#define	INL_TRANSIT	0x000004	/* inode is getting recycled */
+#define	INL_HASHED	0x000010	/* inode is hashed */
+#define	INL_WAIT_ALLOC	0x010000	/* waiting for creation */
+#define	INL_WAIT_TRANSIT 0x020000	/* waiting for recycling */
+
+#define	IHASH_NLOCKS	64		/* power of 2 */
+#define	MAXTHREADS	64
+#define	NINODES		4096		/* checked */
+#define	BENCHINODES	65536		/* timed, one per bucket */
+#define	NGETS		(1 << 21)	/* per timing, shared out */
+
+struct inode {
+	LIST_ENTRY(inode) i_hash;
+	uint64_t	i_number;
+	int		i_dev;
+	int		i_lflags;	/* under the stripe lock */
+	pthread_mutex_t	i_vget;		/* one creator or reclaimer */
+};
+
+static LIST_HEAD(ihashhead, inode) *ihashtbl;
+static u_long ihash;			/* size of hash table - 1 */
+static int nlocks;			/* 1, or IHASH_NLOCKS */
+static pthread_mutex_t ihash_locks[IHASH_NLOCKS];
+static pthread_cond_t ihash_chans[IHASH_NLOCKS];
+
+static struct inode *inodes;
+static int ninodes;
+static long nwaits;
+
+#define	INOHASHIDX(device, inum) (((device) + (inum)) & ihash)
+#define	INOHASH(device, inum)	(&ihashtbl[INOHASHIDX(device, inum)])
+#define	INOHASHLOCK(device, inum) \
+	(INOHASHIDX(device, inum) & (nlocks - 1))
+
+/* msleep(chan, lock, PDROP): what wakeup() is waited for under. */
+static void
+msleep_drop(int lock)
+{
+
+	__atomic_fetch_add(&nwaits, 1, __ATOMIC_RELAXED);
+	pthread_cond_wait(&ihash_chans[lock], &ihash_locks[lock]);
+	pthread_mutex_unlock(&ihash_locks[lock]);
+}
+
+static struct inode *
+hash_lookup(int dev, uint64_t inum)
+{
+	struct inode *ip;
+	int lock;
+
+	lock = INOHASHLOCK(dev, inum);
+	pthread_mutex_lock(&ihash_locks[lock]);
+	LIST_FOREACH(ip, INOHASH(dev, inum), i_hash) {
+		if (inum == ip->i_number && dev == ip->i_dev)
+			break;
+	}
+	pthread_mutex_unlock(&ihash_locks[lock]);
+	return (ip);
+}
+
+/*
+ * Find the inode, waiting for it if it's being created or recycled.
+ * Sets *errorp to EIO, as ufs_hash_get() does, if it left the hash while
+ * we slept.
+ */
+static struct inode *
+hash_get(int dev, uint64_t inum, int *errorp)
+{
+	struct inode *ip;
+	int flags, lock;
+
+	*errorp = 0;
+	lock = INOHASHLOCK(dev, inum);
+loop:
+	pthread_mutex_lock(&ihash_locks[lock]);
+	LIST_FOREACH(ip, INOHASH(dev, inum), i_hash) {
+		if (inum == ip->i_number && dev == ip->i_dev) {
+			if (ip->i_lflags & (INL_ALLOC | INL_TRANSIT)) {
+				ip->i_lflags |= INL_WAIT_ALLOC |
+				    INL_WAIT_TRANSIT;
+				msleep_drop(lock);
+				goto loop;
+			}
+			flags = ip->i_lflags;
+			pthread_mutex_unlock(&ihash_locks[lock]);
+			if ((flags & INL_HASHED) == 0)
+				*errorp = EIO;
+			return (ip);
+		}
+	}
+	pthread_mutex_unlock(&ihash_locks[lock]);
+	return (NULL);
+}
+
+static void
+hash_insert(struct inode *ip)
+{
+	int lock;
+
+	lock = INOHASHLOCK(ip->i_dev, ip->i_number);
+	pthread_mutex_lock(&ihash_locks[lock]);
+	LIST_INSERT_HEAD(INOHASH(ip->i_dev, ip->i_number), ip, i_hash);
+	ip->i_lflags |= INL_HASHED;
+	pthread_mutex_unlock(&ihash_locks[lock]);
+}
+
+static void
+hash_remove(struct inode *ip)
+{
+	int lock;
+
+	lock = INOHASHLOCK(ip->i_dev, ip->i_number);
+	pthread_mutex_lock(&ihash_locks[lock]);
+	if (ip->i_lflags & INL_HASHED) {
+		ip->i_lflags &= ~INL_HASHED;
+		LIST_REMOVE(ip, i_hash);
+	}
+	pthread_mutex_unlock(&ihash_locks[lock]);
+}
+
+/*
+ * Clear INL_ALLOC and wake whoever waited, as ffs_vget() does with
+ * inode_wakeup(), but under the lock the waiters slept on.
+ */
+static void
+hash_finish(struct inode *ip)
+{
+	int lock;
+
+	lock = INOHASHLOCK(ip->i_dev, ip->i_number);
+	pthread_mutex_lock(&ihash_locks[lock]);
+	ip->i_lflags &= ~INL_ALLOC;
+	if (ip->i_lflags & (INL_WAIT_ALLOC | INL_WAIT_TRANSIT)) {
+		ip->i_lflags &= ~(INL_WAIT_ALLOC | INL_WAIT_TRANSIT);
+		pthread_cond_broadcast(&ihash_chans[lock]);
+	}
+	pthread_mutex_unlock(&ihash_locks[lock]);
+}
+
+/* A table of n inodes over two devices, none hashed yet. */
+static void
+table_init(int n, u_long buckets, int locks)
+{
+	int i;
+
+	ninodes = n;
+	ihash = buckets - 1;
+	nlocks = locks;
+	if ((ihashtbl = calloc(buckets, sizeof(*ihashtbl))) == NULL ||
+	    (inodes = calloc(n, sizeof(*inodes))) == NULL)
+		err(2, "calloc");
+	for (i = 0; i < n; i++) {
+		inodes[i].i_dev = 1 + (i & 1);
+		inodes[i].i_number = 2 + i / 2;
+		pthread_mutex_init(&inodes[i].i_vget, NULL);
+	}
+	for (i = 0; i < IHASH_NLOCKS; i++) {
+		pthread_mutex_init(&ihash_locks[i], NULL);
+		pthread_cond_init(&ihash_chans[i], NULL);
+	}
+}
+
+static void
+table_free(void)
+{
+	int i;
+
+	for (i = 0; i < ninodes; i++)
+		pthread_mutex_destroy(&inodes[i].i_vget);
+	for (i = 0; i < IHASH_NLOCKS; i++) {
+		pthread_mutex_destroy(&ihash_locks[i]);
+		pthread_cond_destroy(&ihash_chans[i]);
+	}
+	free(inodes);
+	free(ihashtbl);
+}
+
+struct worker {
+	pthread_t	w_tid;
+	uint64_t	w_rand;		/* xorshift64* state */
+	long		w_nops;
+	long		w_ngets;
+};
+
+static uint64_t
+wrand(struct worker *w, uint64_t n)
+{
+
+	w->w_rand ^= w->w_rand >> 12;
+	w->w_rand ^= w->w_rand << 25;
+	w->w_rand ^= w->w_rand >> 27;
+	return (w->w_rand * 0x2545f4914f6cdd1dULL % n);
+}
+
+static void *
+check_worker(void *arg)
+{
+	struct worker *w;
+	struct inode *ip, *want;
+	long i;
+	int error;
+
+	w = arg;
+	for (i = 0; i < w->w_nops; i++) {
+		want = &inodes[wrand(w, ninodes)];
+		switch (wrand(w, 4)) {
+		case 0:
+			/* Create it, or recycle it, if no one else is. */
+			if (pthread_mutex_trylock(&want->i_vget) != 0)
+				break;
+			if (hash_lookup(want->i_dev, want->i_number) == NULL) {
+				/* Not visible yet, so no lock needed. */
+				want->i_lflags = INL_ALLOC;
+				hash_insert(want);
+				sched_yield();
+				hash_finish(want);
+			} else
+				hash_remove(want);
+			pthread_mutex_unlock(&want->i_vget);
+			break;
+		case 1:
+			ip = hash_lookup(want->i_dev, want->i_number);
+			if (ip != NULL && ip != want)
+				bench_fail("lookup %d/%ju: wrong inode",
+				    want->i_dev, (uintmax_t)want->i_number);
+			break;
+		default:
+			ip = hash_get(want->i_dev, want->i_number, &error);
+			if (ip != NULL && ip != want)
+				bench_fail("get %d/%ju: wrong inode",
+				    want->i_dev, (uintmax_t)want->i_number);
+			w->w_ngets++;
+			break;
+		}
+	}
+	return (NULL);
+}
+
+/* Every inode is where its flags say, and nothing else is hashed. */
+static void
+check_table(void)
+{
+	struct inode *ip;
+	u_long b;
+	int i, n;
+
+	for (i = 0, n = 0; i < ninodes; i++) {
+		ip = hash_lookup(inodes[i].i_dev, inodes[i].i_number);
+		if (inodes[i].i_lflags & ~INL_HASHED)
+			bench_fail("inode %d: flags %#x left behind", i,
+			    inodes[i].i_lflags);
+		if ((inodes[i].i_lflags & INL_HASHED) ?
+		    ip != &inodes[i] : ip != NULL)
+			bench_fail("inode %d: hashed %d, found %p", i,
+			    (inodes[i].i_lflags & INL_HASHED) != 0, ip);
+		if (ip != NULL)
+			n++;
+	}
+	for (b = 0; b <= ihash; b++)
+		LIST_FOREACH(ip, &ihashtbl[b], i_hash)
+			n--;
+	if (n != 0)
+		bench_fail("%d inodes in the table unaccounted for", -n);
+}
+
+static void
+check(int locks, int nthreads, long nops)
+{
+	struct worker w[MAXTHREADS];
+	long ngets;
+	int i;
+
+	table_init(NINODES, 1024, locks);
+	nwaits = 0;
+	for (i = 0; i < nthreads; i++) {
+		w[i].w_rand = bench_random() | 1;
+		w[i].w_nops = nops;
+		w[i].w_ngets = 0;
+		if ((errno = pthread_create(&w[i].w_tid, NULL, check_worker,
+		    &w[i])) != 0)
+			err(2, "pthread_create");
+	}
+	for (i = 0, ngets = 0; i < nthreads; i++) {
+		pthread_join(w[i].w_tid, NULL);
+		ngets += w[i].w_ngets;
+	}
+	check_table();
+	printf("%d lock%s, %d threads: %ld gets checked, %ld slept\n",
+	    locks, locks == 1 ? "" : "s", nthreads, ngets, nwaits);
+	table_free();
+}
+
+static void *
+bench_worker(void *arg)
+{
+	struct worker *w;
+	struct inode *ip;
+	long i;
+	int error;
+
+	w = arg;
+	for (i = 0; i < w->w_nops; i++) {
+		ip = &inodes[wrand(w, ninodes)];
+		if (hash_get(ip->i_dev, ip->i_number, &error) != ip)
+			bench_fail("get %d/%ju: not found", ip->i_dev,
+			    (uintmax_t)ip->i_number);
+	}
+	return (NULL);
+}
+
+static void
+bench(int locks)
+{
+	struct worker w[MAXTHREADS];
+	char name[64];
+	double start;
+	int i, n;
+
+	table_init(BENCHINODES, BENCHINODES, locks);
+	for (i = 0; i < ninodes; i++)
+		hash_insert(&inodes[i]);
+	for (n = 1; n <= MAXTHREADS; n *= 2) {
+		start = bench_now();
+		for (i = 0; i < n; i++) {
+			w[i].w_rand = bench_random() | 1;
+			w[i].w_nops = NGETS / n;
+			if ((errno = pthread_create(&w[i].w_tid, NULL,
+			    bench_worker, &w[i])) != 0)
+				err(2, "pthread_create");
+		}
+		for (i = 0; i < n; i++)
+			pthread_join(w[i].w_tid, NULL);
+		snprintf(name, sizeof(name), "get %d lock%s %d thread%s",
+		    locks, locks == 1 ? "" : "s", n, n == 1 ? "" : "s");
+		bench_report(name, (bench_now() - start) / NGETS, 0);
+	}
+	table_free();
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: ufs_ihash_test [-b] [-n ops] [-s seed] [-t threads]\n");
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *seed;
+	long n;
+	int bflag, ch, nthreads;
+
+	bflag = 0;
+	n = 200000;
+	nthreads = 8;
+	seed = NULL;
+	while ((ch = getopt(argc, argv, "bn:s:t:")) != -1)
+		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'n':
+			n = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = optarg;
+			break;
+		case 't':
+			nthreads = (int)strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	if (argc != optind || nthreads < 1 || nthreads > MAXTHREADS)
+		usage();
+	bench_seed(seed);
+	check(1, nthreads, n);
+	check(IHASH_NLOCKS, nthreads, n);
+	if (bflag) {
+		bench(1);
+		bench(IHASH_NLOCKS);
+	}
+	return (bench_done());
+}
@@ -99,7 +99,6 @@ struct ufsmount {
 	struct	mount *um_mountp;		/* (r) filesystem vfs struct */
     struct  bsdmount *um_compat;        /* (c) compatibility vfs struct */
 	dev_t          um_dev;			/* (r) device mounted */
-    lck_mtx_t     *um_ihash_lock;
 	struct	vnode *um_devvp;		/* (r) devfs dev vnode */
 	u_long	um_fstype;			/* (c) type of filesystem */
 	struct	fs *um_fs;			/* (r) pointer to superblock */
@@ -130,6 +129,7 @@ struct ufsmount {
 	u_long	um_trimlisthashsize;		/* (i) trim hash table size-1 */
     struct ialloc_critical *um_vget_critical; /* ino numbers that have entered the critical allocation point  */
     struct ialloc_critical *um_valloc_critical; /* ino numbers that have entered the critical allocation point  */
+	struct	ffs_fragtree *um_fragtree;	/* per-cg free fragment summary */
 	struct	fsfail_task um_fsfail_task;	/* (i) task for fsfail cleanup*/
 						/* (c) - below function ptrs */
 	int		(*um_balloc)(struct vnode *, off_t, int, struct vfs_context *, int, struct buf **);
@@ -72,6 +72,7 @@ kern_return_t ufsX_start(kmod_info_t * ki, void *d)
     
     log_debug_init();
     ufs_hash_init();
+    inode_lock_init();
        
     fsc.vfe_vfsops = &ffs_vfsops;
     fsc.vfe_vopcnt = nitems(vnops);
@@ -102,6 +103,7 @@ kern_return_t ufsX_stop(kmod_info_t *ki, void *d)
     ufs_uninit(NULL);
     log_debug_uninit();
     ufs_hash_uninit();
+    inode_lock_uninit();
     lck_grp_free(ffs_lock_group);
     
     return (KERN_SUCCESS);
@@ -0,0 +1,616 @@
+//
+//  ufscheck.c
+//  ufscheck
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Read-only consistency check of a UFS image, cylinder groups in
+// parallel. Two passes, each a pool of threads taking cylinder groups
+// off a shared counter, every thread reading through its own libufs
+// cursor:
+//
+// 1. Read the cylinder group and check its check-hash, then the inode
+//    table: inode check-hashes, the inode map, and the blocks every
+//    inode claims, walking its indirect blocks. Claims are or'ed into
+//    one bitmap of the whole file system with atomic operations, which
+//    is also how blocks claimed twice are caught.
+// 2. Compare each group's free map with the bitmap, and the summaries
+//    in the group and in fs_cs with what the bitmap and the inodes say.
+//
+// Pass 2 has to wait for all of pass 1, since any inode may own blocks
+// in any group. Directory contents and link counts are not checked.
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#ifndef __printflike
+#define	__printflike(f, a)	__attribute__((__format__(__printf__, f, a)))
+#endif
+#ifndef SF_SNAPSHOT
+#define	SF_SNAPSHOT	0x00200000	/* snapshot inode */
+#endif
+
+#define	MAXWORKERS	256
+#define	IOCHUNK		(512 * 1024)	/* inode table read size */
+#define	MAXREPORT	20		/* per kind of bitmap mismatch per cg */
+
+/*
+ * The parts of an inode we look at, for either UFS.
+ */
+struct dinfo {
+	ino_t		ino;
+	int		mode;
+	uint32_t	flags;
+	uint64_t	size;
+	uint64_t	blocks;
+	uint64_t	extsize;
+	ufs2_daddr_t	db[UFS_NDADDR];
+	ufs2_daddr_t	ib[UFS_NIADDR];
+	ufs2_daddr_t	extb[UFS_NXADDR];
+};
+
+struct worker {
+	pthread_t	w_thread;
+	struct uufsd_cursor *w_cur;
+	caddr_t		w_ibuf;			/* inode table chunk */
+	caddr_t		w_ind[UFS_NIADDR];	/* indirect block per level */
+	uint64_t	w_inodes;		/* inodes looked at */
+	uint64_t	w_bytes;		/* metadata read */
+};
+
+/* What the inodes of a group add up to, from pass 1. */
+struct cgcount {
+	int32_t		cc_ndir;
+	int32_t		cc_nifree;
+	int		cc_bad;			/* no usable group read */
+};
+
+static struct uufsd disk;
+static struct fs *fs;
+static uint64_t *owned;			/* one bit per frag of the fs */
+static caddr_t cgbufs;			/* every group, from pass 1 */
+static struct cgcount *counts;
+static int nextcg;
+static uint64_t nerrors;
+static int verbose;
+
+static void check(int, const char *);
+static void *pass1(void *);
+static void pass1_cg(struct worker *, int);
+static void checkinode(struct worker *, struct dinfo *);
+static int claim(struct dinfo *, ufs2_daddr_t, int, uint64_t *);
+static void walkindir(struct worker *, struct dinfo *, ufs2_daddr_t, int,
+    uint64_t *);
+static void *pass2(void *);
+static void pass2_cg(int);
+static void markmeta(void);
+static int ismeta(ufs2_daddr_t, int);
+static void report(const char *, ...) __printflike(1, 2);
+static double now(void);
+static void usage(void);
+
+int
+main(int argc, char *argv[])
+{
+	long nthreads;
+	int ch, direct, map, rv;
+
+	direct = map = 0;
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((ch = getopt(argc, argv, "dj:mv")) != -1)
+		switch (ch) {
+		case 'd':
+			direct = 1;
+			break;
+		case 'j':
+			nthreads = strtol(optarg, NULL, 10);
+			if (nthreads < 1 || nthreads > MAXWORKERS)
+				errx(1, "%s: bad number of threads", optarg);
+			break;
+		case 'm':
+			map = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if (map)
+		rv = ufs_disk_fillout_mmap(&disk, argv[0], UFS_MMAP_READ);
+	else if (direct)
+		rv = ufs_disk_fillout_direct(&disk, argv[0]);
+	else
+		rv = ufs_disk_fillout(&disk, argv[0]);
+	if (rv == -1)
+		err(1, "%s: %s", argv[0], disk.d_error);
+	fs = &disk.d_fs;
+	check((int)MIN(nthreads, fs->fs_ncg),
+	    map ? " mapped" : direct ? " direct" : "");
+	ufs_disk_close(&disk);
+	return (nerrors == 0 ? 0 : 2);
+}
+
+static void
+check(int nthreads, const char *how)
+{
+	struct worker *workers, *w;
+	struct csum total;
+	uint64_t nfrags, nbytes, ninodes;
+	double t0, t1, t2;
+	long pgsz;
+	int c, i, j;
+
+	nfrags = howmany((uint64_t)fs->fs_size, 64);
+	if ((owned = calloc(nfrags, sizeof(*owned))) == NULL ||
+	    (cgbufs = malloc((size_t)fs->fs_ncg * fs->fs_cgsize)) == NULL ||
+	    (counts = calloc(fs->fs_ncg, sizeof(*counts))) == NULL ||
+	    (workers = calloc(nthreads, sizeof(*workers))) == NULL)
+		err(1, "malloc");
+	markmeta();
+	/* Page aligned, so direct I/O needn't bounce them. */
+	pgsz = sysconf(_SC_PAGESIZE);
+	for (i = 0; i < nthreads; i++) {
+		w = &workers[i];
+		if ((w->w_cur = ufs_cursor_open(&disk)) == NULL)
+			errx(1, "%s", disk.d_error);
+		if (posix_memalign((void **)&w->w_ibuf, pgsz, IOCHUNK) != 0)
+			err(1, "malloc");
+		for (j = 0; j < UFS_NIADDR; j++)
+			if (posix_memalign((void **)&w->w_ind[j], pgsz,
+			    fs->fs_bsize) != 0)
+				err(1, "malloc");
+	}
+
+	t0 = now();
+	for (i = 0; i < nthreads; i++)
+		if ((errno = pthread_create(&workers[i].w_thread, NULL, pass1,
+		    &workers[i])) != 0)
+			err(1, "pthread_create");
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].w_thread, NULL);
+	t1 = now();
+	nextcg = 0;
+	for (i = 0; i < nthreads; i++)
+		if ((errno = pthread_create(&workers[i].w_thread, NULL, pass2,
+		    NULL)) != 0)
+			err(1, "pthread_create");
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].w_thread, NULL);
+	t2 = now();
+
+	/* The group summaries were checked in pass 2; now their total. */
+	memset(&total, 0, sizeof(total));
+	for (c = 0; c < fs->fs_ncg; c++) {
+		total.cs_ndir += fs->fs_cs(fs, c).cs_ndir;
+		total.cs_nbfree += fs->fs_cs(fs, c).cs_nbfree;
+		total.cs_nifree += fs->fs_cs(fs, c).cs_nifree;
+		total.cs_nffree += fs->fs_cs(fs, c).cs_nffree;
+	}
+	if (total.cs_ndir != fs->fs_cstotal.cs_ndir ||
+	    total.cs_nbfree != fs->fs_cstotal.cs_nbfree ||
+	    total.cs_nifree != fs->fs_cstotal.cs_nifree ||
+	    total.cs_nffree != fs->fs_cstotal.cs_nffree)
+		report("superblock: fs_cstotal is dir %jd bfree %jd ifree %jd "
+		    "ffree %jd, groups add up to %d %d %d %d",
+		    (intmax_t)fs->fs_cstotal.cs_ndir,
+		    (intmax_t)fs->fs_cstotal.cs_nbfree,
+		    (intmax_t)fs->fs_cstotal.cs_nifree,
+		    (intmax_t)fs->fs_cstotal.cs_nffree, total.cs_ndir,
+		    total.cs_nbfree, total.cs_nifree, total.cs_nffree);
+
+	nbytes = ninodes = 0;
+	for (i = 0; i < nthreads; i++) {
+		nbytes += workers[i].w_bytes;
+		ninodes += workers[i].w_inodes;
+		ufs_cursor_close(workers[i].w_cur);
+		free(workers[i].w_ibuf);
+		for (j = 0; j < UFS_NIADDR; j++)
+			free(workers[i].w_ind[j]);
+	}
+	printf("%s: %jd inodes in use, %jd frags free, %ju error%s\n",
+	    disk.d_name, (intmax_t)((int64_t)fs->fs_ipg * fs->fs_ncg -
+	    total.cs_nifree), (intmax_t)(total.cs_nbfree * fs->fs_frag +
+	    total.cs_nffree), (uintmax_t)nerrors, nerrors == 1 ? "" : "s");
+	if (verbose)
+		printf("%d thread%s%s, pass 1 %.3fs, pass 2 %.3fs: "
+		    "%.2f GB of file system/s, %.2f GB of metadata/s, "
+		    "%.0f inodes/s\n", nthreads, nthreads == 1 ? "" : "s",
+		    how, t1 - t0, t2 - t1,
+		    (double)fs->fs_size * fs->fs_fsize / 1e9 / (t2 - t0),
+		    (double)nbytes / 1e9 / (t2 - t0),
+		    (double)ninodes / (t1 - t0));
+	free(workers);
+	free(counts);
+	free(cgbufs);
+	free(owned);
+}
+
+static void *
+pass1(void *arg)
+{
+	struct worker *w;
+	int c;
+
+	w = arg;
+	while ((c = __atomic_fetch_add(&nextcg, 1, __ATOMIC_RELAXED)) <
+	    fs->fs_ncg)
+		pass1_cg(w, c);
+	return (NULL);
+}
+
+static void
+pass1_cg(struct worker *w, int c)
+{
+	struct cg *cgp;
+	struct dinfo di;
+	struct ufs1_dinode *dp1;
+	struct ufs2_dinode *dp2;
+	ino_t base;
+	int i, j, k, n, ninodes, isize, inuse, nused;
+
+	cgp = (struct cg *)(cgbufs + (size_t)c * fs->fs_cgsize);
+	if (ufs_cursor_cgread(w->w_cur, c) == -1) {
+		report("cg %d: %s", c, w->w_cur->c_error);
+		/* A bad check-hash alone still leaves a usable group. */
+		if (!cg_chkmagic(w->w_cur->c_cg) || w->w_cur->c_cg->cg_cgx != c)
+			counts[c].cc_bad = 1;
+	}
+	memcpy(cgp, w->w_cur->c_cg, fs->fs_cgsize);
+	w->w_bytes += fs->fs_cgsize;
+
+	/* UFS2 inodes past cg_initediblk were never written. */
+	ninodes = fs->fs_ipg;
+	if (disk.d_ufs == 2 && !counts[c].cc_bad)
+		ninodes = MIN(cgp->cg_initediblk, fs->fs_ipg);
+	isize = disk.d_ufs == 1 ? sizeof(*dp1) : sizeof(*dp2);
+	base = (ino_t)c * fs->fs_ipg;
+	nused = 0;
+	for (i = 0; i < ninodes; i += n) {
+		n = MIN(ninodes - i, IOCHUNK / isize);
+		if (ufs_cursor_bread(w->w_cur, fsbtodb(fs, cgimin(fs, c) +
+		    i / INOPF(fs)), w->w_ibuf, roundup(n * isize,
+		    fs->fs_fsize)) == -1) {
+			report("cg %d: inodes %ju-%ju: %s", c,
+			    (uintmax_t)(base + i),
+			    (uintmax_t)(base + i + n - 1), w->w_cur->c_error);
+			continue;
+		}
+		w->w_bytes += roundup(n * isize, fs->fs_fsize);
+		w->w_inodes += n;
+		dp1 = (struct ufs1_dinode *)w->w_ibuf;
+		dp2 = (struct ufs2_dinode *)w->w_ibuf;
+		for (k = 0; k < n; k++, dp1++, dp2++) {
+			memset(&di, 0, sizeof(di));
+			di.ino = base + i + k;
+			if (disk.d_ufs == 1) {
+				di.mode = dp1->di_mode;
+				di.flags = dp1->di_flags;
+				di.size = dp1->di_size;
+				di.blocks = dp1->di_blocks;
+				for (j = 0; j < UFS_NDADDR; j++)
+					di.db[j] = dp1->di_db[j];
+				for (j = 0; j < UFS_NIADDR; j++)
+					di.ib[j] = dp1->di_ib[j];
+			} else {
+				di.mode = dp2->di_mode;
+				di.flags = dp2->di_flags;
+				di.size = dp2->di_size;
+				di.blocks = dp2->di_blocks;
+				di.extsize = dp2->di_extsize;
+				memcpy(di.db, dp2->di_db, sizeof(di.db));
+				memcpy(di.ib, dp2->di_ib, sizeof(di.ib));
+				memcpy(di.extb, dp2->di_extb, sizeof(di.extb));
+				if (ffs_verify_dinode_ckhash(fs, dp2) != 0)
+					report("ino %ju: bad check-hash",
+					    (uintmax_t)di.ino);
+			}
+			inuse = di.mode != 0 || di.ino < UFS_ROOTINO;
+			nused += inuse;
+			if (!counts[c].cc_bad &&
+			    inuse != (isset(cg_inosused(cgp), i + k) != 0))
+				report("ino %ju: %s but marked %s in cg %d",
+				    (uintmax_t)di.ino,
+				    inuse ? "in use" : "unallocated",
+				    inuse ? "free" : "used", c);
+			if ((di.mode & IFMT) == IFDIR)
+				counts[c].cc_ndir++;
+			if (di.mode != 0)
+				checkinode(w, &di);
+		}
+	}
+	counts[c].cc_nifree = fs->fs_ipg - nused;
+	/* And nothing may be in use in the part of the table never written. */
+	if (!counts[c].cc_bad && ninodes < fs->fs_ipg &&
+	    (i = ffs_bitmap_ffs(cg_inosused(cgp), ninodes, fs->fs_ipg)) != -1)
+		report("ino %ju: marked used in cg %d past cg_initediblk %d",
+		    (uintmax_t)(base + i), c, ninodes);
+}
+
+/*
+ * Claim everything inode di points at.
+ */
+static void
+checkinode(struct worker *w, struct dinfo *di)
+{
+	uint64_t nfrags;
+	int i, lvl, type;
+
+	type = di->mode & IFMT;
+	if (type == IFCHR || type == IFBLK || type == IFIFO || type == IFSOCK)
+		return;
+	/* Short symbolic links keep the target in di_db. */
+	if (type == IFLNK && (di->size < (uint64_t)fs->fs_maxsymlinklen ||
+	    (fs->fs_maxsymlinklen == 0 && di->blocks == 0)))
+		return;
+	/* The last block before EOF may be a fragment, those past it aren't. */
+	nfrags = 0;
+	for (i = 0; i < UFS_NDADDR; i++)
+		if (di->db[i] != 0)
+			claim(di, di->db[i], (uint64_t)i * fs->fs_bsize <
+			    di->size ? numfrags(fs, sblksize(fs,
+			    (int64_t)di->size, i)) : fs->fs_frag, &nfrags);
+	for (lvl = 0; lvl < UFS_NIADDR; lvl++)
+		if (di->ib[lvl] != 0)
+			walkindir(w, di, di->ib[lvl], lvl, &nfrags);
+	for (i = 0; i < UFS_NXADDR; i++)
+		if (di->extb[i] != 0)
+			claim(di, di->extb[i], (uint64_t)i * fs->fs_bsize <
+			    di->extsize ? numfrags(fs, sblksize(fs,
+			    (int64_t)di->extsize, i)) : fs->fs_frag, &nfrags);
+	if ((di->flags & SF_SNAPSHOT) == 0 &&
+	    nfrags * (fs->fs_fsize / DEV_BSIZE) != di->blocks)
+		report("ino %ju: di_blocks %ju, blocks found %ju",
+		    (uintmax_t)di->ino, (uintmax_t)di->blocks,
+		    (uintmax_t)(nfrags * (fs->fs_fsize / DEV_BSIZE)));
+}
+
+/*
+ * The level lvl indirect block at blkno and everything under it.
+ */
+static void
+walkindir(struct worker *w, struct dinfo *di, ufs2_daddr_t blkno, int lvl,
+    uint64_t *nfrags)
+{
+	ufs2_daddr_t bn;
+	caddr_t buf;
+	int i;
+
+	if (!claim(di, blkno, fs->fs_frag, nfrags))
+		return;
+	buf = w->w_ind[lvl];
+	if (ufs_cursor_bread(w->w_cur, fsbtodb(fs, blkno), buf,
+	    fs->fs_bsize) == -1) {
+		report("ino %ju: indirect block %jd: %s", (uintmax_t)di->ino,
+		    (intmax_t)blkno, w->w_cur->c_error);
+		return;
+	}
+	w->w_bytes += fs->fs_bsize;
+	for (i = 0; i < NINDIR(fs); i++) {
+		bn = disk.d_ufs == 1 ? ((ufs1_daddr_t *)buf)[i] :
+		    ((ufs2_daddr_t *)buf)[i];
+		if (bn == 0)
+			continue;
+		if (lvl > 0)
+			walkindir(w, di, bn, lvl - 1, nfrags);
+		else
+			claim(di, bn, fs->fs_frag, nfrags);
+	}
+}
+
+/*
+ * Mark frags [blkno, blkno + frags) owned by di. They never straddle a
+ * block, and a block never straddles a word of the bitmap.
+ */
+static int
+claim(struct dinfo *di, ufs2_daddr_t blkno, int frags, uint64_t *nfrags)
+{
+	uint64_t mask, old;
+
+	if ((di->flags & SF_SNAPSHOT) != 0 &&
+	    (blkno == BLK_NOCOPY || blkno == BLK_SNAP))
+		return (0);
+	if (frags <= 0 || frags > fs->fs_frag || blkno < 0 ||
+	    blkno + frags > fs->fs_size ||
+	    fragnum(fs, blkno) + frags > fs->fs_frag) {
+		report("ino %ju: bad block %jd", (uintmax_t)di->ino,
+		    (intmax_t)blkno);
+		return (0);
+	}
+	*nfrags += frags;
+	if (ismeta(blkno, frags)) {
+		report("ino %ju: block %jd is file system metadata",
+		    (uintmax_t)di->ino, (intmax_t)blkno);
+		return (0);
+	}
+	mask = (frags == 64 ? ~(uint64_t)0 : ((uint64_t)1 << frags) - 1) <<
+	    (blkno % 64);
+	old = __atomic_fetch_or(&owned[blkno / 64], mask, __ATOMIC_RELAXED);
+	if ((old & mask) != 0) {
+		/* Give back what we just took, it isn't ours either. */
+		__atomic_fetch_and(&owned[blkno / 64], ~(mask & ~old),
+		    __ATOMIC_RELAXED);
+		report("ino %ju: block %jd is claimed twice",
+		    (uintmax_t)di->ino, (intmax_t)blkno);
+		return (0);
+	}
+	return (1);
+}
+
+static void *
+pass2(void *arg)
+{
+	int c;
+
+	(void)arg;
+	while ((c = __atomic_fetch_add(&nextcg, 1, __ATOMIC_RELAXED)) <
+	    fs->fs_ncg)
+		pass2_cg(c);
+	return (NULL);
+}
+
+static void
+pass2_cg(int c)
+{
+	struct cg *cgp;
+	struct csum cs, *fcs;
+	ufs2_daddr_t base, d;
+	u_int mask, used, marked;
+	int b, n, nfree, nlost, ndup;
+	u_char *blksfree;
+
+	if (counts[c].cc_bad)
+		return;
+	cgp = (struct cg *)(cgbufs + (size_t)c * fs->fs_cgsize);
+	blksfree = cg_blksfree(cgp);
+	base = cgbase(fs, c);
+	memset(&cs, 0, sizeof(cs));
+	nlost = ndup = 0;
+	/*
+	 * A block at a time: its frags share a byte of the free map and a
+	 * word of the bitmap, as fs_frag divides both and groups start on
+	 * a block.
+	 */
+	for (b = 0; b < cgp->cg_ndblk; b += fs->fs_frag) {
+		n = MIN(fs->fs_frag, cgp->cg_ndblk - b);
+		mask = (1U << n) - 1;
+		d = base + b;
+		used = (u_int)(owned[d / 64] >> (d % 64)) & mask;
+		marked = (u_int)(blksfree[b / NBBY] >> (b % NBBY)) & mask;
+		nfree = n - __builtin_popcount(used);
+		if (nfree == fs->fs_frag)
+			cs.cs_nbfree++;
+		else
+			cs.cs_nffree += nfree;
+		if ((~used & ~marked & mask) != 0 &&
+		    (nlost++ < MAXREPORT || verbose))
+			report("cg %d: block %jd: %d unused frag%s marked "
+			    "allocated", c, (intmax_t)d,
+			    __builtin_popcount(~used & ~marked & mask),
+			    __builtin_popcount(~used & ~marked & mask) == 1 ?
+			    "" : "s");
+		if ((used & marked) != 0 && (ndup++ < MAXREPORT || verbose))
+			report("cg %d: block %jd: %d frag%s in use but marked "
+			    "free", c, (intmax_t)d, __builtin_popcount(used &
+			    marked), __builtin_popcount(used & marked) == 1 ?
+			    "" : "s");
+	}
+	if (nlost > MAXREPORT && !verbose)
+		report("cg %d: %d more blocks with unused frags marked "
+		    "allocated", c, nlost - MAXREPORT);
+	if (ndup > MAXREPORT && !verbose)
+		report("cg %d: %d more blocks with used frags marked free", c,
+		    ndup - MAXREPORT);
+	cs.cs_ndir = counts[c].cc_ndir;
+	cs.cs_nifree = counts[c].cc_nifree;
+	if (memcmp(&cs, &cgp->cg_cs, sizeof(cs)) != 0)
+		report("cg %d: summary is dir %d bfree %d ifree %d ffree %d, "
+		    "should be %d %d %d %d", c, cgp->cg_cs.cs_ndir,
+		    cgp->cg_cs.cs_nbfree, cgp->cg_cs.cs_nifree,
+		    cgp->cg_cs.cs_nffree, cs.cs_ndir, cs.cs_nbfree,
+		    cs.cs_nifree, cs.cs_nffree);
+	fcs = &fs->fs_cs(fs, c);
+	if (memcmp(&cs, fcs, sizeof(cs)) != 0)
+		report("cg %d: fs_cs is dir %d bfree %d ifree %d ffree %d, "
+		    "should be %d %d %d %d", c, fcs->cs_ndir, fcs->cs_nbfree,
+		    fcs->cs_nifree, fcs->cs_nffree, cs.cs_ndir, cs.cs_nbfree,
+		    cs.cs_nifree, cs.cs_nffree);
+}
+
+/*
+ * Metadata nobody may claim: boot area, superblock copy, cylinder group
+ * and inode table of every group, and the summary area. It is marked
+ * owned before pass 1 so that pass 2 expects it to be allocated.
+ */
+static void
+markmeta(void)
+{
+	ufs2_daddr_t d, lo, hi;
+	int c;
+
+	for (c = 0; c < fs->fs_ncg; c++) {
+		lo = c == 0 ? 0 : cgsblock(fs, c);
+		hi = MIN(cgdmin(fs, c), fs->fs_size);
+		for (d = lo; d < hi; d++)
+			owned[d / 64] |= (uint64_t)1 << (d % 64);
+	}
+	hi = MIN(fs->fs_csaddr + numfrags(fs, fragroundup(fs, fs->fs_cssize)),
+	    fs->fs_size);
+	for (d = fs->fs_csaddr; d < hi; d++)
+		owned[d / 64] |= (uint64_t)1 << (d % 64);
+}
+
+static int
+ismeta(ufs2_daddr_t blkno, int frags)
+{
+	ufs2_daddr_t lo, hi, cslo, cshi;
+	int c;
+
+	c = dtog(fs, blkno);
+	lo = c == 0 ? 0 : cgsblock(fs, c);
+	hi = cgdmin(fs, c);
+	cslo = fs->fs_csaddr;
+	cshi = cslo + numfrags(fs, fragroundup(fs, fs->fs_cssize));
+	return ((blkno < hi && blkno + frags > lo) ||
+	    (blkno < cshi && blkno + frags > cslo));
+}
+
+static void
+report(const char *fmt, ...)
+{
+	va_list ap;
+
+	__atomic_fetch_add(&nerrors, 1, __ATOMIC_RELAXED);
+	va_start(ap, fmt);
+	flockfile(stdout);
+	vprintf(fmt, ap);
+	putchar('\n');
+	funlockfile(stdout);
+	va_end(ap);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: ufscheck [-dmv] [-j threads] special | file\n");
+	exit(1);
+}
@@ -0,0 +1,422 @@
+//
+//  ufsclone.c
+//  ufsclone
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Copy a UFS file system to an image file or another disk, reading only
+// what is allocated. Which frags those are comes from each cylinder
+// group's free map: everything that isn't free is copied, and that
+// includes the boot area, superblocks, cylinder groups, inode tables and
+// summary area, so the clone is the same file system, bit for bit where
+// it matters. Free space is left as a hole in an image and untouched on
+// a disk.
+//
+// A pool of threads takes cylinder groups off a shared counter, as in
+// ufscheck, each reading through its own libufs cursor and writing what
+// it read to the same offset of the target. Runs of allocated frags
+// separated by less than MAXGAP are copied as one, up to IOCHUNK at a
+// time, so both sides see large sequential I/O.
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/disk.h>
+#include <freebsd/compat.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#define	MAXWORKERS	256
+#define	IOCHUNK		(1024 * 1024)	/* most copied by one read */
+#define	MAXGAP		(64 * 1024)	/* free space copied to join runs */
+
+struct worker {
+	pthread_t	w_thread;
+	struct uufsd_cursor *w_cur;
+	caddr_t		w_buf;			/* IOCHUNK bytes */
+	ufs2_daddr_t	w_start;		/* run being built */
+	ufs2_daddr_t	w_end;
+};
+
+static struct uufsd disk;
+static struct fs *fs;
+static int tfd;				/* target */
+static const char *tname;
+static int sparse;			/* target reads zeros where unwritten */
+static int nextcg;
+static int nrunning;
+static uint64_t copied;			/* bytes read */
+static uint64_t written;		/* bytes written, less zeros */
+static uint64_t nruns;
+static uint64_t nerrors;
+
+static void copyfs(int, int);
+static void *cloner(void *);
+static void clone_cg(struct worker *, int);
+static void addfrags(struct worker *, ufs2_daddr_t, ufs2_daddr_t);
+static void copyrun(struct worker *, ufs2_daddr_t, ufs2_daddr_t);
+static void writeout(const char *, size_t, off_t);
+static int iszero(const char *, size_t);
+static void opentarget(const char *, off_t);
+static off_t mediasize(int);
+static void progress(double, int);
+static double now(void);
+static void usage(void);
+
+int
+main(int argc, char *argv[])
+{
+	long nthreads;
+	int ch, direct, verbose;
+
+	direct = verbose = 0;
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((ch = getopt(argc, argv, "dj:v")) != -1)
+		switch (ch) {
+		case 'd':
+			direct = 1;
+			break;
+		case 'j':
+			nthreads = strtol(optarg, NULL, 10);
+			if (nthreads < 1 || nthreads > MAXWORKERS)
+				errx(1, "%s: bad number of threads", optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 2)
+		usage();
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if ((direct ? ufs_disk_fillout_direct(&disk, argv[0]) :
+	    ufs_disk_fillout(&disk, argv[0])) == -1)
+		err(1, "%s: %s", argv[0], disk.d_error);
+	fs = &disk.d_fs;
+	opentarget(argv[1], (off_t)fs->fs_size * fs->fs_fsize);
+	copyfs((int)MIN(nthreads, fs->fs_ncg), verbose);
+	if (fsync(tfd) == -1)
+		err(1, "%s", tname);
+	close(tfd);
+	ufs_disk_close(&disk);
+	return (nerrors == 0 ? 0 : 1);
+}
+
+/*
+ * Open the target. An image is created, or truncated so that what isn't
+ * copied reads as zeros and takes no space; a disk has to be at least
+ * as big as the file system.
+ */
+static void
+opentarget(const char *name, off_t size)
+{
+	struct stat sst, tst;
+	off_t tsize;
+
+	tname = name;
+	if ((tfd = open(name, O_WRONLY | O_CREAT, 0644)) == -1)
+		err(1, "%s", name);
+	if (fstat(disk.d_fd, &sst) == -1 || fstat(tfd, &tst) == -1)
+		err(1, "%s", name);
+	if (sst.st_dev == tst.st_dev && sst.st_ino == tst.st_ino)
+		errx(1, "%s: same as %s", name, disk.d_name);
+	if (S_ISREG(tst.st_mode)) {
+		if (ftruncate(tfd, 0) == -1 || ftruncate(tfd, size) == -1)
+			err(1, "%s", name);
+		sparse = 1;
+		return;
+	}
+	if ((tsize = mediasize(tfd)) > 0 && tsize < size)
+		errx(1, "%s: %jd bytes, file system needs %jd", name,
+		    (intmax_t)tsize, (intmax_t)size);
+}
+
+/*
+ * Size of a disk in bytes, or 0 if it can't be told.
+ */
+static off_t
+mediasize(int fd)
+{
+	uint64_t count;
+	uint32_t size;
+	off_t end;
+
+	if (ioctl(fd, DKIOCGETBLOCKSIZE, &size) == 0 &&
+	    ioctl(fd, DKIOCGETBLOCKCOUNT, &count) == 0)
+		return ((off_t)count * size);
+	if ((end = lseek(fd, 0, SEEK_END)) == -1)
+		return (0);
+	return (end);
+}
+
+static void
+copyfs(int nthreads, int verbose)
+{
+	struct worker *workers, *w;
+	uint64_t alloc;
+	double t0, t1, last;
+	long pgsz;
+	int i, tty;
+
+	if ((workers = calloc(nthreads, sizeof(*workers))) == NULL)
+		err(1, "malloc");
+	/* Page aligned, so direct I/O needn't bounce them. */
+	pgsz = sysconf(_SC_PAGESIZE);
+	for (i = 0; i < nthreads; i++) {
+		w = &workers[i];
+		if ((w->w_cur = ufs_cursor_open(&disk)) == NULL)
+			errx(1, "%s", disk.d_error);
+		if (posix_memalign((void **)&w->w_buf, pgsz, IOCHUNK) != 0)
+			err(1, "malloc");
+	}
+
+	tty = isatty(STDERR_FILENO);
+	t0 = last = now();
+	nrunning = nthreads;
+	for (i = 0; i < nthreads; i++)
+		if ((errno = pthread_create(&workers[i].w_thread, NULL, cloner,
+		    &workers[i])) != 0)
+			err(1, "pthread_create");
+	while (__atomic_load_n(&nrunning, __ATOMIC_RELAXED) > 0) {
+		usleep(100000);
+		if (verbose && now() - last >= 1) {
+			last = now();
+			progress(last - t0, tty);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].w_thread, NULL);
+		ufs_cursor_close(workers[i].w_cur);
+		free(workers[i].w_buf);
+	}
+	t1 = now();
+	if (verbose && tty && t1 - t0 >= 1)
+		fputc('\n', stderr);
+
+	alloc = (uint64_t)fs->fs_size - (fs->fs_cstotal.cs_nbfree *
+	    fs->fs_frag + fs->fs_cstotal.cs_nffree);
+	printf("%s: %ju MB of %ju MB copied (%ju MB in use), %ju MB written, "
+	    "%ju runs, %.3fs, %.1f MB/s\n", tname, (uintmax_t)(copied >> 20),
+	    (uintmax_t)(((uint64_t)fs->fs_size * fs->fs_fsize) >> 20),
+	    (uintmax_t)((alloc * fs->fs_fsize) >> 20),
+	    (uintmax_t)(written >> 20), (uintmax_t)nruns, t1 - t0,
+	    copied / 1e6 / (t1 - t0));
+	if (verbose)
+		printf("%d thread%s\n", nthreads, nthreads == 1 ? "" : "s");
+	free(workers);
+}
+
+static void *
+cloner(void *arg)
+{
+	struct worker *w;
+	int c;
+
+	w = arg;
+	while ((c = __atomic_fetch_add(&nextcg, 1, __ATOMIC_RELAXED)) <
+	    fs->fs_ncg)
+		clone_cg(w, c);
+	__atomic_fetch_sub(&nrunning, 1, __ATOMIC_RELAXED);
+	return (NULL);
+}
+
+/*
+ * Copy what group c has in use: every frag its free map doesn't have
+ * free, less the UFS2 inode blocks past cg_initediblk, which were never
+ * written. A group that can't be read or isn't one is copied whole.
+ */
+static void
+clone_cg(struct worker *w, int c)
+{
+	struct cg *cgp;
+	u_char *freemap;
+	ufs2_daddr_t base, end, d, ilo, ihi;
+	int i;
+
+	base = cgbase(fs, c);
+	end = MIN(cgbase(fs, c + 1), fs->fs_size);
+	w->w_start = w->w_end = 0;
+	if (ufs_cursor_cgread(w->w_cur, c) == -1) {
+		cgp = w->w_cur->c_cg;
+		warnx("cg %d: %s", c, w->w_cur->c_error);
+		/* A bad check-hash alone still leaves a usable map. */
+		if (!cg_chkmagic(cgp) || cgp->cg_cgx != c) {
+			warnx("cg %d: copying all of it", c);
+			__atomic_fetch_add(&nerrors, 1, __ATOMIC_RELAXED);
+			addfrags(w, base, end);
+			copyrun(w, w->w_start, w->w_end);
+			return;
+		}
+	}
+	cgp = w->w_cur->c_cg;
+	freemap = cg_blksfree(cgp);
+	ilo = ihi = 0;
+	if (disk.d_ufs == 2) {
+		ilo = cgimin(fs, c) + howmany(MIN(cgp->cg_initediblk,
+		    fs->fs_ipg), INOPF(fs));
+		ihi = cgdmin(fs, c);
+	}
+	for (d = base; d < end; d++) {
+		i = d - base;
+		/* Eight free frags at once. */
+		if (i % NBBY == 0 && freemap[i / NBBY] == 0xff &&
+		    d + NBBY <= end) {
+			d += NBBY - 1;
+			continue;
+		}
+		if (isset(freemap, i) || (d >= ilo && d < ihi))
+			continue;
+		addfrags(w, d, d + 1);
+	}
+	if (w->w_end > w->w_start)
+		copyrun(w, w->w_start, w->w_end);
+}
+
+/*
+ * Add frags [start, end) to the run being built, copying the run first
+ * if they are too far from it or it would get too long.
+ */
+static void
+addfrags(struct worker *w, ufs2_daddr_t start, ufs2_daddr_t end)
+{
+	ufs2_daddr_t max;
+
+	max = IOCHUNK / fs->fs_fsize;
+	if (w->w_end > w->w_start &&
+	    (start - w->w_end) * fs->fs_fsize <= MAXGAP &&
+	    end - w->w_start <= max) {
+		w->w_end = end;
+		return;
+	}
+	if (w->w_end > w->w_start)
+		copyrun(w, w->w_start, w->w_end);
+	w->w_start = start;
+	w->w_end = end;
+	/* Only a whole group is added in one go; copy it a chunk at a time. */
+	while (w->w_end - w->w_start > max) {
+		copyrun(w, w->w_start, w->w_start + max);
+		w->w_start += max;
+	}
+}
+
+/*
+ * Copy frags [start, end). Into a fresh image, frags of zeros are left
+ * out, so that a sparse source, or one with space allocated but never
+ * written, gives a sparse clone.
+ */
+static void
+copyrun(struct worker *w, ufs2_daddr_t start, ufs2_daddr_t end)
+{
+	size_t len, off, next;
+	ssize_t cnt;
+
+	len = (size_t)(end - start) * fs->fs_fsize;
+	if ((cnt = ufs_cursor_bread(w->w_cur, fsbtodb(fs, start), w->w_buf,
+	    len)) != (ssize_t)len) {
+		warnx("frags %jd-%jd: %s", (intmax_t)start,
+		    (intmax_t)end - 1, cnt == -1 ? w->w_cur->c_error :
+		    "short read");
+		__atomic_fetch_add(&nerrors, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	__atomic_fetch_add(&copied, len, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&nruns, 1, __ATOMIC_RELAXED);
+	for (off = 0; off < len; off = next) {
+		next = len;
+		if (sparse) {
+			while (off < len && iszero(w->w_buf + off,
+			    fs->fs_fsize))
+				off += fs->fs_fsize;
+			for (next = off; next < len && !iszero(w->w_buf +
+			    next, fs->fs_fsize); next += fs->fs_fsize)
+				continue;
+		}
+		if (off < next)
+			writeout(w->w_buf + off, next - off,
+			    (off_t)start * fs->fs_fsize + off);
+	}
+}
+
+static void
+writeout(const char *buf, size_t len, off_t offset)
+{
+	ssize_t cnt;
+
+	__atomic_fetch_add(&written, len, __ATOMIC_RELAXED);
+	for (; len > 0; buf += cnt, len -= cnt, offset += cnt)
+		if ((cnt = pwrite(tfd, buf, len, offset)) <= 0)
+			err(1, "%s", tname);
+}
+
+static int
+iszero(const char *buf, size_t len)
+{
+	const uint64_t *p;
+	size_t i;
+
+	/* Runs are whole frags of an aligned buffer. */
+	p = (const uint64_t *)buf;
+	for (i = 0; i < len / sizeof(*p); i++)
+		if (p[i] != 0)
+			return (0);
+	return (1);
+}
+
+/*
+ * One line of progress report, rewritten in place on a terminal.
+ */
+static void
+progress(double secs, int tty)
+{
+	uint64_t done;
+	int cg;
+
+	done = __atomic_load_n(&copied, __ATOMIC_RELAXED);
+	cg = MIN(__atomic_load_n(&nextcg, __ATOMIC_RELAXED), fs->fs_ncg);
+	fprintf(stderr, "%s%ju MB copied, cg %d of %d, %.1f MB/s%s",
+	    tty ? "\r" : "", (uintmax_t)(done >> 20), cg, fs->fs_ncg,
+	    done / 1e6 / secs, tty ? "   " : "\n");
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: ufsclone [-dv] [-j threads] special | file target\n");
+	exit(1);
+}
@@ -0,0 +1,777 @@
+//
+//  ufsdefrag.c
+//  ufsdefrag
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Lay the files of a UFS file system that is not mounted out again, each
+// in as few runs of blocks as free space allows, the way ffs_reallocblks
+// tries to when a file is written but can't once it is on disk.
+//
+// A file's blocks come from ufs_file_extents() and are put in the order
+// a sequential read goes through them: data blocks by offset, each
+// indirect block just before the first block it maps, as FFS lays them
+// out. A file read in more than one run is given a new place: one free
+// run that holds all of it, found in the inode's cylinder group first,
+// or if no group has one, the longest runs there are, as long as that
+// takes fewer runs than the file has now. Extended attribute blocks stay
+// where they are.
+//
+// Free space is tracked here, one bit per free block, so that a dry run
+// (-n) decides the same moves as a real one without writing anything.
+// Moving a file is:
+//
+// 1. Take its new blocks with cgballoc_at(), which keeps the free map,
+//    cluster summary and counts of the cylinder group right.
+// 2. Copy the data, and write each indirect block to its new place with
+//    its pointers changed to the new blocks.
+// 3. Point the inode at the new blocks.
+// 4. Give the old blocks back with cgbfree().
+//
+// Cylinder groups are cached, so their check-hashes are computed once,
+// when they are written at the end.
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#define	IOCHUNK		(1024 * 1024)	/* most copied at once */
+#define	SEEKMS		8.0		/* disk the estimate is for: seek */
+#define	MBPS		150.0		/* and transfer rate */
+
+/* Some of a file's data blocks, or one of its indirect blocks. */
+struct piece {
+	int64_t		p_lbn;		/* first file block held or mapped */
+	ufs2_daddr_t	p_old;		/* where it is */
+	ufs2_daddr_t	p_new;		/* where it goes */
+	int64_t		p_nfrags;
+	int		p_indir;
+	int		p_seq;		/* order it was found in */
+};
+
+/* Free blocks taken for a file, in the order it fills them. */
+struct run {
+	int64_t		r_start;	/* block */
+	int64_t		r_len;
+};
+
+struct file {
+	struct piece	*f_pc;		/* in read order */
+	size_t		f_npc;
+	size_t		f_max;
+	struct run	*f_run;
+	size_t		f_nrun;
+	size_t		f_maxrun;
+	int		f_seq;
+};
+
+static struct uufsd disk;
+static struct fs *fs;
+static uint8_t *freemap;		/* one bit per block, set if free */
+static int64_t *cgmax;			/* longest free run, -1 if unknown */
+static int64_t *cgrotor;		/* where a search in a group starts */
+static caddr_t iobuf;
+static int nflag, vflag;
+static uint64_t nfiles, nfrag, nmoved, nstuck, nerrors;
+static uint64_t runsbefore, runsafter, fragbytes, movedbytes;
+
+static void loadmap(void);
+static void defrag(ino_t, struct file *);
+static int addpiece(void *, const struct ufs_extent *);
+static void order(struct file *);
+static int64_t countruns(const struct file *, int);
+static int place(struct file *, int, int64_t);
+static void assign(struct file *);
+static int64_t findrun(int, int64_t, int64_t *);
+static int64_t scan(int64_t, int64_t, int64_t, int64_t *, int64_t *);
+static void take(struct file *, int64_t, int64_t);
+static void giveback(struct file *);
+static int move(struct file *, ino_t);
+static void unclaim(const struct file *, int64_t);
+static int copy(ufs2_daddr_t, ufs2_daddr_t, int64_t);
+static int rewriteindir(const struct file *, const struct piece *);
+static ufs2_daddr_t newaddr(const struct file *, ufs2_daddr_t);
+static void freeold(const struct file *);
+static void report(void);
+static void usage(void);
+
+int
+main(int argc, char *argv[])
+{
+	struct file f;
+	uint8_t *used;
+	ino_t ino;
+	int ch, c, fflag, i, n;
+
+	fflag = 0;
+	while ((ch = getopt(argc, argv, "fnv")) != -1)
+		switch (ch) {
+		case 'f':
+			fflag = 1;
+			break;
+		case 'n':
+			nflag = 1;
+			break;
+		case 'v':
+			vflag = 1;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+
+	if (ufs_disk_fillout(&disk, argv[0]) == -1)
+		errx(1, "%s: %s", argv[0], disk.d_error);
+	fs = &disk.d_fs;
+	if (fs->fs_snapinum[0] != 0)
+		errx(1, "%s: has snapshots, which share blocks with files",
+		    argv[0]);
+	if (!fflag && (fs->fs_clean == 0 || (fs->fs_flags & FS_UNCLEAN)))
+		errx(1, "%s: not clean, check it first or use -f", argv[0]);
+	if (!nflag && ufs_disk_write(&disk) == -1)
+		errx(1, "%s: %s", argv[0], disk.d_error);
+	if (ufs_disk_cgcache(&disk, fs->fs_ncg) == -1 ||
+	    ufs_disk_inocache(&disk, 64) == -1)
+		errx(1, "%s: %s", argv[0], disk.d_error);
+	if ((iobuf = malloc(IOCHUNK)) == NULL ||
+	    (used = malloc(howmany(fs->fs_ipg, NBBY))) == NULL)
+		err(1, "malloc");
+	loadmap();
+
+	memset(&f, 0, sizeof(f));
+	for (c = 0; c < fs->fs_ncg; c++) {
+		if (cgread1(&disk, c) != 1) {
+			warnx("cg %d: %s; its files are left alone", c,
+			    disk.d_error);
+			nerrors++;
+			continue;
+		}
+		/* Moving files changes d_cg. */
+		memcpy(used, cg_inosused(&disk.d_cg),
+		    howmany(fs->fs_ipg, NBBY));
+		n = fs->fs_ipg;
+		if (disk.d_ufs == 2)
+			n = MIN(n, (int)disk.d_cg.cg_initediblk);
+		for (i = 0; i < n; i++) {
+			ino = (ino_t)c * fs->fs_ipg + i;
+			if (isset(used, i) && ino >= UFS_ROOTINO)
+				defrag(ino, &f);
+		}
+	}
+	free(f.f_pc);
+	free(f.f_run);
+
+	report();
+	if (!nflag && (ufs_disk_cgflush(&disk) == -1 ||
+	    ufs_disk_inosync(&disk) == -1 || sbwrite(&disk, 0) == -1))
+		errx(1, "%s: %s", argv[0], disk.d_error);
+	if (ufs_disk_close(&disk) == -1 && !nflag)
+		errx(1, "%s: %s", argv[0], disk.d_error);
+	return (nerrors == 0 ? 0 : 1);
+}
+
+/*
+ * Note the free blocks of every group.
+ */
+static void
+loadmap(void)
+{
+	u_char *blksfree;
+	int64_t b, base, end;
+	int c;
+
+	if ((freemap = calloc(howmany(howmany((uint64_t)fs->fs_size,
+	    fs->fs_frag), NBBY), 1)) == NULL ||
+	    (cgmax = calloc(fs->fs_ncg, sizeof(*cgmax))) == NULL ||
+	    (cgrotor = calloc(fs->fs_ncg, sizeof(*cgrotor))) == NULL)
+		err(1, "malloc");
+	for (c = 0; c < fs->fs_ncg; c++) {
+		cgmax[c] = -1;
+		cgrotor[c] = howmany(cgdmin(fs, c), fs->fs_frag);
+		/* A group that can't be read has nothing free here. */
+		if (cgread1(&disk, c) != 1)
+			continue;
+		blksfree = cg_blksfree(&disk.d_cg);
+		base = fragstoblks(fs, cgbase(fs, c));
+		end = fragstoblks(fs, MIN(cgbase(fs, c + 1), fs->fs_size));
+		for (b = cgrotor[c]; b < end; b++)
+			if (ffs_isblock(fs, blksfree, b - base))
+				setbit(freemap, b);
+	}
+}
+
+/*
+ * Move inode ino to fewer runs if it is in more than one.
+ */
+static void
+defrag(ino_t ino, struct file *f)
+{
+	union dinodep dp;
+	int64_t runs, nruns, bytes;
+	size_t i;
+
+	if (getinode(&disk, &dp, ino) == -1) {
+		warnx("inode %ju: %s", (uintmax_t)ino, disk.d_error);
+		nerrors++;
+		return;
+	}
+	f->f_npc = 0;
+	f->f_seq = 0;
+	if (ufs_file_extents(&disk, dp, UFS_EXTENTS_INDIR, addpiece, f) != 0) {
+		warnx("inode %ju: %s", (uintmax_t)ino, disk.d_error);
+		nerrors++;
+		return;
+	}
+	nfiles++;
+	order(f);
+	if ((runs = countruns(f, 0)) <= 1)
+		return;
+	for (bytes = 0, i = 0; i < f->f_npc; i++)
+		bytes += f->f_pc[i].p_nfrags * fs->fs_fsize;
+	nfrag++;
+	runsbefore += runs;
+	fragbytes += bytes;
+	if ((nruns = place(f, ino_to_cg(fs, ino), runs)) == 0) {
+		nstuck++;
+		runsafter += runs;
+		return;
+	}
+	if (!nflag && move(f, ino) == -1) {
+		giveback(f);
+		nerrors++;
+		runsafter += runs;
+		return;
+	}
+	if (vflag)
+		printf("inode %ju: %jd runs -> %jd\n", (uintmax_t)ino,
+		    (intmax_t)runs, (intmax_t)nruns);
+	freeold(f);
+	nmoved++;
+	runsafter += nruns;
+	movedbytes += bytes;
+}
+
+static int
+addpiece(void *arg, const struct ufs_extent *e)
+{
+	struct file *f;
+	struct piece *p;
+	size_t max;
+
+	f = arg;
+	if (e->ue_flags & UFS_EXTENT_EXTATTR)
+		return (0);
+	if (f->f_npc == f->f_max) {
+		max = f->f_max == 0 ? 64 : f->f_max * 2;
+		if ((p = realloc(f->f_pc, max * sizeof(*p))) == NULL)
+			err(1, "malloc");
+		f->f_pc = p;
+		f->f_max = max;
+	}
+	p = &f->f_pc[f->f_npc++];
+	p->p_lbn = e->ue_lbn;
+	p->p_old = e->ue_blkno;
+	p->p_new = 0;
+	p->p_nfrags = e->ue_nfrags;
+	p->p_indir = (e->ue_flags & UFS_EXTENT_INDIR) != 0;
+	p->p_seq = f->f_seq++;
+	return (0);
+}
+
+static int
+piececmp(const void *a, const void *b)
+{
+	const struct piece *pa, *pb;
+
+	pa = a;
+	pb = b;
+	if (pa->p_indir != pb->p_indir)
+		return (pb->p_indir - pa->p_indir);
+	if (pa->p_lbn != pb->p_lbn)
+		return (pa->p_lbn < pb->p_lbn ? -1 : 1);
+	return (pa->p_seq - pb->p_seq);
+}
+
+/*
+ * Put the pieces in the order a sequential read needs them: an indirect
+ * block, parents first, before the first data block it maps, cutting
+ * the data run that block falls in in two.
+ */
+static void
+order(struct file *f)
+{
+	struct piece *in, *out, d;
+	size_t nin, nd, i, j, n, max;
+	int64_t cut;
+
+	qsort(f->f_pc, f->f_npc, sizeof(*f->f_pc), piececmp);
+	for (nin = 0; nin < f->f_npc && f->f_pc[nin].p_indir; nin++)
+		continue;
+	if (nin == 0)
+		return;
+	nd = f->f_npc - nin;
+	/* Every indirect block cuts at most one run. */
+	max = f->f_npc + nin;
+	if ((in = malloc(f->f_npc * sizeof(*in))) == NULL ||
+	    (out = malloc(max * sizeof(*out))) == NULL)
+		err(1, "malloc");
+	memcpy(in, f->f_pc, f->f_npc * sizeof(*in));
+	n = 0;
+	for (i = 0, j = nin; i < nin || j < nin + nd;) {
+		if (i < nin && (j == nin + nd || in[i].p_lbn <= in[j].p_lbn)) {
+			out[n++] = in[i++];
+			continue;
+		}
+		d = in[j];
+		cut = i < nin ? in[i].p_lbn - d.p_lbn : INT64_MAX;
+		if (cut < howmany(d.p_nfrags, fs->fs_frag)) {
+			d.p_nfrags = cut * fs->fs_frag;
+			in[j].p_lbn += cut;
+			in[j].p_old += d.p_nfrags;
+			in[j].p_nfrags -= d.p_nfrags;
+		} else
+			j++;
+		out[n++] = d;
+	}
+	free(in);
+	free(f->f_pc);
+	f->f_pc = out;
+	f->f_npc = n;
+	f->f_max = max;
+}
+
+/*
+ * How many runs of data a read of the file, in order, makes of it where
+ * it is, or where it goes. An indirect block right where the data goes
+ * on is read through; one anywhere else is read on its own, as FreeBSD
+ * places them, and doesn't count.
+ */
+static int64_t
+countruns(const struct file *f, int new)
+{
+	const struct piece *p;
+	ufs2_daddr_t end, at;
+	int64_t runs;
+	size_t i;
+
+	runs = 0;
+	end = -1;
+	for (i = 0; i < f->f_npc; i++) {
+		p = &f->f_pc[i];
+		at = new ? p->p_new : p->p_old;
+		if (p->p_indir) {
+			if (at == end)
+				end += fs->fs_frag;
+			continue;
+		}
+		if (at != end)
+			runs++;
+		end = at + roundup(p->p_nfrags, fs->fs_frag);
+	}
+	return (runs);
+}
+
+/*
+ * Find the file a new place, in fewer than runs runs, starting with
+ * group pref. Returns how many runs it takes, or 0 if it can't have
+ * fewer.
+ */
+static int
+place(struct file *f, int pref, int64_t runs)
+{
+	int64_t need, got, start, len;
+	size_t i;
+	int c, n;
+
+	for (need = 0, i = 0; i < f->f_npc; i++)
+		need += howmany(f->f_pc[i].p_nfrags, fs->fs_frag);
+	f->f_nrun = 0;
+	for (n = 0; n < fs->fs_ncg; n++) {
+		c = (pref + n) % fs->fs_ncg;
+		if (cgmax[c] >= 0 && cgmax[c] < need)
+			continue;
+		if ((start = findrun(c, need, &len)) != -1 && len == need) {
+			take(f, start, need);
+			assign(f);
+			return (1);
+		}
+	}
+	/* Nothing holds it whole: the longest runs there are, then. */
+	for (got = 0, n = 0; got < need && n < fs->fs_ncg; n++) {
+		c = (pref + n) % fs->fs_ncg;
+		while (got < need && (int64_t)f->f_nrun + 1 < runs &&
+		    (start = findrun(c, need - got, &len)) != -1) {
+			take(f, start, len);
+			got += len;
+		}
+		if ((int64_t)f->f_nrun + 1 >= runs && got < need)
+			break;
+	}
+	if (got < need) {
+		giveback(f);
+		return (0);
+	}
+	assign(f);
+	return ((int)countruns(f, 1));
+}
+
+/*
+ * Give every piece its new place, in order, cutting those that straddle
+ * two runs in two.
+ */
+static void
+assign(struct file *f)
+{
+	struct piece *out, p;
+	int64_t left, nb;
+	size_t i, n, r, max;
+	ufs2_daddr_t at;
+
+	max = f->f_npc + f->f_nrun;
+	if ((out = malloc(max * sizeof(*out))) == NULL)
+		err(1, "malloc");
+	n = 0;
+	r = 0;
+	at = blkstofrags(fs, f->f_run[0].r_start);
+	left = f->f_run[0].r_len;
+	for (i = 0; i < f->f_npc;) {
+		if (left == 0) {
+			r++;
+			at = blkstofrags(fs, f->f_run[r].r_start);
+			left = f->f_run[r].r_len;
+		}
+		p = f->f_pc[i];
+		p.p_new = at;
+		nb = howmany(p.p_nfrags, fs->fs_frag);
+		if (nb > left) {
+			/* Only data runs are longer than a block. */
+			p.p_nfrags = left * fs->fs_frag;
+			f->f_pc[i].p_lbn += left;
+			f->f_pc[i].p_old += p.p_nfrags;
+			f->f_pc[i].p_nfrags -= p.p_nfrags;
+			nb = left;
+		} else
+			i++;
+		out[n++] = p;
+		at += blkstofrags(fs, nb);
+		left -= nb;
+	}
+	free(f->f_pc);
+	f->f_pc = out;
+	f->f_npc = n;
+	f->f_max = max;
+}
+
+/*
+ * The first run of want free blocks in group c, from where the last one
+ * taken ended, or if there isn't one the longest there is; its length
+ * is left in lenp. Returns -1 if the group has nothing free.
+ */
+static int64_t
+findrun(int c, int64_t want, int64_t *lenp)
+{
+	int64_t lo, hi, start, best, bestlen;
+
+	lo = howmany(cgdmin(fs, c), fs->fs_frag);
+	hi = fragstoblks(fs, MIN(cgbase(fs, c + 1), fs->fs_size));
+	best = -1;
+	bestlen = 0;
+	if ((start = scan(cgrotor[c], hi, want, &best, &bestlen)) != -1 ||
+	    (start = scan(lo, cgrotor[c], want, &best, &bestlen)) != -1) {
+		*lenp = want;
+		return (start);
+	}
+	/* The whole group was looked at. */
+	cgmax[c] = bestlen;
+	*lenp = bestlen;
+	return (best);
+}
+
+static int64_t
+scan(int64_t b, int64_t hi, int64_t want, int64_t *best, int64_t *bestlen)
+{
+	int64_t start;
+
+	while (b < hi) {
+		if (b % NBBY == 0 && freemap[b / NBBY] == 0) {
+			b += NBBY;
+			continue;
+		}
+		if (isclr(freemap, b)) {
+			b++;
+			continue;
+		}
+		for (start = b; b < hi && isset(freemap, b) &&
+		    b - start < want; b++)
+			continue;
+		if (b - start == want)
+			return (start);
+		if (b - start > *bestlen) {
+			*best = start;
+			*bestlen = b - start;
+		}
+	}
+	return (-1);
+}
+
+/* Take n free blocks from start on for f. */
+static void
+take(struct file *f, int64_t start, int64_t n)
+{
+	struct run *r;
+	size_t max;
+	int64_t b;
+	int c;
+
+	if (f->f_nrun == f->f_maxrun) {
+		max = f->f_maxrun == 0 ? 16 : f->f_maxrun * 2;
+		if ((r = realloc(f->f_run, max * sizeof(*r))) == NULL)
+			err(1, "malloc");
+		f->f_run = r;
+		f->f_maxrun = max;
+	}
+	f->f_run[f->f_nrun].r_start = start;
+	f->f_run[f->f_nrun].r_len = n;
+	f->f_nrun++;
+	for (b = start; b < start + n; b++)
+		clrbit(freemap, b);
+	c = dtog(fs, blkstofrags(fs, start));
+	cgrotor[c] = start + n;
+}
+
+/* Put back the blocks taken for f. */
+static void
+giveback(struct file *f)
+{
+	int64_t b;
+	size_t i;
+
+	for (i = 0; i < f->f_nrun; i++) {
+		for (b = f->f_run[i].r_start;
+		    b < f->f_run[i].r_start + f->f_run[i].r_len; b++)
+			setbit(freemap, b);
+		cgmax[dtog(fs, blkstofrags(fs, f->f_run[i].r_start))] = -1;
+	}
+	f->f_nrun = 0;
+}
+
+/*
+ * Move file ino to the blocks place() found it. Returns -1, with the
+ * file where it was and the new blocks given back, if it can't be.
+ */
+static int
+move(struct file *f, ino_t ino)
+{
+	union dinodep dp;
+	struct piece *p;
+	ufs2_daddr_t d;
+	size_t i, r;
+	int64_t b, n, rem;
+
+	/* 1. */
+	for (n = 0, r = 0; r < f->f_nrun; r++)
+		for (b = 0; b < f->f_run[r].r_len; b++, n++) {
+			d = blkstofrags(fs, f->f_run[r].r_start + b);
+			if (cgballoc_at(&disk, d) == -1) {
+				warnx("inode %ju: %s", (uintmax_t)ino,
+				    disk.d_error);
+				unclaim(f, n);
+				return (-1);
+			}
+		}
+	/* 2. */
+	for (i = 0; i < f->f_npc; i++) {
+		p = &f->f_pc[i];
+		if ((p->p_indir ? rewriteindir(f, p) :
+		    copy(p->p_old, p->p_new, p->p_nfrags)) == -1) {
+			warnx("inode %ju: %s", (uintmax_t)ino, disk.d_error);
+			goto release;
+		}
+	}
+	/* 3. */
+	if (getinode(&disk, &dp, ino) == -1) {
+		warnx("inode %ju: %s", (uintmax_t)ino, disk.d_error);
+		goto release;
+	}
+	for (i = 0; i < UFS_NDADDR; i++)
+		if (disk.d_ufs == 1)
+			dp.dp1->di_db[i] = newaddr(f, dp.dp1->di_db[i]);
+		else
+			dp.dp2->di_db[i] = newaddr(f, dp.dp2->di_db[i]);
+	for (i = 0; i < UFS_NIADDR; i++)
+		if (disk.d_ufs == 1)
+			dp.dp1->di_ib[i] = newaddr(f, dp.dp1->di_ib[i]);
+		else
+			dp.dp2->di_ib[i] = newaddr(f, dp.dp2->di_ib[i]);
+	if (putinode(&disk) == -1) {
+		warnx("inode %ju: %s", (uintmax_t)ino, disk.d_error);
+		goto release;
+	}
+	/* 4. A fragment only needed part of the block it was given. */
+	for (i = 0; i < f->f_npc; i++) {
+		p = &f->f_pc[i];
+		if ((rem = p->p_nfrags % fs->fs_frag) != 0)
+			cgbfree(&disk, p->p_new + p->p_nfrags,
+			    (fs->fs_frag - rem) * fs->fs_fsize);
+		for (d = p->p_old; d < p->p_old + p->p_nfrags; d += b) {
+			b = MIN(fs->fs_frag - fragnum(fs, d),
+			    p->p_old + p->p_nfrags - d);
+			cgbfree(&disk, d, b * fs->fs_fsize);
+		}
+	}
+	return (0);
+
+release:
+	unclaim(f, n);
+	return (-1);
+}
+
+/* Give back the first n blocks move() took for f. */
+static void
+unclaim(const struct file *f, int64_t n)
+{
+	size_t r;
+	int64_t b;
+
+	for (r = 0; r < f->f_nrun && n > 0; r++)
+		for (b = 0; b < f->f_run[r].r_len && n > 0; b++, n--)
+			cgbfree(&disk, blkstofrags(fs, f->f_run[r].r_start + b),
+			    fs->fs_bsize);
+}
+
+static int
+copy(ufs2_daddr_t from, ufs2_daddr_t to, int64_t nfrags)
+{
+	size_t len;
+	int64_t n;
+
+	for (; nfrags > 0; nfrags -= n, from += n, to += n) {
+		n = MIN(nfrags, IOCHUNK / fs->fs_fsize);
+		len = (size_t)n * fs->fs_fsize;
+		if (bread(&disk, fsbtodb(fs, from), iobuf, len) == -1 ||
+		    bwrite(&disk, fsbtodb(fs, to), iobuf, len) != (ssize_t)len)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Write indirect block p to its new place, pointing at the new places of
+ * the blocks it maps.
+ */
+static int
+rewriteindir(const struct file *f, const struct piece *p)
+{
+	int i;
+
+	if (bread(&disk, fsbtodb(fs, p->p_old), iobuf, fs->fs_bsize) == -1)
+		return (-1);
+	for (i = 0; i < NINDIR(fs); i++)
+		if (disk.d_ufs == 1)
+			((ufs1_daddr_t *)iobuf)[i] =
+			    newaddr(f, ((ufs1_daddr_t *)iobuf)[i]);
+		else
+			((ufs2_daddr_t *)iobuf)[i] =
+			    newaddr(f, ((ufs2_daddr_t *)iobuf)[i]);
+	if (bwrite(&disk, fsbtodb(fs, p->p_new), iobuf, fs->fs_bsize) !=
+	    fs->fs_bsize)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Where the block at d goes. The pointers in the inode and in each
+ * indirect block come in the order the pieces are in, so the search
+ * starts where the last one ended.
+ */
+static ufs2_daddr_t
+newaddr(const struct file *f, ufs2_daddr_t d)
+{
+	static size_t last;
+	const struct piece *p;
+	size_t i, n;
+
+	if (d == 0)
+		return (0);
+	for (n = 0, i = last; n < f->f_npc; n++, i++) {
+		if (i >= f->f_npc)
+			i = 0;
+		p = &f->f_pc[i];
+		if (d >= p->p_old && d < p->p_old + p->p_nfrags) {
+			last = i;
+			return (p->p_new + (d - p->p_old));
+		}
+	}
+	return (d);
+}
+
+/* The old blocks of f are free now, for the next file. */
+static void
+freeold(const struct file *f)
+{
+	const struct piece *p;
+	ufs2_daddr_t d;
+	size_t i;
+
+	for (i = 0; i < f->f_npc; i++) {
+		p = &f->f_pc[i];
+		for (d = roundup(p->p_old, fs->fs_frag);
+		    d + fs->fs_frag <= p->p_old + p->p_nfrags; d += fs->fs_frag)
+			setbit(freemap, fragstoblks(fs, d));
+		cgmax[dtog(fs, p->p_old)] = -1;
+	}
+}
+
+/* Seconds to read the fragmented files on the disk SEEKMS and MBPS are. */
+static double
+readtime(uint64_t runs)
+{
+
+	return (runs * SEEKMS / 1000 + fragbytes / (MBPS * 1024 * 1024));
+}
+
+static void
+report(void)
+{
+
+	printf("%ju files, %ju in more than one run\n", (uintmax_t)nfiles,
+	    (uintmax_t)nfrag);
+	printf("%ju %s (%ju MB), %ju can't have fewer runs\n",
+	    (uintmax_t)nmoved, nflag ? "would be moved" : "moved",
+	    (uintmax_t)(movedbytes >> 20), (uintmax_t)nstuck);
+	if (nfrag == 0)
+		return;
+	printf("runs %ju -> %ju; reading them takes %.1fs -> %.1fs (%.1fx) "
+	    "at %.0f ms a seek, %.0f MB/s\n", (uintmax_t)runsbefore,
+	    (uintmax_t)runsafter, readtime(runsbefore), readtime(runsafter),
+	    readtime(runsbefore) / readtime(runsafter), SEEKMS, MBPS);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: ufsdefrag [-fnv] special | file\n");
+	exit(1);
+}
@@ -0,0 +1,880 @@
+//
+//  ufslayout.c
+//  ufslayout
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// How the files and free space of a UFS file system are laid out, for
+// choosing block size, fragment size and the allocator's tunables from
+// what a workload actually writes. Read only; one pass, a pool of
+// threads taking cylinder groups off a shared counter as in ufscheck,
+// every thread reading through its own libufs cursor and adding up into
+// its own counts, which are summed at the end.
+//
+// For each group:
+//
+// - Free space: how full the group is, the free map's runs of whole
+//   blocks, and the group's own summaries of free fragments (cg_frsum)
+//   and free clusters (cg_clustersum).
+// - The inode table, read IOCHUNK at a time. Regular files are mapped
+//   with ufs_cursor_file_extents(): size, runs, tail fragments, slack
+//   past the end and whether the data starts in the inode's group.
+//   Directories are read for where their entries' inodes are.
+//
+// A run is counted the way ufsdefrag(8) counts it: data blocks that a
+// sequential read of the file goes through without a seek, reading
+// through indirect blocks laid out just before the data they map.
+//
+// Counts that vary over a wide range are kept as histograms by powers
+// of two. Only metadata, indirect blocks and directories are read.
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <ufs/ufs/dinode.h>
+#include <ufs/ufs/dir.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#define	MAXWORKERS	256
+#define	IOCHUNK		(512 * 1024)	/* inode table and directory reads */
+#define	NBUCKET		65		/* 0, then one per bit of a uint64_t */
+#define	NRECENT		8		/* indirect blocks kept per file */
+#define	NFILL		11		/* groups by tenths full */
+#define	BARWIDTH	40
+
+/* Histogram: h[0] counts 0, h[k] counts [2^(k-1), 2^k). */
+#define	HADD(h, v)	((h)[bucket(v)]++)
+
+/* What one thread found, added up at the end. */
+struct stats {
+	uint64_t	st_inodes;		/* in use */
+	uint64_t	st_files;		/* regular files */
+	uint64_t	st_dirs;
+	uint64_t	st_links;		/* symbolic links */
+	uint64_t	st_other;
+	uint64_t	st_bytes;		/* file sizes */
+	uint64_t	st_frags;		/* file data */
+	uint64_t	st_slack;		/* bytes allocated past EOF */
+	uint64_t	st_indir;		/* indirect blocks, any inode */
+	uint64_t	st_extfrags;		/* extended attribute data */
+	uint64_t	st_withdata;		/* files with a block */
+	uint64_t	st_runs;
+	uint64_t	st_fragmented;		/* files in more than one run */
+	uint64_t	st_incg;		/* starting in the inode's cg */
+	uint64_t	st_tails;		/* ending in a partial block */
+	uint64_t	st_tailfrags;
+	uint64_t	st_tail[MAXFRAG];	/* by frags in the tail */
+	uint64_t	st_size[NBUCKET];	/* file size, bytes */
+	uint64_t	st_nruns[NBUCKET];	/* runs per file */
+	uint64_t	st_runlen[NBUCKET];	/* run length, bytes */
+	uint64_t	st_entries;		/* directory entries */
+	uint64_t	st_fdist[NBUCKET];	/* groups from dir to file */
+	uint64_t	st_ddist[NBUCKET];	/* to subdirectory */
+	uint64_t	st_freerun[NBUCKET];	/* free runs, blocks */
+	uint64_t	st_frsum[MAXFRAG];	/* cg_frsum */
+	uint64_t	st_clsum[FS_MAXCONTIG + 1]; /* cg_clustersum */
+	uint64_t	st_fill[NFILL];		/* groups by tenths full */
+	uint64_t	st_read;		/* bytes read */
+	uint64_t	st_errors;
+};
+
+/* One group, for -c. */
+struct cginfo {
+	int32_t		ci_nbfree;
+	int32_t		ci_nffree;
+	int32_t		ci_nifree;
+	int32_t		ci_ndir;
+	int32_t		ci_maxrun;		/* longest free run, blocks */
+	int		ci_fill;		/* percent full */
+	int		ci_bad;			/* couldn't be read */
+};
+
+struct worker {
+	pthread_t	w_thread;
+	struct uufsd_cursor *w_cur;
+	caddr_t		w_ibuf;			/* inode table chunk */
+	caddr_t		w_dbuf;			/* directory data */
+	struct stats	w_st;
+};
+
+/* The file being mapped. */
+struct file {
+	struct worker	*f_w;
+	ino_t		f_ino;
+	int		f_isdir;
+	uint64_t	f_size;
+	int64_t		f_runs;
+	int64_t		f_frags;
+	int64_t		f_runfrags;		/* in the run being read */
+	ufs2_daddr_t	f_first;		/* first data frag */
+	ufs2_daddr_t	f_next;			/* where that run goes on */
+	ufs2_daddr_t	f_ind[NRECENT];		/* last indirect blocks */
+	int		f_nind;
+};
+
+static struct uufsd disk;
+static struct fs *fs;
+static struct cginfo *cgs;
+static int nextcg;
+
+static uint64_t analyze(int, int, int);
+static void *scan(void *);
+static void scan_cg(struct worker *, int);
+static void scan_free(struct worker *, struct cg *, int);
+static void scan_inode(struct worker *, ino_t, union dinodep);
+static int onextent(void *, const struct ufs_extent *);
+static int continues(const struct file *, ufs2_daddr_t);
+static int scan_dir(struct file *, const struct ufs_extent *);
+static void addstats(struct stats *, const struct stats *);
+static int bucket(uint64_t);
+static uint64_t hsum(const uint64_t *);
+static void printtext(const struct stats *, int, double, int);
+static void printhist(const char *, const uint64_t *, int);
+static void printrow(const char *, uint64_t, uint64_t);
+static void printarray(const char *, const uint64_t *, int, int, int,
+    const char *);
+static void printjson(const struct stats *, int, double, int);
+static void jsonhist(const char *, const uint64_t *, const char *);
+static void jsonarray(const char *, const uint64_t *, int, int,
+    const char *);
+static const char *human(uint64_t);
+static double pct(uint64_t, uint64_t);
+static double now(void);
+static void usage(void);
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t nerrors;
+	long nthreads;
+	int ch, direct, json, percg;
+
+	direct = json = percg = 0;
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((ch = getopt(argc, argv, "cdj:J")) != -1)
+		switch (ch) {
+		case 'c':
+			percg = 1;
+			break;
+		case 'd':
+			direct = 1;
+			break;
+		case 'j':
+			nthreads = strtol(optarg, NULL, 10);
+			if (nthreads < 1 || nthreads > MAXWORKERS)
+				errx(1, "%s: bad number of threads", optarg);
+			break;
+		case 'J':
+			json = 1;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if ((direct ? ufs_disk_fillout_direct(&disk, argv[0]) :
+	    ufs_disk_fillout(&disk, argv[0])) == -1)
+		errx(1, "%s: %s", argv[0], disk.d_error);
+	fs = &disk.d_fs;
+	nerrors = analyze((int)MIN(nthreads, fs->fs_ncg), json, percg);
+	ufs_disk_close(&disk);
+	return (nerrors == 0 ? 0 : 1);
+}
+
+/*
+ * Scan the file system with nthreads threads and print what they found.
+ * Returns the number of errors.
+ */
+static uint64_t
+analyze(int nthreads, int json, int percg)
+{
+	struct worker *workers, *w;
+	struct stats total;
+	double t0, t1;
+	long pgsz;
+	int i;
+
+	if ((workers = calloc(nthreads, sizeof(*workers))) == NULL ||
+	    (cgs = calloc(fs->fs_ncg, sizeof(*cgs))) == NULL)
+		err(1, "malloc");
+	/* Page aligned, so direct I/O needn't bounce them. */
+	pgsz = sysconf(_SC_PAGESIZE);
+	for (i = 0; i < nthreads; i++) {
+		w = &workers[i];
+		if ((w->w_cur = ufs_cursor_open(&disk)) == NULL)
+			errx(1, "%s", disk.d_error);
+		if (posix_memalign((void **)&w->w_ibuf, pgsz, IOCHUNK) != 0 ||
+		    posix_memalign((void **)&w->w_dbuf, pgsz, IOCHUNK) != 0)
+			err(1, "malloc");
+	}
+
+	t0 = now();
+	for (i = 0; i < nthreads; i++)
+		if ((errno = pthread_create(&workers[i].w_thread, NULL, scan,
+		    &workers[i])) != 0)
+			err(1, "pthread_create");
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].w_thread, NULL);
+	t1 = now();
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nthreads; i++) {
+		w = &workers[i];
+		addstats(&total, &w->w_st);
+		ufs_cursor_close(w->w_cur);
+		free(w->w_ibuf);
+		free(w->w_dbuf);
+	}
+	if (json)
+		printjson(&total, percg, t1 - t0, nthreads);
+	else
+		printtext(&total, percg, t1 - t0, nthreads);
+	free(workers);
+	free(cgs);
+	return (total.st_errors);
+}
+
+static void *
+scan(void *arg)
+{
+	struct worker *w;
+	int c;
+
+	w = arg;
+	while ((c = __atomic_fetch_add(&nextcg, 1, __ATOMIC_RELAXED)) <
+	    fs->fs_ncg)
+		scan_cg(w, c);
+	return (NULL);
+}
+
+/*
+ * Free space of group c, then its inodes. A group that can't be read
+ * has its inode table read whole, since cg_initediblk isn't known.
+ */
+static void
+scan_cg(struct worker *w, int c)
+{
+	struct cg *cgp;
+	union dinodep dp;
+	caddr_t ip;
+	ino_t base;
+	int i, k, n, ninodes, isize;
+
+	cgp = w->w_cur->c_cg;
+	if (ufs_cursor_cgread(w->w_cur, c) == -1) {
+		warnx("cg %d: %s", c, w->w_cur->c_error);
+		w->w_st.st_errors++;
+		/* A bad check-hash alone still leaves a usable group. */
+		if (!cg_chkmagic(cgp) || cgp->cg_cgx != c)
+			cgs[c].ci_bad = 1;
+	}
+	w->w_st.st_read += fs->fs_cgsize;
+	if (!cgs[c].ci_bad)
+		scan_free(w, cgp, c);
+
+	/* UFS2 inodes past cg_initediblk were never written. */
+	ninodes = fs->fs_ipg;
+	if (disk.d_ufs == 2 && !cgs[c].ci_bad)
+		ninodes = MIN(cgp->cg_initediblk, fs->fs_ipg);
+	isize = disk.d_ufs == 1 ? sizeof(struct ufs1_dinode) :
+	    sizeof(struct ufs2_dinode);
+	base = (ino_t)c * fs->fs_ipg;
+	for (i = 0; i < ninodes; i += n) {
+		n = MIN(ninodes - i, IOCHUNK / isize);
+		if (ufs_cursor_bread(w->w_cur, fsbtodb(fs, cgimin(fs, c) +
+		    i / INOPF(fs)), w->w_ibuf, roundup(n * isize,
+		    fs->fs_fsize)) == -1) {
+			warnx("cg %d: inodes %ju-%ju: %s", c,
+			    (uintmax_t)(base + i),
+			    (uintmax_t)(base + i + n - 1), w->w_cur->c_error);
+			w->w_st.st_errors++;
+			continue;
+		}
+		w->w_st.st_read += roundup(n * isize, fs->fs_fsize);
+		for (k = 0, ip = w->w_ibuf; k < n; k++, ip += isize) {
+			dp.dp1 = (struct ufs1_dinode *)ip;
+			if (base + i + k >= UFS_ROOTINO &&
+			    (disk.d_ufs == 1 ? dp.dp1->di_mode :
+			    dp.dp2->di_mode) != 0)
+				scan_inode(w, base + i + k, dp);
+		}
+	}
+}
+
+/*
+ * How full group c is, and how its free space is broken up.
+ */
+static void
+scan_free(struct worker *w, struct cg *cgp, int c)
+{
+	struct stats *st;
+	struct cginfo *ci;
+	u_char *blksfree;
+	int64_t cap, used;
+	int32_t b, nblks, run;
+	int i;
+
+	st = &w->w_st;
+	ci = &cgs[c];
+	ci->ci_nbfree = cgp->cg_cs.cs_nbfree;
+	ci->ci_nffree = cgp->cg_cs.cs_nffree;
+	ci->ci_nifree = cgp->cg_cs.cs_nifree;
+	ci->ci_ndir = cgp->cg_cs.cs_ndir;
+	/* What the group has for data, less its own metadata. */
+	cap = cgp->cg_ndblk - (cgdmin(fs, c) - cgbase(fs, c));
+	used = cap - ((int64_t)ci->ci_nbfree * fs->fs_frag + ci->ci_nffree);
+	ci->ci_fill = cap > 0 ? (int)(MAX(used, 0) * 100 / cap) : 100;
+	st->st_fill[MIN(ci->ci_fill / 10, NFILL - 1)]++;
+
+	blksfree = cg_blksfree(cgp);
+	nblks = cgp->cg_ndblk / fs->fs_frag;
+	for (run = 0, b = 0; b <= nblks; b++) {
+		if (b < nblks && ffs_isblock(fs, blksfree, b)) {
+			run++;
+			continue;
+		}
+		if (run > 0) {
+			HADD(st->st_freerun, (uint64_t)run);
+			ci->ci_maxrun = MAX(ci->ci_maxrun, run);
+		}
+		run = 0;
+	}
+	for (i = 1; i < fs->fs_frag; i++)
+		st->st_frsum[i] += cgp->cg_frsum[i];
+	for (i = 1; i <= fs->fs_contigsumsize; i++)
+		st->st_clsum[i] += cg_clustersum(cgp)[i];
+}
+
+static void
+scan_inode(struct worker *w, ino_t ino, union dinodep dp)
+{
+	struct stats *st;
+	struct file f;
+	ufs2_daddr_t lastbn;
+	int64_t lbn, nf, alloc;
+	int mode, ret;
+
+	st = &w->w_st;
+	st->st_inodes++;
+	memset(&f, 0, sizeof(f));
+	f.f_w = w;
+	f.f_ino = ino;
+	f.f_first = -1;
+	if (disk.d_ufs == 1) {
+		mode = dp.dp1->di_mode;
+		f.f_size = dp.dp1->di_size;
+	} else {
+		mode = dp.dp2->di_mode;
+		f.f_size = dp.dp2->di_size;
+	}
+	switch (mode & IFMT) {
+	case IFREG:
+		st->st_files++;
+		break;
+	case IFDIR:
+		st->st_dirs++;
+		f.f_isdir = 1;
+		break;
+	case IFLNK:
+		st->st_links++;
+		break;
+	default:
+		st->st_other++;
+		return;
+	}
+	if ((ret = ufs_cursor_file_extents(w->w_cur, dp, UFS_EXTENTS_INDIR,
+	    onextent, &f)) != 0) {
+		if (ret == -1) {
+			warnx("inode %ju: %s", (uintmax_t)ino,
+			    w->w_cur->c_error);
+			st->st_errors++;
+		}
+		return;
+	}
+	if ((mode & IFMT) != IFREG)
+		return;
+
+	st->st_bytes += f.f_size;
+	HADD(st->st_size, f.f_size);
+	st->st_frags += f.f_frags;
+	alloc = f.f_frags * fs->fs_fsize;
+	if (alloc > (int64_t)f.f_size)
+		st->st_slack += alloc - f.f_size;
+	if (f.f_runs > 0) {
+		st->st_withdata++;
+		st->st_runs += f.f_runs;
+		HADD(st->st_nruns, (uint64_t)f.f_runs);
+		HADD(st->st_runlen, (uint64_t)f.f_runfrags * fs->fs_fsize);
+		if (f.f_runs > 1)
+			st->st_fragmented++;
+		if (dtog(fs, f.f_first) == ino_to_cg(fs, ino))
+			st->st_incg++;
+	}
+	/* Only a direct block at the end can be short. */
+	if (f.f_size == 0 || (lbn = lblkno(fs, f.f_size - 1)) >= UFS_NDADDR)
+		return;
+	lastbn = disk.d_ufs == 1 ? dp.dp1->di_db[lbn] : dp.dp2->di_db[lbn];
+	nf = numfrags(fs, sblksize(fs, (int64_t)f.f_size, lbn));
+	if (lastbn != 0 && nf < fs->fs_frag) {
+		st->st_tails++;
+		st->st_tailfrags += nf;
+		st->st_tail[nf]++;
+	}
+}
+
+static int
+onextent(void *arg, const struct ufs_extent *e)
+{
+	struct stats *st;
+	struct file *f;
+
+	f = arg;
+	st = &f->f_w->w_st;
+	if (e->ue_flags & UFS_EXTENT_EXTATTR) {
+		st->st_extfrags += e->ue_nfrags;
+		return (0);
+	}
+	if (e->ue_flags & UFS_EXTENT_INDIR) {
+		st->st_indir++;
+		st->st_read += fs->fs_bsize;
+		f->f_ind[f->f_nind++ % NRECENT] = e->ue_blkno;
+		return (0);
+	}
+	/* A directory that can't be read has been reported; stop. */
+	if (f->f_isdir)
+		return (scan_dir(f, e) == -1 ? 1 : 0);
+	if (f->f_runs == 0) {
+		f->f_first = e->ue_blkno;
+		f->f_runs = 1;
+	} else if (!continues(f, e->ue_blkno)) {
+		HADD(st->st_runlen, (uint64_t)f->f_runfrags * fs->fs_fsize);
+		f->f_runfrags = 0;
+		f->f_runs++;
+	}
+	f->f_frags += e->ue_nfrags;
+	f->f_runfrags += e->ue_nfrags;
+	f->f_next = e->ue_blkno + e->ue_nfrags;
+	return (0);
+}
+
+/*
+ * Whether the run that ended at f_next goes on at blkno, past no more
+ * than one indirect block of each level.
+ */
+static int
+continues(const struct file *f, ufs2_daddr_t blkno)
+{
+	ufs2_daddr_t next;
+	int i, n, level;
+
+	next = f->f_next;
+	n = MIN(f->f_nind, NRECENT);
+	for (level = 0; level <= UFS_NIADDR; level++) {
+		if (next == blkno)
+			return (1);
+		for (i = 0; i < n && f->f_ind[i] != next; i++)
+			continue;
+		if (i == n)
+			return (0);
+		next += fs->fs_frag;
+	}
+	return (0);
+}
+
+/*
+ * Where the entries in extent e of a directory are, against the group
+ * of the directory itself.
+ */
+static int
+scan_dir(struct file *f, const struct ufs_extent *e)
+{
+	struct stats *st;
+	struct direct *dp;
+	uint64_t off, len, end;
+	size_t blkend, chunk, loc;
+	int cg, dist;
+
+	st = &f->f_w->w_st;
+	cg = ino_to_cg(fs, f->f_ino);
+	end = MIN((uint64_t)e->ue_nfrags * fs->fs_fsize,
+	    f->f_size - (uint64_t)e->ue_lbn * fs->fs_bsize);
+	for (off = 0; off < end; off += len) {
+		len = MIN(end - off, IOCHUNK);
+		chunk = roundup(len, fs->fs_fsize);
+		if (ufs_cursor_bread(f->f_w->w_cur, fsbtodb(fs, e->ue_blkno +
+		    numfrags(fs, off)), f->f_w->w_dbuf, chunk) == -1) {
+			warnx("inode %ju: %s", (uintmax_t)f->f_ino,
+			    f->f_w->w_cur->c_error);
+			st->st_errors++;
+			return (-1);
+		}
+		st->st_read += chunk;
+		for (loc = 0; loc + DIRECTSIZ(0) <= len; ) {
+			dp = (struct direct *)(f->f_w->w_dbuf + loc);
+			/* A bad record length ends its DIRBLKSIZ chunk. */
+			blkend = MIN(roundup(loc + 1, DIRBLKSIZ), len);
+			if (dp->d_reclen < DIRSIZ(0, dp) ||
+			    loc + dp->d_reclen > blkend ||
+			    (dp->d_reclen & 0x3) != 0) {
+				loc = blkend;
+				continue;
+			}
+			loc += dp->d_reclen;
+			if (dp->d_ino == 0 || dp->d_ino >=
+			    (ino_t)fs->fs_ipg * fs->fs_ncg ||
+			    (dp->d_name[0] == '.' && (dp->d_namlen == 1 ||
+			    (dp->d_namlen == 2 && dp->d_name[1] == '.'))))
+				continue;
+			st->st_entries++;
+			dist = abs((int)ino_to_cg(fs, dp->d_ino) - cg);
+			if (dp->d_type == DT_DIR)
+				HADD(st->st_ddist, (uint64_t)dist);
+			else
+				HADD(st->st_fdist, (uint64_t)dist);
+		}
+	}
+	return (0);
+}
+
+static void
+addstats(struct stats *to, const struct stats *from)
+{
+	const uint64_t *s;
+	uint64_t *d;
+	size_t i;
+
+	/* Nothing but counters. */
+	d = (uint64_t *)to;
+	s = (const uint64_t *)from;
+	for (i = 0; i < sizeof(*to) / sizeof(uint64_t); i++)
+		d[i] += s[i];
+}
+
+static int
+bucket(uint64_t v)
+{
+
+	return (v == 0 ? 0 : 64 - __builtin_clzll(v));
+}
+
+static uint64_t
+hsum(const uint64_t *h)
+{
+	uint64_t n;
+	int i;
+
+	for (n = 0, i = 0; i < NBUCKET; i++)
+		n += h[i];
+	return (n);
+}
+
+static void
+printtext(const struct stats *st, int percg, double secs, int nthreads)
+{
+	uint64_t total, nfree;
+	int c;
+
+	total = (uint64_t)fs->fs_dsize * fs->fs_fsize;
+	nfree = ((uint64_t)fs->fs_cstotal.cs_nbfree * fs->fs_frag +
+	    fs->fs_cstotal.cs_nffree) * fs->fs_fsize;
+	printf("%s: UFS%d, %s, block %d, fragment %d, %d groups of %s, "
+	    "%.1f%% full\n", disk.d_name, disk.d_ufs, human(total),
+	    fs->fs_bsize, fs->fs_fsize, fs->fs_ncg,
+	    human((uint64_t)fs->fs_fpg * fs->fs_fsize),
+	    100 - pct(nfree, total));
+	printf("inodes: %ju in use: %ju files, %ju directories, "
+	    "%ju symbolic links, %ju other\n", (uintmax_t)st->st_inodes,
+	    (uintmax_t)st->st_files, (uintmax_t)st->st_dirs,
+	    (uintmax_t)st->st_links, (uintmax_t)st->st_other);
+	printf("files: %s, %s on average (avgfilesize %d), %s allocated, "
+	    "%s of it past EOF\n", human(st->st_bytes),
+	    human(st->st_files ? st->st_bytes / st->st_files : 0),
+	    fs->fs_avgfilesize, human(st->st_frags * fs->fs_fsize),
+	    human(st->st_slack));
+	printf("runs: %ju, %.2f a file with data; %ju files (%.1f%%) in "
+	    "more than one\n", (uintmax_t)st->st_runs, st->st_withdata ?
+	    (double)st->st_runs / st->st_withdata : 0,
+	    (uintmax_t)st->st_fragmented,
+	    pct(st->st_fragmented, st->st_withdata));
+	printf("placement: %.1f%% of files start in their inode's group; "
+	    "%ju indirect blocks, %s of extended attributes\n",
+	    pct(st->st_incg, st->st_withdata), (uintmax_t)st->st_indir,
+	    human(st->st_extfrags * fs->fs_fsize));
+	printf("tails: %ju files (%.1f%%) end in a fragment, %ju frags, "
+	    "%.2f a file\n", (uintmax_t)st->st_tails,
+	    pct(st->st_tails, st->st_files), (uintmax_t)st->st_tailfrags,
+	    st->st_tails ? (double)st->st_tailfrags / st->st_tails : 0);
+	printf("directories: %ju entries, %.1f a directory (avgfpdir %d); "
+	    "in the directory's group: %.1f%% of files, %.1f%% of "
+	    "subdirectories\n", (uintmax_t)st->st_entries,
+	    st->st_dirs ? (double)st->st_entries / st->st_dirs : 0,
+	    fs->fs_avgfpdir, pct(st->st_fdist[0], hsum(st->st_fdist)),
+	    pct(st->st_ddist[0], hsum(st->st_ddist)));
+	printf("%.3fs, %s read, %d thread%s, %ju error%s\n", secs,
+	    human(st->st_read), nthreads, nthreads == 1 ? "" : "s",
+	    (uintmax_t)st->st_errors, st->st_errors == 1 ? "" : "s");
+
+	printhist("file size, bytes", st->st_size, 1);
+	printhist("runs per file", st->st_nruns, 0);
+	printhist("run length, bytes", st->st_runlen, 1);
+	printarray("frags in a tail", st->st_tail, 1, fs->fs_frag - 1, 1,
+	    "");
+	printhist("groups from directory to file", st->st_fdist, 0);
+	printhist("groups from directory to subdirectory", st->st_ddist, 0);
+	printarray("groups by percent full", st->st_fill, 0, NFILL - 1, 10,
+	    "");
+	printhist("free runs, blocks", st->st_freerun, 0);
+	printarray("free fragment runs (cg_frsum)", st->st_frsum, 1,
+	    fs->fs_frag - 1, 1, "");
+	if (fs->fs_contigsumsize > 0)
+		printarray("free clusters (cg_clustersum)", st->st_clsum, 1,
+		    fs->fs_contigsumsize, 1, "+");
+	if (!percg)
+		return;
+	printf("\n%6s %5s %10s %10s %10s %8s %10s\n", "cg", "full", "bfree",
+	    "ffree", "ifree", "dirs", "maxrun");
+	for (c = 0; c < fs->fs_ncg; c++) {
+		if (cgs[c].ci_bad) {
+			printf("%6d unreadable\n", c);
+			continue;
+		}
+		printf("%6d %4d%% %10d %10d %10d %8d %10d\n", c,
+		    cgs[c].ci_fill, cgs[c].ci_nbfree, cgs[c].ci_nffree,
+		    cgs[c].ci_nifree, cgs[c].ci_ndir, cgs[c].ci_maxrun);
+	}
+}
+
+/*
+ * Histogram h, from its first bucket in use to its last, with a bar
+ * for each. Bucket k holds [2^(k-1), 2^k); bytes are shown in K, M, G.
+ */
+static void
+printhist(const char *title, const uint64_t *h, int bytes)
+{
+	char range[40];
+	uint64_t lo, max;
+	int first, last, i;
+
+	for (first = 0; first < NBUCKET && h[first] == 0; first++)
+		continue;
+	for (last = NBUCKET - 1; last > first && h[last] == 0; last--)
+		continue;
+	printf("\n%s\n", title);
+	if (first == NBUCKET) {
+		printf("%20s\n", "none");
+		return;
+	}
+	for (max = 0, i = first; i <= last; i++)
+		max = MAX(max, h[i]);
+	for (i = first; i <= last; i++) {
+		lo = i == 0 ? 0 : 1ULL << (i - 1);
+		if (i == 0)
+			snprintf(range, sizeof(range), "0");
+		else if (bytes)
+			snprintf(range, sizeof(range), "[%s, %s)", human(lo),
+			    i == 64 ? "16E" : human(lo * 2));
+		else
+			snprintf(range, sizeof(range), "[%ju, %ju)",
+			    (uintmax_t)lo, (uintmax_t)lo * 2);
+		printrow(range, h[i], max);
+	}
+}
+
+/* One line of a table: what is counted, how many, and a bar. */
+static void
+printrow(const char *label, uint64_t n, uint64_t max)
+{
+	int len;
+
+	len = max == 0 ? 0 : (int)((n * BARWIDTH + max - 1) / max);
+	printf("%20s %12ju%s%.*s\n", label, (uintmax_t)n, len ? " " : "",
+	    len, "########################################");
+}
+
+/* a[first] to a[last], each labeled with its index, suffix on the last. */
+static void
+printarray(const char *title, const uint64_t *a, int first, int last,
+    int scale, const char *suffix)
+{
+	char label[16];
+	uint64_t max;
+	int i;
+
+	printf("\n%s\n", title);
+	for (max = 0, i = first; i <= last; i++)
+		max = MAX(max, a[i]);
+	for (i = first; i <= last; i++) {
+		snprintf(label, sizeof(label), "%d%s", i * scale,
+		    i == last ? suffix : "");
+		printrow(label, a[i], max);
+	}
+}
+
+static void
+printjson(const struct stats *st, int percg, double secs, int nthreads)
+{
+	struct cginfo *ci;
+	int c;
+
+	printf("{\n\"fs\": {\"name\": \"%s\", \"ufs\": %d, \"bytes\": %ju, "
+	    "\"free_bytes\": %ju, \"bsize\": %d, \"fsize\": %d, "
+	    "\"ncg\": %d, \"fpg\": %d, \"ipg\": %d, \"maxcontig\": %d, "
+	    "\"avgfilesize\": %d, \"avgfpdir\": %d},\n", disk.d_name,
+	    disk.d_ufs, (uintmax_t)fs->fs_dsize * fs->fs_fsize,
+	    (uintmax_t)((fs->fs_cstotal.cs_nbfree * fs->fs_frag +
+	    fs->fs_cstotal.cs_nffree) * fs->fs_fsize), fs->fs_bsize,
+	    fs->fs_fsize, fs->fs_ncg, fs->fs_fpg, fs->fs_ipg,
+	    fs->fs_maxcontig, fs->fs_avgfilesize, fs->fs_avgfpdir);
+	printf("\"inodes\": {\"used\": %ju, \"files\": %ju, \"dirs\": %ju, "
+	    "\"symlinks\": %ju, \"other\": %ju},\n",
+	    (uintmax_t)st->st_inodes, (uintmax_t)st->st_files,
+	    (uintmax_t)st->st_dirs, (uintmax_t)st->st_links,
+	    (uintmax_t)st->st_other);
+	printf("\"files\": {\"bytes\": %ju, \"allocated\": %ju, "
+	    "\"slack\": %ju, \"indirect_blocks\": %ju, \"extattr\": %ju, "
+	    "\"with_data\": %ju, \"runs\": %ju, \"fragmented\": %ju, "
+	    "\"in_inode_cg\": %ju, \"tails\": %ju, \"tail_frags\": %ju,\n",
+	    (uintmax_t)st->st_bytes, (uintmax_t)st->st_frags * fs->fs_fsize,
+	    (uintmax_t)st->st_slack, (uintmax_t)st->st_indir,
+	    (uintmax_t)st->st_extfrags * fs->fs_fsize,
+	    (uintmax_t)st->st_withdata, (uintmax_t)st->st_runs,
+	    (uintmax_t)st->st_fragmented, (uintmax_t)st->st_incg,
+	    (uintmax_t)st->st_tails, (uintmax_t)st->st_tailfrags);
+	jsonarray("tail_hist", st->st_tail, 1, fs->fs_frag - 1, ",\n");
+	jsonhist("size_hist", st->st_size, ",\n");
+	jsonhist("runs_hist", st->st_nruns, ",\n");
+	jsonhist("run_bytes_hist", st->st_runlen, "},\n");
+	printf("\"dirs\": {\"entries\": %ju,\n", (uintmax_t)st->st_entries);
+	jsonhist("file_cg_distance_hist", st->st_fdist, ",\n");
+	jsonhist("subdir_cg_distance_hist", st->st_ddist, "},\n");
+	printf("\"free\": {");
+	jsonarray("cg_fill_hist", st->st_fill, 0, NFILL - 1, ",\n");
+	jsonhist("run_blocks_hist", st->st_freerun, ",\n");
+	jsonarray("frsum", st->st_frsum, 1, fs->fs_frag - 1, ",\n");
+	jsonarray("clustersum", st->st_clsum, 1, fs->fs_contigsumsize,
+	    "},\n");
+	if (percg) {
+		printf("\"cgs\": [");
+		for (c = 0; c < fs->fs_ncg; c++) {
+			ci = &cgs[c];
+			printf("%s\n  {\"cg\": %d", c == 0 ? "" : ",", c);
+			if (ci->ci_bad)
+				printf(", \"bad\": true}");
+			else
+				printf(", \"fill\": %d, \"nbfree\": %d, "
+				    "\"nffree\": %d, \"nifree\": %d, "
+				    "\"ndir\": %d, \"max_free_run\": %d}",
+				    ci->ci_fill, ci->ci_nbfree, ci->ci_nffree,
+				    ci->ci_nifree, ci->ci_ndir, ci->ci_maxrun);
+		}
+		printf("],\n");
+	}
+	printf("\"read\": %ju, \"seconds\": %.3f, \"threads\": %d, "
+	    "\"errors\": %ju\n}\n", (uintmax_t)st->st_read, secs, nthreads,
+	    (uintmax_t)st->st_errors);
+}
+
+/* Histogram h as the buckets in use, each with its range. */
+static void
+jsonhist(const char *name, const uint64_t *h, const char *end)
+{
+	const char *sep;
+	uint64_t lo, hi;
+	int i;
+
+	printf("\"%s\": [", name);
+	for (sep = "", i = 0; i < NBUCKET; i++) {
+		if (h[i] == 0)
+			continue;
+		lo = i == 0 ? 0 : 1ULL << (i - 1);
+		hi = i == 0 ? 0 : i == 64 ? UINT64_MAX : (1ULL << i) - 1;
+		printf("%s{\"min\": %ju, \"max\": %ju, \"count\": %ju}", sep,
+		    (uintmax_t)lo, (uintmax_t)hi, (uintmax_t)h[i]);
+		sep = ", ";
+	}
+	printf("]%s", end);
+}
+
+/* a[first] to a[last], inclusive. */
+static void
+jsonarray(const char *name, const uint64_t *a, int first, int last,
+    const char *end)
+{
+	int i;
+
+	printf("\"%s\": [", name);
+	for (i = first; i <= last; i++)
+		printf("%s%ju", i == first ? "" : ", ", (uintmax_t)a[i]);
+	printf("]%s", end);
+}
+
+/* n bytes in K, M, G or T; good for a few calls in one printf(). */
+static const char *
+human(uint64_t n)
+{
+	static char bufs[8][16];
+	static int next;
+	const char *units;
+	char *buf;
+	double v;
+
+	buf = bufs[next++ % 8];
+	units = "KMGTPE";
+	if (n < 1024) {
+		snprintf(buf, sizeof(bufs[0]), "%ju", (uintmax_t)n);
+		return (buf);
+	}
+	for (v = n / 1024.0; v >= 1024 && units[1] != '\0'; units++)
+		v /= 1024;
+	snprintf(buf, sizeof(bufs[0]), v < 10 && v != (int)v ? "%.1f%c" :
+	    "%.0f%c", v, *units);
+	return (buf);
+}
+
+static double
+pct(uint64_t n, uint64_t of)
+{
+
+	return (of == 0 ? 0 : 100.0 * n / of);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: ufslayout [-cdJ] [-j threads] special | file\n");
+	exit(1);
+}
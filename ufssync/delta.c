@@ -0,0 +1,216 @@
+//
+//  delta.c
+//  ufssync
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Writing and applying deltas. Hashing threads hand their changed runs
+// to dl_put() as they go, so records come in no particular order; each
+// carries its own offset and the hash of its data, and the record that
+// ends the delta counts the ones before it, so a delta that was cut
+// short or damaged is found out before it is applied, if it can be read
+// twice, or at least before it is reported as applied.
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#include "ufssync.h"
+
+static FILE *dlfp;
+static pthread_mutex_t dllock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t dlnrec;
+static int dlerr;
+
+static int readrecs(FILE *, const struct dhdr *, int, caddr_t, uint64_t *);
+
+void
+dl_open(FILE *fp)
+{
+	struct dhdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.dh_magic = DL_MAGIC;
+	hdr.dh_version = DL_VERSION;
+	hdr.dh_id[0] = fs->fs_id[0];
+	hdr.dh_id[1] = fs->fs_id[1];
+	hdr.dh_size = fs->fs_size;
+	hdr.dh_fsize = fs->fs_fsize;
+	hdr.dh_bsize = fs->fs_bsize;
+	dlfp = fp;
+	dlnrec = 0;
+	dlerr = 0;
+	if (fwrite(&hdr, sizeof(hdr), 1, dlfp) != 1)
+		dlerr = errno;
+}
+
+/* Add the len bytes at off, held in data, to the delta. */
+void
+dl_put(off_t off, const char *data, size_t len)
+{
+	struct drec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.dr_off = off;
+	rec.dr_len = len;
+	rec.dr_hash = blkhash(data, len);
+	pthread_mutex_lock(&dllock);
+	if (dlerr == 0 && (fwrite(&rec, sizeof(rec), 1, dlfp) != 1 ||
+	    fwrite(data, 1, len, dlfp) != len))
+		dlerr = errno;
+	dlnrec++;
+	pthread_mutex_unlock(&dllock);
+}
+
+int
+dl_close(void)
+{
+	struct drec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.dr_off = dlnrec;
+	if (dlerr == 0 && (fwrite(&rec, sizeof(rec), 1, dlfp) != 1 ||
+	    fflush(dlfp) != 0))
+		dlerr = errno;
+	if (dlerr != 0) {
+		errno = dlerr;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Read the records of the delta in fp, after its header, checking each
+ * one, and write them to fd unless it is -1. Returns the number of
+ * records in nrec, or -1 if the delta is bad.
+ */
+static int
+readrecs(FILE *fp, const struct dhdr *hdr, int fd, caddr_t buf,
+    uint64_t *nrec)
+{
+	struct drec rec;
+	uint64_t n, end;
+	ssize_t cnt;
+	size_t off;
+
+	end = (uint64_t)hdr->dh_size * hdr->dh_fsize;
+	for (n = 0;; n++) {
+		if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+			warnx("delta cut short after %ju records",
+			    (uintmax_t)n);
+			return (-1);
+		}
+		if (rec.dr_len == 0)
+			break;
+		if (rec.dr_len > IOCHUNK || rec.dr_off % hdr->dh_fsize != 0 ||
+		    rec.dr_off > end || rec.dr_len > end - rec.dr_off) {
+			warnx("record %ju: %ju bytes at %ju: out of range",
+			    (uintmax_t)n, (uintmax_t)rec.dr_len,
+			    (uintmax_t)rec.dr_off);
+			return (-1);
+		}
+		if (fread(buf, 1, rec.dr_len, fp) != rec.dr_len) {
+			warnx("delta cut short in record %ju", (uintmax_t)n);
+			return (-1);
+		}
+		if (blkhash(buf, rec.dr_len) != rec.dr_hash) {
+			warnx("record %ju: %ju bytes at %ju: bad hash",
+			    (uintmax_t)n, (uintmax_t)rec.dr_len,
+			    (uintmax_t)rec.dr_off);
+			return (-1);
+		}
+		for (off = 0; fd != -1 && off < rec.dr_len; off += cnt)
+			if ((cnt = pwrite(fd, buf + off, rec.dr_len - off,
+			    rec.dr_off + off)) <= 0)
+				err(1, "write at %ju", (uintmax_t)rec.dr_off);
+	}
+	if (rec.dr_off != n) {
+		warnx("delta has %ju records, should have %ju", (uintmax_t)n,
+		    (uintmax_t)rec.dr_off);
+		return (-1);
+	}
+	*nrec = n;
+	return (0);
+}
+
+/*
+ * Apply the delta in fp to the file system on target, a copy of the one
+ * it was made from. A delta that can be read twice is checked all the
+ * way through before anything is written; with verify only, nothing is.
+ */
+int
+dl_apply(FILE *fp, const char *target, int verify)
+{
+	struct dhdr hdr;
+	uint64_t nrec;
+	caddr_t buf;
+	off_t start;
+	int fd;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.dh_magic != DL_MAGIC || hdr.dh_version != DL_VERSION) {
+		warnx("not a delta");
+		return (-1);
+	}
+	if (ufs_disk_fillout(&disk, target) == -1) {
+		warnx("%s: %s", target, disk.d_error);
+		return (-1);
+	}
+	fs = &disk.d_fs;
+	if (hdr.dh_id[0] != fs->fs_id[0] || hdr.dh_id[1] != fs->fs_id[1] ||
+	    hdr.dh_size != fs->fs_size || hdr.dh_fsize != fs->fs_fsize ||
+	    hdr.dh_bsize != fs->fs_bsize) {
+		warnx("%s: delta is for another file system", target);
+		ufs_disk_close(&disk);
+		return (-1);
+	}
+	ufs_disk_close(&disk);
+	if ((buf = malloc(IOCHUNK)) == NULL)
+		err(1, "malloc");
+	start = ftello(fp);
+	if (verify || (start != -1 && fseeko(fp, start, SEEK_SET) == 0)) {
+		if (readrecs(fp, &hdr, -1, buf, &nrec) == -1) {
+			free(buf);
+			return (-1);
+		}
+		if (verify) {
+			printf("%ju records, delta is good\n", (uintmax_t)nrec);
+			free(buf);
+			return (0);
+		}
+		if (fseeko(fp, start, SEEK_SET) == -1)
+			err(1, "seek");
+	} else
+		warnx("delta can't be checked before it is applied");
+	if ((fd = open(target, O_WRONLY)) == -1)
+		err(1, "%s", target);
+	if (readrecs(fp, &hdr, fd, buf, &nrec) == -1) {
+		warnx("%s: delta applied in part", target);
+		close(fd);
+		free(buf);
+		return (-1);
+	}
+	if (fsync(fd) == -1 || close(fd) == -1)
+		err(1, "%s", target);
+	free(buf);
+	return (0);
+}
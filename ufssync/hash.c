@@ -0,0 +1,552 @@
+//
+//  hash.c
+//  ufssync
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Hashing a file system a block at a time, cylinder groups in parallel,
+// every thread reading through its own libufs cursor. Blocks the free
+// map says are free hash to 0 and are never read.
+//
+// Against a base (the hashes of an earlier state, from a sidecar or from
+// hashing another image) only what may have changed is read, the way
+// dump(8) picks files for an incremental:
+//
+// 1. The metadata of each group is always read and hashed: superblock
+//    copy, cylinder group and the initialized part of the inode table.
+//    Inodes whose ctime is not older than the base are remembered.
+// 2. The blocks of those inodes, found with ufs_file_extents(), and the
+//    summary area are marked dirty.
+// 3. Allocated data blocks are read and hashed if they are dirty or were
+//    free in the base; the others keep their base hash.
+//
+// So a diff reads the metadata and the data that changed, not the whole
+// file system. Blocks that differ from the base are sent to the delta as
+// they are hashed, while still in memory.
+//
+// blkhash() works on 64 byte stripes, eight 64-bit lanes at a time, each
+// lane multiplying the two 32-bit halves of a word mixed with a key (as
+// XXH3 does), which compilers turn into SIMD multiplies.
+
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#include "ufssync.h"
+
+#define	NLANES		8
+#define	SCRAMBLE	16		/* stripes between scrambles */
+#define	PRIME32		0x9e3779b1U
+#define	PRIME64_1	0x9e3779b185ebca87ULL
+#define	PRIME64_2	0xc2b2ae3d27d4eb4fULL
+#define	PRIME64_3	0x165667b19e3779f9ULL
+
+static const uint64_t keys[NLANES] = {
+	0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL,
+	0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+	0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL,
+	0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+};
+
+struct worker {
+	pthread_t	w_thread;
+	struct uufsd_cursor *w_cur;
+	caddr_t		w_buf;			/* IOCHUNK bytes */
+	ino_t		*w_ino;			/* changed inodes found */
+	size_t		w_nino;
+	size_t		w_maxino;
+	int		w_err;
+	struct hashstats w_st;
+};
+
+static const uint64_t *ohash;		/* base, or NULL */
+static uint64_t *nhash;
+static int64_t since;			/* ctimes from here on changed */
+static int hflags;
+static uint8_t *dirty;			/* one bit per block */
+static uint8_t *cgbad;			/* no usable free map */
+static int nextcg;
+
+static void *pass1(void *);
+static void pass1_cg(struct worker *, int);
+static void scaninodes(struct worker *, int, ufs2_daddr_t, size_t);
+static void *pass2(void *);
+static void pass2_cg(struct worker *, int);
+static int readhash(struct worker *, int64_t, int64_t);
+static int markdirty(void *, const struct ufs_extent *);
+static void markrange(ufs2_daddr_t, int64_t);
+static void run(void *(*)(void *), struct worker *, int);
+
+uint64_t
+blkhash(const void *buf, size_t len)
+{
+	uint64_t acc[NLANES], stripe[NLANES], k, h;
+	const uint64_t *p;
+	size_t i, n;
+	int l;
+
+	memcpy(acc, keys, sizeof(acc));
+	p = buf;
+	n = len / sizeof(stripe);
+	for (i = 0; i < n; i++, p += NLANES) {
+		for (l = 0; l < NLANES; l++) {
+			k = p[l] ^ keys[l];
+			acc[l] += (k & 0xffffffff) * (k >> 32);
+		}
+		for (l = 0; l < NLANES; l++)
+			acc[l] += p[l ^ 1];
+		if (i % SCRAMBLE == SCRAMBLE - 1)
+			for (l = 0; l < NLANES; l++) {
+				acc[l] ^= acc[l] >> 47;
+				acc[l] ^= keys[l];
+				acc[l] *= PRIME32;
+			}
+	}
+	if (len % sizeof(stripe) != 0) {
+		memset(stripe, 0, sizeof(stripe));
+		memcpy(stripe, p, len % sizeof(stripe));
+		for (l = 0; l < NLANES; l++) {
+			k = stripe[l] ^ keys[l];
+			acc[l] += (k & 0xffffffff) * (k >> 32) + stripe[l ^ 1];
+		}
+	}
+	h = len * PRIME64_1;
+	for (l = 0; l < NLANES; l++) {
+		h ^= (acc[l] ^ (acc[l] >> 29)) * PRIME64_2;
+		h = ((h << 27) | (h >> 37)) * PRIME64_1;
+	}
+	h ^= h >> 37;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	/* 0 means a free block. */
+	return (h == 0 ? 1 : h);
+}
+
+/*
+ * Hash every block of the file system into hash, one per block. With a
+ * base, blocks not changed since it are taken from there and the ones
+ * that differ from it go to the delta if HF_EMIT is set. Returns -1 if
+ * anything couldn't be read; those blocks hash to 0.
+ */
+int
+hashfs(const uint64_t *base, int64_t basetime, uint64_t *hash, int flags,
+    struct hashstats *st)
+{
+	struct worker *workers, *w;
+	union dinodep dp;
+	ufs2_daddr_t cs;
+	uint64_t nblocks;
+	size_t j;
+	long pgsz;
+	int i, n, ret;
+
+	ohash = base;
+	since = basetime;
+	nhash = hash;
+	hflags = base == NULL ? flags | HF_FULL : flags;
+	nblocks = howmany((uint64_t)fs->fs_size, fs->fs_frag);
+	n = MIN(nthreads, fs->fs_ncg);
+	if ((workers = calloc(n, sizeof(*workers))) == NULL ||
+	    (dirty = calloc(howmany(nblocks, NBBY), 1)) == NULL ||
+	    (cgbad = calloc(fs->fs_ncg, 1)) == NULL)
+		err(1, "malloc");
+	/* Page aligned, so direct I/O needn't bounce them. */
+	pgsz = sysconf(_SC_PAGESIZE);
+	for (i = 0; i < n; i++) {
+		w = &workers[i];
+		if ((w->w_cur = ufs_cursor_open(&disk)) == NULL)
+			errx(1, "%s", disk.d_error);
+		if (posix_memalign((void **)&w->w_buf, pgsz, IOCHUNK) != 0)
+			err(1, "malloc");
+	}
+
+	run(pass1, workers, n);
+	/* Inodes that couldn't be read may have changed. */
+	for (i = 0; i < n; i++)
+		if (workers[i].w_err && !(hflags & HF_FULL)) {
+			warnx("hashing everything");
+			hflags |= HF_FULL;
+		}
+	/* The summary area belongs to no inode. */
+	cs = fs->fs_csaddr;
+	markrange(cs, numfrags(fs, fragroundup(fs, fs->fs_cssize)));
+	for (i = 0; i < n && !(hflags & HF_FULL); i++) {
+		w = &workers[i];
+		for (j = 0; j < w->w_nino; j++) {
+			dp.dp2 = NULL;
+			if ((getinode(&disk, &dp, w->w_ino[j]) == -1 &&
+			    dp.dp2 == NULL) || ufs_file_extents(&disk, dp,
+			    UFS_EXTENTS_INDIR, markdirty, NULL) != 0) {
+				warnx("inode %ju: %s; hashing everything",
+				    (uintmax_t)w->w_ino[j], disk.d_error);
+				hflags |= HF_FULL;
+				break;
+			}
+		}
+	}
+	run(pass2, workers, n);
+
+	memset(st, 0, sizeof(*st));
+	ret = 0;
+	for (i = 0; i < n; i++) {
+		w = &workers[i];
+		st->hs_read += w->w_st.hs_read;
+		st->hs_alloc += w->w_st.hs_alloc;
+		st->hs_changed += w->w_st.hs_changed;
+		st->hs_inodes += w->w_nino;
+		if (w->w_err)
+			ret = -1;
+		ufs_cursor_close(w->w_cur);
+		free(w->w_buf);
+		free(w->w_ino);
+	}
+	free(workers);
+	free(cgbad);
+	free(dirty);
+	return (ret);
+}
+
+static void
+run(void *(*fn)(void *), struct worker *workers, int n)
+{
+	int i;
+
+	nextcg = 0;
+	for (i = 0; i < n; i++)
+		if ((errno = pthread_create(&workers[i].w_thread, NULL, fn,
+		    &workers[i])) != 0)
+			err(1, "pthread_create");
+	for (i = 0; i < n; i++)
+		pthread_join(workers[i].w_thread, NULL);
+}
+
+static void *
+pass1(void *arg)
+{
+	struct worker *w;
+	int c;
+
+	w = arg;
+	while ((c = __atomic_fetch_add(&nextcg, 1, __ATOMIC_RELAXED)) <
+	    fs->fs_ncg)
+		pass1_cg(w, c);
+	return (NULL);
+}
+
+/*
+ * Hash the metadata of group c: everything before its first data block,
+ * less the UFS2 inode blocks past cg_initediblk, which were never
+ * written. Inode blocks are looked at for changed inodes on the way.
+ */
+static void
+pass1_cg(struct worker *w, int c)
+{
+	struct cg *cgp;
+	ufs2_daddr_t lo, imin, ihi, hi, d;
+	int64_t b, n, max;
+
+	if (ufs_cursor_cgread(w->w_cur, c) == -1) {
+		cgp = w->w_cur->c_cg;
+		warnx("cg %d: %s", c, w->w_cur->c_error);
+		/* A bad check-hash alone still leaves a usable map. */
+		if (!cg_chkmagic(cgp) || cgp->cg_cgx != c)
+			cgbad[c] = 1;
+	}
+	cgp = w->w_cur->c_cg;
+	lo = c == 0 ? 0 : cgsblock(fs, c);
+	imin = cgimin(fs, c);
+	hi = ihi = cgdmin(fs, c);
+	if (disk.d_ufs == 2 && !cgbad[c])
+		ihi = MIN(hi, imin + roundup(howmany(MIN(cgp->cg_initediblk,
+		    fs->fs_ipg), INOPF(fs)), fs->fs_frag));
+	max = IOCHUNK / fs->fs_bsize;
+	for (d = lo; d < ihi; d += n * fs->fs_frag) {
+		/* Inode blocks are read in chunks of their own. */
+		b = fragstoblks(fs, d);
+		n = MIN(max, howmany(d < imin ? imin - d : ihi - d,
+		    fs->fs_frag));
+		w->w_st.hs_alloc += (uint64_t)n * fs->fs_bsize;
+		if (readhash(w, b, n) == 0 && d >= imin &&
+		    !(hflags & HF_FULL))
+			scaninodes(w, c, d, MIN((size_t)n * fs->fs_bsize,
+			    (size_t)(ihi - d) * fs->fs_fsize));
+	}
+	for (b = fragstoblks(fs, ihi); b < howmany(hi, fs->fs_frag); b++)
+		nhash[b] = 0;
+}
+
+/*
+ * Remember the inodes in use in the len bytes of group c's inode table
+ * at frag d, just read into w_buf, that changed since the base.
+ */
+static void
+scaninodes(struct worker *w, int c, ufs2_daddr_t d, size_t len)
+{
+	struct ufs1_dinode *dp1;
+	struct ufs2_dinode *dp2;
+	ino_t ino, *p;
+	int64_t ctime;
+	size_t i, n, max;
+	int mode;
+
+	ino = (ino_t)c * fs->fs_ipg + (d - cgimin(fs, c)) * INOPF(fs);
+	n = len / (disk.d_ufs == 1 ? sizeof(*dp1) : sizeof(*dp2));
+	dp1 = (struct ufs1_dinode *)w->w_buf;
+	dp2 = (struct ufs2_dinode *)w->w_buf;
+	for (i = 0; i < n; i++, ino++) {
+		if (disk.d_ufs == 1) {
+			mode = dp1[i].di_mode;
+			ctime = dp1[i].di_ctime;
+		} else {
+			mode = dp2[i].di_mode;
+			ctime = dp2[i].di_ctime;
+		}
+		if (mode == 0 || ctime < since)
+			continue;
+		if (w->w_nino == w->w_maxino) {
+			max = w->w_maxino == 0 ? 1024 : w->w_maxino * 2;
+			if ((p = realloc(w->w_ino, max * sizeof(*p))) == NULL)
+				err(1, "malloc");
+			w->w_ino = p;
+			w->w_maxino = max;
+		}
+		w->w_ino[w->w_nino++] = ino;
+	}
+}
+
+static void *
+pass2(void *arg)
+{
+	struct worker *w;
+	int c;
+
+	w = arg;
+	while ((c = __atomic_fetch_add(&nextcg, 1, __ATOMIC_RELAXED)) <
+	    fs->fs_ncg)
+		pass2_cg(w, c);
+	return (NULL);
+}
+
+/*
+ * Hash the data blocks of group c, reading the ones that may have
+ * changed a run of contiguous blocks at a time.
+ */
+static void
+pass2_cg(struct worker *w, int c)
+{
+	struct cg *cgp;
+	u_char *freemap;
+	int64_t b, base, end, mlo, mhi, start, max;
+	int bad, need;
+
+	bad = cgbad[c];
+	cgp = w->w_cur->c_cg;
+	if (!bad && ufs_cursor_cgread(w->w_cur, c) == -1 &&
+	    (!cg_chkmagic(cgp) || cgp->cg_cgx != c))
+		bad = 1;
+	freemap = cg_blksfree(cgp);
+	base = fragstoblks(fs, cgbase(fs, c));
+	end = howmany(MIN(cgbase(fs, c + 1), fs->fs_size), fs->fs_frag);
+	mlo = fragstoblks(fs, c == 0 ? 0 : cgsblock(fs, c));
+	mhi = howmany(cgdmin(fs, c), fs->fs_frag);
+	max = IOCHUNK / fs->fs_bsize;
+	start = -1;
+	for (b = base; b <= end; b++) {
+		need = 0;
+		if (b == end || (b >= mlo && b < mhi)) {
+			/* Ends the run; pass 1 did the metadata. */
+		} else if (!bad && ffs_isblock(fs, freemap, b - base)) {
+			nhash[b] = 0;
+		} else {
+			w->w_st.hs_alloc += fs->fs_bsize;
+			if ((hflags & HF_FULL) || ohash[b] == 0 ||
+			    isset(dirty, b))
+				need = 1;
+			else
+				nhash[b] = ohash[b];
+		}
+		if (start != -1 && (!need || b - start == max)) {
+			readhash(w, start, b - start);
+			start = -1;
+		}
+		if (need && start == -1)
+			start = b;
+	}
+}
+
+/*
+ * Read and hash n blocks from block b on, sending those that differ from
+ * the base to the delta, a run at a time.
+ */
+static int
+readhash(struct worker *w, int64_t b, int64_t n)
+{
+	size_t len, blen, off;
+	ssize_t cnt;
+	int64_t i, first;
+	uint64_t h;
+
+	len = MIN((size_t)n * fs->fs_bsize,
+	    (size_t)(fs->fs_size - blkstofrags(fs, b)) * fs->fs_fsize);
+	if ((cnt = ufs_cursor_bread(w->w_cur, fsbtodb(fs, blkstofrags(fs, b)),
+	    w->w_buf, len)) != (ssize_t)len) {
+		warnx("blocks %jd-%jd: %s", (intmax_t)b, (intmax_t)(b + n - 1),
+		    cnt == -1 ? w->w_cur->c_error : "short read");
+		for (i = 0; i < n; i++)
+			nhash[b + i] = 0;
+		w->w_err = 1;
+		return (-1);
+	}
+	w->w_st.hs_read += len;
+	first = -1;
+	for (i = 0; i <= n; i++) {
+		off = (size_t)i * fs->fs_bsize;
+		if (i < n) {
+			blen = MIN((size_t)fs->fs_bsize, len - off);
+			h = nhash[b + i] = blkhash(w->w_buf + off, blen);
+			if (ohash != NULL && ohash[b + i] != h) {
+				w->w_st.hs_changed += blen;
+				if (first == -1)
+					first = i;
+				continue;
+			}
+		}
+		if (first != -1 && (hflags & HF_EMIT))
+			dl_put((off_t)blkstofrags(fs, b + first) *
+			    fs->fs_fsize, w->w_buf + (size_t)first *
+			    fs->fs_bsize, MIN(off, len) -
+			    (size_t)first * fs->fs_bsize);
+		first = -1;
+	}
+	return (0);
+}
+
+static int
+markdirty(void *arg, const struct ufs_extent *e)
+{
+
+	markrange(e->ue_blkno, e->ue_nfrags);
+	return (0);
+}
+
+/* Mark the blocks holding frags [d, d + nfrags) dirty. */
+static void
+markrange(ufs2_daddr_t d, int64_t nfrags)
+{
+	int64_t b, last;
+
+	if (d < 0 || nfrags <= 0 || d + nfrags > fs->fs_size)
+		return;
+	last = fragstoblks(fs, d + nfrags - 1);
+	for (b = fragstoblks(fs, d); b <= last; b++)
+		setbit(dirty, b);
+}
+
+/*
+ * Map the sidecar at path, checking that it is for this file system.
+ */
+int
+sc_load(const char *path, struct schdr *hdr, uint64_t **hashp)
+{
+	struct stat sb;
+	uint64_t nblocks;
+	void *p;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		warn("%s", path);
+		return (-1);
+	}
+	if (read(fd, hdr, sizeof(*hdr)) != sizeof(*hdr) ||
+	    hdr->sh_magic != SC_MAGIC || hdr->sh_version != SC_VERSION) {
+		warnx("%s: not a hash sidecar", path);
+		close(fd);
+		return (-1);
+	}
+	nblocks = howmany((uint64_t)fs->fs_size, fs->fs_frag);
+	if (hdr->sh_id[0] != fs->fs_id[0] || hdr->sh_id[1] != fs->fs_id[1] ||
+	    hdr->sh_size != fs->fs_size || hdr->sh_bsize != fs->fs_bsize ||
+	    hdr->sh_frag != fs->fs_frag || hdr->sh_nblocks != nblocks) {
+		warnx("%s: hashes of another file system", path);
+		close(fd);
+		return (-1);
+	}
+	if (fstat(fd, &sb) == -1 || (uint64_t)sb.st_size != sizeof(*hdr) +
+	    nblocks * sizeof(uint64_t)) {
+		warnx("%s: truncated", path);
+		close(fd);
+		return (-1);
+	}
+	p = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		warn("%s", path);
+		return (-1);
+	}
+	*hashp = (uint64_t *)((char *)p + sizeof(*hdr));
+	return (0);
+}
+
+/*
+ * Write hash out as the sidecar at path, replacing what was there only
+ * once all of it is written.
+ */
+int
+sc_save(const char *path, int64_t start, const uint64_t *hash)
+{
+	struct schdr hdr;
+	char tmp[MAXPATHLEN];
+	FILE *fp;
+	int fd, ok;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.sh_magic = SC_MAGIC;
+	hdr.sh_version = SC_VERSION;
+	hdr.sh_id[0] = fs->fs_id[0];
+	hdr.sh_id[1] = fs->fs_id[1];
+	hdr.sh_size = fs->fs_size;
+	hdr.sh_bsize = fs->fs_bsize;
+	hdr.sh_frag = fs->fs_frag;
+	hdr.sh_since = start;
+	hdr.sh_nblocks = howmany((uint64_t)fs->fs_size, fs->fs_frag);
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	if ((fd = mkstemp(tmp)) == -1)
+		return (-1);
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		unlink(tmp);
+		return (-1);
+	}
+	ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+	    fwrite(hash, sizeof(*hash), hdr.sh_nblocks, fp) == hdr.sh_nblocks;
+	if (fclose(fp) != 0)
+		ok = 0;
+	if (!ok || rename(tmp, path) == -1) {
+		unlink(tmp);
+		return (-1);
+	}
+	return (0);
+}
@@ -0,0 +1,322 @@
+//
+//  main.c
+//  ufssync
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Keep a copy of a UFS file system up to date a block at a time.
+//
+//	ufssync hash	hash every block of an image into a sidecar
+//	ufssync diff	write the blocks that differ from a sidecar, or
+//			from another image, as a delta
+//	ufssync apply	write a delta over the copy it was made for
+//
+// The usual round: clone a file system with ufsclone(8) and hash the
+// clone; later, diff the file system against the sidecar and apply the
+// delta to the clone. The diff rewrites the sidecar to hold what the
+// clone will once the delta is applied, so the next diff goes from there.
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/time.h>
+
+#include <ufs/ufs/dinode.h>
+#include <ufs/ffs/fs.h>
+#include <ufs/ufs/extattr.h>
+#include <ufs/ufs/quota.h>
+#include <ufs/ufs/ufsmount.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libufs.h>
+
+#include "ufssync.h"
+
+struct uufsd disk;
+struct fs *fs;
+int nthreads;
+
+static int direct;
+
+static int cmd_hash(int, char *[]);
+static int cmd_diff(int, char *[]);
+static int cmd_apply(int, char *[]);
+static void setthreads(const char *);
+static void openfs(const char *);
+static uint64_t *hashbuf(void);
+static int issidecar(const char *);
+static void report(const char *, const struct hashstats *, double);
+static double now(void);
+static void usage(void);
+
+int
+main(int argc, char *argv[])
+{
+
+	if (argc < 2)
+		usage();
+	nthreads = (int)MIN(sysconf(_SC_NPROCESSORS_ONLN), MAXWORKERS);
+	if (nthreads < 1)
+		nthreads = 1;
+	if (strcmp(argv[1], "hash") == 0)
+		return (cmd_hash(argc - 1, argv + 1));
+	if (strcmp(argv[1], "diff") == 0)
+		return (cmd_diff(argc - 1, argv + 1));
+	if (strcmp(argv[1], "apply") == 0)
+		return (cmd_apply(argc - 1, argv + 1));
+	usage();
+}
+
+static void
+setthreads(const char *arg)
+{
+	long n;
+
+	n = strtol(arg, NULL, 10);
+	if (n < 1 || n > MAXWORKERS)
+		errx(1, "%s: bad number of threads", arg);
+	nthreads = (int)n;
+}
+
+/*
+ * ufssync hash [-d] [-j threads] special | file sidecar
+ */
+static int
+cmd_hash(int argc, char *argv[])
+{
+	struct hashstats st;
+	uint64_t *hash;
+	double start;
+	time_t since;
+	int ch, ret;
+
+	while ((ch = getopt(argc, argv, "dj:")) != -1)
+		switch (ch) {
+		case 'd':
+			direct = 1;
+			break;
+		case 'j':
+			setthreads(optarg);
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 2)
+		usage();
+
+	openfs(argv[0]);
+	hash = hashbuf();
+	since = time(NULL);
+	start = now();
+	ret = hashfs(NULL, 0, hash, HF_FULL, &st);
+	/* Blocks that couldn't be read hash to 0 and are read next time. */
+	if (sc_save(argv[1], since, hash) == -1)
+		err(1, "%s", argv[1]);
+	report(argv[0], &st, now() - start);
+	ufs_disk_close(&disk);
+	return (ret == 0 ? 0 : 1);
+}
+
+/*
+ * ufssync diff [-dfn] [-j threads] [-o delta] base special | file
+ */
+static int
+cmd_diff(int argc, char *argv[])
+{
+	struct hashstats st;
+	struct schdr hdr;
+	uint64_t *base, *hash;
+	int32_t id[2];
+	int64_t size;
+	const char *out;
+	double start;
+	time_t since;
+	FILE *fp;
+	int ch, flags, nflag, ret, sidecar;
+
+	flags = HF_EMIT;
+	nflag = 0;
+	out = NULL;
+	while ((ch = getopt(argc, argv, "dfj:no:")) != -1)
+		switch (ch) {
+		case 'd':
+			direct = 1;
+			break;
+		case 'f':
+			flags |= HF_FULL;
+			break;
+		case 'j':
+			setthreads(optarg);
+			break;
+		case 'n':
+			nflag = 1;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 2)
+		usage();
+
+	if (out == NULL && isatty(STDOUT_FILENO))
+		errx(1, "won't write a delta to a terminal; use -o");
+	start = now();
+	if ((sidecar = issidecar(argv[0])) == 1) {
+		openfs(argv[1]);
+		if (sc_load(argv[0], &hdr, &base) == -1)
+			exit(1);
+	} else {
+		/* Nothing says what changed when, so both are read whole. */
+		openfs(argv[0]);
+		base = hashbuf();
+		if (hashfs(NULL, 0, base, HF_FULL, &st) != 0)
+			errx(1, "%s: can't be read", argv[0]);
+		id[0] = fs->fs_id[0];
+		id[1] = fs->fs_id[1];
+		size = fs->fs_size;
+		ufs_disk_close(&disk);
+		openfs(argv[1]);
+		if (fs->fs_id[0] != id[0] || fs->fs_id[1] != id[1] ||
+		    fs->fs_size != size)
+			errx(1, "%s: not a copy of %s", argv[1], argv[0]);
+		hdr.sh_since = 0;
+		flags |= HF_FULL;
+	}
+	if (out == NULL)
+		fp = stdout;
+	else if ((fp = fopen(out, "w")) == NULL)
+		err(1, "%s", out);
+	hash = hashbuf();
+	since = time(NULL);
+	dl_open(fp);
+	ret = hashfs(base, hdr.sh_since, hash, flags, &st);
+	if (dl_close() == -1 || (out != NULL && fclose(fp) != 0))
+		err(1, "%s", out == NULL ? "stdout" : out);
+	if (ret == 0 && sidecar && !nflag && sc_save(argv[0], since,
+	    hash) == -1)
+		err(1, "%s", argv[0]);
+	report(argv[1], &st, now() - start);
+	ufs_disk_close(&disk);
+	return (ret == 0 ? 0 : 1);
+}
+
+/*
+ * ufssync apply [-n] delta special | file
+ */
+static int
+cmd_apply(int argc, char *argv[])
+{
+	FILE *fp;
+	int ch, nflag, ret;
+
+	nflag = 0;
+	while ((ch = getopt(argc, argv, "n")) != -1)
+		switch (ch) {
+		case 'n':
+			nflag = 1;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 2)
+		usage();
+
+	if (strcmp(argv[0], "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(argv[0], "r")) == NULL)
+		err(1, "%s", argv[0]);
+	ret = dl_apply(fp, argv[1], nflag);
+	if (fp != stdin)
+		fclose(fp);
+	return (ret == 0 ? 0 : 1);
+}
+
+static void
+openfs(const char *name)
+{
+
+	if ((direct ? ufs_disk_fillout_direct(&disk, name) :
+	    ufs_disk_fillout(&disk, name)) == -1)
+		errx(1, "%s: %s", name, disk.d_error);
+	fs = &disk.d_fs;
+}
+
+/* Room for a hash of every block of the file system. */
+static uint64_t *
+hashbuf(void)
+{
+	uint64_t *hash;
+
+	hash = calloc(howmany((uint64_t)fs->fs_size, fs->fs_frag),
+	    sizeof(*hash));
+	if (hash == NULL)
+		err(1, "malloc");
+	return (hash);
+}
+
+/* Whether name is a sidecar rather than a file system. */
+static int
+issidecar(const char *name)
+{
+	uint32_t magic;
+	int fd, ret;
+
+	if ((fd = open(name, O_RDONLY)) == -1)
+		err(1, "%s", name);
+	ret = read(fd, &magic, sizeof(magic)) == sizeof(magic) &&
+	    magic == SC_MAGIC;
+	close(fd);
+	return (ret);
+}
+
+static void
+report(const char *name, const struct hashstats *st, double secs)
+{
+
+	fprintf(stderr, "%s: %ju MB in use, %ju MB read, %ju MB changed, "
+	    "%ju inodes changed, %.2fs, %.0f MB/s\n", name,
+	    (uintmax_t)(st->hs_alloc >> 20), (uintmax_t)(st->hs_read >> 20),
+	    (uintmax_t)(st->hs_changed >> 20), (uintmax_t)st->hs_inodes, secs,
+	    secs > 0 ? st->hs_read / secs / (1 << 20) : 0);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "%s\n%s\n%s\n",
+	    "usage: ufssync hash [-d] [-j threads] special | file sidecar",
+	    "       ufssync diff [-dfn] [-j threads] [-o delta] base "
+	    "special | file",
+	    "       ufssync apply [-n] delta special | file");
+	exit(1);
+}
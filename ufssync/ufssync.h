@@ -0,0 +1,93 @@
+//
+//  ufssync.h
+//  ufssync
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+
+#ifndef ufssync_h
+#define ufssync_h
+
+#define	MAXWORKERS	256
+#define	IOCHUNK		(1024 * 1024)	/* most read or sent at once */
+
+/*
+ * A hash sidecar: what every block of a file system held when it was
+ * last hashed, so that the next diff only has to read what changed.
+ *
+ *	struct schdr
+ *	uint64_t	[sh_nblocks]	hash of each block, 0 if free
+ */
+#define	SC_MAGIC	0x48534655	/* "UFSH" */
+#define	SC_VERSION	1
+
+struct schdr {
+	uint32_t	sh_magic;
+	uint32_t	sh_version;
+	int32_t		sh_id[2];	/* fs_id */
+	int64_t		sh_size;	/* fs_size */
+	int32_t		sh_bsize;	/* fs_bsize */
+	int32_t		sh_frag;	/* fs_frag */
+	int64_t		sh_since;	/* when hashing started */
+	uint64_t	sh_nblocks;
+};
+
+/*
+ * A delta: the blocks that differ, each run as a record followed by its
+ * data, ending with a record of length 0 whose offset is the number of
+ * records before it.
+ *
+ *	struct dhdr
+ *	struct drec, data [dr_len]	...
+ *	struct drec			dr_len 0
+ */
+#define	DL_MAGIC	0x544c4455	/* "UDLT" */
+#define	DL_VERSION	1
+
+struct dhdr {
+	uint32_t	dh_magic;
+	uint32_t	dh_version;
+	int32_t		dh_id[2];	/* fs_id of the file system */
+	int64_t		dh_size;	/* its fs_size */
+	int32_t		dh_fsize;	/* its fs_fsize */
+	int32_t		dh_bsize;	/* its fs_bsize */
+};
+
+struct drec {
+	uint64_t	dr_off;		/* bytes into the file system */
+	uint32_t	dr_len;
+	uint32_t	dr_pad;
+	uint64_t	dr_hash;	/* blkhash() of the data */
+};
+
+/* hashfs() flags */
+#define	HF_FULL		0x01	/* read every allocated block */
+#define	HF_EMIT		0x02	/* send changed blocks to the delta */
+
+/* What hashfs() found. */
+struct hashstats {
+	uint64_t	hs_read;	/* bytes read and hashed */
+	uint64_t	hs_alloc;	/* bytes allocated */
+	uint64_t	hs_changed;	/* bytes that differ from the base */
+	uint64_t	hs_inodes;	/* inodes changed since the base */
+};
+
+extern struct uufsd disk;
+extern struct fs *fs;
+extern int nthreads;
+
+/* hash.c */
+uint64_t blkhash(const void *, size_t);
+int	 hashfs(const uint64_t *, int64_t, uint64_t *, int,
+	    struct hashstats *);
+int	 sc_load(const char *, struct schdr *, uint64_t **);
+int	 sc_save(const char *, int64_t, const uint64_t *);
+
+/* delta.c */
+void	 dl_open(FILE *);
+void	 dl_put(off_t, const char *, size_t);
+int	 dl_close(void);
+int	 dl_apply(FILE *, const char *, int);
+
+#endif /* ufssync_h */
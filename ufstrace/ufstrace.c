@@ -0,0 +1,430 @@
+//
+//  ufstrace.c
+//  ufstrace
+//
+//  Created by John Othwolo on 10/17/26.
+//  Copyright © 2026 John Othwolo. All rights reserved.
+//
+// Control and decode the kext's event trace, see freebsd/compat/trace.h.
+
+#include <sys/param.h>
+#include <sys/sysctl.h>
+
+#include <freebsd/compat/trace.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define	MASK_OID	"debug.ufs_trace.mask"
+#define	DUMP_OID	"debug.ufs_trace.dump"
+
+static const struct {
+	const char	*name;
+	uint32_t	bits;
+} masknames[] = {
+	{ "ufs",	UFS_TRACE_UFS },
+	{ "ffs",	UFS_TRACE_FFS },
+	{ "softdep",	UFS_TRACE_SOFTDEP },
+	{ "other",	UFS_TRACE_OTHER },
+	{ "func",	UFS_TRACE_FUNC },
+	{ "lock",	UFS_TRACE_LOCK },
+	{ "all",	UFS_TRACE_ALL },
+};
+
+static const char *evnames[] = {
+	"?", "enter", "return", "xlock", "slock", "lockpair", "unlockpair",
+	"upgrade", "downgrade", "unlock",
+};
+
+struct ent {
+	uint64_t	time;
+	uint64_t	thread;
+	uint64_t	arg;
+	uint32_t	cpu;
+	const struct ufs_trace_sitedesc *site;
+};
+
+/* Open functions of a thread, for matching returns in -j output. */
+struct tstack {
+	uint64_t	thread;
+	int		depth;
+	int		size;
+	const struct ufs_trace_sitedesc **funcs;
+};
+
+static const struct ufs_trace_hdr *hdr;
+static const struct ufs_trace_sitedesc *sites;
+
+static uint32_t parsemask(const char *);
+static char *readdump(const char *, size_t *);
+static struct ent *collect(const char *, size_t, size_t *);
+static int entcmp(const void *, const void *);
+static double nsec(uint64_t, uint64_t);
+static const char *evname(int);
+static void printtext(struct ent *, size_t);
+static void printjson(struct ent *, size_t);
+static void usage(void);
+
+int
+main(int argc, char *argv[])
+{
+	struct ent *ents;
+	const char *infile, *outfile;
+	char *buf;
+	size_t len, nents;
+	uint32_t mask;
+	int ch, json, setmask;
+	FILE *fp;
+
+	infile = outfile = NULL;
+	json = setmask = 0;
+	mask = 0;
+	while ((ch = getopt(argc, argv, "f:jm:o:")) != -1)
+		switch (ch) {
+		case 'f':
+			infile = optarg;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'm':
+			mask = parsemask(optarg);
+			setmask = 1;
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 0 || (setmask && (infile != NULL || outfile != NULL ||
+	    json)))
+		usage();
+
+	if (setmask) {
+		if (sysctlbyname(MASK_OID, NULL, NULL, &mask, sizeof(mask)) != 0)
+			err(1, "%s", MASK_OID);
+		return (0);
+	}
+
+	buf = readdump(infile, &len);
+	if (outfile != NULL) {
+		if ((fp = fopen(outfile, "w")) == NULL)
+			err(1, "%s", outfile);
+		if (fwrite(buf, 1, len, fp) != len || fclose(fp) != 0)
+			err(1, "%s", outfile);
+		return (0);
+	}
+	ents = collect(buf, len, &nents);
+	qsort(ents, nents, sizeof(*ents), entcmp);
+	if (json)
+		printjson(ents, nents);
+	else
+		printtext(ents, nents);
+	free(ents);
+	free(buf);
+	return (0);
+}
+
+/*
+ * A number, or a comma separated list of subsystem and class names. A
+ * list with no class in it means every class, and the other way around.
+ */
+static uint32_t
+parsemask(const char *arg)
+{
+	char *copy, *p, *word, *end;
+	uint32_t mask;
+	size_t i;
+
+	if (isdigit((unsigned char)arg[0])) {
+		errno = 0;
+		mask = (uint32_t)strtoul(arg, &end, 0);
+		if (errno != 0 || *end != '\0')
+			errx(1, "%s: bad mask", arg);
+		return (mask);
+	}
+	if ((copy = strdup(arg)) == NULL)
+		err(1, NULL);
+	mask = 0;
+	for (p = copy; (word = strsep(&p, ",")) != NULL; ) {
+		for (i = 0; i < nitems(masknames); i++)
+			if (strcmp(word, masknames[i].name) == 0)
+				break;
+		if (i == nitems(masknames))
+			errx(1, "%s: unknown subsystem or class", word);
+		mask |= masknames[i].bits;
+	}
+	free(copy);
+	if (mask != 0 && (mask & UFS_TRACE_SUBSYS) == 0)
+		mask |= UFS_TRACE_ALL & UFS_TRACE_SUBSYS;
+	if (mask != 0 && (mask & UFS_TRACE_CLASS) == 0)
+		mask |= UFS_TRACE_ALL & UFS_TRACE_CLASS;
+	return (mask);
+}
+
+/*
+ * The raw dump, from a file or from the running kext.
+ */
+static char *
+readdump(const char *file, size_t *lenp)
+{
+	struct ufs_trace_sitedesc pad[64];
+	char *buf;
+	size_t len, n;
+	FILE *fp;
+
+	if (file == NULL) {
+		/* Leave room for sites that fire in between the two calls. */
+		if (sysctlbyname(DUMP_OID, NULL, &len, NULL, 0) != 0)
+			err(1, "%s", DUMP_OID);
+		len += sizeof(pad);
+		if ((buf = malloc(len)) == NULL)
+			err(1, NULL);
+		if (sysctlbyname(DUMP_OID, buf, &len, NULL, 0) != 0)
+			err(1, "%s", DUMP_OID);
+		*lenp = len;
+		return (buf);
+	}
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	len = 0;
+	buf = NULL;
+	for (;;) {
+		if ((buf = realloc(buf, len + 65536)) == NULL)
+			err(1, NULL);
+		n = fread(buf + len, 1, 65536, fp);
+		len += n;
+		if (n < 65536)
+			break;
+	}
+	if (ferror(fp))
+		err(1, "%s", file);
+	fclose(fp);
+	*lenp = len;
+	return (buf);
+}
+
+/*
+ * Every finished record of every ring.
+ */
+static struct ent *
+collect(const char *buf, size_t len, size_t *nentsp)
+{
+	const struct ufs_trace_rec *recs, *tr;
+	struct ent *ents, *e;
+	const char *p;
+	uint64_t count, n, i;
+	size_t need;
+	uint32_t cpu;
+
+	if (len < sizeof(*hdr))
+		errx(1, "trace dump too short");
+	hdr = (const struct ufs_trace_hdr *)buf;
+	if (hdr->th_magic != UFS_TRACE_MAGIC)
+		errx(1, "not a ufs trace dump");
+	if (hdr->th_version != UFS_TRACE_VERSION)
+		errx(1, "trace dump version %u, expected %u", hdr->th_version,
+		    UFS_TRACE_VERSION);
+	need = sizeof(*hdr) + (size_t)hdr->th_nsites * sizeof(*sites) +
+	    (size_t)hdr->th_ncpu * (sizeof(count) +
+	    (size_t)hdr->th_nrecs * sizeof(*recs));
+	if (len < need)
+		errx(1, "trace dump truncated: %zu bytes, expected %zu", len,
+		    need);
+	sites = (const struct ufs_trace_sitedesc *)(buf + sizeof(*hdr));
+	if (hdr->th_ncpu == 0) {
+		*nentsp = 0;
+		return (NULL);
+	}
+	if ((ents = calloc((size_t)hdr->th_ncpu * hdr->th_nrecs,
+	    sizeof(*ents))) == NULL)
+		err(1, NULL);
+	e = ents;
+	p = (const char *)(sites + hdr->th_nsites);
+	for (cpu = 0; cpu < hdr->th_ncpu; cpu++) {
+		memcpy(&count, p, sizeof(count));
+		recs = (const struct ufs_trace_rec *)(p + sizeof(count));
+		p += sizeof(count) + (size_t)hdr->th_nrecs * sizeof(*recs);
+		n = MIN(count, hdr->th_nrecs);
+		for (i = 0; i < n; i++) {
+			tr = &recs[i];
+			if (tr->tr_site == 0 || tr->tr_site > hdr->th_nsites)
+				continue;
+			e->time = tr->tr_time;
+			e->thread = tr->tr_thread;
+			e->arg = tr->tr_arg;
+			e->cpu = tr->tr_cpu;
+			e->site = &sites[tr->tr_site - 1];
+			e++;
+		}
+	}
+	*nentsp = e - ents;
+	return (ents);
+}
+
+static int
+entcmp(const void *a, const void *b)
+{
+	const struct ent *ea = a, *eb = b;
+
+	if (ea->time != eb->time)
+		return (ea->time < eb->time ? -1 : 1);
+	return (0);
+}
+
+/*
+ * Nanoseconds from t0 to t.
+ */
+static double
+nsec(uint64_t t0, uint64_t t)
+{
+	double ns;
+
+	ns = (double)(t - t0);
+	if (hdr->th_denom != 0)
+		ns = ns * hdr->th_numer / hdr->th_denom;
+	return (ns);
+}
+
+static const char *
+evname(int ev)
+{
+
+	if (ev < 0 || ev >= (int)nitems(evnames))
+		return (evnames[0]);
+	return (evnames[ev]);
+}
+
+static void
+printtext(struct ent *ents, size_t nents)
+{
+	const struct ufs_trace_sitedesc *sd;
+	struct ent *e;
+
+	for (e = ents; e < ents + nents; e++) {
+		sd = e->site;
+		printf("%15.3f %3u %#10" PRIx64 " %s:%u %s %s",
+		    nsec(ents[0].time, e->time) / 1000.0, e->cpu, e->thread,
+		    sd->sd_file, sd->sd_line, sd->sd_func,
+		    evname(sd->sd_event));
+		switch (sd->sd_event) {
+		case UFS_TRACE_ENTER:
+			break;
+		case UFS_TRACE_RETURN:
+			printf(" %" PRId64, (int64_t)e->arg);
+			break;
+		default:
+			printf(" %#" PRIx64, e->arg);
+			break;
+		}
+		printf("\n");
+	}
+}
+
+static struct tstack *
+tstack_get(struct tstack **stacks, size_t *nstacks, uint64_t thread)
+{
+	struct tstack *ts;
+	size_t i;
+
+	for (i = 0; i < *nstacks; i++)
+		if ((*stacks)[i].thread == thread)
+			return (&(*stacks)[i]);
+	if ((*stacks = realloc(*stacks, (*nstacks + 1) * sizeof(**stacks))) ==
+	    NULL)
+		err(1, NULL);
+	ts = &(*stacks)[(*nstacks)++];
+	memset(ts, 0, sizeof(*ts));
+	ts->thread = thread;
+	return (ts);
+}
+
+/*
+ * Chrome trace event format, for chrome://tracing or Perfetto. Matched
+ * enter/return pairs become duration events; lock operations, and
+ * returns from functions entered before the trace started, are instants.
+ */
+static void
+printjson(struct ent *ents, size_t nents)
+{
+	const struct ufs_trace_sitedesc *sd;
+	struct tstack *stacks, *ts;
+	struct ent *e;
+	size_t nstacks;
+	const char *name, *ph, *sep;
+	double us;
+
+	stacks = NULL;
+	nstacks = 0;
+	sep = "";
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (e = ents; e < ents + nents; e++) {
+		sd = e->site;
+		ts = tstack_get(&stacks, &nstacks, e->thread);
+		us = nsec(ents[0].time, e->time) / 1000.0;
+		name = sd->sd_func;
+		ph = "i";
+		if (sd->sd_event != UFS_TRACE_ENTER &&
+		    sd->sd_event != UFS_TRACE_RETURN)
+			name = evname(sd->sd_event);
+		else if (sd->sd_event == UFS_TRACE_ENTER) {
+			if (ts->depth == ts->size) {
+				ts->size = ts->size ? ts->size * 2 : 16;
+				if ((ts->funcs = realloc(ts->funcs,
+				    ts->size * sizeof(*ts->funcs))) == NULL)
+					err(1, NULL);
+			}
+			ts->funcs[ts->depth++] = sd;
+			ph = "B";
+		} else if (sd->sd_event == UFS_TRACE_RETURN &&
+		    ts->depth > 0 &&
+		    strcmp(ts->funcs[ts->depth - 1]->sd_func, sd->sd_func) == 0) {
+			ts->depth--;
+			ph = "E";
+		}
+		printf("%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\","
+		    "\"ts\":%.3f,\"pid\":0,\"tid\":%" PRIu64, sep, name,
+		    sd->sd_mask & UFS_TRACE_LOCK ? "lock" : "func", ph, us,
+		    e->thread);
+		if (*ph == 'i')
+			printf(",\"s\":\"t\"");
+		if (sd->sd_event == UFS_TRACE_RETURN)
+			printf(",\"args\":{\"ret\":%" PRId64 ",\"at\":\"%s:%u\"}",
+			    (int64_t)e->arg, sd->sd_file, sd->sd_line);
+		else if (sd->sd_event != UFS_TRACE_ENTER)
+			printf(",\"args\":{\"ip\":\"%#" PRIx64 "\",\"func\":"
+			    "\"%s\",\"at\":\"%s:%u\",\"cpu\":%u}", e->arg,
+			    sd->sd_func, sd->sd_file, sd->sd_line, e->cpu);
+		printf("}");
+		sep = ",\n";
+	}
+	printf("\n]}\n");
+	while (nstacks > 0)
+		free(stacks[--nstacks].funcs);
+	free(stacks);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: ufstrace [-j] [-f dumpfile]\n"
+	    "       ufstrace -o dumpfile\n"
+	    "       ufstrace -m mask\n");
+	exit(1);
+}